@@ -0,0 +1,509 @@
+/**
+ * Atmospheres: precomputed scattering tables for the bodies that have one, and the pass that draws them around the bodies.
+ */
+
+#include "Atmosphere.h"
+
+#include "JobSystem.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+const char ATMOSPHERE_CACHE_MAGIC[4] = { 'A', 'T', 'M', '1' };
+
+// Floats an AtmosphereParameters is stored as in the cache
+const int ATMOSPHERE_PARAMETER_FLOATS = 8;
+
+/**
+ * Struct containing an atmosphere's coefficients in units of the body's radius, so the ground is at 1
+ */
+struct AtmosphereCoefficients
+{
+	float top;					// Radius of the top of the atmosphere
+	float thickness;
+	float rayleighHeight, mieHeight;
+	glm::vec3 rayleighScattering;
+	float mieScattering;
+	float mieExtinction;		// The haze also absorbs a little
+
+	AtmosphereCoefficients(const AtmosphereParameters& parameters)
+	{
+		thickness = parameters.thickness;
+		top = 1.f + thickness;
+		rayleighHeight = parameters.rayleighHeight * thickness;
+		mieHeight = parameters.mieHeight * thickness;
+
+		// The density falls off exponentially, so the depth straight up is the coefficient times the scale height
+		rayleighScattering = parameters.rayleighDepth / rayleighHeight;
+		mieScattering = parameters.mieDepth / mieHeight;
+		mieExtinction = mieScattering / 0.9f;
+	}
+
+	/**
+	 * @brief Light lost per unit of length at an altitude.
+	 */
+	glm::vec3 Extinction(float altitude) const
+	{
+		return rayleighScattering * std::exp(-altitude / rayleighHeight) + glm::vec3(mieExtinction * std::exp(-altitude / mieHeight));
+	}
+};
+
+bool GetAtmosphereParameters(const std::string& name, AtmosphereParameters& parameters)
+{
+	// Thickness, Rayleigh depth (r, g, b), Mie depth, Rayleigh height, Mie height, Mie anisotropy.
+	// The ice giants' methane absorbs red, which is folded into a weaker red scattering here.
+	struct Preset
+	{
+		const char* name;
+		float values[ATMOSPHERE_PARAMETER_FLOATS];
+	};
+	static const Preset presets[] =
+	{
+		{ "Venus", { 0.08f, 0.45f, 0.42f, 0.3f, 0.9f, 0.3f, 0.3f, 0.7f } },
+		{ "Earth", { 0.06f, 0.05f, 0.12f, 0.29f, 0.04f, 0.25f, 0.1f, 0.76f } },
+		{ "Jupiter", { 0.025f, 0.08f, 0.11f, 0.16f, 0.35f, 0.3f, 0.2f, 0.7f } },
+		{ "Saturn", { 0.03f, 0.07f, 0.09f, 0.11f, 0.4f, 0.3f, 0.2f, 0.7f } },
+		{ "Uranus", { 0.04f, 0.05f, 0.25f, 0.3f, 0.08f, 0.3f, 0.1f, 0.7f } },
+		{ "Neptune", { 0.04f, 0.04f, 0.14f, 0.4f, 0.06f, 0.3f, 0.1f, 0.7f } },
+	};
+
+	for (const Preset& preset : presets)
+	{
+		if (name == preset.name)
+		{
+			parameters.thickness = preset.values[0];
+			parameters.rayleighDepth = glm::vec3(preset.values[1], preset.values[2], preset.values[3]);
+			parameters.mieDepth = preset.values[4];
+			parameters.rayleighHeight = preset.values[5];
+			parameters.mieHeight = preset.values[6];
+			parameters.mieAnisotropy = preset.values[7];
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Flattens the parameters for the cache, which compares them value by value.
+ */
+static void PackParameters(const AtmosphereParameters& parameters, float values[ATMOSPHERE_PARAMETER_FLOATS])
+{
+	values[0] = parameters.thickness;
+	values[1] = parameters.rayleighDepth.r;
+	values[2] = parameters.rayleighDepth.g;
+	values[3] = parameters.rayleighDepth.b;
+	values[4] = parameters.mieDepth;
+	values[5] = parameters.rayleighHeight;
+	values[6] = parameters.mieHeight;
+	values[7] = parameters.mieAnisotropy;
+}
+
+/**
+ * @brief Distance along a ray to where it hits the ground or leaves the atmosphere.
+ * @param[in] radius Distance of the start from the center
+ * @param[in] mu Cosine of the angle between the ray and straight up
+ * @param[in] top Radius of the top of the atmosphere
+ * @param[out] hitsGround Whether the ray ends on the ground
+ */
+static float DistanceToBoundary(float radius, float mu, float top, bool& hitsGround)
+{
+	float groundDiscriminant = radius * radius * (mu * mu - 1.f) + 1.f;
+	hitsGround = mu < 0.f && groundDiscriminant >= 0.f;
+	if (hitsGround)
+	{
+		return std::max(-radius * mu - std::sqrt(groundDiscriminant), 0.f);
+	}
+	return std::max(-radius * mu + std::sqrt(std::max(radius * radius * (mu * mu - 1.f) + top * top, 0.f)), 0.f);
+}
+
+/**
+ * @brief Computes one texel of the transmittance table: how much light gets through from a point to
+ * the ground or the top of the atmosphere. Rows are altitudes, denser near the ground, columns are
+ * the cosine of the view zenith angle from -1 to 1.
+ */
+static glm::vec3 ComputeTransmittance(const AtmosphereCoefficients& atmosphere, int x, int y)
+{
+	float mu = -1.f + 2.f * x / (ATMOSPHERE_TRANSMITTANCE_WIDTH - 1);
+	float altitudeCoord = (float)y / (ATMOSPHERE_TRANSMITTANCE_HEIGHT - 1);
+	float radius = 1.f + altitudeCoord * altitudeCoord * atmosphere.thickness;
+
+	bool hitsGround;
+	float step = DistanceToBoundary(radius, mu, atmosphere.top, hitsGround) / ATMOSPHERE_TRANSMITTANCE_STEPS;
+	glm::vec3 opticalDepth(0.f);
+	for (int i = 0; i < ATMOSPHERE_TRANSMITTANCE_STEPS; i++)
+	{
+		float t = (i + 0.5f) * step;
+		float sampleRadius = std::sqrt(radius * radius + t * t + 2.f * radius * mu * t);
+		opticalDepth += atmosphere.Extinction(std::max(sampleRadius - 1.f, 0.f)) * step;
+	}
+	return glm::exp(-opticalDepth);
+}
+
+/**
+ * @brief Reads the transmittance table with bilinear filtering, the way the GPU would.
+ */
+static glm::vec3 SampleTransmittance(const AtmosphereCoefficients& atmosphere, const std::vector<float>& table, float radius, float mu)
+{
+	float fx = glm::clamp((mu + 1.f) * 0.5f, 0.f, 1.f) * (ATMOSPHERE_TRANSMITTANCE_WIDTH - 1);
+	float fy = std::sqrt(glm::clamp((radius - 1.f) / atmosphere.thickness, 0.f, 1.f)) * (ATMOSPHERE_TRANSMITTANCE_HEIGHT - 1);
+	int x0 = std::min((int)fx, ATMOSPHERE_TRANSMITTANCE_WIDTH - 2);
+	int y0 = std::min((int)fy, ATMOSPHERE_TRANSMITTANCE_HEIGHT - 2);
+	float ax = fx - x0;
+	float ay = fy - y0;
+
+	glm::vec3 corners[4];
+	for (int corner = 0; corner < 4; corner++)
+	{
+		const float* texel = &table[((y0 + corner / 2) * ATMOSPHERE_TRANSMITTANCE_WIDTH + x0 + corner % 2) * 3];
+		corners[corner] = glm::vec3(texel[0], texel[1], texel[2]);
+	}
+	return glm::mix(glm::mix(corners[0], corners[1], ax), glm::mix(corners[2], corners[3], ax), ay);
+}
+
+/**
+ * @brief Computes one texel of the in-scattering table: the sunlight scattered towards the viewer
+ * along a ray that enters the atmosphere from space, without the phase functions. The Rayleigh part
+ * is in rgb and the red channel of the Mie part in a, as in Bruneton's paper.
+ *
+ * The ray starts at the top of the atmosphere, so it is described by three angles there: x is the
+ * view zenith, from grazing (cosine 0) to straight down with more texels near the horizon, y the
+ * sun zenith and z the angle between the view and the sun, both cosines from -1 to 1.
+ */
+static glm::vec4 ComputeScattering(const AtmosphereCoefficients& atmosphere, const std::vector<float>& transmittance, int x, int y, int z)
+{
+	float viewCoord = (float)x / (ATMOSPHERE_SCATTERING_MU - 1);
+	float mu = -viewCoord * viewCoord;
+	float muS = -1.f + 2.f * y / (ATMOSPHERE_SCATTERING_MU_S - 1);
+	float nu = -1.f + 2.f * z / (ATMOSPHERE_SCATTERING_NU - 1);
+
+	// Up is +y at the start, and the view direction is in the xy plane
+	float viewSine = std::sqrt(std::max(1.f - mu * mu, 0.f));
+	glm::vec3 start(0.f, atmosphere.top, 0.f);
+	glm::vec3 view(viewSine, mu, 0.f);
+
+	// Not every combination of angles exists; those get the nearest sun direction that does
+	float sunX = viewSine > 1e-4f ? (nu - mu * muS) / viewSine : 0.f;
+	glm::vec3 sun = glm::normalize(glm::vec3(sunX, muS, std::sqrt(std::max(1.f - sunX * sunX - muS * muS, 0.f))));
+
+	bool hitsGround;
+	float step = DistanceToBoundary(atmosphere.top, mu, atmosphere.top, hitsGround) / ATMOSPHERE_SCATTERING_STEPS;
+	glm::vec3 opticalDepth(0.f);
+	glm::vec3 rayleigh(0.f);
+	glm::vec3 mie(0.f);
+	for (int i = 0; i < ATMOSPHERE_SCATTERING_STEPS; i++)
+	{
+		glm::vec3 position = start + (i + 0.5f) * step * view;
+		float radius = glm::length(position);
+		float altitude = std::max(radius - 1.f, 0.f);
+		glm::vec3 extinction = atmosphere.Extinction(altitude) * step;
+		glm::vec3 viewTransmittance = glm::exp(-(opticalDepth + 0.5f * extinction));
+		opticalDepth += extinction;
+
+		// No sunlight reaches a point the ground is in front of
+		float sunMu = glm::dot(position, sun) / radius;
+		if (sunMu < -std::sqrt(std::max(1.f - 1.f / (radius * radius), 0.f)))
+		{
+			continue;
+		}
+		glm::vec3 lit = viewTransmittance * SampleTransmittance(atmosphere, transmittance, radius, sunMu) * step;
+		rayleigh += lit * std::exp(-altitude / atmosphere.rayleighHeight);
+		mie += lit * std::exp(-altitude / atmosphere.mieHeight);
+	}
+
+	rayleigh *= atmosphere.rayleighScattering;
+	mie *= atmosphere.mieScattering;
+	return glm::vec4(rayleigh, mie.r);
+}
+
+void ComputeAtmosphereTables(JobSystem& jobs, const std::vector<AtmosphereParameters>& atmospheres, std::vector<AtmosphereTables>& tables)
+{
+	int count = (int)atmospheres.size();
+	std::vector<AtmosphereCoefficients> coefficients;
+	tables.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		coefficients.push_back(AtmosphereCoefficients(atmospheres[i]));
+		tables[i].transmittance.resize(ATMOSPHERE_TRANSMITTANCE_WIDTH * ATMOSPHERE_TRANSMITTANCE_HEIGHT * 3);
+		tables[i].scattering.resize(ATMOSPHERE_SCATTERING_MU * ATMOSPHERE_SCATTERING_MU_S * ATMOSPHERE_SCATTERING_NU * 4);
+	}
+
+	// One row per item; the in-scattering reads the transmittance, so it waits for all of it
+	jobs.ParallelFor(count * ATMOSPHERE_TRANSMITTANCE_HEIGHT, 1, [&](int begin, int end) {
+		for (int row = begin; row < end; row++)
+		{
+			int atmosphere = row / ATMOSPHERE_TRANSMITTANCE_HEIGHT;
+			int y = row % ATMOSPHERE_TRANSMITTANCE_HEIGHT;
+			float* texels = &tables[atmosphere].transmittance[y * ATMOSPHERE_TRANSMITTANCE_WIDTH * 3];
+			for (int x = 0; x < ATMOSPHERE_TRANSMITTANCE_WIDTH; x++)
+			{
+				glm::vec3 transmittance = ComputeTransmittance(coefficients[atmosphere], x, y);
+				texels[x * 3 + 0] = transmittance.r;
+				texels[x * 3 + 1] = transmittance.g;
+				texels[x * 3 + 2] = transmittance.b;
+			}
+		}
+	});
+
+	int rowsPerAtmosphere = ATMOSPHERE_SCATTERING_MU_S * ATMOSPHERE_SCATTERING_NU;
+	jobs.ParallelFor(count * rowsPerAtmosphere, 1, [&](int begin, int end) {
+		for (int row = begin; row < end; row++)
+		{
+			int atmosphere = row / rowsPerAtmosphere;
+			int y = row % ATMOSPHERE_SCATTERING_MU_S;
+			int z = row % rowsPerAtmosphere / ATMOSPHERE_SCATTERING_MU_S;
+			float* texels = &tables[atmosphere].scattering[(row % rowsPerAtmosphere) * ATMOSPHERE_SCATTERING_MU * 4];
+			for (int x = 0; x < ATMOSPHERE_SCATTERING_MU; x++)
+			{
+				glm::vec4 scattering = ComputeScattering(coefficients[atmosphere], tables[atmosphere].transmittance, x, y, z);
+				memcpy(&texels[x * 4], glm::value_ptr(scattering), sizeof(scattering));
+			}
+		}
+	});
+}
+
+/**
+ * @brief Reads the header of the cache, which has to match the table sizes and atmospheres of this run.
+ */
+static bool ReadCacheHeader(std::ifstream& file, const std::vector<AtmosphereParameters>& atmospheres)
+{
+	char magic[4];
+	uint32_t header[7];
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(header), sizeof(header));
+	const uint32_t expected[7] = { ATMOSPHERE_CACHE_VERSION, (uint32_t)atmospheres.size(),
+		ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT,
+		ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_MU_S, ATMOSPHERE_SCATTERING_NU };
+	if (!file || memcmp(magic, ATMOSPHERE_CACHE_MAGIC, sizeof(magic)) != 0 || memcmp(header, expected, sizeof(header)) != 0)
+	{
+		return false;
+	}
+
+	for (const AtmosphereParameters& atmosphere : atmospheres)
+	{
+		float stored[ATMOSPHERE_PARAMETER_FLOATS];
+		float wanted[ATMOSPHERE_PARAMETER_FLOATS];
+		file.read(reinterpret_cast<char*>(stored), sizeof(stored));
+		PackParameters(atmosphere, wanted);
+		if (!file || memcmp(stored, wanted, sizeof(stored)) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Loads the tables from the cache.
+ * @return False if there is no cache or it was made for other atmospheres
+ */
+static bool LoadAtmosphereCache(const std::string& path, const std::vector<AtmosphereParameters>& atmospheres, std::vector<AtmosphereTables>& tables)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file || !ReadCacheHeader(file, atmospheres))
+	{
+		return false;
+	}
+
+	tables.resize(atmospheres.size());
+	for (AtmosphereTables& table : tables)
+	{
+		table.transmittance.resize(ATMOSPHERE_TRANSMITTANCE_WIDTH * ATMOSPHERE_TRANSMITTANCE_HEIGHT * 3);
+		table.scattering.resize(ATMOSPHERE_SCATTERING_MU * ATMOSPHERE_SCATTERING_MU_S * ATMOSPHERE_SCATTERING_NU * 4);
+		file.read(reinterpret_cast<char*>(table.transmittance.data()), (std::streamsize)(table.transmittance.size() * sizeof(float)));
+		file.read(reinterpret_cast<char*>(table.scattering.data()), (std::streamsize)(table.scattering.size() * sizeof(float)));
+	}
+	if (!file)
+	{
+		std::cerr << "Atmosphere cache " << path << " is cut short" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Writes the tables to the cache, replacing it.
+ */
+static void SaveAtmosphereCache(const std::string& path, const std::vector<AtmosphereParameters>& atmospheres, const std::vector<AtmosphereTables>& tables)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	const uint32_t header[7] = { ATMOSPHERE_CACHE_VERSION, (uint32_t)atmospheres.size(),
+		ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT,
+		ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_MU_S, ATMOSPHERE_SCATTERING_NU };
+	file.write(ATMOSPHERE_CACHE_MAGIC, sizeof(ATMOSPHERE_CACHE_MAGIC));
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (const AtmosphereParameters& atmosphere : atmospheres)
+	{
+		float values[ATMOSPHERE_PARAMETER_FLOATS];
+		PackParameters(atmosphere, values);
+		file.write(reinterpret_cast<const char*>(values), sizeof(values));
+	}
+	for (const AtmosphereTables& table : tables)
+	{
+		file.write(reinterpret_cast<const char*>(table.transmittance.data()), (std::streamsize)(table.transmittance.size() * sizeof(float)));
+		file.write(reinterpret_cast<const char*>(table.scattering.data()), (std::streamsize)(table.scattering.size() * sizeof(float)));
+	}
+	if (!file)
+	{
+		std::cerr << "Failed to write atmosphere cache " << path << std::endl;
+	}
+}
+
+AtmosphereScattering::AtmosphereScattering()
+{
+	program = 0;
+}
+
+void AtmosphereScattering::Init(JobSystem& jobs, const std::vector<Planet>& bodies, const std::string& cachePath, GLuint shader)
+{
+	program = shader;
+	layers.clear();
+
+	std::vector<AtmosphereParameters> atmospheres;
+	for (int i = 0; i < (int)bodies.size(); i++)
+	{
+		AtmosphereLayer layer;
+		if (GetAtmosphereParameters(bodies[i].name, layer.parameters))
+		{
+			layer.body = i;
+			atmospheres.push_back(layer.parameters);
+			layers.push_back(std::move(layer));
+		}
+	}
+	if (layers.empty())
+	{
+		return;
+	}
+
+	std::vector<AtmosphereTables> tables;
+	if (!cachePath.empty() && LoadAtmosphereCache(cachePath, atmospheres, tables))
+	{
+		std::cout << "Atmospheres: " << layers.size() << " bodies, tables loaded from " << cachePath << std::endl;
+	}
+	else
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ComputeAtmosphereTables(jobs, atmospheres, tables);
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Atmospheres: " << layers.size() << " bodies, tables computed in " << milliseconds << " ms" << std::endl;
+		if (!cachePath.empty())
+		{
+			SaveAtmosphereCache(cachePath, atmospheres, tables);
+		}
+	}
+
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		AtmosphereLayer& layer = layers[i];
+		layer.transmittanceTexture.Create("atmosphere transmittance");
+		glBindTexture(GL_TEXTURE_2D, layer.transmittanceTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, ATMOSPHERE_TRANSMITTANCE_WIDTH, ATMOSPHERE_TRANSMITTANCE_HEIGHT, 0, GL_RGB, GL_FLOAT, tables[i].transmittance.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		layer.transmittanceTexture.SetSize((long long)ATMOSPHERE_TRANSMITTANCE_WIDTH * ATMOSPHERE_TRANSMITTANCE_HEIGHT * 6);
+
+		layer.scatteringTexture.Create("atmosphere in-scattering");
+		glBindTexture(GL_TEXTURE_3D, layer.scatteringTexture);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, ATMOSPHERE_SCATTERING_MU, ATMOSPHERE_SCATTERING_MU_S, ATMOSPHERE_SCATTERING_NU, 0, GL_RGBA, GL_FLOAT, tables[i].scattering.data());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		layer.scatteringTexture.SetSize((long long)ATMOSPHERE_SCATTERING_MU * ATMOSPHERE_SCATTERING_MU_S * ATMOSPHERE_SCATTERING_NU * 8);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+int AtmosphereScattering::Draw(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, glm::vec3 eye, glm::vec3 lightPosition,
+	const std::vector<Planet>& bodies, GLuint sphereVao, GLsizei sphereIndexCount, int viewportHeight)
+{
+	if (layers.empty())
+	{
+		return 0;
+	}
+
+	// The scattered light is added and what is behind is dimmed by the alpha, the transmittance
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+	glDepthMask(GL_FALSE);
+
+	glUseProgram(program);
+	glUniformMatrix4fv(glGetUniformLocation(program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+	glUniformMatrix4fv(glGetUniformLocation(program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
+	glUniform3fv(glGetUniformLocation(program, "eye"), 1, glm::value_ptr(eye));
+	glUniform3fv(glGetUniformLocation(program, "lightPosition"), 1, glm::value_ptr(lightPosition));
+	glUniform1f(glGetUniformLocation(program, "sunIntensity"), ATMOSPHERE_SUN_INTENSITY);
+	glUniform1f(glGetUniformLocation(program, "shellMargin"), ATMOSPHERE_SHELL_MARGIN);
+	glUniform1i(glGetUniformLocation(program, "transmittance"), 0);
+	glUniform1i(glGetUniformLocation(program, "scattering"), 1);
+	GLint sphereUniform = glGetUniformLocation(program, "sphere");
+	GLint thicknessUniform = glGetUniformLocation(program, "thickness");
+	GLint rayleighRatioUniform = glGetUniformLocation(program, "rayleighRatio");
+	GLint mieAnisotropyUniform = glGetUniformLocation(program, "mieAnisotropy");
+
+	glBindVertexArray(sphereVao);
+	int drawCalls = 0;
+	for (const AtmosphereLayer& layer : layers)
+	{
+		const Planet& body = bodies[layer.body];
+		glm::vec3 center(body.cx + body.x1, body.cy, body.cz + body.z1);
+		float top = body.radius * (1.f + layer.parameters.thickness);
+
+		// Skip atmospheres behind the camera or too small to see
+		float distance = glm::length(center - eye);
+		float viewDepth = -(viewMatrix * glm::vec4(center, 1.f)).z;
+		if (viewDepth < -top || top * projectionMatrix[1][1] * viewportHeight * 0.5f < ATMOSPHERE_MIN_PIXELS * std::max(distance, top))
+		{
+			continue;
+		}
+
+		// From inside the shell only its far side is drawn, which the body may hide
+		bool insideShell = distance < top * ATMOSPHERE_SHELL_MARGIN;
+		if (insideShell)
+		{
+			glDisable(GL_DEPTH_TEST);
+		}
+
+		glUniform4f(sphereUniform, center.x, center.y, center.z, top);
+		glUniform1f(thicknessUniform, layer.parameters.thickness);
+		glUniform3fv(rayleighRatioUniform, 1, glm::value_ptr(layer.parameters.rayleighDepth.r / layer.parameters.rayleighDepth));
+		glUniform1f(mieAnisotropyUniform, layer.parameters.mieAnisotropy);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, layer.transmittanceTexture);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_3D, layer.scatteringTexture);
+		glDrawElements(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, (void*)0);
+		drawCalls++;
+
+		if (insideShell)
+		{
+			glEnable(GL_DEPTH_TEST);
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+
+	return drawCalls;
+}
+
+void AtmosphereScattering::Destroy()
+{
+	layers.clear();
+}
@@ -0,0 +1,141 @@
+/**
+ * Atmospheres: precomputed scattering tables for the bodies that have one, and the pass that draws them around the bodies.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+#include "Planet.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+struct JobSystem;
+
+// Size of the transmittance table: view zenith angles by altitudes
+const int ATMOSPHERE_TRANSMITTANCE_WIDTH = 64;
+const int ATMOSPHERE_TRANSMITTANCE_HEIGHT = 32;
+
+// Size of the in-scattering table: view zenith angles by sun zenith angles by view-sun angles
+const int ATMOSPHERE_SCATTERING_MU = 32;
+const int ATMOSPHERE_SCATTERING_MU_S = 32;
+const int ATMOSPHERE_SCATTERING_NU = 16;
+
+// Integration steps along a ray
+const int ATMOSPHERE_TRANSMITTANCE_STEPS = 40;
+const int ATMOSPHERE_SCATTERING_STEPS = 32;
+
+// Changes whenever the tables are computed differently, so an old cache is not used
+const unsigned int ATMOSPHERE_CACHE_VERSION = 1;
+
+// Brightness of the sunlight that is scattered, relative to the white light the bodies are lit with
+const float ATMOSPHERE_SUN_INTENSITY = 8.f;
+
+// Atmospheres smaller than this on screen are not drawn
+const float ATMOSPHERE_MIN_PIXELS = 2.f;
+
+// The shell mesh is this much bigger than the atmosphere, so its flat triangles cover all of it
+const float ATMOSPHERE_SHELL_MARGIN = 1.05f;
+
+/**
+ * Struct containing what an atmosphere is made of. Lengths are relative to the body, so the same
+ * tables work at any radius; the atmospheres are a lot thicker than real ones to be seen at the
+ * scale of the scene.
+ */
+struct AtmosphereParameters
+{
+	float thickness;			// Height of the top of the atmosphere, as a fraction of the body's radius
+	glm::vec3 rayleighDepth;	// Optical depth of the molecules straight up from the ground, per color channel
+	float mieDepth;				// Optical depth of the haze and aerosols straight up from the ground
+	float rayleighHeight;		// Height over which the density of the molecules falls by e, as a fraction of the thickness
+	float mieHeight;			// Same for the haze
+	float mieAnisotropy;		// How much the haze scatters forward, g of the Cornette-Shanks phase function
+};
+
+/**
+ * Struct containing the precomputed tables of one atmosphere
+ */
+struct AtmosphereTables
+{
+	std::vector<float> transmittance;	// RGB, ATMOSPHERE_TRANSMITTANCE_WIDTH * ATMOSPHERE_TRANSMITTANCE_HEIGHT texels
+	std::vector<float> scattering;		// RGBA, ATMOSPHERE_SCATTERING_MU * ATMOSPHERE_SCATTERING_MU_S * ATMOSPHERE_SCATTERING_NU texels
+};
+
+/**
+ * @brief Looks up the atmosphere of a body.
+ * @param[in] name Name of the body
+ * @param[out] parameters Its atmosphere
+ * @return False if the body has no atmosphere
+ */
+bool GetAtmosphereParameters(const std::string& name, AtmosphereParameters& parameters);
+
+/**
+ * @brief Computes the tables of several atmospheres on the job system, after Bruneton and Neyret,
+ * "Precomputed Atmospheric Scattering" (2008), single scattering only.
+ * @param[in] jobs Job system that computes the texels
+ * @param[in] atmospheres Atmospheres to compute the tables of
+ * @param[out] tables Tables of every atmosphere
+ */
+void ComputeAtmosphereTables(JobSystem& jobs, const std::vector<AtmosphereParameters>& atmospheres, std::vector<AtmosphereTables>& tables);
+
+/**
+ * Struct containing an atmosphere around a body and its tables on the GPU
+ */
+struct AtmosphereLayer
+{
+	int body;
+	AtmosphereParameters parameters;
+	TextureHandle transmittanceTexture;		// 2D, transmittance from a point to the edge of the atmosphere or the ground
+	TextureHandle scatteringTexture;		// 3D, light scattered towards a viewer outside the atmosphere, without the phase functions
+};
+
+/**
+ * Atmospheres drawn as a shell around their bodies. Raymarching the scattering per pixel would be far
+ * too slow, so it is precomputed into two small tables per atmosphere: the transmittance, and the
+ * sunlight scattered along a ray that enters the atmosphere from space. The viewer is always outside
+ * the atmosphere, so the in-scattering only depends on three angles at the point the ray enters,
+ * and the shell is shaded with two texture fetches per pixel. It adds the scattered light and dims
+ * what is behind it by the transmittance.
+ *
+ * The tables are computed on the job system at startup and saved to a cache file, which later runs
+ * load instead as long as it was made for the same atmospheres.
+ */
+struct AtmosphereScattering
+{
+	std::vector<AtmosphereLayer> layers;
+	GLuint program;
+
+	AtmosphereScattering();
+
+	/**
+	 * @brief Loads or computes the tables of every body that has an atmosphere and uploads them.
+	 * @param[in] jobs Job system that computes the tables
+	 * @param[in] bodies Every body
+	 * @param[in] cachePath File the tables are loaded from or saved to, empty to always compute them
+	 * @param[in] shader Program that draws the atmospheres (atmosphere.vsh)
+	 */
+	void Init(JobSystem& jobs, const std::vector<Planet>& bodies, const std::string& cachePath, GLuint shader);
+
+	/**
+	 * @brief Draws the atmospheres over the bodies. Has to come after the bodies, since it blends over them.
+	 * @param[in] projectionMatrix Projection matrix used for rendering
+	 * @param[in] viewMatrix View matrix used for rendering
+	 * @param[in] eye Camera position
+	 * @param[in] lightPosition Position of the sun
+	 * @param[in] bodies Every body, at this frame's positions
+	 * @param[in] sphereVao Vertex array of a unit sphere, with its index buffer
+	 * @param[in] sphereIndexCount Indices of the sphere
+	 * @param[in] viewportHeight Height of the viewport in pixels
+	 * @return Number of draw calls
+	 */
+	int Draw(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, glm::vec3 eye, glm::vec3 lightPosition,
+		const std::vector<Planet>& bodies, GLuint sphereVao, GLsizei sphereIndexCount, int viewportHeight);
+
+	/**
+	 * @brief Deletes the textures.
+	 */
+	void Destroy();
+};
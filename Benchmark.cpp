@@ -0,0 +1,339 @@
+/**
+ * Microbenchmarks of the CPU hot paths, as a separate program that needs no window or GL context.
+ *
+ * On Linux it builds with nothing but the glad and glm headers, e.g.
+ *   g++ -std=c++14 -O2 -I<include dir> Benchmark.cpp Mesh.cpp Planet.cpp ShaderSource.cpp -o benchmark
+ * and it is run from the project directory, where the shaders are. The results are printed as JSON.
+ */
+
+#include "Mesh.h"
+#include "Planet.h"
+#include "ShaderSource.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Seed of every generated input, so runs on different days measure the same work
+const unsigned int BENCHMARK_SEED = 184116;
+
+// Timed runs per benchmark; the median is the result, the spread shows how noisy the machine was
+const int BENCHMARK_SAMPLES = 7;
+
+// Shortest time one run of a benchmark takes; the iterations per run are raised until it is reached
+const double BENCHMARK_MIN_SAMPLE_SECONDS = 0.05;
+
+// Bodies the per-body benchmarks go through per iteration, about as many as a large asteroid belt
+const int BENCHMARK_BODY_COUNT = 100000;
+
+// Triangles the cross product benchmark goes through per iteration
+const int BENCHMARK_TRIANGLE_COUNT = 4096;
+
+// Tessellations of the UV sphere, from coarse to fine
+const int SPHERE_LEVEL_COUNT = 5;
+const int SPHERE_SECTORS[SPHERE_LEVEL_COUNT] = { 18, 36, 72, 144, 288 };
+const int SPHERE_STACKS[SPHERE_LEVEL_COUNT] = { 9, 18, 36, 72, 144 };
+
+// Shader files loaded by the shader loading benchmark
+const char* const BENCHMARK_SHADERS[] = { "main.vsh", "main.fsh", "impostor.vsh", "impostor.fsh", "cull.csh" };
+
+// The benchmarks add their results here, so the compiler cannot drop the work
+volatile double benchmarkSink = 0.0;
+
+/**
+ * Struct containing the timings of one benchmark
+ */
+struct BenchmarkResult
+{
+	std::string name;
+	long long iterations;		// Iterations per timed run
+	long long items;			// Items (bodies, vertices, bytes...) one iteration processes
+	std::string itemName;
+	double medianNs;			// Time of one iteration
+	double minNs;
+	double maxNs;
+};
+
+/**
+ * Struct containing the settings that can be changed from the command line
+ */
+struct BenchmarkOptions
+{
+	std::string filter;			// Only benchmarks whose name contains this run
+	std::string outputPath;		// File the JSON goes to, empty for the standard output
+	int samples;
+	double minSampleSeconds;
+
+	BenchmarkOptions()
+	{
+		samples = BENCHMARK_SAMPLES;
+		minSampleSeconds = BENCHMARK_MIN_SAMPLE_SECONDS;
+	}
+};
+
+/**
+ * @brief Times a number of iterations of a benchmark.
+ * @param[in] function Benchmark, returns a value that depends on its work
+ * @param[in] iterations Number of calls
+ * @return Elapsed seconds
+ */
+template <typename Function>
+double TimeIterations(Function& function, long long iterations)
+{
+	double sink = 0.0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long long i = 0; i < iterations; i++)
+	{
+		sink += function();
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	benchmarkSink = benchmarkSink + sink;
+	return std::chrono::duration<double>(end - start).count();
+}
+
+/**
+ * @brief Runs a benchmark: finds how many iterations fill a run, then times that many runs.
+ * @param[in] name Name in the output
+ * @param[in] items Items one iteration processes
+ * @param[in] itemName What the items are
+ * @param[in] options Settings of the suite
+ * @param[in] function Benchmark, returns a value that depends on its work
+ * @param[in,out] results The result is appended here, unless the filter skips the benchmark
+ */
+template <typename Function>
+void RunBenchmark(const std::string& name, long long items, const std::string& itemName, const BenchmarkOptions& options, Function function, std::vector<BenchmarkResult>& results)
+{
+	if (name.find(options.filter) == std::string::npos)
+	{
+		return;
+	}
+
+	// The first run also warms up the caches
+	long long iterations = 1;
+	double seconds = TimeIterations(function, iterations);
+	while (seconds < options.minSampleSeconds)
+	{
+		double scale = seconds > 0.0 ? options.minSampleSeconds / seconds * 1.2 : 10.0;
+		iterations = std::max(iterations + 1, (long long)(iterations * std::min(scale, 10.0)));
+		seconds = TimeIterations(function, iterations);
+	}
+
+	std::vector<double> samples(options.samples);
+	for (double& sample : samples)
+	{
+		sample = TimeIterations(function, iterations) * 1e9 / iterations;
+	}
+	std::sort(samples.begin(), samples.end());
+
+	BenchmarkResult result;
+	result.name = name;
+	result.iterations = iterations;
+	result.items = items;
+	result.itemName = itemName;
+	result.medianNs = samples[samples.size() / 2];
+	result.minNs = samples.front();
+	result.maxNs = samples.back();
+	results.push_back(result);
+
+	std::cerr << name << ": " << result.medianNs << " ns" << std::endl;
+}
+
+/**
+ * @brief Makes up bodies on orbits like those of the asteroid belt.
+ * @param[in] count Number of bodies
+ * @param[in] gen Random number generator
+ * @param[out] bodies Generated bodies
+ */
+void GenerateBenchmarkBodies(int count, std::mt19937& gen, std::vector<Planet>& bodies)
+{
+	std::uniform_real_distribution<float> axis(20.f, 40.f);
+	std::uniform_real_distribution<float> eccentricity(0.f, 0.25f);
+	std::uniform_real_distribution<float> speed(1.f, 5.f);
+	std::uniform_real_distribution<float> phase(0.f, 360.f);
+
+	bodies.resize(count);
+	for (Planet& body : bodies)
+	{
+		body.majorAxis = axis(gen);
+		body.eccentricity = eccentricity(gen);
+		body.speed = speed(gen);
+		body.phaseShift = phase(gen);
+		body.ComputeMinorAxis();
+	}
+}
+
+/**
+ * @brief Writes the results as JSON.
+ * @param[in] out Stream to write to
+ * @param[in] options Settings of the suite
+ * @param[in] results Results of every benchmark that ran
+ */
+void WriteResults(std::ostream& out, const BenchmarkOptions& options, const std::vector<BenchmarkResult>& results)
+{
+	out << "{\n";
+	out << "  \"seed\": " << BENCHMARK_SEED << ",\n";
+	out << "  \"samples\": " << options.samples << ",\n";
+	out << "  \"benchmarks\": [";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& result = results[i];
+		char line[512];
+		snprintf(line, sizeof(line),
+			"%s\n    { \"name\": \"%s\", \"iterations\": %lld, \"items\": %lld, \"item\": \"%s\", "
+			"\"median_ns\": %.1f, \"min_ns\": %.1f, \"max_ns\": %.1f, \"median_ns_per_item\": %.3f }",
+			i == 0 ? "" : ",", result.name.c_str(), result.iterations, result.items, result.itemName.c_str(),
+			result.medianNs, result.minNs, result.maxNs, result.medianNs / std::max(result.items, 1LL));
+		out << line;
+	}
+	out << "\n  ]\n}\n";
+}
+
+/**
+ * @brief Reads the command line arguments into the options of the suite.
+ * @param[in] argc Number of arguments
+ * @param[in] argv Arguments
+ * @param[out] options Options to fill in
+ * @return False if an argument was not recognized
+ */
+bool ParseBenchmarkArguments(int argc, char** argv, BenchmarkOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--filter" && i + 1 < argc)
+		{
+			options.filter = argv[++i];
+		}
+		else if (arg == "--output" && i + 1 < argc)
+		{
+			options.outputPath = argv[++i];
+		}
+		else if (arg == "--samples" && i + 1 < argc)
+		{
+			options.samples = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (arg == "--min-time" && i + 1 < argc)
+		{
+			options.minSampleSeconds = std::max(0.001, std::stod(argv[++i]));
+		}
+		else
+		{
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			std::cerr << "Usage: " << argv[0] << " [--filter <text>] [--output <file.json>] [--samples <count>] [--min-time <seconds>]" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Main function of the benchmark suite
+ * @param[in] argc Number of command line arguments
+ * @param[in] argv Command line arguments, see ParseBenchmarkArguments
+ * @return 0 if every benchmark ran
+ */
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!ParseBenchmarkArguments(argc, argv, options))
+	{
+		return 1;
+	}
+
+	std::vector<BenchmarkResult> results;
+	std::mt19937 gen(BENCHMARK_SEED);
+
+	// Sphere generation, from a low-poly impostor stand-in to a close-up mesh
+	std::vector<Vertex> vertices;
+	std::vector<int> indices;
+	for (int level = 0; level < SPHERE_LEVEL_COUNT; level++)
+	{
+		int sectors = SPHERE_SECTORS[level];
+		int stacks = SPHERE_STACKS[level];
+		float color[3] = { 255, 255, 255 };
+		long long vertexCount = (long long)(sectors + 1) * (stacks + 1);
+		RunBenchmark("GenerateSphereVertices/" + std::to_string(sectors) + "x" + std::to_string(stacks), vertexCount, "vertices", options, [&]() {
+			vertices.clear();
+			indices.clear();
+			GenerateSphereVertices(vertices, indices, 1.0f, sectors, stacks, color);
+			return (double)vertices.back().u + indices.size();
+		}, results);
+	}
+
+	// The orbit update of the render loop, over a whole belt of bodies per iteration
+	std::vector<Planet> bodies;
+	GenerateBenchmarkBodies(BENCHMARK_BODY_COUNT, gen, bodies);
+	double simTime = 0.0;
+	RunBenchmark("UpdateOrbitPosition/" + std::to_string(BENCHMARK_BODY_COUNT), BENCHMARK_BODY_COUNT, "bodies", options, [&]() {
+		simTime += 1.0 / 60.0;
+		for (Planet& body : bodies)
+		{
+			UpdateOrbitPosition(body, simTime, 1.f);
+		}
+		return (double)bodies.back().x1;
+	}, results);
+
+	RunBenchmark("ComputeMinorAxis/" + std::to_string(BENCHMARK_BODY_COUNT), BENCHMARK_BODY_COUNT, "bodies", options, [&]() {
+		for (Planet& body : bodies)
+		{
+			body.ComputeMinorAxis();
+		}
+		return (double)bodies.back().minorAxis;
+	}, results);
+
+	// Triangle normals over random triangles
+	std::uniform_real_distribution<float> coordinate(-1.f, 1.f);
+	std::vector<float> corners(BENCHMARK_TRIANGLE_COUNT * 9);
+	for (float& value : corners)
+	{
+		value = coordinate(gen);
+	}
+	std::vector<float> normals(BENCHMARK_TRIANGLE_COUNT * 3);
+	RunBenchmark("CrossProduct/" + std::to_string(BENCHMARK_TRIANGLE_COUNT), BENCHMARK_TRIANGLE_COUNT, "triangles", options, [&]() {
+		for (int i = 0; i < BENCHMARK_TRIANGLE_COUNT; i++)
+		{
+			float* corner = &corners[i * 9];
+			CrossProduct(&normals[i * 3], corner, corner + 3, corner + 6);
+		}
+		return (double)normals.back();
+	}, results);
+
+	// Shader loading as CreateShaderFromFile does it, without compiling
+	int failures = 0;
+	for (const char* shader : BENCHMARK_SHADERS)
+	{
+		std::string source;
+		if (!LoadShaderSource(shader, source))
+		{
+			failures++;
+			continue;
+		}
+		RunBenchmark(std::string("LoadShaderSource/") + shader, (long long)source.size(), "bytes", options, [&]() {
+			LoadShaderSource(shader, source);
+			return (double)source.size();
+		}, results);
+	}
+
+	if (options.outputPath.empty())
+	{
+		WriteResults(std::cout, options, results);
+	}
+	else
+	{
+		std::ofstream out(options.outputPath);
+		if (out.fail())
+		{
+			std::cerr << "Unable to open output file: " << options.outputPath << std::endl;
+			return 1;
+		}
+		WriteResults(out, options, results);
+	}
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+/**
+ * Dynamic resolution scaling that keeps the GPU time of a frame near a target budget.
+ */
+
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// The scale is only changed when the measured time is this far (relative) from the budget
+const float RESOLUTION_DEADBAND = 0.05f;
+
+// How much of the way to the ideal scale is taken per measurement. Going down is fast so
+// a heavy frame is corrected right away, going up is slow so the scale does not oscillate.
+const float RESOLUTION_DECREASE_RATE = 0.5f;
+const float RESOLUTION_INCREASE_RATE = 0.1f;
+
+DynamicResolution::DynamicResolution()
+{
+	outputWidth = 0;
+	outputHeight = 0;
+	renderWidth = 0;
+	renderHeight = 0;
+	scale = 1.f;
+	minScale = 0.35f;
+	maxScale = 1.f;
+	targetMs = 16.6f;
+	gpuTimeMs = 0.f;
+	enabled = true;
+	offscreen = false;
+	queryIndex = 0;
+
+	for (int i = 0; i < RESOLUTION_QUERY_COUNT; i++)
+	{
+		timerQueries[i] = 0;
+		queryPending[i] = false;
+		queryScales[i] = 1.f;
+	}
+}
+
+void DynamicResolution::Init(int width, int height, float frameBudgetMs)
+{
+	targetMs = frameBudgetMs;
+
+	fbo.Create("dynamic resolution framebuffer");
+	colorTexture.Create("dynamic resolution color");
+	depthRenderbuffer.Create("dynamic resolution depth");
+	glGenQueries(RESOLUTION_QUERY_COUNT, timerQueries);
+
+	Resize(width, height);
+}
+
+void DynamicResolution::Resize(int width, int height)
+{
+	outputWidth = std::max(width, 1);
+	outputHeight = std::max(height, 1);
+
+	// The offscreen framebuffer is allocated at full size once, and smaller scales only use
+	// a corner of it, so changing the scale never reallocates anything
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, outputWidth, outputHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	colorTexture.SetSize((long long)outputWidth * outputHeight * 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, outputWidth, outputHeight);
+	depthRenderbuffer.SetSize((long long)outputWidth * outputHeight * 4);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cerr << "Dynamic resolution framebuffer is incomplete, rendering at full resolution" << std::endl;
+		enabled = false;
+		offscreen = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DynamicResolution::BeginFrame()
+{
+	if (!enabled)
+	{
+		scale = 1.f;
+	}
+
+	renderWidth = std::max(1, (int)std::lround(outputWidth * scale));
+	renderHeight = std::max(1, (int)std::lround(outputHeight * scale));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, SceneFramebuffer());
+	glViewport(0, 0, renderWidth, renderHeight);
+
+	// Skip timing this frame if the query in this slot has not come back yet
+	if (!queryPending[queryIndex])
+	{
+		glBeginQuery(GL_TIME_ELAPSED, timerQueries[queryIndex]);
+	}
+}
+
+void DynamicResolution::EndFrame(float frameTimeMs)
+{
+	if (!queryPending[queryIndex])
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		queryPending[queryIndex] = true;
+		queryScales[queryIndex] = scale;
+	}
+	queryIndex = (queryIndex + 1) % RESOLUTION_QUERY_COUNT;
+
+	if (SceneFramebuffer() != 0)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, outputWidth, outputHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	glViewport(0, 0, outputWidth, outputHeight);
+
+	// Software GL rasterizes when the frame is flushed, which timer queries do not see,
+	// so the CPU time of the frame is also a measurement and whichever of the two is bigger wins.
+	// It leaves out the vsync wait, which would otherwise make every frame look exactly on budget.
+	float measuredMs = frameTimeMs;
+	float measuredScale = scale;
+
+	// Collect whichever older queries have finished, without waiting for the rest
+	for (int i = 0; i < RESOLUTION_QUERY_COUNT; i++)
+	{
+		int slot = (queryIndex + i) % RESOLUTION_QUERY_COUNT;
+		if (!queryPending[slot])
+		{
+			continue;
+		}
+
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(timerQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available != GL_TRUE)
+		{
+			continue;
+		}
+
+		GLuint64 elapsedNs = 0;
+		glGetQueryObjectui64v(timerQueries[slot], GL_QUERY_RESULT, &elapsedNs);
+		queryPending[slot] = false;
+
+		gpuTimeMs = elapsedNs / 1000000.f;
+		if (gpuTimeMs > measuredMs)
+		{
+			measuredMs = gpuTimeMs;
+			measuredScale = queryScales[slot];
+		}
+	}
+
+	UpdateScale(measuredMs, measuredScale);
+}
+
+void DynamicResolution::UpdateScale(float measuredMs, float measuredScale)
+{
+	if (!enabled || measuredMs <= 0.f)
+	{
+		return;
+	}
+
+	float error = (measuredMs - targetMs) / targetMs;
+	if (std::fabs(error) < RESOLUTION_DEADBAND)
+	{
+		return;
+	}
+
+	// GPU time grows with the number of pixels, which is proportional to the square of the scale.
+	// The measurement belongs to a frame a few frames back, so start from the scale it was rendered at.
+	float idealScale = measuredScale * std::sqrt(targetMs / measuredMs);
+	float rate = idealScale < scale ? RESOLUTION_DECREASE_RATE : RESOLUTION_INCREASE_RATE;
+	scale = std::min(maxScale, std::max(minScale, scale + (idealScale - scale) * rate));
+}
+
+GLuint DynamicResolution::SceneFramebuffer() const
+{
+	return enabled || offscreen ? (GLuint)fbo : 0;
+}
+
+void DynamicResolution::Destroy()
+{
+	glDeleteQueries(RESOLUTION_QUERY_COUNT, timerQueries);
+	depthRenderbuffer.Reset();
+	colorTexture.Reset();
+	fbo.Reset();
+}
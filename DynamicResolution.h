@@ -0,0 +1,86 @@
+/**
+ * Dynamic resolution scaling that keeps the GPU time of a frame near a target budget.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+
+#include <glad/glad.h>
+
+// Number of timer queries in flight; results are read a few frames later so we never wait on the GPU
+const int RESOLUTION_QUERY_COUNT = 4;
+
+/**
+ * The scene is rendered into an offscreen framebuffer that is as big as the window, but only a
+ * scaled-down rectangle of it is used. At the end of the frame that rectangle is stretched over the
+ * window with bilinear filtering. The scale follows the GPU time measured with timer queries (or the
+ * CPU time of the frame, if that is longer), so heavy frames (e.g. the sun filling the screen) render fewer
+ * pixels instead of taking longer.
+ */
+struct DynamicResolution
+{
+	FramebufferHandle fbo;
+	TextureHandle colorTexture;
+	RenderbufferHandle depthRenderbuffer;
+	int outputWidth, outputHeight;	// Size of the window framebuffer
+	int renderWidth, renderHeight;	// Size of the rectangle that is actually rendered
+
+	float scale, minScale, maxScale;
+	float targetMs;		// GPU time budget of a frame
+	float gpuTimeMs;	// Last measured GPU time of a frame
+	bool enabled;		// Whether the scale follows the frame time
+	bool offscreen;		// Whether the scene goes through the offscreen framebuffer even at a fixed scale, so it can be read back
+
+	GLuint timerQueries[RESOLUTION_QUERY_COUNT];
+	bool queryPending[RESOLUTION_QUERY_COUNT];
+	float queryScales[RESOLUTION_QUERY_COUNT];	// Scale that each query was rendered at
+	int queryIndex;
+
+	DynamicResolution();
+
+	/**
+	 * @brief Creates the offscreen framebuffer and the timer queries.
+	 * @param[in] width Width of the window framebuffer
+	 * @param[in] height Height of the window framebuffer
+	 * @param[in] frameBudgetMs GPU time budget of a frame in milliseconds
+	 */
+	void Init(int width, int height, float frameBudgetMs);
+
+	/**
+	 * @brief Reallocates the offscreen framebuffer after the window framebuffer changed size.
+	 * @param[in] width New width
+	 * @param[in] height New height
+	 */
+	void Resize(int width, int height);
+
+	/**
+	 * @brief Binds the offscreen framebuffer, sets the viewport to the scaled rectangle and starts timing.
+	 */
+	void BeginFrame();
+
+	/**
+	 * @brief Stops timing, upscales the rendered rectangle to the window and updates the scale for the next frame.
+	 * @param[in] frameTimeMs CPU time of the frame's work in milliseconds, without the waits for the GPU,
+	 * the frame rate limit and the swap
+	 */
+	void EndFrame(float frameTimeMs);
+
+	/**
+	 * @brief Framebuffer the scene of the current frame is rendered into.
+	 * @return The offscreen framebuffer, or 0 for the window
+	 */
+	GLuint SceneFramebuffer() const;
+
+	/**
+	 * @brief Deletes the offscreen framebuffer and the timer queries.
+	 */
+	void Destroy();
+
+	/**
+	 * @brief Applies a measured GPU time to the scale controller.
+	 * @param[in] measuredMs GPU time of a finished frame in milliseconds
+	 * @param[in] measuredScale Scale that the finished frame was rendered at
+	 */
+	void UpdateScale(float measuredMs, float measuredScale);
+};
@@ -0,0 +1,162 @@
+/**
+ * Eclipses: the bodies whose shadows can fall on another body this frame, for the analytic shadows in main.fsh and impostor.fsh.
+ */
+
+#include "Eclipse.h"
+
+#include "JobSystem.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Computes the penumbra cone of an occluder.
+ * @param[in] lightPosition Center of the light
+ * @param[in] lightRadius Radius of the light
+ * @param[in] occluder Center in xyz, radius in w
+ * @return The cone
+ */
+static ShadowCone ComputeShadowCone(glm::vec3 lightPosition, float lightRadius, glm::vec4 occluder)
+{
+	ShadowCone cone;
+	glm::vec3 toOccluder = glm::vec3(occluder) - lightPosition;
+	float distance = glm::length(toOccluder);
+	cone.axis = distance > 0.f ? toOccluder / distance : glm::vec3(1.f, 0.f, 0.f);
+	cone.nearSide = distance - occluder.w;
+
+	// The tangents that touch the light and the occluder on opposite sides cross at the apex
+	cone.sine = (lightRadius + occluder.w) / std::max(distance, 1e-6f);
+	cone.everywhere = cone.sine >= 1.f;
+	cone.sine = std::min(cone.sine, 1.f);
+	cone.cosine = std::sqrt(1.f - cone.sine * cone.sine);
+	cone.apex = distance * lightRadius / (lightRadius + occluder.w);
+	return cone;
+}
+
+/**
+ * @brief Checks whether any part of a sphere is inside a penumbra cone.
+ * @param[in] cone Penumbra cone
+ * @param[in] lightPosition Center of the light the cone was computed for
+ * @param[in] receiver Center in xyz, radius in w
+ * @return True if the sphere can be in the shadow
+ */
+static bool IsInShadowCone(const ShadowCone& cone, glm::vec3 lightPosition, glm::vec4 receiver)
+{
+	glm::vec3 toReceiver = glm::vec3(receiver) - lightPosition;
+	float along = glm::dot(toReceiver, cone.axis);
+
+	// Nothing between the light and the occluder is in its shadow
+	if (along + receiver.w < cone.nearSide)
+	{
+		return false;
+	}
+	if (cone.everywhere)
+	{
+		return true;
+	}
+
+	// Distance from the center to the surface of the cone, negative inside
+	float fromAxis = glm::length(toReceiver - along * cone.axis);
+	return fromAxis * cone.cosine - (along - cone.apex) * cone.sine < receiver.w;
+}
+
+EclipseOccluders::EclipseOccluders()
+{
+	lightPosition = glm::vec3(0.f);
+	lightRadius = 1.f;
+}
+
+void EclipseOccluders::Init(const std::vector<Planet>& bodies, glm::vec3 sunPosition, float sunRadius)
+{
+	lightPosition = sunPosition;
+	lightRadius = sunRadius;
+
+	candidates.clear();
+	for (int i = 0; i < (int)bodies.size(); i++)
+	{
+		if (bodies[i].radius >= ECLIPSE_MIN_OCCLUDER_RADIUS)
+		{
+			candidates.push_back(i);
+		}
+	}
+
+	// A bigger body casts a bigger shadow, so if there are too many the biggest ones win
+	std::stable_sort(candidates.begin(), candidates.end(), [&bodies](int a, int b) { return bodies[a].radius > bodies[b].radius; });
+	if ((int)candidates.size() > ECLIPSE_MAX_CANDIDATES)
+	{
+		candidates.resize(ECLIPSE_MAX_CANDIDATES);
+	}
+	cones.resize(candidates.size());
+}
+
+void EclipseOccluders::Select(JobSystem& jobs, const std::vector<Planet>& bodies, int grainSize)
+{
+	spheres.clear();
+	if (candidates.empty())
+	{
+		return;
+	}
+
+	std::vector<glm::vec4> candidateSpheres(candidates.size());
+	for (size_t c = 0; c < candidates.size(); c++)
+	{
+		const Planet& occluder = bodies[candidates[c]];
+		candidateSpheres[c] = glm::vec4(occluder.cx + occluder.x1, occluder.cy, occluder.cz + occluder.z1, occluder.radius);
+		cones[c] = ComputeShadowCone(lightPosition, lightRadius, candidateSpheres[c]);
+	}
+
+	int bodyCount = (int)bodies.size();
+	int chunkCount = (bodyCount + grainSize - 1) / grainSize;
+	chunkHits.assign(chunkCount, 0u);
+	uint32_t allCandidates = candidates.size() >= 32 ? 0xFFFFFFFFu : (1u << candidates.size()) - 1u;
+
+	jobs.ParallelFor(chunkCount, 1, [&](int beginChunk, int endChunk) {
+		for (int chunk = beginChunk; chunk < endChunk; chunk++)
+		{
+			uint32_t hits = 0u;
+			int end = std::min(bodyCount, (chunk + 1) * grainSize);
+			for (int i = chunk * grainSize; i < end && hits != allCandidates; i++)
+			{
+				const Planet& body = bodies[i];
+				glm::vec4 receiver(body.cx + body.x1, body.cy, body.cz + body.z1, body.radius);
+				for (size_t c = 0; c < candidates.size(); c++)
+				{
+					if ((hits >> c) & 1u || candidates[c] == i)
+					{
+						continue;
+					}
+					if (IsInShadowCone(cones[c], lightPosition, receiver))
+					{
+						hits |= 1u << c;
+					}
+				}
+			}
+			chunkHits[chunk] = hits;
+		}
+	});
+
+	uint32_t hits = 0u;
+	for (uint32_t chunk : chunkHits)
+	{
+		hits |= chunk;
+	}
+	for (size_t c = 0; c < candidates.size() && (int)spheres.size() < ECLIPSE_MAX_OCCLUDERS; c++)
+	{
+		if ((hits >> c) & 1u)
+		{
+			spheres.push_back(candidateSpheres[c]);
+		}
+	}
+}
+
+void EclipseOccluders::SetUniforms(GLuint program) const
+{
+	glUniform1f(glGetUniformLocation(program, "lightRadius"), lightRadius);
+	glUniform1i(glGetUniformLocation(program, "occluderCount"), (GLint)spheres.size());
+	if (!spheres.empty())
+	{
+		glUniform4fv(glGetUniformLocation(program, "occluders"), (GLsizei)spheres.size(), glm::value_ptr(spheres[0]));
+	}
+}
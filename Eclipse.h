@@ -0,0 +1,80 @@
+/**
+ * Eclipses: the bodies whose shadows can fall on another body this frame, for the analytic shadows in main.fsh and impostor.fsh.
+ */
+
+#pragma once
+
+#include "Planet.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct JobSystem;
+
+// Occluders the shaders test every fragment against; must match MAX_OCCLUDERS in main.fsh and impostor.fsh
+const int ECLIPSE_MAX_OCCLUDERS = 8;
+
+// Bodies checked for casting a shadow; the largest ones are kept
+const int ECLIPSE_MAX_CANDIDATES = 32;
+
+// Smallest body that is checked for casting a shadow. Smaller ones (the asteroids) cast shadows no one can see.
+const float ECLIPSE_MIN_OCCLUDER_RADIUS = 0.2f;
+
+/**
+ * Struct containing the penumbra cone an occluder casts away from the light: the region where any
+ * part of the light is hidden behind the occluder
+ */
+struct ShadowCone
+{
+	glm::vec3 axis;			// From the light through the occluder
+	float nearSide;			// Distance from the light to the side of the occluder facing it
+	float apex;				// Distance from the light to where the cone starts, between the light and the occluder
+	float sine, cosine;		// Of the half-angle of the cone
+	bool everywhere;		// Whether the occluder overlaps the light, so anything behind it may be shadowed
+};
+
+/**
+ * Shadow-casting spheres of the frame. Shadow maps of the sun (a point light in every direction)
+ * would take six passes, so the shadows are analytic instead: the shaders treat every occluder as a
+ * disk in front of the sun's disk and darken the diffuse light by how much of the sun it covers,
+ * which gives the umbra and a soft penumbra.
+ *
+ * Only occluders whose penumbra cone reaches another body are uploaded, so the shaders usually
+ * loop over none of them. The cone test is done per body chunk on the job system.
+ */
+struct EclipseOccluders
+{
+	glm::vec3 lightPosition;
+	float lightRadius;
+	std::vector<int> candidates;		// Bodies big enough to cast a visible shadow, largest first
+	std::vector<ShadowCone> cones;		// Penumbra cone of every candidate, at the current positions
+	std::vector<uint32_t> chunkHits;	// Per body chunk, a bit for every candidate whose cone reaches a body of the chunk
+	std::vector<glm::vec4> spheres;		// Occluders selected this frame: center in xyz, radius in w
+
+	EclipseOccluders();
+
+	/**
+	 * @brief Picks the bodies that can cast shadows.
+	 * @param[in] bodies Every body
+	 * @param[in] sunPosition Center of the light
+	 * @param[in] sunRadius Radius of the light
+	 */
+	void Init(const std::vector<Planet>& bodies, glm::vec3 sunPosition, float sunRadius);
+
+	/**
+	 * @brief Selects the occluders whose shadows reach another body at the bodies' current positions.
+	 * @param[in] jobs Job system that runs the cone tests
+	 * @param[in] bodies Every body, already moved for this frame
+	 * @param[in] grainSize Bodies per chunk
+	 */
+	void Select(JobSystem& jobs, const std::vector<Planet>& bodies, int grainSize);
+
+	/**
+	 * @brief Uploads the occluders to a shader that computes the eclipse shadows.
+	 * @param[in] program Shader program, in use
+	 */
+	void SetUniforms(GLuint program) const;
+};
@@ -0,0 +1,203 @@
+/**
+ * Batch export of the body positions over long time spans, without a window or GL context.
+ */
+
+#include "Ephemeris.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Fewest body positions worth handing to another thread; a job is as many steps as that takes
+const int EPHEMERIS_GRAIN_BODIES = 4096;
+
+EphemerisWriter::EphemerisWriter()
+{
+	file = nullptr;
+	bodyCount = 0;
+	for (EphemerisBlock& block : blocks)
+	{
+		block.stepCount = 0;
+		block.full = false;
+	}
+	stopping = false;
+	failed = false;
+	waitSeconds = 0.0;
+	bytesWritten = 0;
+}
+
+bool EphemerisWriter::Open(const std::vector<Planet>& bodies, const EphemerisSettings& settings, int blockSteps)
+{
+	file = fopen(settings.path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		std::cerr << "Unable to create ephemeris file: " << settings.path << std::endl;
+		return false;
+	}
+
+	bodyCount = (int)bodies.size();
+	uint32_t count = (uint32_t)bodyCount;
+	uint64_t steps = (uint64_t)settings.stepCount;
+	uint32_t stepsPerBlock = (uint32_t)blockSteps;
+	fwrite("EPH1", 1, 4, file);
+	fwrite(&count, sizeof(count), 1, file);
+	fwrite(&steps, sizeof(steps), 1, file);
+	fwrite(&settings.startTime, sizeof(double), 1, file);
+	fwrite(&settings.stepTime, sizeof(double), 1, file);
+	fwrite(&stepsPerBlock, sizeof(stepsPerBlock), 1, file);
+	for (const Planet& body : bodies)
+	{
+		uint16_t length = (uint16_t)std::min(body.name.size(), (size_t)UINT16_MAX);
+		fwrite(&length, sizeof(length), 1, file);
+		fwrite(body.name.data(), 1, length, file);
+	}
+	bytesWritten = ftell(file);
+
+	for (EphemerisBlock& block : blocks)
+	{
+		block.columns.resize((size_t)blockSteps * bodyCount * 3);
+	}
+	writer = std::thread(&EphemerisWriter::WriterLoop, this);
+	return true;
+}
+
+EphemerisBlock& EphemerisWriter::Acquire(int index)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(mutex);
+	changed.wait(lock, [this, index]() { return !blocks[index].full; });
+	waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return blocks[index];
+}
+
+void EphemerisWriter::Submit(int index)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		blocks[index].full = true;
+	}
+	changed.notify_all();
+}
+
+bool EphemerisWriter::Close()
+{
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	writer.join();
+
+	bool closed = fclose(file) == 0;
+	file = nullptr;
+	return closed && !failed;
+}
+
+void EphemerisWriter::WriterLoop()
+{
+	// The blocks are filled alternately, so they are written alternately
+	int index = 0;
+	while (true)
+	{
+		EphemerisBlock& block = blocks[index];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this, &block]() { return block.full || stopping; });
+			if (!block.full)
+			{
+				return;
+			}
+		}
+
+		// The columns of a short last block are packed to its step count, so one write covers all three
+		size_t floatCount = (size_t)block.stepCount * bodyCount * 3;
+		bool written = fwrite(block.columns.data(), sizeof(float), floatCount, file) == floatCount;
+		bytesWritten += (long long)(floatCount * sizeof(float));
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			failed = failed || !written;
+			block.full = false;
+		}
+		changed.notify_all();
+		index ^= 1;
+	}
+}
+
+bool ExportEphemeris(JobSystem& jobs, const std::vector<Planet>& bodies, const EphemerisSettings& settings)
+{
+	int bodyCount = (int)bodies.size();
+	size_t stepBytes = std::max((size_t)bodyCount * 3 * sizeof(float), (size_t)1);
+	int blockSteps = (int)std::max(1LL, std::min(settings.stepCount, (long long)(EPHEMERIS_BLOCK_BYTES / stepBytes)));
+
+	EphemerisWriter writer;
+	if (!writer.Open(bodies, settings, blockSteps))
+	{
+		return false;
+	}
+	std::cout << "Ephemeris: " << bodyCount << " bodies, " << settings.stepCount << " steps, "
+		<< blockSteps << " steps per block, " << jobs.ThreadCount() << " threads" << std::endl;
+
+	int grainSteps = std::max(1, EPHEMERIS_GRAIN_BODIES / std::max(bodyCount, 1));
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	int index = 0;
+	int lastPercent = 0;
+	for (long long firstStep = 0; firstStep < settings.stepCount; firstStep += blockSteps)
+	{
+		EphemerisBlock& block = writer.Acquire(index);
+		block.stepCount = (int)std::min((long long)blockSteps, settings.stepCount - firstStep);
+
+		size_t columnSize = (size_t)block.stepCount * bodyCount;
+		float* xs = block.columns.data();
+		float* ys = xs + columnSize;
+		float* zs = ys + columnSize;
+		jobs.ParallelFor(block.stepCount, grainSteps, [&](int begin, int end) {
+			for (int step = begin; step < end; step++)
+			{
+				double time = settings.startTime + (double)(firstStep + step) * settings.stepTime;
+				size_t row = (size_t)step * bodyCount;
+				for (int i = 0; i < bodyCount; i++)
+				{
+					const Planet& body = bodies[i];
+					float x1, z1;
+					ComputeOrbitPosition(body, time, settings.revolutionSpeed, x1, z1);
+					xs[row + i] = body.cx + x1;
+					ys[row + i] = body.cy;
+					zs[row + i] = body.cz + z1;
+				}
+			}
+		});
+
+		writer.Submit(index);
+		index ^= 1;
+
+		int percent = (int)((firstStep + block.stepCount) * 100 / settings.stepCount);
+		if (percent / 10 > lastPercent / 10)
+		{
+			std::cout << "Ephemeris: " << percent << "%" << std::endl;
+			lastPercent = percent;
+		}
+	}
+
+	bool written = writer.Close();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (!written)
+	{
+		std::cerr << "Failed to write ephemeris file: " << settings.path << std::endl;
+		return false;
+	}
+
+	double bodySteps = (double)bodyCount * settings.stepCount;
+	std::cout << "Ephemeris: " << bodySteps / std::max(seconds, 1e-9) << " bodies*steps/s (" << seconds << " s, "
+		<< writer.waitSeconds << " s waiting for the disk), " << writer.bytesWritten / (1024.0 * 1024.0)
+		<< " MB written to " << settings.path << std::endl;
+	return true;
+}
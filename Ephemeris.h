@@ -0,0 +1,117 @@
+/**
+ * Batch export of the body positions over long time spans, without a window or GL context.
+ */
+
+#pragma once
+
+#include "Planet.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct JobSystem;
+
+// Simulated seconds in a year: the Earth goes around the sun once every 360 seconds at normal speed
+const double EPHEMERIS_SECONDS_PER_YEAR = 360.0;
+
+// Hours in a year, to turn the step length given on the command line into simulated seconds
+const double EPHEMERIS_HOURS_PER_YEAR = 365.25 * 24.0;
+
+// Size of each of the two output buffers; a block is as many steps as fit (at least one)
+const size_t EPHEMERIS_BLOCK_BYTES = 32 * 1024 * 1024;
+
+/**
+ * Struct containing what to export
+ */
+struct EphemerisSettings
+{
+	std::string path;
+	double startTime;		// Simulated time of the first step
+	double stepTime;		// Simulated time between two steps
+	long long stepCount;
+	float revolutionSpeed;
+};
+
+/**
+ * Struct containing the positions of a run of consecutive steps, one column per coordinate:
+ * all x of the first step, all x of the second step and so on, then the same for y and z
+ */
+struct EphemerisBlock
+{
+	std::vector<float> columns;
+	int stepCount;
+	bool full;				// Whether the block waits to be written, guarded by the writer's mutex
+};
+
+/**
+ * Writes blocks to a file on its own thread. There are two blocks: the caller fills one while the
+ * other is being written, and only waits when the disk falls behind, so memory stays at two
+ * blocks however long the span is.
+ */
+struct EphemerisWriter
+{
+	FILE* file;
+	int bodyCount;
+	EphemerisBlock blocks[2];
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool stopping;
+	bool failed;			// Whether a write failed, guarded by mutex
+	double waitSeconds;		// Time the caller spent waiting for a free block
+	long long bytesWritten;
+
+	EphemerisWriter();
+
+	/**
+	 * @brief Creates the file, writes the header and starts the writer thread.
+	 * @param[in] bodies Bodies whose names go into the header
+	 * @param[in] settings What is exported
+	 * @param[in] blockSteps Steps per block
+	 * @return False if the file could not be created
+	 */
+	bool Open(const std::vector<Planet>& bodies, const EphemerisSettings& settings, int blockSteps);
+
+	/**
+	 * @brief Waits until a block is written out, so it can be filled again.
+	 * @param[in] index Block, 0 or 1
+	 * @return The block to fill
+	 */
+	EphemerisBlock& Acquire(int index);
+
+	/**
+	 * @brief Hands a filled block to the writer thread.
+	 * @param[in] index Block, 0 or 1
+	 */
+	void Submit(int index);
+
+	/**
+	 * @brief Writes the remaining blocks, stops the writer thread and closes the file.
+	 * @return False if anything could not be written
+	 */
+	bool Close();
+
+private:
+	void WriterLoop();
+};
+
+/**
+ * @brief Evaluates the orbit of every body at every step and streams the positions to a file. The
+ * steps of a block are spread over all threads; the orbits are closed-form, so every step is
+ * independent of the one before. Prints bodies * steps per second when done.
+ *
+ * The file starts with the magic "EPH1", the body count (uint32), the step count (uint64), the
+ * start time and the step time (double, simulated seconds), the steps per block (uint32) and every
+ * body's name (uint16 length, then the characters). Blocks of float positions follow, laid out as
+ * in EphemerisBlock; every block but the last has the same number of steps. All little-endian.
+ * @param[in] jobs Job system that runs the work
+ * @param[in] bodies Bodies to export
+ * @param[in] settings What to export
+ * @return False if the file could not be written
+ */
+bool ExportEphemeris(JobSystem& jobs, const std::vector<Planet>& bodies, const EphemerisSettings& settings);
@@ -0,0 +1,502 @@
+/**
+ * Asynchronous frame capture through a ring of pixel pack buffers and a background encoder thread.
+ */
+
+#include "FrameCapture.h"
+
+#include <algorithm>
+#include <cctype>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Include stb_image_write for the PNG sequence output
+// Remember to define STB_IMAGE_WRITE_IMPLEMENTATION first before including
+// to avoid linker errors
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+const char* const NULL_DEVICE = "NUL";
+const char* const PIPE_WRITE_MODE = "wb";
+#else
+const char* const NULL_DEVICE = "/dev/null";
+const char* const PIPE_WRITE_MODE = "w";
+#endif
+
+/**
+ * @brief Checks whether an ffmpeg executable can be started from the current PATH.
+ * @return True if ffmpeg is available
+ */
+static bool IsFfmpegAvailable()
+{
+	std::string command = std::string("ffmpeg -version > ") + NULL_DEVICE + " 2>&1";
+	return std::system(command.c_str()) == 0;
+}
+
+/**
+ * @brief Quotes an argument so the shell passes it to a command unchanged.
+ * @param[in] argument Argument to quote
+ * @param[out] quoted Argument with its quotes
+ * @return False if the argument cannot be quoted safely
+ */
+static bool QuoteShellArgument(const std::string& argument, std::string& quoted)
+{
+#ifdef _WIN32
+	// cmd.exe has no escape inside double quotes, but a double quote cannot be part of a Windows path anyway.
+	// "%" would expand variables, but paths with one are written as PNG sequences.
+	if (argument.find('"') != std::string::npos || argument.find('%') != std::string::npos)
+	{
+		return false;
+	}
+	quoted = "\"" + argument + "\"";
+#else
+	// Nothing is special inside single quotes, so only the single quotes themselves need to be closed and escaped
+	quoted = "'";
+	for (char c : argument)
+	{
+		quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+	}
+	quoted += "'";
+#endif
+	return true;
+}
+
+/**
+ * @brief Splits a PNG sequence path around its frame number. The path is never used as a printf format,
+ * so only "%d", "%5d" or "%05d" (once) and "%%" are accepted.
+ * @param[in] path Path with the pattern, e.g. "frames/%05d.png"
+ * @param[out] prefix Path before the frame number, with "%%" turned into "%"
+ * @param[out] suffix Path after the frame number, same
+ * @param[out] digits Fewest digits the frame number is written with
+ * @param[out] zeroPadded Whether the frame number is padded with zeros instead of spaces
+ * @return False if the path does not have exactly one integer conversion
+ */
+static bool ParseFramePattern(const std::string& path, std::string& prefix, std::string& suffix, int& digits, bool& zeroPadded)
+{
+	prefix.clear();
+	suffix.clear();
+	digits = 0;
+	zeroPadded = false;
+
+	int conversions = 0;
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		std::string& part = conversions == 0 ? prefix : suffix;
+		if (path[i] != '%')
+		{
+			part += path[i];
+			continue;
+		}
+		if (i + 1 < path.size() && path[i + 1] == '%')
+		{
+			part += '%';
+			i++;
+			continue;
+		}
+
+		size_t end = i + 1;
+		bool zero = end < path.size() && path[end] == '0';
+		if (zero)
+		{
+			end++;
+		}
+		size_t digitsStart = end;
+		while (end < path.size() && isdigit((unsigned char)path[end]) && end - digitsStart < 2)
+		{
+			end++;
+		}
+		if (end >= path.size() || path[end] != 'd' || conversions > 0)
+		{
+			return false;
+		}
+		digits = end > digitsStart ? std::atoi(path.substr(digitsStart, end - digitsStart).c_str()) : 0;
+		zeroPadded = zero;
+		conversions++;
+		i = end;
+	}
+	return conversions == 1;
+}
+
+FrameCapture::FrameCapture()
+{
+	active = false;
+	width = 0;
+	height = 0;
+	framesPerSecond = 60;
+	format = CAPTURE_Y4M;
+	frameDigits = 0;
+	frameZeroPadded = false;
+	pboIndex = 0;
+	frameIndex = 0;
+	framesWritten = 0;
+	stopping = false;
+	ffmpegPipe = nullptr;
+	previousPipeHandler = SIG_DFL;
+	failed = false;
+
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+	{
+		pboFrames[i] = -1;
+	}
+}
+
+FrameCapture::~FrameCapture()
+{
+	if (active)
+	{
+		Stop();
+	}
+}
+
+bool FrameCapture::Start(const std::string& path, int frameWidth, int frameHeight, int fps)
+{
+	width = frameWidth;
+	height = frameHeight;
+	framesPerSecond = fps;
+	outputPath = path;
+	frameIndex = 0;
+	framesWritten = 0;
+	stopping = false;
+	failed = false;
+
+	std::string extension = path.substr(std::min(path.size(), path.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	if (path.find('%') != std::string::npos)
+	{
+		if (!ParseFramePattern(path, framePrefix, frameSuffix, frameDigits, frameZeroPadded))
+		{
+			std::cerr << "A PNG sequence path needs exactly one frame number such as %05d: " << path << std::endl;
+			return false;
+		}
+		format = CAPTURE_PNG;
+	}
+	else if (extension == ".y4m")
+	{
+		format = CAPTURE_Y4M;
+	}
+	else if (IsFfmpegAvailable())
+	{
+		format = CAPTURE_FFMPEG;
+	}
+	else
+	{
+		std::cerr << "ffmpeg was not found, writing raw Y4M video instead" << std::endl;
+		format = CAPTURE_Y4M;
+		outputPath = path + ".y4m";
+	}
+
+	if (format == CAPTURE_Y4M)
+	{
+		y4mFile.open(outputPath, std::ios::binary);
+		if (!y4mFile)
+		{
+			std::cerr << "Unable to open capture file: " << outputPath << std::endl;
+			return false;
+		}
+		// 4:2:0 chroma with JPEG siting and full range, which is what the RGB conversion below produces
+		y4mFile << "YUV4MPEG2 W" << width << " H" << height << " F" << framesPerSecond << ":1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n";
+	}
+	else if (format == CAPTURE_FFMPEG)
+	{
+		std::string quotedPath;
+		if (!QuoteShellArgument(outputPath, quotedPath))
+		{
+			std::cerr << "Unable to pass the capture path to ffmpeg: " << outputPath << std::endl;
+			return false;
+		}
+
+		std::string command = "ffmpeg -y -loglevel error -f rawvideo -pix_fmt rgba -s " +
+			std::to_string(width) + "x" + std::to_string(height) + " -r " + std::to_string(framesPerSecond) +
+			" -i - -vf vflip -pix_fmt yuv420p " + quotedPath;
+		ffmpegPipe = popen(command.c_str(), PIPE_WRITE_MODE);
+		if (ffmpegPipe == nullptr)
+		{
+			std::cerr << "Unable to start ffmpeg: " << command << std::endl;
+			return false;
+		}
+
+#ifndef _WIN32
+		// If ffmpeg exits early, writing to the pipe would kill the whole program instead of failing
+		previousPipeHandler = signal(SIGPIPE, SIG_IGN);
+#endif
+	}
+
+	// Each buffer holds one RGBA frame; GL_STREAM_READ tells the driver we read it back once
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+	{
+		pbos[i].Create("capture readback");
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+		pbos[i].SetSize((long long)width * height * 4);
+		pboFrames[i] = -1;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	pboIndex = 0;
+
+	encoder = std::thread(&FrameCapture::EncoderLoop, this);
+	active = true;
+
+	std::cout << "Capturing " << width << "x" << height << " at " << framesPerSecond << " fps to " << outputPath << std::endl;
+	return true;
+}
+
+void FrameCapture::CaptureFrame(GLuint framebuffer)
+{
+	if (!active)
+	{
+		return;
+	}
+	if (failed)
+	{
+		Stop();
+		return;
+	}
+
+	// The buffer we are about to reuse holds the oldest frame in the ring, so hand it over first
+	if (pboFrames[pboIndex] >= 0)
+	{
+		CollectBuffer(pboIndex);
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[pboIndex]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	// With a pixel pack buffer bound, the last argument is an offset into the buffer and the call returns right away
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	pboFrames[pboIndex] = frameIndex++;
+	pboIndex = (pboIndex + 1) % CAPTURE_PBO_COUNT;
+}
+
+void FrameCapture::CollectBuffer(int index)
+{
+	size_t frameSize = (size_t)width * height * 4;
+
+	CapturedFrame frame;
+	frame.index = pboFrames[index];
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		if (!freeBuffers.empty())
+		{
+			frame.pixels.swap(freeBuffers.back());
+			freeBuffers.pop_back();
+		}
+	}
+	frame.pixels.resize(frameSize);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[index]);
+	void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameSize, GL_MAP_READ_BIT);
+	if (mapped != nullptr)
+	{
+		memcpy(frame.pixels.data(), mapped, frameSize);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	pboFrames[index] = -1;
+
+	if (mapped == nullptr)
+	{
+		std::cerr << "Failed to map capture buffer for frame " << frame.index << std::endl;
+		return;
+	}
+
+	// Wait for the encoder if it falls too far behind, so no frame is ever dropped
+	std::unique_lock<std::mutex> lock(queueMutex);
+	queueChanged.wait(lock, [this]() { return queue.size() < CAPTURE_QUEUE_LIMIT; });
+	queue.push_back(std::move(frame));
+	queueChanged.notify_all();
+}
+
+void FrameCapture::Stop()
+{
+	if (!active)
+	{
+		return;
+	}
+
+	// Collect the frames still in flight, oldest first
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+	{
+		int index = (pboIndex + i) % CAPTURE_PBO_COUNT;
+		if (pboFrames[index] >= 0)
+		{
+			CollectBuffer(index);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueChanged.notify_all();
+	encoder.join();
+
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+	{
+		pbos[i].Reset();
+	}
+
+	if (ffmpegPipe != nullptr)
+	{
+		int status = pclose(ffmpegPipe);
+		ffmpegPipe = nullptr;
+#ifndef _WIN32
+		signal(SIGPIPE, previousPipeHandler);
+#endif
+		if (status != 0 && !failed)
+		{
+			std::cerr << "ffmpeg failed to write " << outputPath << std::endl;
+			failed = true;
+		}
+	}
+	if (y4mFile.is_open())
+	{
+		y4mFile.close();
+		if (!y4mFile && !failed)
+		{
+			std::cerr << "Unable to write capture file: " << outputPath << std::endl;
+			failed = true;
+		}
+	}
+
+	active = false;
+	if (failed)
+	{
+		std::cerr << "Capture stopped after " << framesWritten << " frames" << std::endl;
+		return;
+	}
+	std::cout << "Captured " << framesWritten << " frames to " << outputPath << std::endl;
+}
+
+void FrameCapture::EncoderLoop()
+{
+	// glReadPixels returns the bottom row first
+	stbi_flip_vertically_on_write(1);
+
+	while (true)
+	{
+		CapturedFrame frame;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueChanged.wait(lock, [this]() { return !queue.empty() || stopping; });
+			if (queue.empty())
+			{
+				return;
+			}
+			frame = std::move(queue.front());
+			queue.pop_front();
+		}
+		queueChanged.notify_all();
+
+		// After a failed write the frames are only drained, until the render thread stops the capture
+		if (!failed)
+		{
+			if (WriteFrame(frame))
+			{
+				framesWritten++;
+			}
+			else
+			{
+				failed = true;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(queueMutex);
+		freeBuffers.push_back(std::move(frame.pixels));
+	}
+}
+
+bool FrameCapture::WriteFrame(const CapturedFrame& frame)
+{
+	const unsigned char* pixels = frame.pixels.data();
+
+	if (format == CAPTURE_FFMPEG)
+	{
+		if (fwrite(pixels, 1, frame.pixels.size(), ffmpegPipe) != frame.pixels.size())
+		{
+			std::cerr << "ffmpeg stopped reading frames for " << outputPath << std::endl;
+			return false;
+		}
+	}
+	else if (format == CAPTURE_PNG)
+	{
+		std::string number = std::to_string(frame.index);
+		if ((int)number.size() < frameDigits)
+		{
+			number.insert(0, frameDigits - number.size(), frameZeroPadded ? '0' : ' ');
+		}
+		std::string fileName = framePrefix + number + frameSuffix;
+		if (!stbi_write_png(fileName.c_str(), width, height, 4, pixels, width * 4))
+		{
+			std::cerr << "Unable to write capture file: " << fileName << std::endl;
+			return false;
+		}
+	}
+	else
+	{
+		// Convert to full-range BT.601 YUV 4:2:0, flipping vertically on the way
+		int chromaWidth = (width + 1) / 2;
+		int chromaHeight = (height + 1) / 2;
+		std::vector<unsigned char> yPlane((size_t)width * height);
+		std::vector<unsigned char> uPlane((size_t)chromaWidth * chromaHeight);
+		std::vector<unsigned char> vPlane((size_t)chromaWidth * chromaHeight);
+
+		for (int y = 0; y < height; y++)
+		{
+			const unsigned char* row = pixels + (size_t)(height - 1 - y) * width * 4;
+			for (int x = 0; x < width; x++)
+			{
+				float r = row[x * 4 + 0];
+				float g = row[x * 4 + 1];
+				float b = row[x * 4 + 2];
+				yPlane[(size_t)y * width + x] = (unsigned char)std::min(255.f, 0.299f * r + 0.587f * g + 0.114f * b + 0.5f);
+			}
+		}
+
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			for (int x = 0; x < chromaWidth; x++)
+			{
+				// Average the 2x2 block of pixels that shares this chroma sample
+				float r = 0.f, g = 0.f, b = 0.f;
+				for (int dy = 0; dy < 2; dy++)
+				{
+					int sourceY = height - 1 - std::min(y * 2 + dy, height - 1);
+					for (int dx = 0; dx < 2; dx++)
+					{
+						const unsigned char* pixel = pixels + ((size_t)sourceY * width + std::min(x * 2 + dx, width - 1)) * 4;
+						r += pixel[0];
+						g += pixel[1];
+						b += pixel[2];
+					}
+				}
+				r *= 0.25f;
+				g *= 0.25f;
+				b *= 0.25f;
+
+				float u = -0.168736f * r - 0.331264f * g + 0.5f * b + 128.f;
+				float v = 0.5f * r - 0.418688f * g - 0.081312f * b + 128.f;
+				uPlane[(size_t)y * chromaWidth + x] = (unsigned char)std::max(0.f, std::min(255.f, u + 0.5f));
+				vPlane[(size_t)y * chromaWidth + x] = (unsigned char)std::max(0.f, std::min(255.f, v + 0.5f));
+			}
+		}
+
+		y4mFile << "FRAME\n";
+		y4mFile.write((const char*)yPlane.data(), yPlane.size());
+		y4mFile.write((const char*)uPlane.data(), uPlane.size());
+		y4mFile.write((const char*)vPlane.data(), vPlane.size());
+		if (!y4mFile)
+		{
+			std::cerr << "Unable to write capture file: " << outputPath << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,112 @@
+/**
+ * Asynchronous frame capture through a ring of pixel pack buffers and a background encoder thread.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Number of pixel pack buffers in the ring. A frame is mapped CAPTURE_PBO_COUNT - 1 frames after
+// it was read, by which time the GPU has long finished the copy and mapping does not stall.
+const int CAPTURE_PBO_COUNT = 3;
+
+// Maximum number of frames waiting for the encoder before the render loop waits for it
+const size_t CAPTURE_QUEUE_LIMIT = 8;
+
+/**
+ * Output formats that the encoder thread can write
+ */
+enum CaptureFormat
+{
+	CAPTURE_Y4M,		// Raw YUV 4:2:0 video in a single .y4m file
+	CAPTURE_PNG,		// One PNG per frame, the path holds one frame number such as "frames/%05d.png"
+	CAPTURE_FFMPEG		// Raw RGB piped into a local ffmpeg, which picks the codec from the file extension
+};
+
+/**
+ * Struct containing the pixels of one captured frame
+ */
+struct CapturedFrame
+{
+	long index;
+	std::vector<unsigned char> pixels;	// RGBA, bottom row first (as returned by glReadPixels)
+};
+
+/**
+ * Reads back every rendered frame without stalling the render loop. glReadPixels writes into a
+ * pixel pack buffer, which is only mapped a few frames later, copied, and handed to an encoder
+ * thread that converts and writes the frames to disk (or to ffmpeg).
+ */
+struct FrameCapture
+{
+	bool active;
+	int width, height, framesPerSecond;
+	CaptureFormat format;
+	std::string outputPath;
+	std::string framePrefix, frameSuffix;	// PNG sequence path around the frame number
+	int frameDigits;						// Fewest digits of the frame number
+	bool frameZeroPadded;
+
+	BufferHandle pbos[CAPTURE_PBO_COUNT];
+	long pboFrames[CAPTURE_PBO_COUNT];	// Frame index stored in each buffer, or -1 if it is empty
+	int pboIndex;
+	long frameIndex;
+	long framesWritten;
+
+	std::thread encoder;
+	std::mutex queueMutex;
+	std::condition_variable queueChanged;
+	std::deque<CapturedFrame> queue;
+	std::vector<std::vector<unsigned char>> freeBuffers;	// Recycled pixel buffers, guarded by queueMutex
+	bool stopping;
+	std::atomic<bool> failed;		// A frame could not be written; the capture stops at the next frame
+
+	FILE* ffmpegPipe;
+	void (*previousPipeHandler)(int);	// SIGPIPE handler to restore once ffmpeg is closed
+	std::ofstream y4mFile;
+
+	FrameCapture();
+	~FrameCapture();
+
+	/**
+	 * @brief Starts capturing. The format is picked from the output path: ".y4m" writes Y4M, a path
+	 * containing one frame number (e.g. "%05d") writes a PNG sequence, and any other extension is piped
+	 * to ffmpeg if it is installed (falling back to Y4M otherwise).
+	 * @param[in] path Output path
+	 * @param[in] frameWidth Width of the frames in pixels
+	 * @param[in] frameHeight Height of the frames in pixels
+	 * @param[in] fps Frame rate written into the video
+	 * @return True if the output could be opened
+	 */
+	bool Start(const std::string& path, int frameWidth, int frameHeight, int fps);
+
+	/**
+	 * @brief Queues a read of a framebuffer and passes the oldest finished read to the encoder thread.
+	 * Call this before swapping buffers. Stops the capture once a frame could not be written.
+	 * @param[in] framebuffer Framebuffer the frame was rendered into. The back buffer of a hidden window
+	 * fails the pixel ownership test, so its contents are undefined; an offscreen framebuffer is always safe.
+	 */
+	void CaptureFrame(GLuint framebuffer);
+
+	/**
+	 * @brief Reads back the frames still in flight, waits for the encoder to write everything and closes the output.
+	 */
+	void Stop();
+
+private:
+	void CollectBuffer(int index);
+	void EncoderLoop();
+	bool WriteFrame(const CapturedFrame& frame);
+};
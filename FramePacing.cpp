@@ -0,0 +1,152 @@
+/**
+ * Frame pacing: how far the CPU may run ahead of the GPU, vertical sync, the frame rate limit and input latency.
+ */
+
+#include "FramePacing.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+// How long a fence wait blocks before checking again, in nanoseconds
+const GLuint64 PACING_FENCE_TIMEOUT = 1000000;
+
+// The frame rate limit sleeps until this long before the frame starts and yields for the rest,
+// since a sleep can overshoot by about a scheduler tick
+const double PACING_SPIN_SECONDS = 0.002;
+
+// Weight of the newest frame in the averaged latency
+const float PACING_LATENCY_SMOOTHING = 0.1f;
+
+/**
+ * @brief Seconds on the clock the frame pacer measures with.
+ */
+static double FramePacingNow()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FramePacer::FramePacer()
+{
+	framesInFlight = 2;
+	frameLimitSeconds = 0.0;
+	vsync = VSYNC_ON;
+	for (int i = 0; i < FRAME_PACING_MAX_IN_FLIGHT; i++)
+	{
+		fences[i] = nullptr;
+		timestampQueries[i] = 0;
+		inputTimes[i] = 0.0;
+	}
+	slot = 0;
+	nextFrameTime = 0.0;
+	gpuClockOffset = 0.0;
+	latencyMs = 0.f;
+	waitMs = 0.f;
+}
+
+void FramePacer::Init(VsyncMode vsyncMode, int maxFramesInFlight, float maxFps)
+{
+	framesInFlight = std::min(std::max(maxFramesInFlight, 1), FRAME_PACING_MAX_IN_FLIGHT);
+	frameLimitSeconds = maxFps > 0.f ? 1.0 / maxFps : 0.0;
+
+	// A negative interval turns on adaptive sync, where the context supports it
+	vsync = vsyncMode;
+	if (vsync == VSYNC_ADAPTIVE && !glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+	{
+		std::cerr << "Adaptive vertical sync is not supported, using regular vertical sync" << std::endl;
+		vsync = VSYNC_ON;
+	}
+	glfwSwapInterval(vsync == VSYNC_OFF ? 0 : vsync == VSYNC_ON ? 1 : -1);
+
+	glGenQueries(FRAME_PACING_MAX_IN_FLIGHT, timestampQueries);
+}
+
+void FramePacer::BeginFrame()
+{
+	double waitStart = FramePacingNow();
+
+	// Latencies of frames that are already done, oldest first, then wait for the one whose slot is reused
+	for (int i = 1; i < framesInFlight; i++)
+	{
+		int frameSlot = (slot + i) % framesInFlight;
+		if (fences[frameSlot] != nullptr && glClientWaitSync(fences[frameSlot], 0, 0) != GL_TIMEOUT_EXPIRED)
+		{
+			FinishFrame(frameSlot);
+		}
+	}
+	if (fences[slot] != nullptr)
+	{
+		// The first wait flushes the commands, so the fence is guaranteed to signal eventually
+		GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		while (glClientWaitSync(fences[slot], flags, PACING_FENCE_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+		{
+			flags = 0;
+		}
+		FinishFrame(slot);
+	}
+
+	if (frameLimitSeconds > 0.0)
+	{
+		double now = FramePacingNow();
+		if (now < nextFrameTime - PACING_SPIN_SECONDS)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<double>(nextFrameTime - PACING_SPIN_SECONDS - now));
+		}
+		while (FramePacingNow() < nextFrameTime)
+		{
+			std::this_thread::yield();
+		}
+
+		// A frame that started late moves the schedule instead of the next frames rushing to catch up
+		nextFrameTime = std::max(nextFrameTime, FramePacingNow() - frameLimitSeconds) + frameLimitSeconds;
+	}
+
+	// The GPU clock drifts from the CPU clock, so the two are lined up again every frame
+	GLint64 gpuTime = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	double now = FramePacingNow();
+	gpuClockOffset = now - gpuTime * 1e-9;
+	waitMs = (float)((now - waitStart) * 1000.0);
+	inputTimes[slot] = now;
+}
+
+void FramePacer::InputSampled()
+{
+	inputTimes[slot] = FramePacingNow();
+}
+
+void FramePacer::EndFrame()
+{
+	glQueryCounter(timestampQueries[slot], GL_TIMESTAMP);
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot = (slot + 1) % framesInFlight;
+}
+
+void FramePacer::FinishFrame(int frameSlot)
+{
+	glDeleteSync(fences[frameSlot]);
+	fences[frameSlot] = nullptr;
+
+	// The timestamp was written before the fence, so it is available without waiting
+	GLuint64 presentTime = 0;
+	glGetQueryObjectui64v(timestampQueries[frameSlot], GL_QUERY_RESULT, &presentTime);
+	float frameLatencyMs = (float)((presentTime * 1e-9 + gpuClockOffset - inputTimes[frameSlot]) * 1000.0);
+	frameLatencyMs = std::max(frameLatencyMs, 0.f);
+	latencyMs = latencyMs == 0.f ? frameLatencyMs : latencyMs + (frameLatencyMs - latencyMs) * PACING_LATENCY_SMOOTHING;
+}
+
+void FramePacer::Destroy()
+{
+	for (int i = 0; i < FRAME_PACING_MAX_IN_FLIGHT; i++)
+	{
+		if (fences[i] != nullptr)
+		{
+			glDeleteSync(fences[i]);
+			fences[i] = nullptr;
+		}
+	}
+	glDeleteQueries(FRAME_PACING_MAX_IN_FLIGHT, timestampQueries);
+}
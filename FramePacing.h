@@ -0,0 +1,82 @@
+/**
+ * Frame pacing: how far the CPU may run ahead of the GPU, vertical sync, the frame rate limit and input latency.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+
+// Most frames that can be configured to be in flight at once
+const int FRAME_PACING_MAX_IN_FLIGHT = 4;
+
+/**
+ * How the buffer swap waits for the display
+ */
+enum VsyncMode
+{
+	VSYNC_OFF,			// Swap right away, tearing if the frame is not ready at the refresh
+	VSYNC_ON,			// Wait for the next refresh
+	VSYNC_ADAPTIVE		// Wait for the refresh, but swap right away (and tear) when a frame misses it
+};
+
+/**
+ * Keeps the input of a frame as fresh as possible. The driver would let the CPU queue several frames
+ * ahead of the GPU, each of them sampled the input long before it is shown, so a fence after every
+ * swap caps the frames in flight instead: BeginFrame waits until the frame framesInFlight frames back
+ * has finished, and an optional frame rate limit sleeps after that, so the input is sampled as late as
+ * possible and not before the wait.
+ *
+ * The latency is measured from the input sample to the GPU finishing the frame's swap, with a GPU
+ * timestamp written after the swap and converted to the CPU clock. It is read once the frame's fence
+ * has signaled, so measuring never stalls.
+ */
+struct FramePacer
+{
+	int framesInFlight;
+	double frameLimitSeconds;	// Shortest time between two frames, or 0 for no limit
+	VsyncMode vsync;			// Mode in effect, which is VSYNC_ON if adaptive sync was asked for but is not supported
+
+	GLsync fences[FRAME_PACING_MAX_IN_FLIGHT];
+	GLuint timestampQueries[FRAME_PACING_MAX_IN_FLIGHT];
+	double inputTimes[FRAME_PACING_MAX_IN_FLIGHT];	// When each frame sampled its input, in seconds of the CPU clock
+	int slot;					// Slot of the current frame
+
+	double nextFrameTime;		// When the frame rate limit lets the next frame start
+	double gpuClockOffset;		// CPU clock minus GPU clock, in seconds
+
+	float latencyMs;			// Input-to-present latency, averaged over the last frames
+	float waitMs;				// Time the last BeginFrame waited for the GPU and the frame rate limit
+
+	FramePacer();
+
+	/**
+	 * @brief Sets the swap interval and creates the timestamp queries.
+	 * @param[in] vsyncMode How the swap waits for the display
+	 * @param[in] maxFramesInFlight Frames the CPU may be ahead of the GPU, 1 for the lowest latency
+	 * @param[in] maxFps Frame rate limit, or 0 for none
+	 */
+	void Init(VsyncMode vsyncMode, int maxFramesInFlight, float maxFps);
+
+	/**
+	 * @brief Waits until a new frame may start. Call this before the input is sampled.
+	 */
+	void BeginFrame();
+
+	/**
+	 * @brief Marks the moment the input of the current frame was sampled.
+	 */
+	void InputSampled();
+
+	/**
+	 * @brief Fences the frame. Call this right after the buffers were swapped.
+	 */
+	void EndFrame();
+
+	/**
+	 * @brief Deletes the fences and queries.
+	 */
+	void Destroy();
+
+private:
+	void FinishFrame(int frameSlot);
+};
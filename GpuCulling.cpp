@@ -0,0 +1,422 @@
+/**
+ * GPU-driven culling: a compute shader picks the visible bodies and their level of detail and writes the indirect draw commands.
+ */
+
+#include "GpuCulling.h"
+
+#include <GLFW/glfw3.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Compute shaders, shader storage buffers and multi-draw-indirect are GL 4.3, so they are not part of the GL 3.3 loader
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+#define GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT 0x90DF
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+
+typedef void (APIENTRYP DispatchComputeProc)(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+typedef void (APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+typedef void (APIENTRYP MultiDrawArraysIndirectProc)(GLenum mode, const void* indirect, GLsizei drawCount, GLsizei stride);
+
+static DispatchComputeProc dispatchCompute = nullptr;
+static MemoryBarrierProc memoryBarrier = nullptr;
+static MultiDrawElementsIndirectProc multiDrawElementsIndirect = nullptr;
+static MultiDrawArraysIndirectProc multiDrawArraysIndirect = nullptr;
+
+// Threads per work group, has to match local_size_x in cull.csh
+const int CULL_GROUP_SIZE = 64;
+
+// Passes of cull.csh
+const int CULL_PASS_COUNT = 0;
+const int CULL_PASS_SCAN = 1;
+const int CULL_PASS_WRITE = 2;
+
+// Floats per instance as cull.csh writes them: the layout of MeshInstance and ImpostorInstance in Main.cpp
+const int MESH_INSTANCE_FLOATS = 17;
+const int IMPOSTOR_INSTANCE_FLOATS = 21;
+
+bool IsGpuCullingSupported()
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	return major > 4 || (major == 4 && minor >= 3);
+}
+
+/**
+ * @brief Extracts the six planes of the view frustum (Gribb and Hartmann), normalized so that the
+ * distance of a point to a plane is dot(plane.xyz, point) + plane.w.
+ * @param[in] viewProjection Projection matrix times view matrix
+ * @param[out] planes Left, right, bottom, top, near and far plane, facing inwards
+ */
+static void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; row++)
+	{
+		rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		planes[axis * 2] = rows[3] + rows[axis];
+		planes[axis * 2 + 1] = rows[3] - rows[axis];
+	}
+	for (int i = 0; i < 6; i++)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+GpuCulling::GpuCulling()
+{
+	program = 0;
+	bodyCount = 0;
+	groupCount = 0;
+	fadeStart = 0.f;
+	fadeEnd = 0.f;
+	storageAlignment = 256;
+	viewCount = 1;
+	meshCommandStride = 0;
+	impostorCommandStride = 0;
+	counterStride = 0;
+	for (int i = 0; i < GPU_CULL_READBACK_FRAMES; i++)
+	{
+		readbackFences[i] = nullptr;
+	}
+	readbackFrame = 0;
+	meshesDrawn = 0;
+	impostorsDrawn = 0;
+}
+
+/**
+ * @brief Rounds a size up to a multiple of an alignment.
+ */
+static GLsizeiptr AlignSize(GLsizeiptr size, GLsizeiptr alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+bool GpuCulling::Init(GLuint cullShader, const std::vector<int>& bodyGroups, int groups, const std::vector<MeshLod>& meshLods, float impostorFadeStart, float impostorFadeEnd, int views)
+{
+	dispatchCompute = (DispatchComputeProc)glfwGetProcAddress("glDispatchCompute");
+	memoryBarrier = (MemoryBarrierProc)glfwGetProcAddress("glMemoryBarrier");
+	multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)glfwGetProcAddress("glMultiDrawElementsIndirect");
+	multiDrawArraysIndirect = (MultiDrawArraysIndirectProc)glfwGetProcAddress("glMultiDrawArraysIndirect");
+	if (dispatchCompute == nullptr || memoryBarrier == nullptr || multiDrawElementsIndirect == nullptr || multiDrawArraysIndirect == nullptr)
+	{
+		std::cerr << "Failed to load the GL 4.3 functions of the GPU culling" << std::endl;
+		return false;
+	}
+
+	program = cullShader;
+	bodyCount = (int)bodyGroups.size();
+	groupCount = groups;
+	lods.assign(meshLods.begin(), meshLods.begin() + std::min((int)meshLods.size(), GPU_CULL_MAX_LODS));
+	fadeStart = impostorFadeStart;
+	fadeEnd = impostorFadeEnd;
+	viewCount = std::max(views, 1);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+
+	std::vector<GLuint> groupsOfBodies(bodyGroups.begin(), bodyGroups.end());
+	bodyGroupBuffer.Create("body groups");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyGroupBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, groupsOfBodies.size() * sizeof(GLuint), groupsOfBodies.data(), GL_STATIC_DRAW);
+	bodyGroupBuffer.SetSize(groupsOfBodies.size() * sizeof(GLuint));
+
+	// Every group has a command per level of detail, all over the same vertex and index buffers
+	meshCommands.resize(groupCount * lods.size());
+	for (int group = 0; group < groupCount; group++)
+	{
+		for (size_t lod = 0; lod < lods.size(); lod++)
+		{
+			DrawElementsIndirectCommand& command = meshCommands[group * lods.size() + lod];
+			command.count = lods[lod].indexCount;
+			command.instanceCount = 0;
+			command.firstIndex = lods[lod].firstIndex;
+			command.baseVertex = lods[lod].baseVertex;
+			command.baseInstance = 0;
+		}
+	}
+
+	impostorCommands.resize(groupCount);
+	for (DrawArraysIndirectCommand& command : impostorCommands)
+	{
+		command.count = 4;
+		command.instanceCount = 0;
+		command.first = 0;
+		command.baseInstance = 0;
+	}
+
+	counters.assign(meshCommands.size() + impostorCommands.size() + groupCount, 0);
+	groupPixelRadii.assign(groupCount, 0.f);
+
+	GLsizeiptr meshCommandBytes = meshCommands.size() * sizeof(DrawElementsIndirectCommand);
+	GLsizeiptr impostorCommandBytes = impostorCommands.size() * sizeof(DrawArraysIndirectCommand);
+	GLsizeiptr counterBytes = counters.size() * sizeof(GLuint);
+
+	// The regions of the views are bound as storage buffers, so each starts at a multiple of the alignment
+	meshCommandStride = AlignSize(meshCommandBytes, storageAlignment);
+	impostorCommandStride = AlignSize(impostorCommandBytes, storageAlignment);
+	counterStride = AlignSize(counterBytes, storageAlignment);
+
+	meshCommandBuffer.Create("mesh draw commands");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, meshCommandStride * viewCount, nullptr, GL_DYNAMIC_DRAW);
+	meshCommandBuffer.SetSize(meshCommandStride * viewCount);
+
+	impostorCommandBuffer.Create("impostor draw commands");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, impostorCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, impostorCommandStride * viewCount, nullptr, GL_DYNAMIC_DRAW);
+	impostorCommandBuffer.SetSize(impostorCommandStride * viewCount);
+
+	counterBuffer.Create("culling counters");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, counterStride * viewCount, nullptr, GL_DYNAMIC_DRAW);
+	counterBuffer.SetSize(counterStride * viewCount);
+
+	// Never changes, so resetting a view is a copy that stays on the GPU
+	GLsizeiptr resetBytes = meshCommandBytes + impostorCommandBytes + counterBytes;
+	resetBuffer.Create("culling reset");
+	glBindBuffer(GL_COPY_WRITE_BUFFER, resetBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, resetBytes, nullptr, GL_STATIC_DRAW);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, meshCommandBytes, meshCommands.data());
+	glBufferSubData(GL_COPY_WRITE_BUFFER, meshCommandBytes, impostorCommandBytes, impostorCommands.data());
+	glBufferSubData(GL_COPY_WRITE_BUFFER, meshCommandBytes + impostorCommandBytes, counterBytes, counters.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	resetBuffer.SetSize(resetBytes);
+
+	// Room for every body as both a mesh and an impostor, which is what the crossfade can need
+	GLsizeiptr meshInstanceBytes = (GLsizeiptr)std::max(bodyCount, 1) * MESH_INSTANCE_FLOATS * sizeof(GLfloat);
+	meshInstanceBuffer.Create("culled mesh instances");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshInstanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, meshInstanceBytes, nullptr, GL_DYNAMIC_COPY);
+	meshInstanceBuffer.SetSize(meshInstanceBytes);
+
+	GLsizeiptr impostorInstanceBytes = (GLsizeiptr)std::max(bodyCount, 1) * IMPOSTOR_INSTANCE_FLOATS * sizeof(GLfloat);
+	impostorInstanceBuffer.Create("culled impostor instances");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, impostorInstanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, impostorInstanceBytes, nullptr, GL_DYNAMIC_COPY);
+	impostorInstanceBuffer.SetSize(impostorInstanceBytes);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	for (int i = 0; i < GPU_CULL_READBACK_FRAMES; i++)
+	{
+		GLsizeiptr readbackBytes = meshCommandBytes + impostorCommandBytes + counterBytes;
+		readbackBuffers[i].Create("culling readback");
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[i]);
+		glBufferData(GL_COPY_WRITE_BUFFER, readbackBytes, nullptr, GL_STREAM_READ);
+		readbackBuffers[i].SetSize(readbackBytes);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	return true;
+}
+
+void GpuCulling::Cull(int view, GLuint bodyBuffer, GLintptr bodyOffset, const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, glm::vec3 eye, int renderHeight)
+{
+	GLsizeiptr meshCommandBytes = meshCommands.size() * sizeof(DrawElementsIndirectCommand);
+	GLsizeiptr impostorCommandBytes = impostorCommands.size() * sizeof(DrawArraysIndirectCommand);
+	GLsizeiptr counterBytes = counters.size() * sizeof(GLuint);
+
+	// Start from commands without instances and cleared counters. The view's region was last read by its
+	// draws of the previous frame, and the copy never goes through the CPU, so nothing waits for it.
+	glBindBuffer(GL_COPY_READ_BUFFER, resetBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, meshCommandBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, view * meshCommandStride, meshCommandBytes);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, impostorCommandBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, meshCommandBytes, view * impostorCommandStride, impostorCommandBytes);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, counterBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, meshCommandBytes + impostorCommandBytes, view * counterStride, counterBytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bodyBuffer, bodyOffset, bodyCount * sizeof(glm::vec4));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bodyGroupBuffer);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, meshCommandBuffer, view * meshCommandStride, meshCommandBytes);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, impostorCommandBuffer, view * impostorCommandStride, impostorCommandBytes);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, counterBuffer, view * counterStride, counterBytes);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, meshInstanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, impostorInstanceBuffer);
+
+	glm::vec4 planes[6];
+	ExtractFrustumPlanes(projectionMatrix * viewMatrix, planes);
+
+	float lodMinPixels[GPU_CULL_MAX_LODS];
+	for (size_t lod = 0; lod < lods.size(); lod++)
+	{
+		lodMinPixels[lod] = lods[lod].minPixelRadius;
+	}
+
+	glUseProgram(program);
+	glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, glm::value_ptr(planes[0]));
+	glUniform3fv(glGetUniformLocation(program, "eye"), 1, glm::value_ptr(eye));
+	glUniform1f(glGetUniformLocation(program, "pixelScale"), projectionMatrix[1][1] * renderHeight * 0.5f);
+	glUniform1f(glGetUniformLocation(program, "fullscreenRadius"), (float)renderHeight);
+	glUniform1f(glGetUniformLocation(program, "fadeStart"), fadeStart);
+	glUniform1f(glGetUniformLocation(program, "fadeEnd"), fadeEnd);
+	glUniform1fv(glGetUniformLocation(program, "lodMinPixels"), (GLsizei)lods.size(), lodMinPixels);
+	glUniform1i(glGetUniformLocation(program, "lodCount"), (GLint)lods.size());
+	glUniform1i(glGetUniformLocation(program, "groupCount"), groupCount);
+	glUniform1ui(glGetUniformLocation(program, "bodyCount"), (GLuint)bodyCount);
+	GLint passUniform = glGetUniformLocation(program, "pass");
+
+	GLuint bodyGroups = (GLuint)((bodyCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE);
+
+	glUniform1i(passUniform, CULL_PASS_COUNT);
+	dispatchCompute(bodyGroups, 1, 1);
+	memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUniform1i(passUniform, CULL_PASS_SCAN);
+	dispatchCompute(1, 1, 1);
+	memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUniform1i(passUniform, CULL_PASS_WRITE);
+	dispatchCompute(bodyGroups, 1, 1);
+
+	// The commands are read by the draw calls, the instances as vertex attributes and the counters by the readback copy
+	memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	for (GLuint binding = 0; binding <= 6; binding++)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+	}
+}
+
+void GpuCulling::DrawMeshes(int view, int group)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, meshCommandBuffer);
+	GLintptr offset = view * meshCommandStride + group * lods.size() * sizeof(DrawElementsIndirectCommand);
+	multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, (GLsizei)lods.size(), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GpuCulling::DrawImpostors(int view, int group)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, impostorCommandBuffer);
+	GLintptr offset = view * impostorCommandStride + group * sizeof(DrawArraysIndirectCommand);
+	multiDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)offset, 1, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GpuCulling::EndFrame()
+{
+	int frame = readbackFrame % GPU_CULL_READBACK_FRAMES;
+	if (readbackFences[frame] != nullptr)
+	{
+		// The results of that frame never came back in time; they are overwritten
+		glDeleteSync(readbackFences[frame]);
+		readbackFences[frame] = nullptr;
+	}
+
+	GLsizeiptr meshCommandBytes = meshCommands.size() * sizeof(DrawElementsIndirectCommand);
+	GLsizeiptr impostorCommandBytes = impostorCommands.size() * sizeof(DrawArraysIndirectCommand);
+	GLsizeiptr counterBytes = counters.size() * sizeof(GLuint);
+
+	// The first view's region starts at 0 in every buffer
+	glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[frame]);
+	glBindBuffer(GL_COPY_READ_BUFFER, meshCommandBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, meshCommandBytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, impostorCommandBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, meshCommandBytes, impostorCommandBytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, counterBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, meshCommandBytes + impostorCommandBytes, counterBytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	readbackFences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readbackFrame++;
+}
+
+void GpuCulling::ReadBack()
+{
+	// Oldest frame first, so the results never go back in time
+	int newest = -1;
+	for (int age = GPU_CULL_READBACK_FRAMES; age >= 1; age--)
+	{
+		int frame = (readbackFrame - age + GPU_CULL_READBACK_FRAMES) % GPU_CULL_READBACK_FRAMES;
+		if (readbackFences[frame] == nullptr || glClientWaitSync(readbackFences[frame], 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			continue;
+		}
+		glDeleteSync(readbackFences[frame]);
+		readbackFences[frame] = nullptr;
+		newest = frame;
+	}
+	if (newest < 0)
+	{
+		return;
+	}
+
+	std::vector<DrawElementsIndirectCommand> drawnMeshes(meshCommands.size());
+	std::vector<DrawArraysIndirectCommand> drawnImpostors(impostorCommands.size());
+	std::vector<GLuint> drawnCounters(counters.size());
+	GLsizeiptr meshCommandBytes = drawnMeshes.size() * sizeof(DrawElementsIndirectCommand);
+	GLsizeiptr impostorCommandBytes = drawnImpostors.size() * sizeof(DrawArraysIndirectCommand);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffers[newest]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, meshCommandBytes, drawnMeshes.data());
+	glGetBufferSubData(GL_COPY_READ_BUFFER, meshCommandBytes, impostorCommandBytes, drawnImpostors.data());
+	glGetBufferSubData(GL_COPY_READ_BUFFER, meshCommandBytes + impostorCommandBytes, drawnCounters.size() * sizeof(GLuint), drawnCounters.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	meshesDrawn = 0;
+	for (const DrawElementsIndirectCommand& command : drawnMeshes)
+	{
+		meshesDrawn += command.instanceCount;
+	}
+	impostorsDrawn = 0;
+	for (const DrawArraysIndirectCommand& command : drawnImpostors)
+	{
+		impostorsDrawn += command.instanceCount;
+	}
+
+	// The pixel radii are stored as the bits of the float, which compare like unsigned integers for positive values
+	const GLuint* radii = &drawnCounters[drawnMeshes.size() + drawnImpostors.size()];
+	for (int group = 0; group < groupCount; group++)
+	{
+		std::memcpy(&groupPixelRadii[group], &radii[group], sizeof(float));
+	}
+}
+
+void GpuCulling::Destroy()
+{
+	for (int i = 0; i < GPU_CULL_READBACK_FRAMES; i++)
+	{
+		if (readbackFences[i] != nullptr)
+		{
+			glDeleteSync(readbackFences[i]);
+			readbackFences[i] = nullptr;
+		}
+		readbackBuffers[i].Reset();
+	}
+	bodyGroupBuffer.Reset();
+	meshCommandBuffer.Reset();
+	impostorCommandBuffer.Reset();
+	counterBuffer.Reset();
+	resetBuffer.Reset();
+	meshInstanceBuffer.Reset();
+	impostorInstanceBuffer.Reset();
+}
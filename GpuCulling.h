@@ -0,0 +1,169 @@
+/**
+ * GPU-driven culling: a compute shader picks the visible bodies and their level of detail and writes the indirect draw commands.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+
+// Most levels of detail of the sphere mesh, see cull.csh
+const int GPU_CULL_MAX_LODS = 4;
+
+// Frames the results of the culling take to come back to the CPU; a readback buffer per frame in between
+const int GPU_CULL_READBACK_FRAMES = 3;
+
+/**
+ * Struct containing one command of glMultiDrawElementsIndirect, as laid out by GL
+ */
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+/**
+ * Struct containing one command of glMultiDrawArraysIndirect, as laid out by GL
+ */
+struct DrawArraysIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint first;
+	GLuint baseInstance;
+};
+
+/**
+ * Struct containing where one level of detail of the sphere mesh is in the shared vertex and index buffers
+ */
+struct MeshLod
+{
+	GLuint indexCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	float minPixelRadius;	// Smallest projected radius the level is used for
+};
+
+/**
+ * The bodies' bounding spheres are uploaded every frame and a compute shader does the rest in
+ * three passes: it counts the visible bodies of every (texture, level of detail) draw command,
+ * turns the counts into where each command's instances start, then writes the mesh and impostor
+ * instances there. The commands are drawn with one glMultiDrawElementsIndirect per texture (plus
+ * one glMultiDrawArraysIndirect for the impostors), so the CPU cost of a frame no longer depends on
+ * how many bodies there are. What was drawn comes back a few frames late through readback
+ * buffers, for the stats and the texture streaming.
+ *
+ * Every view has its own region of the command and counter buffers, reset by a copy on the GPU, so culling
+ * a view never rewrites what the previous view's draws are still reading.
+ */
+struct GpuCulling
+{
+	GLuint program;
+	int bodyCount;
+	int groupCount;
+	std::vector<MeshLod> lods;
+	float fadeStart, fadeEnd;		// Projected radii of the impostor crossfade, see ComputeMeshFade
+	GLint storageAlignment;			// Alignment of the body spheres' offset in their buffer
+	int viewCount;
+
+	// Bytes from one view's region to the next, a multiple of storageAlignment
+	GLsizeiptr meshCommandStride, impostorCommandStride, counterStride;
+
+	BufferHandle bodyGroupBuffer;		// Texture group of every body
+	BufferHandle meshCommandBuffer;		// Per view: groupCount * LOD count commands, by group then LOD
+	BufferHandle impostorCommandBuffer;	// Per view: one command per group
+	BufferHandle counterBuffer;			// Per view: write cursor of every command, then the largest pixel radius of every group
+	BufferHandle resetBuffer;			// Commands without instances, then cleared counters; copied over a view's region
+	BufferHandle meshInstanceBuffer;
+	BufferHandle impostorInstanceBuffer;
+	BufferHandle readbackBuffers[GPU_CULL_READBACK_FRAMES];
+	GLsync readbackFences[GPU_CULL_READBACK_FRAMES];
+	int readbackFrame;
+
+	// Commands as they are before the culling (no instances), and the counters cleared
+	std::vector<DrawElementsIndirectCommand> meshCommands;
+	std::vector<DrawArraysIndirectCommand> impostorCommands;
+	std::vector<GLuint> counters;
+
+	// What the newest frame that came back drew
+	int meshesDrawn;
+	int impostorsDrawn;
+	std::vector<float> groupPixelRadii;	// Largest visible body of every group, in pixels
+
+	GpuCulling();
+
+	/**
+	 * @brief Creates the buffers and loads the GL 4.3 functions. Check IsGpuCullingSupported first.
+	 * @param[in] cullShader Compute program that does the culling (cull.csh)
+	 * @param[in] bodyGroups Texture group of every body
+	 * @param[in] groups Number of texture groups
+	 * @param[in] meshLods Levels of detail of the sphere mesh, from the most detailed
+	 * @param[in] impostorFadeStart Projected radius below which a body starts fading into its impostor
+	 * @param[in] impostorFadeEnd Projected radius below which only the impostor is drawn
+	 * @param[in] views Number of views culled every frame
+	 * @return False if the functions could not be loaded
+	 */
+	bool Init(GLuint cullShader, const std::vector<int>& bodyGroups, int groups, const std::vector<MeshLod>& meshLods, float impostorFadeStart, float impostorFadeEnd, int views);
+
+	/**
+	 * @brief Runs the culling of one view for this frame. The instances of the previous view are overwritten,
+	 * so its draws have to be submitted first.
+	 * @param[in] view Index of the view, whose region of the command and counter buffers is used
+	 * @param[in] bodyBuffer Buffer with the bounding sphere (center, radius) of every body
+	 * @param[in] bodyOffset Offset of the first sphere, a multiple of storageAlignment
+	 * @param[in] projectionMatrix Projection matrix used for rendering
+	 * @param[in] viewMatrix View matrix used for rendering
+	 * @param[in] eye Camera position
+	 * @param[in] renderHeight Height of the render target in pixels
+	 */
+	void Cull(int view, GLuint bodyBuffer, GLintptr bodyOffset, const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, glm::vec3 eye, int renderHeight);
+
+	/**
+	 * @brief Draws the mesh instances of one texture group, every level of detail in one call. The sphere
+	 * mesh VAO has to be bound, with its instance attributes pointing at meshInstanceBuffer.
+	 * @param[in] view Index of the view that was culled
+	 * @param[in] group Texture group
+	 */
+	void DrawMeshes(int view, int group);
+
+	/**
+	 * @brief Draws the impostors of one texture group. The impostor VAO has to be bound, with its
+	 * instance attributes pointing at impostorInstanceBuffer.
+	 * @param[in] view Index of the view that was culled
+	 * @param[in] group Texture group
+	 */
+	void DrawImpostors(int view, int group);
+
+	/**
+	 * @brief Copies this frame's commands and counters of the first view into a readback buffer, after its draw calls.
+	 */
+	void EndFrame();
+
+	/**
+	 * @brief Takes the results of the oldest frame in flight if the GPU is done with it. Does not wait,
+	 * so the previous results stay until then.
+	 */
+	void ReadBack();
+
+	/**
+	 * @brief Deletes the buffers.
+	 */
+	void Destroy();
+};
+
+/**
+ * @brief Checks whether the context can run the GPU culling, i.e. is at least GL 4.3
+ * (compute shaders, shader storage buffers and multi-draw-indirect).
+ */
+bool IsGpuCullingSupported();
@@ -0,0 +1,175 @@
+/**
+ * Owning handles for GL objects and a registry that counts them and the GPU memory behind them.
+ */
+
+#include "GpuResources.h"
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+/**
+ * Struct containing what the registry knows about one live object
+ */
+struct GpuResourceRecord
+{
+	std::string label;
+	long long bytes;
+};
+
+// Names are only unique per kind of object, so the key holds both
+static std::unordered_map<uint64_t, GpuResourceRecord> records;
+static GpuMemoryStats stats = {};
+
+static const char* const TYPE_NAMES[GPU_RESOURCE_TYPE_COUNT] = {
+	"buffer", "texture", "vertex array", "program", "framebuffer", "renderbuffer"
+};
+
+static uint64_t RecordKey(GpuResourceType type, GLuint name)
+{
+	return ((uint64_t)type << 32) | name;
+}
+
+static double Megabytes(long long bytes)
+{
+	return bytes / (1024.0 * 1024.0);
+}
+
+GLuint CreateGpuResource(GpuResourceType type, const std::string& label)
+{
+	GLuint name = 0;
+	switch (type)
+	{
+	case GPU_BUFFER:
+		glGenBuffers(1, &name);
+		break;
+	case GPU_TEXTURE:
+		glGenTextures(1, &name);
+		break;
+	case GPU_VERTEX_ARRAY:
+		glGenVertexArrays(1, &name);
+		break;
+	case GPU_PROGRAM:
+		name = glCreateProgram();
+		break;
+	case GPU_FRAMEBUFFER:
+		glGenFramebuffers(1, &name);
+		break;
+	case GPU_RENDERBUFFER:
+		glGenRenderbuffers(1, &name);
+		break;
+	default:
+		break;
+	}
+
+	TrackGpuResource(type, name, label);
+	return name;
+}
+
+void TrackGpuResource(GpuResourceType type, GLuint name, const std::string& label)
+{
+	if (name == 0)
+	{
+		return;
+	}
+
+	GpuResourceRecord record;
+	record.label = label;
+	record.bytes = 0;
+	if (records.emplace(RecordKey(type, name), record).second)
+	{
+		stats.liveCount[type]++;
+	}
+}
+
+void SetGpuResourceSize(GpuResourceType type, GLuint name, long long bytes)
+{
+	std::unordered_map<uint64_t, GpuResourceRecord>::iterator found = records.find(RecordKey(type, name));
+	if (found == records.end())
+	{
+		return;
+	}
+
+	long long change = bytes - found->second.bytes;
+	found->second.bytes = bytes;
+	stats.bytes[type] += change;
+	stats.totalBytes += change;
+	if (stats.totalBytes > stats.peakBytes)
+	{
+		stats.peakBytes = stats.totalBytes;
+	}
+}
+
+void DeleteGpuResource(GpuResourceType type, GLuint name)
+{
+	std::unordered_map<uint64_t, GpuResourceRecord>::iterator found = records.find(RecordKey(type, name));
+	if (found != records.end())
+	{
+		stats.bytes[type] -= found->second.bytes;
+		stats.totalBytes -= found->second.bytes;
+		stats.liveCount[type]--;
+		records.erase(found);
+	}
+
+	if (glfwGetCurrentContext() == nullptr)
+	{
+		return;
+	}
+
+	switch (type)
+	{
+	case GPU_BUFFER:
+		glDeleteBuffers(1, &name);
+		break;
+	case GPU_TEXTURE:
+		glDeleteTextures(1, &name);
+		break;
+	case GPU_VERTEX_ARRAY:
+		glDeleteVertexArrays(1, &name);
+		break;
+	case GPU_PROGRAM:
+		glDeleteProgram(name);
+		break;
+	case GPU_FRAMEBUFFER:
+		glDeleteFramebuffers(1, &name);
+		break;
+	case GPU_RENDERBUFFER:
+		glDeleteRenderbuffers(1, &name);
+		break;
+	default:
+		break;
+	}
+}
+
+GpuMemoryStats GetGpuMemoryStats()
+{
+	return stats;
+}
+
+void ReportGpuResources()
+{
+	std::cout << "GPU memory peak: " << Megabytes(stats.peakBytes) << " MB" << std::endl;
+
+	if (records.empty())
+	{
+		std::cout << "GPU resources: all released" << std::endl;
+		return;
+	}
+
+	for (int type = 0; type < GPU_RESOURCE_TYPE_COUNT; type++)
+	{
+		if (stats.liveCount[type] > 0)
+		{
+			std::cerr << "Leaked " << stats.liveCount[type] << " " << TYPE_NAMES[type] << "(s), "
+				<< Megabytes(stats.bytes[type]) << " MB" << std::endl;
+		}
+	}
+	for (const std::pair<const uint64_t, GpuResourceRecord>& entry : records)
+	{
+		std::cerr << "  " << TYPE_NAMES[entry.first >> 32] << " " << (GLuint)entry.first << " (" << entry.second.label
+			<< "), " << entry.second.bytes << " bytes" << std::endl;
+	}
+}
@@ -0,0 +1,174 @@
+/**
+ * Owning handles for GL objects and a registry that counts them and the GPU memory behind them.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+
+/**
+ * Kinds of GL objects the registry keeps apart
+ */
+enum GpuResourceType
+{
+	GPU_BUFFER,
+	GPU_TEXTURE,
+	GPU_VERTEX_ARRAY,
+	GPU_PROGRAM,
+	GPU_FRAMEBUFFER,
+	GPU_RENDERBUFFER,
+	GPU_RESOURCE_TYPE_COUNT
+};
+
+/**
+ * Struct containing the live objects and memory of every kind of GL object
+ */
+struct GpuMemoryStats
+{
+	int liveCount[GPU_RESOURCE_TYPE_COUNT];
+	long long bytes[GPU_RESOURCE_TYPE_COUNT];
+	long long totalBytes;
+	long long peakBytes;	// Highest totalBytes since the start
+};
+
+/**
+ * @brief Generates a GL object and starts tracking it.
+ * @param[in] type Kind of object
+ * @param[in] label Name shown in the reports, e.g. the file a texture was loaded from
+ * @return Name of the new object
+ */
+GLuint CreateGpuResource(GpuResourceType type, const std::string& label);
+
+/**
+ * @brief Starts tracking a GL object that was created elsewhere (e.g. a linked shader program).
+ * @param[in] type Kind of object
+ * @param[in] name Name of the object, ignored if 0
+ * @param[in] label Name shown in the reports
+ */
+void TrackGpuResource(GpuResourceType type, GLuint name, const std::string& label);
+
+/**
+ * @brief Records how much memory the storage of an object takes, replacing the previous size.
+ * GL does not report this, so it is the size that was asked for (width * height * bytes per texel, buffer size).
+ * @param[in] type Kind of object
+ * @param[in] name Name of the object
+ * @param[in] bytes Size of the storage in bytes
+ */
+void SetGpuResourceSize(GpuResourceType type, GLuint name, long long bytes);
+
+/**
+ * @brief Stops tracking a GL object and deletes it. If the context is already gone (e.g. after
+ * glfwTerminate on an error path), the object went with it and only the tracking is dropped.
+ * @param[in] type Kind of object
+ * @param[in] name Name of the object
+ */
+void DeleteGpuResource(GpuResourceType type, GLuint name);
+
+/**
+ * @brief Returns the current counters. Cheap enough to call every frame.
+ */
+GpuMemoryStats GetGpuMemoryStats();
+
+/**
+ * @brief Prints the peak memory and every object that is still alive. Called at shutdown,
+ * after everything was deleted, so anything it lists is a leak.
+ */
+void ReportGpuResources();
+
+/**
+ * Owns one GL object: deleted when the handle is reset, destroyed or assigned another object.
+ * Handles can be moved but not copied, so there is always exactly one owner. Converts to GLuint,
+ * so it can be passed to GL calls as is. All calls have to come from the thread with the GL context.
+ */
+template <GpuResourceType TYPE>
+struct GpuHandle
+{
+	GLuint name;
+
+	GpuHandle()
+	{
+		name = 0;
+	}
+
+	~GpuHandle()
+	{
+		Reset();
+	}
+
+	GpuHandle(const GpuHandle&) = delete;
+	GpuHandle& operator=(const GpuHandle&) = delete;
+
+	GpuHandle(GpuHandle&& other)
+	{
+		name = other.name;
+		other.name = 0;
+	}
+
+	GpuHandle& operator=(GpuHandle&& other)
+	{
+		if (this != &other)
+		{
+			Reset();
+			name = other.name;
+			other.name = 0;
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Generates a new object, deleting the one held before.
+	 * @param[in] label Name shown in the reports
+	 */
+	void Create(const std::string& label)
+	{
+		Reset();
+		name = CreateGpuResource(TYPE, label);
+	}
+
+	/**
+	 * @brief Takes ownership of an object that was created elsewhere, deleting the one held before.
+	 * @param[in] existing Name of the object
+	 * @param[in] label Name shown in the reports
+	 */
+	void Adopt(GLuint existing, const std::string& label)
+	{
+		Reset();
+		name = existing;
+		TrackGpuResource(TYPE, name, label);
+	}
+
+	/**
+	 * @brief Records the size of the storage that was just allocated for the object.
+	 * @param[in] bytes Size in bytes
+	 */
+	void SetSize(long long bytes)
+	{
+		SetGpuResourceSize(TYPE, name, bytes);
+	}
+
+	/**
+	 * @brief Deletes the object, if there is one.
+	 */
+	void Reset()
+	{
+		if (name != 0)
+		{
+			DeleteGpuResource(TYPE, name);
+			name = 0;
+		}
+	}
+
+	operator GLuint() const
+	{
+		return name;
+	}
+};
+
+typedef GpuHandle<GPU_BUFFER> BufferHandle;
+typedef GpuHandle<GPU_TEXTURE> TextureHandle;
+typedef GpuHandle<GPU_VERTEX_ARRAY> VertexArrayHandle;
+typedef GpuHandle<GPU_PROGRAM> ProgramHandle;
+typedef GpuHandle<GPU_FRAMEBUFFER> FramebufferHandle;
+typedef GpuHandle<GPU_RENDERBUFFER> RenderbufferHandle;
@@ -0,0 +1,246 @@
+/**
+ * Event-driven keyboard and cursor input, mapped to actions through a table of key bindings.
+ */
+
+#include "Input.h"
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include <cstddef>
+
+ActionMap::ActionMap()
+{
+	slotOfKey.assign(GLFW_KEY_LAST + 1, -1);
+	slotOfMouseButton.assign(GLFW_MOUSE_BUTTON_LAST + 1, -1);
+}
+
+bool ActionMap::Bind(int key, Action action, int body)
+{
+	if (key < 0 || key > GLFW_KEY_LAST || slotOfKey[key] >= 0 || (int)bindings.size() >= MAX_ACTION_SLOTS)
+	{
+		return false;
+	}
+
+	ActionBinding binding;
+	binding.key = key;
+	binding.mouseButton = false;
+	binding.action = action;
+	binding.body = body;
+
+	slotOfKey[key] = (int)bindings.size();
+	bindings.push_back(binding);
+	return true;
+}
+
+bool ActionMap::BindMouseButton(int button, Action action)
+{
+	if (button < 0 || button > GLFW_MOUSE_BUTTON_LAST || slotOfMouseButton[button] >= 0 || (int)bindings.size() >= MAX_ACTION_SLOTS)
+	{
+		return false;
+	}
+
+	ActionBinding binding;
+	binding.key = button;
+	binding.mouseButton = true;
+	binding.action = action;
+	binding.body = -1;
+
+	slotOfMouseButton[button] = (int)bindings.size();
+	bindings.push_back(binding);
+	return true;
+}
+
+void ActionMap::BindDefaults(int bodyCount)
+{
+	Bind(GLFW_KEY_W, ACTION_MOVE_FORWARD);
+	Bind(GLFW_KEY_S, ACTION_MOVE_BACKWARD);
+	Bind(GLFW_KEY_A, ACTION_MOVE_LEFT);
+	Bind(GLFW_KEY_D, ACTION_MOVE_RIGHT);
+	Bind(GLFW_KEY_LEFT_SHIFT, ACTION_SPRINT);
+	Bind(GLFW_KEY_SPACE, ACTION_RESET_CAMERA);
+	Bind(GLFW_KEY_F, ACTION_FREE_CAMERA);
+
+	// 1 to 9 follow the first nine bodies and 0 the tenth
+	for (int i = 0; i < 10 && i < bodyCount; i++)
+	{
+		Bind(i < 9 ? GLFW_KEY_1 + i : GLFW_KEY_0, ACTION_FOLLOW_BODY, i);
+	}
+
+	// Everything after that is reached by cycling
+	Bind(GLFW_KEY_TAB, ACTION_NEXT_BODY);
+	Bind(GLFW_KEY_RIGHT_BRACKET, ACTION_NEXT_BODY);
+	Bind(GLFW_KEY_LEFT_BRACKET, ACTION_PREVIOUS_BODY);
+
+	Bind(GLFW_KEY_UP, ACTION_SPEED_UP);
+	Bind(GLFW_KEY_DOWN, ACTION_SPEED_DOWN);
+	Bind(GLFW_KEY_R, ACTION_SPEED_RESET);
+
+	BindMouseButton(GLFW_MOUSE_BUTTON_LEFT, ACTION_PICK_BODY);
+	Bind(GLFW_KEY_C, ACTION_TOGGLE_CURSOR);
+
+	Bind(GLFW_KEY_T, ACTION_TOGGLE_TRAILS);
+	Bind(GLFW_KEY_O, ACTION_TOGGLE_ORBITS);
+}
+
+int ActionMap::SlotOfKey(int key) const
+{
+	if (key < 0 || key > GLFW_KEY_LAST)
+	{
+		return -1;
+	}
+	return slotOfKey[key];
+}
+
+int ActionMap::SlotOfMouseButton(int button) const
+{
+	if (button < 0 || button > GLFW_MOUSE_BUTTON_LAST)
+	{
+		return -1;
+	}
+	return slotOfMouseButton[button];
+}
+
+unsigned int ActionMap::MaskOf(Action action) const
+{
+	unsigned int mask = 0;
+	for (size_t i = 0; i < bindings.size(); i++)
+	{
+		if (bindings[i].action == action)
+		{
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+}
+
+InputQueue::InputQueue()
+	: head(0), tail(0), dropped(0)
+{
+}
+
+bool InputQueue::Push(const InputEvent& event)
+{
+	unsigned int currentTail = tail.load(std::memory_order_relaxed);
+	if (currentTail - head.load(std::memory_order_acquire) >= INPUT_QUEUE_CAPACITY)
+	{
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	events[currentTail & (INPUT_QUEUE_CAPACITY - 1)] = event;
+	tail.store(currentTail + 1, std::memory_order_release);
+	return true;
+}
+
+bool InputQueue::Pop(InputEvent& event)
+{
+	unsigned int currentHead = head.load(std::memory_order_relaxed);
+	if (currentHead == tail.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	event = events[currentHead & (INPUT_QUEUE_CAPACITY - 1)];
+	head.store(currentHead + 1, std::memory_order_release);
+	return true;
+}
+
+/**
+ * @brief GLFW key callback; queues presses and releases of bound keys.
+ */
+static void KeyCallback(GLFWwindow* window, int key, int /*scancode*/, int action, int /*mods*/)
+{
+	InputSystem* input = static_cast<InputSystem*>(glfwGetWindowUserPointer(window));
+	int slot = input->actions.SlotOfKey(key);
+	if (slot < 0 || action == GLFW_REPEAT)
+	{
+		return;
+	}
+
+	InputEvent event;
+	event.type = action == GLFW_PRESS ? InputEvent::KEY_DOWN : InputEvent::KEY_UP;
+	event.slot = slot;
+	event.x = 0.0;
+	event.y = 0.0;
+	input->queue.Push(event);
+}
+
+/**
+ * @brief GLFW mouse button callback; queues presses and releases of bound buttons.
+ */
+static void MouseButtonCallback(GLFWwindow* window, int button, int action, int /*mods*/)
+{
+	InputSystem* input = static_cast<InputSystem*>(glfwGetWindowUserPointer(window));
+	int slot = input->actions.SlotOfMouseButton(button);
+	if (slot < 0)
+	{
+		return;
+	}
+
+	InputEvent event;
+	event.type = action == GLFW_PRESS ? InputEvent::KEY_DOWN : InputEvent::KEY_UP;
+	event.slot = slot;
+	event.x = 0.0;
+	event.y = 0.0;
+	input->queue.Push(event);
+}
+
+/**
+ * @brief GLFW cursor position callback; queues the new position.
+ */
+static void CursorPositionCallback(GLFWwindow* window, double xpos, double ypos)
+{
+	InputSystem* input = static_cast<InputSystem*>(glfwGetWindowUserPointer(window));
+
+	InputEvent event;
+	event.type = InputEvent::CURSOR;
+	event.slot = -1;
+	event.x = xpos;
+	event.y = ypos;
+	input->queue.Push(event);
+}
+
+InputSystem::InputSystem()
+{
+	held = 0;
+	cursorX = 0.0;
+	cursorY = 0.0;
+}
+
+void InputSystem::Install(GLFWwindow* window)
+{
+	glfwGetCursorPos(window, &cursorX, &cursorY);
+	glfwSetWindowUserPointer(window, this);
+	glfwSetKeyCallback(window, KeyCallback);
+	glfwSetMouseButtonCallback(window, MouseButtonCallback);
+	glfwSetCursorPosCallback(window, CursorPositionCallback);
+}
+
+void InputSystem::Update(InputFrame& frame)
+{
+	frame.pressed = 0;
+
+	InputEvent event;
+	while (queue.Pop(event))
+	{
+		switch (event.type)
+		{
+		case InputEvent::KEY_DOWN:
+			held |= 1u << event.slot;
+			frame.pressed |= 1u << event.slot;
+			break;
+		case InputEvent::KEY_UP:
+			held &= ~(1u << event.slot);
+			break;
+		case InputEvent::CURSOR:
+			cursorX = event.x;
+			cursorY = event.y;
+			break;
+		}
+	}
+
+	frame.held = held;
+	frame.cursorX = cursorX;
+	frame.cursorY = cursorY;
+}
@@ -0,0 +1,196 @@
+/**
+ * Event-driven keyboard and cursor input, mapped to actions through a table of key bindings.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+struct GLFWwindow;
+
+// Number of events the queue holds between two frames; must be a power of two
+const unsigned int INPUT_QUEUE_CAPACITY = 1024;
+
+// Every binding gets one bit in InputFrame, so at most this many keys can be bound
+const int MAX_ACTION_SLOTS = 32;
+
+/**
+ * Things a key can be bound to
+ */
+enum Action
+{
+	ACTION_MOVE_FORWARD,
+	ACTION_MOVE_BACKWARD,
+	ACTION_MOVE_LEFT,
+	ACTION_MOVE_RIGHT,
+	ACTION_SPRINT,			// Doubles the movement speed while held
+	ACTION_RESET_CAMERA,	// Puts the free camera back at its starting position
+	ACTION_FREE_CAMERA,		// Stops following a body
+	ACTION_FOLLOW_BODY,		// Follows the body given in the binding
+	ACTION_NEXT_BODY,		// Follows the body after the current one
+	ACTION_PREVIOUS_BODY,	// Follows the body before the current one
+	ACTION_SPEED_UP,		// Speeds up the revolutions while held
+	ACTION_SPEED_DOWN,		// Slows down the revolutions while held
+	ACTION_SPEED_RESET,		// Resets the revolution speed
+	ACTION_PICK_BODY,		// Follows the body under the cursor
+	ACTION_TOGGLE_CURSOR,	// Switches between mouse look and a free cursor for picking
+	ACTION_TOGGLE_TRAILS,	// Shows or hides the trails behind the bodies
+	ACTION_TOGGLE_ORBITS	// Shows or hides the orbit ellipses
+};
+
+/**
+ * Struct containing one key binding
+ */
+struct ActionBinding
+{
+	int key;		// GLFW key code, or mouse button if mouseButton is set
+	bool mouseButton;
+	Action action;
+	int body;		// Index into the planets for ACTION_FOLLOW_BODY, -1 otherwise
+};
+
+/**
+ * Table of key bindings. The position of a binding in the table is its slot, which is the bit it
+ * uses in InputFrame::held and InputFrame::pressed.
+ */
+struct ActionMap
+{
+	std::vector<ActionBinding> bindings;
+	std::vector<int> slotOfKey;			// Slot of every GLFW key code, or -1 if the key is not bound
+	std::vector<int> slotOfMouseButton;	// Slot of every GLFW mouse button, or -1 if the button is not bound
+
+	ActionMap();
+
+	/**
+	 * @brief Binds a key to an action. A key can only be bound once.
+	 * @param[in] key GLFW key code
+	 * @param[in] action Action to perform
+	 * @param[in] body Index of the body for ACTION_FOLLOW_BODY
+	 * @return False if the key is already bound or there are no slots left
+	 */
+	bool Bind(int key, Action action, int body = -1);
+
+	/**
+	 * @brief Binds a mouse button to an action. Mouse buttons share the slots with the keys.
+	 * @param[in] button GLFW mouse button
+	 * @param[in] action Action to perform
+	 * @return False if the button is already bound or there are no slots left
+	 */
+	bool BindMouseButton(int button, Action action);
+
+	/**
+	 * @brief Binds the default controls: WASD and shift to move, space to reset the camera, F for the
+	 * free camera, the number keys for the first ten bodies, tab and the brackets to cycle through
+	 * every body, the arrow keys and R for the revolution speed, the left mouse button to pick a body,
+	 * C to free the cursor for picking, and T and O for the trails and orbits.
+	 * @param[in] bodyCount Number of bodies that can be followed
+	 */
+	void BindDefaults(int bodyCount);
+
+	/**
+	 * @brief Looks up the slot of a key.
+	 * @param[in] key GLFW key code
+	 * @return Slot of the key, or -1 if it is not bound
+	 */
+	int SlotOfKey(int key) const;
+
+	/**
+	 * @brief Looks up the slot of a mouse button.
+	 * @param[in] button GLFW mouse button
+	 * @return Slot of the button, or -1 if it is not bound
+	 */
+	int SlotOfMouseButton(int button) const;
+
+	/**
+	 * @brief Collects the slots of every key bound to an action.
+	 * @param[in] action Action to look for
+	 * @return Bit mask of the slots
+	 */
+	unsigned int MaskOf(Action action) const;
+};
+
+/**
+ * Struct containing the input of one frame
+ */
+struct InputFrame
+{
+	float deltaTime;			// Simulated seconds this frame advances
+	unsigned int held;			// Slots whose key is down at the end of the frame
+	unsigned int pressed;		// Slots whose key went down during the frame, even if it was released again
+	double cursorX, cursorY;	// Cursor position at the end of the frame
+
+	InputFrame()
+	{
+		deltaTime = 0.f;
+		held = 0;
+		pressed = 0;
+		cursorX = 0.0;
+		cursorY = 0.0;
+	}
+};
+
+/**
+ * Struct containing one event sent from a GLFW callback
+ */
+struct InputEvent
+{
+	enum Type { KEY_DOWN, KEY_UP, CURSOR } type;
+	int slot;		// Slot of the key or mouse button for key events
+	double x, y;	// Cursor position for cursor events
+};
+
+/**
+ * Lock-free queue with a single producer (the GLFW callbacks) and a single consumer (the frame).
+ * Events are dropped if the queue is full, which only happens if nobody reads it.
+ */
+struct InputQueue
+{
+	InputEvent events[INPUT_QUEUE_CAPACITY];
+	std::atomic<unsigned int> head;		// Next slot to read, only written by the consumer
+	std::atomic<unsigned int> tail;		// Next slot to write, only written by the producer
+	std::atomic<unsigned int> dropped;
+
+	InputQueue();
+
+	/**
+	 * @brief Adds an event to the queue.
+	 * @param[in] event Event to add
+	 * @return False if the queue was full and the event was dropped
+	 */
+	bool Push(const InputEvent& event);
+
+	/**
+	 * @brief Takes the oldest event out of the queue.
+	 * @param[out] event Oldest event
+	 * @return False if the queue was empty
+	 */
+	bool Pop(InputEvent& event);
+};
+
+/**
+ * Receives key, mouse button and cursor events from GLFW and turns them into one InputFrame per frame.
+ * Keys that are not bound are ignored in the callback, so they never reach the queue.
+ */
+struct InputSystem
+{
+	ActionMap actions;
+	InputQueue queue;
+	unsigned int held;
+	double cursorX, cursorY;
+
+	InputSystem();
+
+	/**
+	 * @brief Registers the key, mouse button and cursor callbacks of the window.
+	 * The window user pointer is set to this input system.
+	 * @param[in] window Reference to the window
+	 */
+	void Install(GLFWwindow* window);
+
+	/**
+	 * @brief Applies the events received since the last call.
+	 * @param[out] frame Input of the frame; the time step is left untouched
+	 */
+	void Update(InputFrame& frame);
+};
@@ -0,0 +1,198 @@
+/**
+ * Recording and replay of the per-frame input, time step and random seed of a run.
+ */
+
+#include "InputRecording.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+const char RECORDING_MAGIC[4] = { 'S', 'S', 'I', 'R' };
+const uint32_t RECORDING_VERSION = 2;
+
+// Flags at the start of every frame, telling which fields follow
+const uint8_t FRAME_TIME_CHANGED = 1 << 0;
+const uint8_t FRAME_HELD_CHANGED = 1 << 1;
+const uint8_t FRAME_PRESSED_CHANGED = 1 << 2;
+const uint8_t FRAME_CURSOR_CHANGED = 1 << 3;
+
+/**
+ * @brief Writes a value to a binary stream as raw bytes.
+ */
+template <typename T>
+static void WriteValue(std::ofstream& file, const T& value)
+{
+	file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/**
+ * @brief Reads a value from a binary stream as raw bytes.
+ * @return False if the stream ended before the whole value was read
+ */
+template <typename T>
+static bool ReadValue(std::ifstream& file, T& value)
+{
+	file.read(reinterpret_cast<char*>(&value), sizeof(T));
+	return (bool)file;
+}
+
+InputRecorder::InputRecorder()
+{
+	frameCount = 0;
+}
+
+bool InputRecorder::Open(const std::string& path, unsigned int seed, int width, int height)
+{
+	file.open(path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Unable to create input recording: " << path << std::endl;
+		return false;
+	}
+
+	file.write(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+	WriteValue(file, RECORDING_VERSION);
+	WriteValue(file, (uint32_t)seed);
+	WriteValue(file, (int32_t)width);
+	WriteValue(file, (int32_t)height);
+
+	// Every frame is stored relative to the one before it, and the first one relative to an empty frame
+	last = InputFrame();
+	frameCount = 0;
+	return true;
+}
+
+void InputRecorder::WriteFrame(const InputFrame& input)
+{
+	if (!file.is_open())
+	{
+		return;
+	}
+
+	uint8_t flags = 0;
+	if (input.deltaTime != last.deltaTime)
+	{
+		flags |= FRAME_TIME_CHANGED;
+	}
+	if (input.held != last.held)
+	{
+		flags |= FRAME_HELD_CHANGED;
+	}
+	if (input.pressed != last.pressed)
+	{
+		flags |= FRAME_PRESSED_CHANGED;
+	}
+	if (input.cursorX != last.cursorX || input.cursorY != last.cursorY)
+	{
+		flags |= FRAME_CURSOR_CHANGED;
+	}
+
+	WriteValue(file, flags);
+	if (flags & FRAME_TIME_CHANGED)
+	{
+		WriteValue(file, input.deltaTime);
+	}
+	if (flags & FRAME_HELD_CHANGED)
+	{
+		WriteValue(file, (uint32_t)input.held);
+	}
+	if (flags & FRAME_PRESSED_CHANGED)
+	{
+		WriteValue(file, (uint32_t)input.pressed);
+	}
+	if (flags & FRAME_CURSOR_CHANGED)
+	{
+		WriteValue(file, input.cursorX);
+		WriteValue(file, input.cursorY);
+	}
+
+	last = input;
+	frameCount++;
+}
+
+void InputRecorder::Close()
+{
+	if (file.is_open())
+	{
+		file.close();
+		std::cout << "Recorded " << frameCount << " frames" << std::endl;
+	}
+}
+
+InputReplay::InputReplay()
+{
+	seed = 0;
+	width = 0;
+	height = 0;
+}
+
+bool InputReplay::Open(const std::string& path)
+{
+	file.open(path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Unable to open input recording: " << path << std::endl;
+		return false;
+	}
+
+	char magic[4];
+	uint32_t version = 0;
+	uint32_t recordedSeed = 0;
+	int32_t recordedWidth = 0;
+	int32_t recordedHeight = 0;
+	file.read(magic, sizeof(magic));
+	if (!file || memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0 ||
+		!ReadValue(file, version) || version != RECORDING_VERSION ||
+		!ReadValue(file, recordedSeed) || !ReadValue(file, recordedWidth) || !ReadValue(file, recordedHeight))
+	{
+		std::cerr << "Not a valid input recording: " << path << std::endl;
+		return false;
+	}
+
+	seed = recordedSeed;
+	width = recordedWidth;
+	height = recordedHeight;
+	last = InputFrame();
+	return true;
+}
+
+bool InputReplay::ReadFrame(InputFrame& input)
+{
+	uint8_t flags = 0;
+	if (!ReadValue(file, flags))
+	{
+		return false;
+	}
+
+	if (flags & FRAME_TIME_CHANGED)
+	{
+		ReadValue(file, last.deltaTime);
+	}
+	if (flags & FRAME_HELD_CHANGED)
+	{
+		uint32_t held = 0;
+		ReadValue(file, held);
+		last.held = held;
+	}
+	if (flags & FRAME_PRESSED_CHANGED)
+	{
+		uint32_t pressed = 0;
+		ReadValue(file, pressed);
+		last.pressed = pressed;
+	}
+	if (flags & FRAME_CURSOR_CHANGED)
+	{
+		ReadValue(file, last.cursorX);
+		ReadValue(file, last.cursorY);
+	}
+
+	if (!file)
+	{
+		std::cerr << "Input recording ended in the middle of a frame" << std::endl;
+		return false;
+	}
+
+	input = last;
+	return true;
+}
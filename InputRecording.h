@@ -0,0 +1,74 @@
+/**
+ * Recording and replay of the per-frame input, time step and random seed of a run.
+ */
+
+#pragma once
+
+#include "Input.h"
+
+#include <fstream>
+#include <string>
+
+/**
+ * Writes a run to a binary file. The header holds the random seed and the framebuffer size, and every
+ * frame after that starts with a byte that flags which of the time step, held keys, pressed keys and
+ * cursor changed since the previous frame; only those follow. A frame where nothing happened takes a
+ * single byte. Keys are stored by their slot in the ActionMap, so a recording is replayed with the
+ * same bindings it was made with.
+ */
+struct InputRecorder
+{
+	std::ofstream file;
+	InputFrame last;
+	long frameCount;
+
+	InputRecorder();
+
+	/**
+	 * @brief Creates the recording and writes its header.
+	 * @param[in] path Output path
+	 * @param[in] seed Seed of the random number generator used by the run
+	 * @param[in] width Width of the window framebuffer
+	 * @param[in] height Height of the window framebuffer
+	 * @return True if the file could be created
+	 */
+	bool Open(const std::string& path, unsigned int seed, int width, int height);
+
+	/**
+	 * @brief Appends one frame to the recording.
+	 * @param[in] input Input of the frame
+	 */
+	void WriteFrame(const InputFrame& input);
+
+	/**
+	 * @brief Flushes and closes the recording.
+	 */
+	void Close();
+};
+
+/**
+ * Reads back a file written by InputRecorder, one frame at a time.
+ */
+struct InputReplay
+{
+	std::ifstream file;
+	InputFrame last;
+	unsigned int seed;
+	int width, height;		// Framebuffer size of the recorded run
+
+	InputReplay();
+
+	/**
+	 * @brief Opens a recording and reads its header.
+	 * @param[in] path Path of the recording
+	 * @return True if the file is a valid recording
+	 */
+	bool Open(const std::string& path);
+
+	/**
+	 * @brief Reads the next frame of the recording.
+	 * @param[out] input Input of the frame
+	 * @return False once the recording has ended
+	 */
+	bool ReadFrame(InputFrame& input);
+};
@@ -0,0 +1,252 @@
+/**
+ * Work-stealing job system: one queue per core, parallel-for over index ranges and tasks with dependencies.
+ */
+
+#include "JobSystem.h"
+
+#include <algorithm>
+
+// Queue of the thread that is running; the thread that started the job system (and any thread the
+// job system does not know about) uses queue 0
+static thread_local int currentQueue = 0;
+
+Task::Task()
+	: waitingFor(1), finished(false), released(false)
+{
+}
+
+JobSystem::JobSystem()
+	: queuedJobs(0), stopping(false)
+{
+	queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+}
+
+JobSystem::~JobSystem()
+{
+	Stop();
+}
+
+void JobSystem::Start(int threadCount)
+{
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	stopping = false;
+	for (int i = 1; i < threadCount; i++)
+	{
+		queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+	for (int i = 1; i < threadCount; i++)
+	{
+		workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+	}
+}
+
+void JobSystem::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+	queues.resize(1);
+}
+
+int JobSystem::ThreadCount() const
+{
+	return (int)queues.size();
+}
+
+void JobSystem::Push(std::function<void()> job)
+{
+	{
+		WorkQueue& queue = *queues[currentQueue];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+
+	// Take the sleep lock so a worker that just found nothing cannot miss this job
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queuedJobs++;
+	}
+	wakeCondition.notify_one();
+}
+
+bool JobSystem::RunOneJob()
+{
+	std::function<void()> job;
+	int queueCount = (int)queues.size();
+
+	// Newest job from our own queue first, then the oldest job of the others
+	for (int i = 0; i < queueCount && !job; i++)
+	{
+		int index = (currentQueue + i) % queueCount;
+		WorkQueue& queue = *queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+		{
+			continue;
+		}
+		if (i == 0)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+	}
+
+	if (!job)
+	{
+		return false;
+	}
+
+	queuedJobs--;
+	job();
+	return true;
+}
+
+void JobSystem::WorkerLoop(int index)
+{
+	currentQueue = index;
+
+	while (true)
+	{
+		if (RunOneJob())
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeCondition.wait(lock, [this]() { return queuedJobs.load() > 0 || stopping; });
+		if (stopping)
+		{
+			return;
+		}
+	}
+}
+
+Task* JobSystem::AddTask(std::function<void()> work, std::initializer_list<Task*> dependencies)
+{
+	tasks.emplace_back();
+	Task* task = &tasks.back();
+	task->work = std::move(work);
+
+	for (Task* dependency : dependencies)
+	{
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (!dependency->released)
+		{
+			task->waitingFor++;
+			dependency->dependents.push_back(task);
+		}
+	}
+
+	// Drop the reference that kept the task from starting while its dependencies were added
+	if (--task->waitingFor == 0)
+	{
+		QueueTask(task);
+	}
+	return task;
+}
+
+void JobSystem::QueueTask(Task* task)
+{
+	Push([this, task]() {
+		task->work();
+		FinishTask(task);
+	});
+}
+
+void JobSystem::FinishTask(Task* task)
+{
+	std::vector<Task*> ready;
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		task->released = true;
+		ready.swap(task->dependents);
+	}
+
+	for (Task* dependent : ready)
+	{
+		if (--dependent->waitingFor == 0)
+		{
+			QueueTask(dependent);
+		}
+	}
+
+	// Whoever waits for the task may reset the tasks right after this
+	task->finished = true;
+}
+
+void JobSystem::Wait(Task* task)
+{
+	while (!task->finished)
+	{
+		if (!RunOneJob())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::ResetTasks()
+{
+	// A task the caller did not wait for may still be running, or its thread may be about to mark it finished
+	for (Task& task : tasks)
+	{
+		Wait(&task);
+	}
+	tasks.clear();
+}
+
+void JobSystem::ParallelFor(int count, int grainSize, const std::function<void(int, int)>& body)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	// A few chunks per thread, so threads that finish early can steal the rest
+	int chunkSize = std::max(std::max(grainSize, 1), count / (ThreadCount() * 4) + 1);
+	if (count <= chunkSize || ThreadCount() == 1)
+	{
+		body(0, count);
+		return;
+	}
+
+	int chunkCount = (count + chunkSize - 1) / chunkSize;
+	std::atomic<int> remaining(chunkCount - 1);
+
+	// Everything but the first chunk goes to the queue, the first one runs here
+	for (int chunk = 1; chunk < chunkCount; chunk++)
+	{
+		int begin = chunk * chunkSize;
+		int end = std::min(count, begin + chunkSize);
+		Push([&body, &remaining, begin, end]() {
+			body(begin, end);
+			remaining--;
+		});
+	}
+	body(0, std::min(count, chunkSize));
+
+	while (remaining > 0)
+	{
+		if (!RunOneJob())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
@@ -0,0 +1,114 @@
+/**
+ * Work-stealing job system: one queue per core, parallel-for over index ranges and tasks with dependencies.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Struct containing one unit of work in a frame graph. A task is queued once all of its
+ * dependencies have finished.
+ */
+struct Task
+{
+	std::function<void()> work;
+	std::atomic<int> waitingFor;		// Unfinished dependencies, plus one until the task is fully created
+	std::atomic<bool> finished;			// Set last, once the job system no longer touches the task
+	std::vector<Task*> dependents;		// Tasks waiting for this one, guarded by mutex
+	bool released;						// Whether the dependents were already queued, guarded by mutex
+	std::mutex mutex;
+
+	Task();
+};
+
+/**
+ * Double-ended queue of jobs owned by one thread. The owner pushes and pops at the back, so it
+ * works on the newest (cache-warm) job first, and other threads steal from the front.
+ */
+struct WorkQueue
+{
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+};
+
+/**
+ * Runs jobs on a pool of worker threads, one per core. The thread that created the job system
+ * (the one with the GL context) has a queue of its own and helps with the work whenever it waits,
+ * so nothing deadlocks even without any worker threads.
+ */
+struct JobSystem
+{
+	std::vector<std::unique_ptr<WorkQueue>> queues;	// Queue 0 belongs to the creating thread
+	std::vector<std::thread> workers;
+	std::deque<Task> tasks;		// Tasks of the current frame; a deque so their addresses never change
+
+	std::atomic<int> queuedJobs;
+	std::mutex sleepMutex;
+	std::condition_variable wakeCondition;
+	bool stopping;
+
+	JobSystem();
+	~JobSystem();
+
+	/**
+	 * @brief Starts the worker threads.
+	 * @param[in] threadCount Total number of threads that run jobs, including the calling thread.
+	 * 0 uses one per hardware thread.
+	 */
+	void Start(int threadCount);
+
+	/**
+	 * @brief Stops and joins the worker threads.
+	 */
+	void Stop();
+
+	/**
+	 * @brief Number of threads that run jobs, including the calling thread.
+	 */
+	int ThreadCount() const;
+
+	/**
+	 * @brief Creates a task that runs once all of its dependencies have finished.
+	 * Tasks are only created from the thread that started the job system.
+	 * @param[in] work Function to run
+	 * @param[in] dependencies Tasks that have to finish first
+	 * @return The new task, valid until ResetTasks
+	 */
+	Task* AddTask(std::function<void()> work, std::initializer_list<Task*> dependencies = {});
+
+	/**
+	 * @brief Runs jobs until a task has finished.
+	 * @param[in] task Task to wait for
+	 */
+	void Wait(Task* task);
+
+	/**
+	 * @brief Waits for every task to finish, then forgets them all.
+	 */
+	void ResetTasks();
+
+	/**
+	 * @brief Splits [0, count) into chunks, runs them on all threads and returns when all are done.
+	 * Can be called from inside a task. Ranges no bigger than one chunk run right away on the calling thread.
+	 * @param[in] count Number of items
+	 * @param[in] grainSize Smallest number of items worth sending to another thread
+	 * @param[in] body Function called with each [begin, end) chunk
+	 */
+	void ParallelFor(int count, int grainSize, const std::function<void(int, int)>& body);
+
+private:
+	void Push(std::function<void()> job);
+	bool RunOneJob();
+	void WorkerLoop(int index);
+	void FinishTask(Task* task);
+	void QueueTask(Task* task);
+};
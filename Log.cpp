@@ -0,0 +1,86 @@
+/**
+ * Asynchronous console log, so printing never blocks the render loop.
+ */
+
+#include "Log.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static std::mutex logMutex;
+static std::condition_variable logChanged;
+static std::vector<std::string> pendingLines;	// Guarded by logMutex
+static std::thread logThread;
+static bool logRunning = false;
+static bool logStopping = false;
+
+/**
+ * @brief Body of the log thread; takes all queued lines at once and prints them with a single flush.
+ */
+static void LogLoop()
+{
+	std::vector<std::string> lines;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(logMutex);
+			logChanged.wait(lock, []() { return !pendingLines.empty() || logStopping; });
+			if (pendingLines.empty())
+			{
+				return;
+			}
+			lines.swap(pendingLines);
+		}
+
+		for (const std::string& line : lines)
+		{
+			std::cout << line << '\n';
+		}
+		std::cout.flush();
+		lines.clear();
+	}
+}
+
+void StartLog()
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	if (logRunning)
+	{
+		return;
+	}
+	logStopping = false;
+	logRunning = true;
+	logThread = std::thread(LogLoop);
+}
+
+void Log(const std::string& message)
+{
+	{
+		std::lock_guard<std::mutex> lock(logMutex);
+		if (logRunning)
+		{
+			pendingLines.push_back(message);
+			logChanged.notify_one();
+			return;
+		}
+	}
+	std::cout << message << std::endl;
+}
+
+void StopLog()
+{
+	{
+		std::lock_guard<std::mutex> lock(logMutex);
+		if (!logRunning)
+		{
+			return;
+		}
+		logStopping = true;
+		logRunning = false;
+	}
+	logChanged.notify_one();
+	logThread.join();
+}
@@ -0,0 +1,24 @@
+/**
+ * Asynchronous console log, so printing never blocks the render loop.
+ */
+
+#pragma once
+
+#include <string>
+
+/**
+ * @brief Starts the thread that writes log messages to the console.
+ */
+void StartLog();
+
+/**
+ * @brief Queues a line for the console. Only a short critical section is taken; the console is written
+ * by the log thread. Before StartLog (or after StopLog) the line is printed right away.
+ * @param[in] message Line to print, without the newline
+ */
+void Log(const std::string& message);
+
+/**
+ * @brief Writes out the queued lines and stops the log thread.
+ */
+void StopLog();
@@ -17,13 +17,13 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-#include <fstream>
 #include <iostream>
 #include <string>
 #include <cmath>
 #include <vector>
 #include <algorithm>
 #include <random>
+#include <stdexcept>
 
 // Include stb_image for loading images
 // Remember to define STB_IMAGE_IMPLEMENTATION first before including
@@ -38,6 +38,32 @@
 // This gives us access to the glm::value_ptr() function, which converts a vector/matrix to a pointer that OpenGL accepts
 #include <glm/gtc/type_ptr.hpp>
 
+#include "Atmosphere.h"
+#include "DynamicResolution.h"
+#include "Eclipse.h"
+#include "Ephemeris.h"
+#include "FrameCapture.h"
+#include "FramePacing.h"
+#include "GpuCulling.h"
+#include "GpuResources.h"
+#include "Input.h"
+#include "InputRecording.h"
+#include "JobSystem.h"
+#include "Log.h"
+#include "Mesh.h"
+#include "NBody.h"
+#include "Occlusion.h"
+#include "Picking.h"
+#include "Planet.h"
+#include "ShaderSource.h"
+#include "SharedState.h"
+#include "Stats.h"
+#include "StarField.h"
+#include "StreamBuffer.h"
+#include "TextureStreaming.h"
+#include "Trails.h"
+#include "Views.h"
+
 // ---------------
 // Function declarations
 // ---------------
@@ -50,6 +76,13 @@
  */
 GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath);
 
+/**
+ * @brief Creates a compute shader program based on the provided file path.
+ * @param[in] computeShaderFilePath Compute shader file path
+ * @return OpenGL handle to the created shader program
+ */
+GLuint CreateComputeShaderProgram(const std::string& computeShaderFilePath);
+
 /**
  * @brief Creates a shader based on the provided shader type and the path to the file containing the shader source.
  * @param[in] shaderType Shader type
@@ -74,136 +107,6 @@ GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shade
  */
 void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height);
 
-void CrossProduct (float cross[3], float origin[3], float start[3], float end[3])
-{
-	float a[3] = { start[0] - origin[0], start[1] - origin[1], start[2] - origin[2] };
-	float b[3] = { end[0] - origin[0], end[1] - origin[1], end[2] - origin[2] };
-
-	cross[0] = (a[1] * b[2]) - (a[2] * b[1]);
-	cross[1] = (a[0] * b[2]) - (a[2] * b[0]);
-	cross[2] = (a[0] * b[1]) - (a[1] * b[0]);
-}
-/**
- * Struct containing data about a vertex
- */
-struct Vertex
-{
-	GLfloat x, y, z;	// Position
-	GLfloat nx, ny, nz; // Normals
-	GLubyte r, g, b;	// Color
-	GLfloat u, v;		// UV-coordinates
-
-	Vertex()
-	{
-
-	}
-
-	Vertex(GLfloat cx, GLfloat cy, GLfloat cz, GLfloat cnx, GLfloat cny, GLfloat cnz, GLubyte cr, GLubyte cg, GLfloat cb, GLfloat cu, GLfloat cv)
-	{
-		x = cx;
-		y = cy;
-		z = cz;
-		nx = cnx;
-		ny = cny;
-		nz = cnz;
-		r = cr;
-		g = cg;
-		b = cb;
-		u = cu;
-		v = cv;
-	}
-
-	Vertex(GLfloat vertex[3], GLfloat normals[3], GLubyte cr, GLubyte cg, GLfloat cb, GLfloat cu, GLfloat cv)
-	{
-		x = vertex[0];
-		y = vertex[1];
-		z = vertex[2];
-		nx = normals[0];
-		ny = normals[1];
-		nz = normals[2];
-		r = cr;
-		g = cg;
-		b = cb;
-		u = cu;
-		v = cv;
-	}
-};
-
-struct Planet {
-	GLfloat radius, majorAxis, minorAxis, angle, speed, eccentricity;
-	GLfloat cx, cy, cz, x1, y1, z1;
-	GLfloat phaseShift;
-	std::string textureMap, name;
-	GLuint texture;
-	
-	Planet(){
-		radius = 1.0f;
-		majorAxis = 1.0f;
-		minorAxis = 1.0f;
-		angle = 0.f;
-		cx = 0.f;
-		cy = 0.f;
-		cz = 0.f;
-		speed = 90.0f;
-	}
-
-	Planet(std::string n, float r, float m1, float m2, float a, float s, float x, float y, float z) {
-		name = n;
-		radius = r;
-		majorAxis = m1;
-		minorAxis = m2;
-		angle = a;
-		speed = s;
-		cx = x;
-		cy = y;
-		cz = z;
-	}
-
-	void ComputeMinorAxis() {
-		minorAxis = majorAxis * sqrt(1 - (pow(eccentricity, 2)));
-	}
-
-	void LoadTexture() {
-		glGenTextures(1, &texture);
-		stbi_set_flip_vertically_on_load(true);
-
-		int imageWidth, imageHeight, numChannels;
-
-		unsigned char* imageData = stbi_load(textureMap.c_str(), &imageWidth, &imageHeight, &numChannels, 0);
-
-		// Make sure that we actually loaded the image before uploading the data to the GPU
-		if (imageData != nullptr)
-		{
-			// Our texture is 2D, so we bind our texture to the GL_TEXTURE_2D target
-			glBindTexture(GL_TEXTURE_2D, texture);
-
-			// Set the filtering methods for magnification and minification
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-			// Set the wrapping method for the s-axis (x-axis) and t-axis (y-axis)
-			// Try experimenting with different wrapping methods introduced in the textures slide set
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-			// Upload the image data to GPU memory
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
-
-			// If we set minification to use mipmaps, we can tell OpenGL to generate the mipmaps for us
-			//glGenerateMipmap(GL_TEXTURE_2D);
-
-			// Once we have copied the data over to the GPU, we can delete
-			// the data on the CPU side, since we won't be using it anymore
-			stbi_image_free(imageData);
-			imageData = nullptr;
-		}
-		else
-		{
-			std::cerr << "Failed to load white.jpg" << std::endl;
-		}
-	}
-};
-
 const float SPEED = 50.0f;
 float moveConstant = SPEED;
 const float PI = acos(-1);
@@ -223,109 +126,131 @@ void SetCamera(glm::vec3& eye, glm::vec3& target, glm::vec3 pos, glm::vec3 look)
 	pitch = 0.f;
 }
 
-void FollowPlanet(GLFWwindow* window) {
-	int resetFocus = glfwGetKey(window, GLFW_KEY_F);
-	int mercury = glfwGetKey(window, GLFW_KEY_1);
-	int venus = glfwGetKey(window, GLFW_KEY_2);
-	int earth = glfwGetKey(window, GLFW_KEY_3);
-	int mars = glfwGetKey(window, GLFW_KEY_4);
-	int jupiter = glfwGetKey(window, GLFW_KEY_5);
-	int saturn = glfwGetKey(window, GLFW_KEY_6);
-	int uranus = glfwGetKey(window, GLFW_KEY_7);
-	int neptune = glfwGetKey(window, GLFW_KEY_8);
-
-	if (mercury == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 0;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (venus == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 1;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (earth == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 2;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (mars == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 3;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (jupiter == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 4;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (saturn == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 5;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (uranus == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 6;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (neptune == GLFW_PRESS) {
-		isFollowingPlanet = true;
-		focusedPlanet = 7;
-		std::cout << "Current planet: " << planets[focusedPlanet].name << std::endl;
-	}
-	if (resetFocus == GLFW_PRESS) {
-		isFollowingPlanet = false;
-		focusedPlanet = 0;
-		std::cout << "Camera set to free camera." << std::endl;
-	}
+float revolutionSpeed = 1.f;
 
-}
+// Whether the cursor is hidden and drives mouse look; otherwise it is free to point at bodies
+bool cursorCaptured = true;
 
-void ProcessMovement(GLFWwindow* window, glm::vec3& eye, glm::vec3& target, glm::vec3& up, float moveSpeed)
-{
-	int wKey = glfwGetKey(window, GLFW_KEY_W);
-	int sKey = glfwGetKey(window, GLFW_KEY_S);
-	int aKey = glfwGetKey(window, GLFW_KEY_A);
-	int dKey = glfwGetKey(window, GLFW_KEY_D);
-	int shiftKey = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT);
-	int spaceKey = glfwGetKey(window, GLFW_KEY_SPACE);
-	glm::vec3 look = glm::vec3(1.f, 0.f, 0.f);
-
-	if (sKey == GLFW_PRESS)
-	{
-		eye -= moveSpeed * target;
-	}
+// Whether the trails behind the bodies and their orbit ellipses are shown
+bool trailsVisible = true;
+bool orbitsVisible = true;
 
-	if (wKey == GLFW_PRESS)
-	{
-		eye += moveSpeed * target;
-	}
+/**
+ * @brief Makes the camera follow a body.
+ * @param[in] body Index of the body in planets
+ */
+void FollowPlanet(int body) {
+	isFollowingPlanet = true;
+	focusedPlanet = body;
+	Log("Current planet: " + planets[focusedPlanet].name);
+}
 
-	if (dKey == GLFW_PRESS)
-	{
-		eye += glm::normalize(glm::cross(target, up)) * moveSpeed;
-	}
+/**
+ * @brief Performs the actions bound to the keys that are held or were pressed this frame.
+ * Held keys move the camera and change the revolution speed every frame, while pressed keys
+ * (following a body, resetting the camera, ...) act once per press.
+ * @param[in] input Input of the frame
+ * @param[in] actions Key bindings the input was collected with
+ * @param[in,out] eye Camera position
+ * @param[in,out] target Camera direction
+ * @param[in] up Global up vector
+ * @param[in] deltaTime Simulated seconds this frame advances
+ */
+void ProcessActions(const InputFrame& input, const ActionMap& actions, glm::vec3& eye, glm::vec3& target, glm::vec3& up, float deltaTime)
+{
+	moveConstant = (input.held & actions.MaskOf(ACTION_SPRINT)) ? SPEED * 2.f : SPEED;
+	float moveSpeed = moveConstant * deltaTime;
+	int bodyCount = (int)planets.size();
 
-	if (aKey == GLFW_PRESS)
+	// Only the slots of keys that are involved this frame are visited
+	unsigned int active = input.held | input.pressed;
+	for (int slot = 0; active != 0; slot++, active >>= 1)
 	{
-		eye -= glm::normalize(glm::cross(target, up)) * moveSpeed;
-	}
+		if ((active & 1u) == 0)
+		{
+			continue;
+		}
 
-	if (shiftKey == GLFW_PRESS)
-	{
-		moveConstant = SPEED * 2.f;
-	}
+		const ActionBinding& binding = actions.bindings[slot];
+		bool pressed = ((input.pressed >> slot) & 1u) != 0;
 
-	if (shiftKey == GLFW_RELEASE)
-	{
-		moveConstant = SPEED;
+		switch (binding.action)
+		{
+		case ACTION_MOVE_FORWARD:
+			eye += moveSpeed * target;
+			break;
+		case ACTION_MOVE_BACKWARD:
+			eye -= moveSpeed * target;
+			break;
+		case ACTION_MOVE_RIGHT:
+			eye += glm::normalize(glm::cross(target, up)) * moveSpeed;
+			break;
+		case ACTION_MOVE_LEFT:
+			eye -= glm::normalize(glm::cross(target, up)) * moveSpeed;
+			break;
+		case ACTION_SPRINT:
+			break;
+		case ACTION_RESET_CAMERA:
+			if (pressed) {
+				SetCamera(eye, target, glm::vec3(-10.f, 0.f, 0.f), glm::vec3(1.f, 0.f, 0.f));
+				isFollowingPlanet = false;
+			}
+			break;
+		case ACTION_FREE_CAMERA:
+			if (pressed) {
+				isFollowingPlanet = false;
+				focusedPlanet = 0;
+				Log("Camera set to free camera.");
+			}
+			break;
+		case ACTION_FOLLOW_BODY:
+			if (pressed && binding.body < bodyCount) {
+				FollowPlanet(binding.body);
+			}
+			break;
+		case ACTION_NEXT_BODY:
+			if (pressed && bodyCount > 0) {
+				FollowPlanet(isFollowingPlanet ? (focusedPlanet + 1) % bodyCount : 0);
+			}
+			break;
+		case ACTION_PREVIOUS_BODY:
+			if (pressed && bodyCount > 0) {
+				FollowPlanet(isFollowingPlanet ? (focusedPlanet + bodyCount - 1) % bodyCount : bodyCount - 1);
+			}
+			break;
+		case ACTION_SPEED_UP:
+			revolutionSpeed += 1.0f;
+			break;
+		case ACTION_SPEED_DOWN:
+			revolutionSpeed -= 1.0f;
+			break;
+		case ACTION_SPEED_RESET:
+			revolutionSpeed = 1.0f;
+			break;
+		case ACTION_PICK_BODY:
+			// Needs the matrices of the frame, see PickBody
+			break;
+		case ACTION_TOGGLE_CURSOR:
+			if (pressed) {
+				cursorCaptured = !cursorCaptured;
+				// Don't turn the camera by however far the free cursor moved in the meantime
+				initialMouseInput = true;
+			}
+			break;
+		case ACTION_TOGGLE_TRAILS:
+			if (pressed) {
+				trailsVisible = !trailsVisible;
+			}
+			break;
+		case ACTION_TOGGLE_ORBITS:
+			if (pressed) {
+				orbitsVisible = !orbitsVisible;
+			}
+			break;
+		}
 	}
 
-	if (spaceKey == GLFW_PRESS) {
-		SetCamera(eye, target, glm::vec3(-10.f, 0.f, 0.f), glm::vec3(1.f, 0.f, 0.f));
-		isFollowingPlanet = false;
-	}
+	revolutionSpeed = fmax(revolutionSpeed, 1.0f);
 }
 
 
@@ -367,129 +292,416 @@ void ProcessMouse(GLFWwindow* window, double xpos, double ypos)
 	target = glm::normalize(lookField);
 }
 
-float revolutionSpeed = 1.f;
-const float distScale = 1.f;
-void ProcessRevolutionSpeed(GLFWwindow* window, float& revolutionSpeed) {
-	int upKey = glfwGetKey(window, GLFW_KEY_UP);
-	int downKey = glfwGetKey(window, GLFW_KEY_DOWN);
-	int rKey = glfwGetKey(window, GLFW_KEY_R);
+// Projected radius (in pixels) below which a planet starts fading into its impostor,
+// and below which only the impostor is drawn
+const float IMPOSTOR_FADE_START = 24.f;
+const float IMPOSTOR_FADE_END = 12.f;
+
+/**
+ * @brief Computes how big a sphere appears on screen.
+ * @param[in] center World-space center of the sphere
+ * @param[in] radius Radius of the sphere
+ * @param[in] eye Camera position
+ * @param[in] projectionMatrix Projection matrix used for rendering
+ * @param[in] viewportHeight Height of the viewport in pixels
+ * @return Radius of the projected silhouette in pixels
+ */
+float ComputePixelRadius(glm::vec3 center, float radius, glm::vec3 eye, const glm::mat4& projectionMatrix, int viewportHeight)
+{
+	float distSquared = glm::dot(center - eye, center - eye);
+	float radiusSquared = radius * radius;
 
-	if (upKey == GLFW_PRESS)
+	// The camera is inside (or touching) the sphere, so it covers the whole screen
+	if (distSquared <= radiusSquared)
 	{
-		revolutionSpeed += 1.0f;
-	}
-	if (downKey == GLFW_PRESS) {
-		revolutionSpeed -= 1.0f;
-	}
-	if (rKey == GLFW_PRESS) {
-		revolutionSpeed = 1.0f;
+		return (float)viewportHeight;
 	}
 
-	revolutionSpeed = fmax(revolutionSpeed, 1.0f);
+	return radius / sqrt(distSquared - radiusSquared) * projectionMatrix[1][1] * viewportHeight * 0.5f;
 }
 
-void GenerateSphereVertices(std::vector<Vertex>& vertices, std::vector<int>& indices, float radius, int sectorCount, int stackCount, float color[3])
+/**
+ * @brief Computes how much of the sphere mesh is drawn; the impostor covers the rest.
+ * @param[in] pixelRadius Projected radius in pixels
+ * @return 1 if only the mesh is drawn, 0 if only the impostor is drawn, and a blend factor in between
+ */
+float ComputeMeshFade(float pixelRadius)
 {
-	// xyz, rgb, uv
-	// clear memory of prev arrays
-	Vertex v;
-
-	float xy;
-	float lengthInv = 1.0f / radius;
-
-	float sectorStep = 2 * PI / sectorCount;
-	float stackStep = PI / stackCount;
-	float sectorAngle, stackAngle;
-
-	for (int i = 0; i <= stackCount; ++i)
-	{
-		stackAngle = PI / 2 - i * stackStep;        // starting from pi/2 to -pi/2
-		xy = radius * cosf(stackAngle);             // r * cos(u)
-		v.z = radius * sinf(stackAngle);              // r * sin(u)
+	return glm::clamp((pixelRadius - IMPOSTOR_FADE_END) / (IMPOSTOR_FADE_START - IMPOSTOR_FADE_END), 0.f, 1.f);
+}
 
-		// add (sectorCount+1) vertices per stack
-		// the first and last vertices have same position and normal, but different tex coords
-		for (int j = 0; j <= sectorCount; ++j)
-		{
-			sectorAngle = j * sectorStep;           // starting from 0 to 2pi
+/**
+ * @brief Uploads the point light of the sun to a shader program that uses the ptLight struct.
+ * @param[in] shaderProgram Shader program that is currently in use
+ */
+void SetPointLightUniforms(GLuint shaderProgram)
+{
+	// Point light
+	// Ambient
+	glm::vec3 ambientColor = glm::vec3(1.0f, 1.0f, 1.0f);
+	GLint ambientColorUniform = glGetUniformLocation(shaderProgram, "ptLight.ambient");
+	glUniform3fv(ambientColorUniform, 1, glm::value_ptr(ambientColor));
+
+	// Diffuse
+	glm::vec3 lightPos = glm::vec3(0.0f, 0.0f, 0.0f);
+	GLint lightPosUniform = glGetUniformLocation(shaderProgram, "ptLight.position");
+	glUniform3fv(lightPosUniform, 1, glm::value_ptr(lightPos));
+
+	//glm::vec3 diffuseColor = glm::vec3(0.5294f, 0.8078f, 0.9216f);
+	glm::vec3 diffuseColor = glm::vec3(1.0f, 1.0f, 1.0f);
+	GLint diffuseColorUniform = glGetUniformLocation(shaderProgram, "ptLight.diffuse");
+	glUniform3fv(diffuseColorUniform, 1, glm::value_ptr(diffuseColor));
+
+	glm::vec3 pointLightAttenuation = glm::vec3(0.0f, 0.f, 1.0f);
+	GLint plAttenuationUniform = glGetUniformLocation(shaderProgram, "ptLight.attenuation");
+	glUniform3fv(plAttenuationUniform, 1, glm::value_ptr(pointLightAttenuation));
+}
 
-			// vertex position (x, y, z)
-			v.x = xy * cosf(sectorAngle);             // r * cos(u) * cos(v)
-			v.y = xy * sinf(sectorAngle);             // r * cos(u) * sin(v)
+// The sun is drawn with the unit sphere without any scaling
+const float SUN_RADIUS = 1.f;
 
-			v.nx = v.x * lengthInv;
-			v.ny = v.y * lengthInv;
-			v.nz = v.z * lengthInv;
+// Projected radius (in pixels) a planet needs before it is used as an occluder
+const float OCCLUDER_MIN_PIXELS = 48.f;
+bool occlusionCullingEnabled = true;
 
-			// vertex color (r, g, b)
-			
-			v.r = color[0];
-			v.g = color[1];
-			v.b = color[2];
+// Size of the window framebuffer, kept up to date by FramebufferSizeChangedCallback
+int framebufferWidth = 0;
+int framebufferHeight = 0;
+bool framebufferResized = false;
 
-			// vertex tex coord (s, t) range between [0, 1]
-			v.u = (float)j / sectorCount;
-			v.v = (float)i / stackCount;
+/**
+ * @brief Gathers the bounding spheres of the bodies and brings the picking index up to date with them.
+ * The index is refitted every frame and only rebuilt once refitting has made it too loose.
+ * @param[in,out] spheres Every body, then the sun; reused from frame to frame
+ * @param[in,out] bodyIndex Bounding volume hierarchy over the spheres
+ */
+void UpdatePickIndex(std::vector<glm::vec4>& spheres, SphereBVH& bodyIndex)
+{
+	spheres.resize(planets.size() + 1);
+	for (size_t i = 0; i < planets.size(); i++) {
+		const Planet& planet = planets[i];
+		spheres[i] = glm::vec4(planet.cx + planet.x1, planet.cy, planet.cz + planet.z1, planet.radius);
+	}
+	spheres[planets.size()] = glm::vec4(0.f, 0.f, 0.f, SUN_RADIUS);
 
-			vertices.push_back(v);
-		}
+	if (!bodyIndex.Refit(spheres)) {
+		bodyIndex.Build(spheres);
 	}
-	;
-	int k1, k2;
-	for (int i = 0; i < stackCount; ++i)
+}
+
+/**
+ * Struct containing the settings that can be changed from the command line
+ */
+struct Options
+{
+	float targetFrameMs;		// GPU time budget used by dynamic resolution scaling
+	bool dynamicResolution;		// Whether the render resolution follows the frame time
+	std::string capturePath;	// Where captured frames are written, empty if not capturing
+	int captureFps;				// Frame rate of the captured video
+	float fixedTimeStep;		// Simulated seconds per frame, or 0 to follow the real clock
+	int maxFrames;				// Number of frames to render before exiting, or 0 to run until the window is closed
+	bool headless;				// Whether the window is hidden
+	std::string recordPath;		// Where the input of this run is recorded, empty if not recording
+	std::string replayPath;		// Recording to play back instead of reading the keyboard and mouse
+	unsigned int seed;			// Seed for the planet phases
+	bool hasSeed;				// Whether the seed was given, otherwise a random one is picked
+	int threads;				// Threads that run the frame tasks, or 0 for one per core
+	int asteroids;				// Number of asteroids added between Mars and Jupiter
+	std::string sphereMesh;		// Mesh the bodies are drawn with: "uv", "ico" or "cube"
+	int textureBudgetMb;		// GPU memory the streamed planet textures may take
+	std::string starCatalogPath;	// Star catalog to draw, empty to generate one
+	int starCount;				// Stars in the generated catalog
+	bool gravity;				// Whether the bodies move under mutual gravity instead of on fixed ellipses
+	bool nbodyBenchmark;		// Whether to time the N-body integrator and exit
+	bool gpuCulling;			// Whether culling and LOD selection run in a compute shader (GL 4.3)
+	VsyncMode vsync;			// How the buffer swap waits for the display
+	int framesInFlight;			// Frames the CPU may run ahead of the GPU
+	float maxFps;				// Frame rate limit, or 0 for none
+	bool eclipses;				// Whether bodies cast shadows on each other
+	bool atmospheres;			// Whether the bodies with an atmosphere are drawn with it
+	std::string atmosphereCachePath;	// Where the atmosphere tables are cached, empty to compute them every run
+	bool focusView;				// Whether the followed body is shown in an inset
+	bool systemMap;				// Whether a map of the whole system is shown in an inset
+	std::string sharedStateName;	// Shared memory the body state is published to every frame, empty to not publish
+	std::string ephemerisPath;	// Where the body positions are exported to instead of opening a window, empty to run normally
+	double ephemerisYears;		// Span of the export
+	double ephemerisStepHours;	// Time between two exported positions
+
+	Options()
 	{
-		k1 = i * (sectorCount + 1);     // beginning of current stack
-		k2 = k1 + sectorCount + 1;      // beginning of next stack
+		targetFrameMs = 16.6f;
+		dynamicResolution = true;
+		captureFps = 60;
+		fixedTimeStep = 0.f;
+		maxFrames = 0;
+		headless = false;
+		seed = 0;
+		hasSeed = false;
+		threads = 0;
+		asteroids = 0;
+		sphereMesh = "ico";
+		textureBudgetMb = 64;
+		starCount = STAR_DEFAULT_COUNT;
+		gravity = false;
+		nbodyBenchmark = false;
+		gpuCulling = false;
+		eclipses = true;
+		atmospheres = true;
+		atmosphereCachePath = "atmosphere.lut";
+		focusView = false;
+		systemMap = false;
+		vsync = VSYNC_ON;
+		framesInFlight = 2;
+		maxFps = 0.f;
+		ephemerisYears = 100.0;
+		ephemerisStepHours = 1.0;
+	}
+};
 
-		for (int j = 0; j < sectorCount; ++j, ++k1, ++k2)
+/**
+ * @brief Reads the command line arguments into the program options.
+ * @param[in] argc Number of arguments
+ * @param[in] argv Arguments
+ * @param[out] options Options to fill in
+ * @return False if an argument was not recognized
+ */
+bool ParseArguments(int argc, char** argv, Options& options)
+{
+	// The numbers are read with std::stoi and friends, which throw on anything that is not a number
+	int i = 1;
+	try
+	{
+		for (; i < argc; i++)
 		{
-			// 2 triangles per sector excluding first and last stacks
-			// k1 => k2 => k1+1
-			if (i != 0)
+			std::string arg = argv[i];
+
+			if (arg == "--target-ms" && i + 1 < argc)
 			{
-				indices.push_back(k1);
-				indices.push_back(k2);
-				indices.push_back(k1 + 1);
+				options.targetFrameMs = std::stof(argv[++i]);
 			}
-
-			// k1+1 => k2 => k2+1
-			if (i != (stackCount - 1))
+			else if (arg == "--no-dynamic-resolution")
+			{
+				options.dynamicResolution = false;
+			}
+			else if (arg == "--capture" && i + 1 < argc)
+			{
+				options.capturePath = argv[++i];
+			}
+			else if (arg == "--capture-fps" && i + 1 < argc)
+			{
+				options.captureFps = std::max(1, std::stoi(argv[++i]));
+			}
+			else if (arg == "--fixed-dt" && i + 1 < argc)
+			{
+				options.fixedTimeStep = std::max(0.f, std::stof(argv[++i]));
+			}
+			else if (arg == "--frames" && i + 1 < argc)
+			{
+				options.maxFrames = std::max(0, std::stoi(argv[++i]));
+			}
+			else if (arg == "--headless")
+			{
+				options.headless = true;
+			}
+			else if (arg == "--record" && i + 1 < argc)
+			{
+				options.recordPath = argv[++i];
+			}
+			else if (arg == "--replay" && i + 1 < argc)
+			{
+				options.replayPath = argv[++i];
+			}
+			else if (arg == "--seed" && i + 1 < argc)
+			{
+				options.seed = (unsigned int)std::stoul(argv[++i]);
+				options.hasSeed = true;
+			}
+			else if (arg == "--threads" && i + 1 < argc)
+			{
+				options.threads = std::max(0, std::stoi(argv[++i]));
+			}
+			else if (arg == "--asteroids" && i + 1 < argc)
+			{
+				options.asteroids = std::max(0, std::stoi(argv[++i]));
+			}
+			else if (arg == "--mesh" && i + 1 < argc)
+			{
+				options.sphereMesh = argv[++i];
+			}
+			else if (arg == "--texture-budget" && i + 1 < argc)
+			{
+				options.textureBudgetMb = std::max(1, std::stoi(argv[++i]));
+			}
+			else if (arg == "--star-catalog" && i + 1 < argc)
+			{
+				options.starCatalogPath = argv[++i];
+			}
+			else if (arg == "--stars" && i + 1 < argc)
+			{
+				options.starCount = std::max(0, std::stoi(argv[++i]));
+			}
+			else if (arg == "--gravity")
+			{
+				options.gravity = true;
+			}
+			else if (arg == "--nbody-benchmark")
+			{
+				options.nbodyBenchmark = true;
+			}
+			else if (arg == "--gpu-culling")
+			{
+				options.gpuCulling = true;
+			}
+			else if (arg == "--no-eclipses")
+			{
+				options.eclipses = false;
+			}
+			else if (arg == "--no-atmospheres")
+			{
+				options.atmospheres = false;
+			}
+			else if (arg == "--atmosphere-cache" && i + 1 < argc)
+			{
+				options.atmosphereCachePath = argv[++i];
+			}
+			else if (arg == "--focus-view")
+			{
+				options.focusView = true;
+			}
+			else if (arg == "--system-map")
+			{
+				options.systemMap = true;
+			}
+			else if (arg == "--vsync" && i + 1 < argc)
+			{
+				std::string mode = argv[++i];
+				if (mode == "off")
+				{
+					options.vsync = VSYNC_OFF;
+				}
+				else if (mode == "adaptive")
+				{
+					options.vsync = VSYNC_ADAPTIVE;
+				}
+				else
+				{
+					options.vsync = VSYNC_ON;
+				}
+			}
+			else if (arg == "--frames-in-flight" && i + 1 < argc)
+			{
+				options.framesInFlight = std::min(std::max(1, std::stoi(argv[++i])), FRAME_PACING_MAX_IN_FLIGHT);
+			}
+			else if (arg == "--max-fps" && i + 1 < argc)
+			{
+				options.maxFps = std::max(0.f, std::stof(argv[++i]));
+			}
+			else if (arg == "--shared-state" && i + 1 < argc)
+			{
+				options.sharedStateName = argv[++i];
+			}
+			else if (arg == "--ephemeris" && i + 1 < argc)
 			{
-				indices.push_back(k1 + 1);
-				indices.push_back(k2);
-				indices.push_back(k2 + 1);
+				options.ephemerisPath = argv[++i];
+			}
+			else if (arg == "--ephemeris-years" && i + 1 < argc)
+			{
+				options.ephemerisYears = std::max(0.0, std::stod(argv[++i]));
+			}
+			else if (arg == "--ephemeris-step-hours" && i + 1 < argc)
+			{
+				options.ephemerisStepHours = std::max(1e-3, std::stod(argv[++i]));
+			}
+			else
+			{
+				std::cerr << "Unknown argument: " << arg << std::endl;
+				std::cerr << "Usage: " << argv[0] << " [--target-ms <milliseconds>] [--no-dynamic-resolution]"
+					<< " [--capture <file.y4m|file.mp4|frame_%05d.png>] [--capture-fps <fps>]"
+					<< " [--fixed-dt <seconds>] [--frames <count>] [--headless]"
+					<< " [--record <file>] [--replay <file>] [--seed <number>]"
+					<< " [--threads <count>] [--asteroids <count>] [--mesh <uv|ico|cube>]"
+					<< " [--texture-budget <megabytes>] [--star-catalog <file>] [--stars <count>]"
+					<< " [--gravity] [--nbody-benchmark] [--gpu-culling] [--no-eclipses]"
+					<< " [--no-atmospheres] [--atmosphere-cache <file>] [--focus-view] [--system-map]"
+					<< " [--vsync <on|off|adaptive>] [--frames-in-flight <count>] [--max-fps <fps>] [--shared-state <name>]"
+					<< " [--ephemeris <file>] [--ephemeris-years <years>] [--ephemeris-step-hours <hours>]" << std::endl;
+				return false;
 			}
 		}
 	}
-}
+	catch (const std::exception&)
+	{
+		std::cerr << "Invalid value for " << argv[i - 1] << ": " << argv[i] << std::endl;
+		return false;
+	}
 
-unsigned int LoadCubeMap(std::vector<std::string> faces) {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	if (!(options.targetFrameMs > 0.f))
+	{
+		std::cerr << "--target-ms must be greater than 0" << std::endl;
+		return false;
+	}
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
+	if (options.headless && options.maxFrames == 0 && options.replayPath.empty())
 	{
-		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
-		}
+		std::cerr << "--headless needs --frames or --replay, since there is no window to close" << std::endl;
+		return false;
+	}
+
+	if (options.sphereMesh != "uv" && options.sphereMesh != "ico" && options.sphereMesh != "cube")
+	{
+		std::cerr << "--mesh must be uv, ico or cube" << std::endl;
+		return false;
+	}
+
+	if (!options.recordPath.empty() && !options.replayPath.empty())
+	{
+		std::cerr << "--record and --replay cannot be used together" << std::endl;
+		return false;
+	}
+
+	// A video plays back at a fixed rate, so the simulation has to advance by exactly one video frame per rendered frame
+	if (!options.capturePath.empty() && options.fixedTimeStep == 0.f)
+	{
+		options.fixedTimeStep = 1.f / options.captureFps;
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	return textureID;
+	return true;
+}
+
+const float distScale = 1.f;
+
+// Resolution of the body meshes; all three have roughly the same number of triangles
+const int UV_SPHERE_SECTORS = 36;
+const int UV_SPHERE_STACKS = 18;
+const int ICOSPHERE_SUBDIVISIONS = 3;
+const int CUBE_SPHERE_GRID_SIZE = 10;
+
+// Levels of detail of the body mesh, used by the GPU culling; every level halves the resolution of the one before
+const int BODY_MESH_LODS = 3;
+
+// Projected radius (in pixels) from which each level of detail is used, from the most detailed
+const float BODY_MESH_LOD_MIN_PIXELS[BODY_MESH_LODS] = { 96.f, 40.f, 0.f };
+
+/**
+ * @brief Generates the unit sphere the bodies are drawn with.
+ * @param[in] type "uv", "ico" or "cube"
+ * @param[in] lod Level of detail, 0 for the full resolution
+ * @param[out] mesh Mesh to replace
+ */
+void GenerateBodyMesh(const std::string& type, int lod, Mesh& mesh)
+{
+	if (type == "uv") {
+		float sphereColor[3] = { 255, 255, 255 };
+		mesh.vertices.clear();
+		mesh.indices.clear();
+		GenerateSphereVertices(mesh.vertices, mesh.indices, 1.0f, std::max(UV_SPHERE_SECTORS >> lod, 3), std::max(UV_SPHERE_STACKS >> lod, 2), sphereColor);
+	}
+	else if (type == "cube") {
+		GenerateCubeSphere(mesh, std::max(CUBE_SPHERE_GRID_SIZE >> lod, 1));
+	}
+	else {
+		GenerateIcosphere(mesh, std::max(ICOSPHERE_SUBDIVISIONS - lod, 0));
+	}
 }
 
 void SetPlanetInfo() {
@@ -501,8 +713,8 @@ void SetPlanetInfo() {
 	mercury.eccentricity = 0.205f;
 	mercury.ComputeMinorAxis();
 	mercury.speed = 4.15f;
+	mercury.mass = 1.66e-7;
 	mercury.textureMap = "mercury.jpg";
-	mercury.LoadTexture();
 	mercury.cx = 0.f;
 	mercury.cy = 0.f;
 	mercury.cz = 0.f;
@@ -515,8 +727,8 @@ void SetPlanetInfo() {
 	venus.eccentricity = 0.007;
 	venus.ComputeMinorAxis();
 	venus.speed = 1.62;
+	venus.mass = 2.448e-6;
 	venus.textureMap = "venus.jpg";
-	venus.LoadTexture();
 	venus.cx = 0.f;
 	venus.cy = 0.f;
 	venus.cz = 0.f;
@@ -529,8 +741,8 @@ void SetPlanetInfo() {
 	earth.eccentricity = 0.017;
 	earth.ComputeMinorAxis();
 	earth.speed = 1;
+	earth.mass = 3.003e-6;
 	earth.textureMap = "earth.jpg";
-	earth.LoadTexture();
 	earth.cx = 0.f;
 	earth.cy = 0.f;
 	earth.cz = 0.f;
@@ -543,8 +755,8 @@ void SetPlanetInfo() {
 	mars.eccentricity = 0.093;
 	mars.ComputeMinorAxis();
 	mars.speed = 0.53f;
+	mars.mass = 3.227e-7;
 	mars.textureMap = "mars.jpg";
-	mars.LoadTexture();
 	mars.cx = 0.f;
 	mars.cy = 0.f;
 	mars.cz = 0.f;
@@ -557,8 +769,8 @@ void SetPlanetInfo() {
 	jupiter.eccentricity = 0.084;
 	jupiter.ComputeMinorAxis();
 	jupiter.speed = 0.08f;
+	jupiter.mass = 9.548e-4;
 	jupiter.textureMap = "jupiter.jpg";
-	jupiter.LoadTexture();
 	jupiter.cx = 0.f;
 	jupiter.cy = 0.f;
 	jupiter.cz = 0.f;
@@ -571,8 +783,8 @@ void SetPlanetInfo() {
 	saturn.eccentricity = 0.054f;
 	saturn.ComputeMinorAxis();
 	saturn.speed = 0.03f;
+	saturn.mass = 2.859e-4;
 	saturn.textureMap = "saturn.jpg";
-	saturn.LoadTexture();
 	saturn.cx = 0.f;
 	saturn.cy = 0.f;
 	saturn.cz = 0.f;
@@ -585,8 +797,8 @@ void SetPlanetInfo() {
 	uranus.eccentricity = 0.047f;
 	uranus.ComputeMinorAxis();
 	uranus.speed = 0.0119f;
+	uranus.mass = 4.366e-5;
 	uranus.textureMap = "uranus.jpg";
-	uranus.LoadTexture();
 	uranus.cx = 0.f;
 	uranus.cy = 0.f;
 	uranus.cz = 0.f;
@@ -599,30 +811,430 @@ void SetPlanetInfo() {
 	neptune.eccentricity = 0.008f;
 	neptune.ComputeMinorAxis();
 	neptune.speed = 0.0061f;
+	neptune.mass = 5.151e-5;
 	neptune.textureMap = "neptune.jpg";
-	neptune.LoadTexture();
 	neptune.cx = 0.f;
 	neptune.cy = 0.f;
 	neptune.cz = 0.f;
 	neptune.angle = 0.f;
 
-	planets.push_back(mercury);
-	planets.push_back(venus);
-	planets.push_back(earth);
-	planets.push_back(mars);
-	planets.push_back(jupiter);
-	planets.push_back(saturn);
-	planets.push_back(uranus);
-	planets.push_back(neptune);
+	planets.push_back(mercury);
+	planets.push_back(venus);
+	planets.push_back(earth);
+	planets.push_back(mars);
+	planets.push_back(jupiter);
+	planets.push_back(saturn);
+	planets.push_back(uranus);
+	planets.push_back(neptune);
+}
+
+// Orbits of the generated asteroids, between Mars and Jupiter
+const float ASTEROID_MIN_AXIS = 30.f;
+const float ASTEROID_MAX_AXIS = 80.f;
+
+/**
+ * @brief Adds a belt of small bodies on random orbits, so the per-body work of a frame can be
+ * measured with a large catalog.
+ * @param[in] count Number of asteroids
+ * @param[in] texture Texture shared by every asteroid
+ * @param[in,out] gen Random number generator
+ */
+void AddAsteroidBelt(int count, GLuint texture, std::mt19937& gen) {
+	std::uniform_real_distribution<float> axisDist(ASTEROID_MIN_AXIS * distScale, ASTEROID_MAX_AXIS * distScale);
+	std::uniform_real_distribution<float> eccentricityDist(0.f, 0.15f);
+	std::uniform_real_distribution<float> radiusDist(0.03f, 0.12f);
+	std::uniform_real_distribution<float> heightDist(-1.5f, 1.5f);
+	std::uniform_real_distribution<float> phaseDist(0.f, 360.f);
+
+	planets.reserve(planets.size() + count);
+	for (int i = 0; i < count; i++) {
+		Planet asteroid;
+		asteroid.name = "Asteroid " + std::to_string(i + 1);
+		asteroid.radius = radiusDist(gen);
+		asteroid.majorAxis = axisDist(gen);
+		asteroid.eccentricity = eccentricityDist(gen);
+		asteroid.ComputeMinorAxis();
+		// Kepler's third law, relative to the Earth
+		asteroid.speed = pow(14.9f * distScale / asteroid.majorAxis, 1.5f);
+		asteroid.texture = texture;
+		asteroid.cy = heightDist(gen);
+		asteroid.phaseShift = phaseDist(gen);
+		planets.push_back(asteroid);
+	}
+}
+
+/**
+ * @brief Puts the bodies at their starting points on their orbits and adds the asteroid belt, all
+ * from the seed, so the window and the ephemeris export place them the same way.
+ * @param[in] seed Seed of the run
+ * @param[in] asteroids Number of asteroids
+ * @param[in] asteroidTexture Texture shared by every asteroid
+ */
+void PlaceBodies(unsigned int seed, int asteroids, GLuint asteroidTexture) {
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<> dist(0, 360);
+	for (auto& currentPlanet : planets) {
+		currentPlanet.phaseShift = dist(gen);
+	}
+
+	if (asteroids > 0) {
+		AddAsteroidBelt(asteroids, asteroidTexture, gen);
+	}
+}
+
+// Gravitational parameter of the sun in scene units, picked so a circular orbit at the Earth's
+// distance takes as long as the Earth does on its ellipse (1 degree per unit of time)
+const double SUN_GRAVITY = pow(glm::radians(1.0), 2.0) * pow(14.9 * distScale, 3.0);
+
+// Longest step of the integrator; a faster revolution speed takes several steps per frame
+const double NBODY_MAX_STEP = 0.25;
+
+// Most integrator steps in one frame. A long frame would otherwise take more steps, which makes the next
+// frame longer still; past this the simulation falls behind instead
+const int NBODY_MAX_SUBSTEPS = 16;
+
+/**
+ * @brief Starts the N-body integrator from where the bodies are at time 0 on their ellipses. Body 0
+ * of the integrator is the sun, body i + 1 is planets[i]. Every body gets the speed of a Kepler orbit
+ * with the same major axis (vis-viva) along its ellipse, and the sun the momentum that keeps the
+ * center of mass at rest.
+ * @param[out] nbody Integrator to start
+ * @param[in] jobs Job system that runs the integrator
+ */
+void InitGravity(NBodySystem& nbody, JobSystem& jobs) {
+	std::vector<glm::dvec3> positions(planets.size() + 1, glm::dvec3(0.0));
+	std::vector<glm::dvec3> velocities(planets.size() + 1, glm::dvec3(0.0));
+	std::vector<double> masses(planets.size() + 1);
+	masses[0] = 1.0;
+
+	glm::dvec3 momentum(0.0);
+	for (size_t i = 0; i < planets.size(); i++) {
+		const Planet& currentPlanet = planets[i];
+		double orbitAngle = glm::radians((double)currentPlanet.phaseShift);
+		glm::dvec3 position(currentPlanet.cx + currentPlanet.majorAxis * cos(orbitAngle), currentPlanet.cy, currentPlanet.cz - currentPlanet.minorAxis * sin(orbitAngle));
+		glm::dvec3 tangent(-currentPlanet.majorAxis * sin(orbitAngle), 0.0, -currentPlanet.minorAxis * cos(orbitAngle));
+		double distance = glm::length(position);
+		double speed = sqrt(std::max(0.0, SUN_GRAVITY * (2.0 / distance - 1.0 / currentPlanet.majorAxis)));
+
+		positions[i + 1] = position;
+		velocities[i + 1] = glm::normalize(tangent) * speed;
+		masses[i + 1] = currentPlanet.mass;
+		momentum += velocities[i + 1] * currentPlanet.mass;
+	}
+	velocities[0] = -momentum;
+
+	nbody.gravitationalConstant = SUN_GRAVITY;
+	nbody.Init(jobs, positions, velocities, masses);
+}
+
+/**
+ * Struct containing what the cull and LOD tasks decided for one body, read when the instances are built
+ */
+struct BodyDraw
+{
+	float pixelRadius;			// Projected radius in pixels
+	float meshFade;				// See ComputeMeshFade
+	bool occluded;
+};
+
+/**
+ * Struct containing the per-instance attributes of a sphere mesh, see main.vsh
+ */
+struct MeshInstance
+{
+	glm::mat4 transform;
+	GLfloat lodFade;
+};
+
+/**
+ * Struct containing the per-instance attributes of an impostor quad, see impostor.vsh
+ */
+struct ImpostorInstance
+{
+	glm::vec4 sphere;			// Center in xyz, radius in w
+	glm::mat4 inverseTransform;
+	GLfloat lodFade;
+};
+
+/**
+ * Struct containing one view of the frame and what its cull task decided. The bodies are moved and
+ * their transforms built once per frame; every view only culls them, picks their levels of detail,
+ * copies the transforms of what it draws into its own instances and rasterizes them.
+ */
+struct RenderView
+{
+	ViewKind kind;
+	ViewRect rect;
+	ViewCamera camera;
+	glm::mat4 viewMatrix;
+	glm::mat4 projectionMatrix;
+	OcclusionBuffer occlusionBuffer;
+	std::vector<BodyDraw> bodyDraws;	// One entry per body
+
+	// Instances of every group per chunk of BODY_GRAIN_SIZE bodies, counted by the cull task; turned
+	// into the position of each chunk's first instance before the instances are written
+	std::vector<int> meshChunkStarts;
+	std::vector<int> impostorChunkStarts;
+	std::vector<int> meshGroupStarts;
+	std::vector<int> impostorGroupStarts;
+
+	// Largest visible body of every group per chunk, which decides the mip level its texture needs
+	std::vector<float> chunkPixelRadii;
+
+	// This frame's instances in the stream buffer
+	MeshInstance* meshInstances;
+	ImpostorInstance* impostorInstances;
+	GLintptr meshOffset;
+	GLintptr impostorOffset;
+
+	Task* cullTask;
+};
+
+// Fewest bodies worth handing to another thread in a parallel-for; the bodies are also
+// counted and written out in chunks of this size
+const int BODY_GRAIN_SIZE = 1024;
+
+// Alignment of the instance data in the streaming buffer
+const GLsizeiptr INSTANCE_ALIGNMENT = 16;
+
+// Samples kept per body for its trail, and the simulated seconds between two samples
+const int TRAIL_LENGTH = 128;
+const double TRAIL_SAMPLE_INTERVAL = 0.5;
+
+/**
+ * @brief Casts a ray from the camera of the view under the cursor (or through the middle of the screen
+ * while the cursor is captured) and follows the first body it hits. The index is kept up to date by the
+ * frame tasks (see UpdatePickIndex), so a click only queries it.
+ * @param[in] window Reference to the window
+ * @param[in] input Input of the frame
+ * @param[in] views Views the frame was rendered with, in drawing order
+ * @param[in] renderWidth Width of the render target the views were laid out in
+ * @param[in] renderHeight Height of the render target the views were laid out in
+ * @param[in] bodyIndex Bounding volume hierarchy over the bodies of that frame, the sun last
+ */
+void PickBody(GLFWwindow* window, const InputFrame& input, const std::vector<RenderView>& views, int renderWidth, int renderHeight, const SphereBVH& bodyIndex)
+{
+	double startTime = glfwGetTime();
+
+	// The render target is stretched over the whole window
+	float pointX = 0.5f;
+	float pointY = 0.5f;
+	if (!cursorCaptured) {
+		int windowWidth, windowHeight;
+		glfwGetWindowSize(window, &windowWidth, &windowHeight);
+		pointX = (float)(input.cursorX / std::max(windowWidth, 1));
+		pointY = (float)(1.0 - input.cursorY / std::max(windowHeight, 1));
+	}
+	pointX *= renderWidth;
+	pointY *= renderHeight;
+
+	// The insets are drawn over the free camera, so the last view under the point is the one that shows there
+	const RenderView* pickedView = &views[0];
+	for (const RenderView& view : views) {
+		const ViewRect& rect = view.rect;
+		if (pointX >= rect.x && pointX < rect.x + rect.width && pointY >= rect.y && pointY < rect.y + rect.height) {
+			pickedView = &view;
+		}
+	}
+
+	const ViewRect& rect = pickedView->rect;
+	float ndcX = (pointX - rect.x) / std::max(rect.width, 1) * 2.f - 1.f;
+	float ndcY = (pointY - rect.y) / std::max(rect.height, 1) * 2.f - 1.f;
+
+	glm::vec3 rayOrigin, rayDirection;
+	ScreenPointToRay(ndcX, ndcY, pickedView->projectionMatrix, pickedView->viewMatrix, rayOrigin, rayDirection);
+	float hitDistance;
+	int hit = bodyIndex.Raycast(rayOrigin, rayDirection, hitDistance);
+
+	double endTime = glfwGetTime();
+
+	char timing[128];
+	snprintf(timing, sizeof(timing), " (%d bodies, ray cast in %.4f ms)", (int)bodyIndex.spheres.size(), (endTime - startTime) * 1000.0);
+
+	if (hit >= 0 && hit < (int)planets.size()) {
+		FollowPlanet(hit);
+		Log(std::string("Picked ") + planets[hit].name + timing);
+	}
+	else {
+		Log(std::string(hit >= 0 ? "Picked the sun, which cannot be followed" : "Nothing to pick") + timing);
+	}
+}
+
+/**
+ * @brief Writes where every body is and how fast it moves to shared memory, straight into the slot
+ * the readers will see.
+ * @param[in,out] publisher Shared memory to write to
+ * @param[in] jobs Job system that runs the work
+ * @param[in] simTime Simulated time of the frame
+ * @param[in] nbody Integrator that moves the bodies, or null if they follow their ellipses
+ */
+void PublishBodyState(SharedStatePublisher& publisher, JobSystem& jobs, double simTime, const NBodySystem* nbody) {
+	SharedStateView& view = publisher.BeginSnapshot(simTime);
+	jobs.ParallelFor((int)planets.size(), BODY_GRAIN_SIZE, [&](int begin, int end) {
+		glm::dvec3 sunVelocity = nbody != nullptr ? nbody->Velocity(0) : glm::dvec3(0.0);
+		for (int i = begin; i < end; i++) {
+			const Planet& currentPlanet = planets[i];
+			view.positions[0][i] = currentPlanet.cx + currentPlanet.x1;
+			view.positions[1][i] = currentPlanet.cy;
+			view.positions[2][i] = currentPlanet.cz + currentPlanet.z1;
+
+			// The integrator's time runs revolutionSpeed times faster than the simulated time
+			glm::vec3 velocity;
+			if (nbody != nullptr) {
+				velocity = glm::vec3((nbody->Velocity(i + 1) - sunVelocity) * (double)revolutionSpeed);
+			}
+			else {
+				ComputeOrbitVelocity(currentPlanet, simTime, revolutionSpeed, velocity.x, velocity.z);
+				velocity.y = 0.f;
+			}
+			view.velocities[0][i] = velocity.x;
+			view.velocities[1][i] = velocity.y;
+			view.velocities[2][i] = velocity.z;
+		}
+	});
+	publisher.EndSnapshot();
+}
+
+/**
+ * @brief Computes the model matrix of a body.
+ * @param[in] planet Body to place
+ * @return Transformation from the unit sphere to the body in world space
+ */
+glm::mat4 ComputeBodyTransform(const Planet& planet)
+{
+	// Adjustments on proper orientation of planets
+	glm::vec3 planeAngle = glm::vec3(-1.0f, 0.f, 0.f);
+	float angle = 90.0f;
+
+	glm::mat4 sphereTransform2 = glm::mat4(1.0f);
+	sphereTransform2 = glm::translate(sphereTransform2, glm::vec3(planet.cx, planet.cy, planet.cz));
+	sphereTransform2 = glm::translate(sphereTransform2, glm::vec3(planet.x1, 0.f, planet.z1));
+	sphereTransform2 = glm::rotate(sphereTransform2, glm::radians(angle), planeAngle);
+	// Negatively scaling the objects flips the object in the correct orientation
+	sphereTransform2 = glm::scale(sphereTransform2, glm::vec3(-planet.radius));
+	return sphereTransform2;
+}
+
+/**
+ * @brief Points the per-instance attributes of the sphere mesh VAO at mesh instances in a buffer.
+ * The VAO has to be bound.
+ * @param[in] buffer Buffer containing the instances
+ * @param[in] offset Offset of the first instance in the buffer
+ */
+void SetMeshInstanceAttributes(GLuint buffer, GLintptr offset)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	// Instance attributes 4 to 7 - Model matrix, one column each
+	for (int column = 0; column < 4; column++) {
+		glVertexAttribPointer(4 + column, 4, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (void*)(offset + offsetof(MeshInstance, transform) + column * sizeof(glm::vec4)));
+	}
+
+	// Instance attribute 8 - LOD crossfade
+	glVertexAttribPointer(8, 1, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (void*)(offset + offsetof(MeshInstance, lodFade)));
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+ * @brief Points the per-instance attributes of the impostor VAO at impostor instances in a buffer.
+ * The VAO has to be bound.
+ * @param[in] buffer Buffer containing the instances
+ * @param[in] offset Offset of the first instance in the buffer
+ */
+void SetImpostorInstanceAttributes(GLuint buffer, GLintptr offset)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	// Instance attribute 1 - Bounding sphere
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (void*)(offset + offsetof(ImpostorInstance, sphere)));
+
+	// Instance attributes 2 to 5 - Inverse model matrix, one column each
+	for (int column = 0; column < 4; column++) {
+		glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (void*)(offset + offsetof(ImpostorInstance, inverseTransform) + column * sizeof(glm::vec4)));
+	}
+
+	// Instance attribute 6 - LOD crossfade
+	glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (void*)(offset + offsetof(ImpostorInstance, lodFade)));
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+ * @brief Binds the impostor shader and uploads the uniforms every impostor shares.
+ * @param[in] impostorShader Impostor shader program
+ * @param[in] projectionMatrix Projection matrix used for rendering
+ * @param[in] viewMatrix View matrix used for rendering
+ * @param[in] eye Camera position
+ * @param[in] eclipse Bodies that cast shadows this frame
+ * @param[in] minPixelRadius Smallest radius the impostors are drawn with on screen, 0 for their true size
+ * @param[in] viewportHeight Height of the viewport in pixels
+ */
+void UseImpostorShader(GLuint impostorShader, const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, glm::vec3 eye, const EclipseOccluders& eclipse,
+	float minPixelRadius, int viewportHeight)
+{
+	glUseProgram(impostorShader);
+	SetPointLightUniforms(impostorShader);
+	eclipse.SetUniforms(impostorShader);
+
+	glUniformMatrix4fv(glGetUniformLocation(impostorShader, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+	glUniformMatrix4fv(glGetUniformLocation(impostorShader, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
+	glUniform3fv(glGetUniformLocation(impostorShader, "eye"), 1, glm::value_ptr(eye));
+	glUniform1f(glGetUniformLocation(impostorShader, "minPixelRadius"), minPixelRadius);
+	glUniform1f(glGetUniformLocation(impostorShader, "pixelScale"), projectionMatrix[1][1] * viewportHeight * 0.5f);
 }
+
 /**
  * @brief Main function
+ * @param[in] argc Number of command line arguments
+ * @param[in] argv Command line arguments, see ParseArguments
  * @return An integer indicating whether the program ended successfully or not.
  * A value of 0 indicates the program ended succesfully, while a non-zero value indicates
  * something wrong happened during execution.
  */
-int main()
+int main(int argc, char** argv)
 {
+	Options options;
+	if (!ParseArguments(argc, argv, options))
+	{
+		return 1;
+	}
+
+	// The benchmark needs no window
+	if (options.nbodyBenchmark)
+	{
+		JobSystem benchmarkJobs;
+		benchmarkJobs.Start(options.threads);
+		RunNBodyBenchmark(benchmarkJobs);
+		benchmarkJobs.Stop();
+		return 0;
+	}
+
+	// So does the ephemeris export: the orbits are evaluated on every core and streamed to the file
+	if (!options.ephemerisPath.empty())
+	{
+		JobSystem ephemerisJobs;
+		ephemerisJobs.Start(options.threads);
+		SetPlanetInfo();
+		if (!options.hasSeed)
+		{
+			std::random_device rd;
+			options.seed = rd();
+		}
+		std::cout << "Seed: " << options.seed << std::endl;
+		PlaceBodies(options.seed, options.asteroids, 0);
+
+		EphemerisSettings settings;
+		settings.path = options.ephemerisPath;
+		settings.startTime = 0.0;
+		settings.stepTime = EPHEMERIS_SECONDS_PER_YEAR / EPHEMERIS_HOURS_PER_YEAR * options.ephemerisStepHours;
+		settings.stepCount = (long long)(options.ephemerisYears * EPHEMERIS_HOURS_PER_YEAR / options.ephemerisStepHours) + 1;
+		settings.revolutionSpeed = revolutionSpeed;
+		bool exported = ExportEphemeris(ephemerisJobs, planets, settings);
+		ephemerisJobs.Stop();
+		return exported ? 0 : 1;
+	}
+
 	// Initialize GLFW
 	int glfwInitStatus = glfwInit();
 	if (glfwInitStatus == GLFW_FALSE)
@@ -639,6 +1251,12 @@ int main()
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+	// A headless run still needs a context, so the window is created but never shown
+	if (options.headless)
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	}
+
 	// Tell GLFW to create a window
 	int windowWidth = 800;
 	int windowHeight = 600;
@@ -663,124 +1281,67 @@ int main()
 		return 1;
 	}
 
-	// --- Vertex specification ---
-	float v0[3] = { -0.5f, -0.5f, -0.5f };
-	float v1[3] = { -0.5f, -0.5f, 0.5f };
-	float v2[3] = { -0.5f, 0.5f, -0.5f };
-	float v3[3] = { -0.5f, 0.5f, 0.5f };
-	float v4[3] = { 0.5f, -0.5f, -0.5f };
-	float v5[3] = { 0.5f, -0.5f, 0.5f };
-	float v6[3] = { 0.5f, 0.5f, -0.5f };
-	float v7[3] = { 0.5f, 0.5f, 0.5f };
-
-	float xP[3] = { 1.0f, 0.0f, 0.0f };
-	float xN[3] = { -1.0f, 0.0f, 0.0f };
-	float yP[3] = { 0.0f, 1.0f, 0.0f };
-	float yN[3] = { 0.0f, -1.0f, 0.0f };
-	float zP[3] = { 0.0f, 0.0f, 1.0f };
-	float zN[3] = { 0.0f, 0.0f, -1.0f };
-
-	float center0[3] = { 0.f, 0.f, 0.5f };
-	float center1[3] = { -0.5f, 0.f, 0.f };
-	float center2[3] = { 0.f, 0.f, -0.5f };
-	float center3[3] = { 0.5f, 0.f, 0.f };
-	float center4[3] = { 0.f, 0.5f, 0.f };
-	float center5[3] = { 0.f, -0.5f, 0.f };
-
-	// Set up the data for each vertex of the quad
-	// These vertices are in LOCAL SPACE
-	Vertex vertices[36];
-					// Position				// Normals				// Color				// UV
-	vertices[0] = { center0,		zP,		255,255,255,		0.5f, 0.5f };
-	vertices[1] = { v7,				zP,		255,255,255,		1.0f, 1.0f };
-	vertices[2] = { v3,				zP,		255,255,255,		0.0f, 1.0f };
-	vertices[3] = { v1,				zP,		255,255,255,		0.0f, 0.0f };
-	vertices[4] = { v5,				zP,		255,255,255,		1.0f, 0.0f };
-	vertices[5] = { v7,				zP,		255,255,255,		1.0f, 1.0f };
-
-	vertices[6] = { center1,		xN,		255,255,255,		0.5f, 0.5f };
-	vertices[7] = { v2,				xN,		255,255,255,		1.0f, 1.0f };
-	vertices[8] = { v3,				xN,		255,255,255,		0.0f, 1.0f };
-	vertices[9] = { v1,				xN,		255,255,255,		0.0f, 0.0f };
-	vertices[10] = { v0,			xN,		255,255,255,		1.0f, 0.0f };
-	vertices[11] = { v2,			xN,		255,255,255,		1.0f, 1.0f };
-
-	vertices[12] = { center2,		zN,		255,255,255,		0.5f, 0.5f };
-	vertices[13] = { v6,			zN,		255,255,255,		1.0f, 1.0f };
-	vertices[14] = { v2,			zN,		255,255,255,		0.0f, 1.0f };
-	vertices[15] = { v0,			zN,		255,255,255,		0.0f, 0.0f };
-	vertices[16] = { v4,			zN,		255,255,255,		1.0f, 0.0f };
-	vertices[17] = { v6,			zN,		255,255,255,		1.0f, 1.0f };
-
-	vertices[18] = { center3,		xP,		255,255,255,		0.5f, 0.5f };
-	vertices[19] = { v6,			xP,		255,255,255,		1.0f, 1.0f };
-	vertices[20] = { v7,			xP,		255,255,255,		0.0f, 1.0f };
-	vertices[21] = { v5,			xP,		255,255,255,		0.0f, 0.0f };
-	vertices[22] = { v4,			xP,		255,255,255,		1.0f, 0.0f };
-	vertices[23] = { v6,			xP,		255,255,255,		1.0f, 1.0f };
-
-	vertices[24] = { center4,		yP,		255,255,255,		0.5f, 0.5f };
-	vertices[25] = { v6,			yP,		255,255,255,		1.0f, 1.0f };
-	vertices[26] = { v2,			yP,		255,255,255,		0.0f, 1.0f };
-	vertices[27] = { v3,			yP,		255,255,255,		0.0f, 0.0f };
-	vertices[28] = { v7,			yP,		255,255,255,		1.0f, 0.0f };
-	vertices[29] = { v6,			yP,		255,255,255,		1.0f, 1.0f };
-
-	vertices[30] = { center5,		yN,		255,255,255,		0.5f, 0.5f };
-	vertices[31] = { v4,			yN,		255,255,255,		1.0f, 1.0f };
-	vertices[32] = { v0,			yN,		255,255,255,		0.0f, 1.0f };
-	vertices[33] = { v1,			yN,		255,255,255,		0.0f, 0.0f };
-	vertices[34] = { v5,			yN,		255,255,255,		1.0f, 0.0f };
-	vertices[35] = { v4,			yN,		255,255,255,		1.0f, 1.0f };
-
-	std::vector<Vertex> sphereVertices;
-	std::vector<int> sphereIndices;
-	float sphereColor[3] = { 255, 255, 255 };
-
-	GenerateSphereVertices(sphereVertices, sphereIndices, 1.0f, 36, 18, sphereColor);
+	// Culling in a compute shader needs GL 4.3; older contexts keep culling on the CPU
+	bool useGpuCulling = options.gpuCulling && IsGpuCullingSupported();
+	if (options.gpuCulling && !useGpuCulling)
+	{
+		std::cerr << "GPU culling needs OpenGL 4.3, culling on the CPU instead" << std::endl;
+	}
+
+	// Every body is drawn with the same unit sphere, so its triangles are ordered for the vertex cache once
+	Mesh sphere;
+	GenerateBodyMesh(options.sphereMesh, 0, sphere);
+
+	VertexCacheStats cacheBefore = MeasureVertexCache(sphere.indices, (int)sphere.vertices.size(), VERTEX_CACHE_SIZE);
+	OptimizeVertexCache(sphere.indices, (int)sphere.vertices.size());
+	OptimizeVertexFetch(sphere);
+	VertexCacheStats cacheAfter = MeasureVertexCache(sphere.indices, (int)sphere.vertices.size(), VERTEX_CACHE_SIZE);
+	std::cout << "Sphere mesh (" << options.sphereMesh << "): " << sphere.vertices.size() << " vertices, "
+		<< sphere.indices.size() / 3 << " triangles, ACMR " << cacheBefore.acmr << " -> " << cacheAfter.acmr
+		<< ", ATVR " << cacheBefore.atvr << " -> " << cacheAfter.atvr << std::endl;
+
+	// The GPU culling also picks a level of detail; the coarser meshes go after the full one in the same buffers
+	std::vector<MeshLod> meshLods(1);
+	meshLods[0].indexCount = (GLuint)sphere.indices.size();
+	meshLods[0].firstIndex = 0;
+	meshLods[0].baseVertex = 0;
+	meshLods[0].minPixelRadius = BODY_MESH_LOD_MIN_PIXELS[0];
+	for (int lod = 1; lod < BODY_MESH_LODS && useGpuCulling; lod++) {
+		Mesh lodMesh;
+		GenerateBodyMesh(options.sphereMesh, lod, lodMesh);
+		OptimizeVertexCache(lodMesh.indices, (int)lodMesh.vertices.size());
+		OptimizeVertexFetch(lodMesh);
+
+		MeshLod meshLod;
+		meshLod.indexCount = (GLuint)lodMesh.indices.size();
+		meshLod.firstIndex = (GLuint)sphere.indices.size();
+		meshLod.baseVertex = (GLint)sphere.vertices.size();
+		meshLod.minPixelRadius = BODY_MESH_LOD_MIN_PIXELS[lod];
+		meshLods.push_back(meshLod);
+		std::cout << "Sphere mesh LOD " << lod << ": " << lodMesh.vertices.size() << " vertices, " << lodMesh.indices.size() / 3 << " triangles" << std::endl;
+
+		sphere.vertices.insert(sphere.vertices.end(), lodMesh.vertices.begin(), lodMesh.vertices.end());
+		sphere.indices.insert(sphere.indices.end(), lodMesh.indices.begin(), lodMesh.indices.end());
+	}
 
 	// Create a vertex buffer object (VBO), and upload our vertices data to the VBO
-	GLuint vbo1, vbo2;
-	glGenBuffers(1, &vbo1);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo1);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glGenBuffers(1, &vbo2);
+	BufferHandle vbo2;
+	vbo2.Create("sphere vertices");
 	glBindBuffer(GL_ARRAY_BUFFER, vbo2);
-	glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(Vertex), sphereVertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sphere.vertices.size() * sizeof(Vertex), sphere.vertices.data(), GL_STATIC_DRAW);
+	vbo2.SetSize(sphere.vertices.size() * sizeof(Vertex));
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	GLuint ibo;
-	glGenBuffers(1, &ibo);
+	BufferHandle ibo;
+	ibo.Create("sphere indices");
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(int), sphereIndices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphere.indices.size() * sizeof(int), sphere.indices.data(), GL_STATIC_DRAW);
+	ibo.SetSize(sphere.indices.size() * sizeof(int));
 
 	// Create a vertex array object that contains data on how to map vertex attributes
 	// (e.g., position, color) to vertex shader properties.
-	GLuint vao1, vao2, sunVAO;
-	glGenVertexArrays(1, &vao1);
-	glBindVertexArray(vao1);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbo1);
-
-	// Vertex attribute 0 - Position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-
-	// Vertex attribute 1 - Normals
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
-
-	// Vertex attribute 2 - Color
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(offsetof(Vertex, r)));
-
-	// Vertex attribute 3 - UV-coordinates
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, u)));
-	
-	glGenVertexArrays(1, &vao2);
+	VertexArrayHandle vao2, sunVAO;
+	vao2.Create("bodies");
 	glBindVertexArray(vao2);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo2);
 	glEnableVertexAttribArray(0);
@@ -800,10 +1361,17 @@ int main()
 	// Vertex attribute 3 - UV-coordinates
 	glEnableVertexAttribArray(3);
 	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, u)));
+
+	// Instance attributes 4 to 8 - Model matrix and LOD crossfade, advanced once per instance.
+	// They point into the streaming buffer, see SetMeshInstanceAttributes
+	for (GLuint attribute = 4; attribute <= 8; attribute++) {
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribDivisor(attribute, 1);
+	}
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	glGenVertexArrays(1, &sunVAO);
+	sunVAO.Create("sun");
 	glBindVertexArray(sunVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo2);
 	// Vertex attribute 0 - Position
@@ -824,20 +1392,41 @@ int main()
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	std::vector<std::string> faces{
-		"px.png",
-		"nx.png",
-		"py.png",
-		"ny.png",
-		"pz.png",
-		"nz.png"
+	// Unit quad for planet impostors, drawn as a triangle strip
+	GLfloat quadCorners[8] = {
+		-1.f, -1.f,
+		1.f, -1.f,
+		-1.f, 1.f,
+		1.f, 1.f
 	};
 
-	unsigned int cubemapTexture = LoadCubeMap(faces);
+	BufferHandle quadVBO;
+	quadVBO.Create("impostor quad");
+	glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quadCorners), quadCorners, GL_STATIC_DRAW);
+	quadVBO.SetSize(sizeof(quadCorners));
+
+	VertexArrayHandle impostorVAO;
+	impostorVAO.Create("impostors");
+	glBindVertexArray(impostorVAO);
+
+	// Vertex attribute 0 - Quad corner
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+
+	// Instance attributes 1 to 6 - Bounding sphere, inverse model matrix and LOD crossfade,
+	// see SetImpostorInstanceAttributes
+	for (GLuint attribute = 1; attribute <= 6; attribute++) {
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribDivisor(attribute, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
 	// Create a variable that will contain the ID of our first texture (eye.jpg),
 	// and use glGenTextures() to generate the texture itself
-	GLuint tex0;
-	glGenTextures(1, &tex0);
+	TextureHandle tex0;
+	tex0.Create("sun.jpg");
 
 	// --- Load our pepe.jpg image using stb_image ---
 
@@ -870,6 +1459,7 @@ int main()
 
 		// Upload the image data to GPU memory
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, imageData);
+		tex0.SetSize((long long)imageWidth * imageHeight * 3);
 
 		// If we set minification to use mipmaps, we can tell OpenGL to generate the mipmaps for us
 		//glGenerateMipmap(GL_TEXTURE_2D);
@@ -885,13 +1475,45 @@ int main()
 	}
 
 	// Create a shader program
-	GLuint program = CreateShaderProgram("main.vsh", "main.fsh");
-	GLuint skyboxShader = CreateShaderProgram("skybox.vsh", "skybox.fsh");
-	GLuint lightShader = CreateShaderProgram("light.vsh", "light.fsh");
+	ProgramHandle program, starShader, lightShader, impostorShader, trailShader, orbitShader, atmosphereShader;
+	program.Adopt(CreateShaderProgram("main.vsh", "main.fsh"), "main");
+	starShader.Adopt(CreateShaderProgram("star.vsh", "star.fsh"), "stars");
+	lightShader.Adopt(CreateShaderProgram("light.vsh", "light.fsh"), "light");
+	impostorShader.Adopt(CreateShaderProgram("impostor.vsh", "impostor.fsh"), "impostor");
+	trailShader.Adopt(CreateShaderProgram("trail.vsh", "line.fsh"), "trail");
+	orbitShader.Adopt(CreateShaderProgram("orbit.vsh", "line.fsh"), "orbit");
+	atmosphereShader.Adopt(CreateShaderProgram("atmosphere.vsh", "atmosphere.fsh"), "atmosphere");
+	ProgramHandle cullShader;
+	if (useGpuCulling)
+	{
+		cullShader.Adopt(CreateComputeShaderProgram("cull.csh"), "culling");
+	}
 
 	// Tell OpenGL the dimensions of the region where stuff will be drawn.
 	// For now, tell OpenGL to use the whole screen
-	glViewport(0, 0, windowWidth, windowHeight);
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	glViewport(0, 0, framebufferWidth, framebufferHeight);
+
+	// Nothing is presented in a headless run, so don't wait for vertical sync
+	FramePacer framePacer;
+	framePacer.Init(options.headless ? VSYNC_OFF : options.vsync, options.framesInFlight, options.maxFps);
+
+	// The scene is rendered offscreen at a scale that keeps the frame within the time budget.
+	// A capture should look the same on every machine, so it always renders at full resolution. So does a
+	// replay, since the render scale changes the levels of detail and the texture mips, and with them the workload.
+	// Captures and headless runs still render offscreen: the back buffer of a hidden window fails the
+	// pixel ownership test, so what is read back from it is undefined.
+	DynamicResolution dynamicResolution;
+	dynamicResolution.enabled = options.dynamicResolution && options.capturePath.empty() && options.replayPath.empty();
+	dynamicResolution.offscreen = options.headless || !options.capturePath.empty();
+	dynamicResolution.Init(framebufferWidth, framebufferHeight, options.targetFrameMs);
+
+	FrameCapture frameCapture;
+	if (!options.capturePath.empty() && !frameCapture.Start(options.capturePath, framebufferWidth, framebufferHeight, options.captureFps))
+	{
+		glfwTerminate();
+		return 1;
+	}
 
 	// We enable depth testing so that we use the z-axis to determine
 	// which objects goes in front of which object (when overlapping geometry is drawn)
@@ -910,205 +1532,859 @@ int main()
 	glm::vec3 eye = cameraPosition;
 
 	// Declaration of time frames
-	float deltaTime = 0.0f;	// Time between current frame and last frame
+	float deltaTime = 0.0f;	// Simulated time between current frame and last frame
+	float frameTime = 0.0f;	// Real time between current frame and last frame
 	float lastFrame = 0.0f; // Time of last frame
+	double simTime = 0.0;	// Simulated time since the start, which drives the orbits
+	int frameCount = 0;
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	glm::mat4 modelMatrix(1.0f);
 
+	// The per-body work of every frame runs on one thread per core
+	JobSystem jobs;
+	jobs.Start(options.threads);
+
 	SetPlanetInfo();
 
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_real_distribution<> dist(0, 360);
+	// Only a small mip of every planet texture is loaded up front; finer ones are streamed in as the
+	// planets grow on screen. Captures and replays wait for the loads so every run renders the same frames.
+	TextureStreamer textureStreamer;
+	std::vector<int> planetTextureIndices(planets.size());
+	for (size_t i = 0; i < planets.size(); i++) {
+		planetTextureIndices[i] = textureStreamer.Add(planets[i].textureMap);
+	}
+	stbi_set_flip_vertically_on_load(true);
+	textureStreamer.Init(jobs, (long long)options.textureBudgetMb * 1024 * 1024, !options.capturePath.empty() || !options.replayPath.empty());
+	for (size_t i = 0; i < planets.size(); i++) {
+		planets[i].texture = textureStreamer.Texture(planetTextureIndices[i]);
+	}
+
+	// Keys reach the simulation as events from the GLFW callbacks, through the action map
+	InputSystem inputSystem;
+	inputSystem.actions.BindDefaults((int)planets.size());
+
+	// Everything that makes a run different from the last one (the seed, the time steps and the
+	// input) either comes from a recording or is written to one
+	InputRecorder inputRecorder;
+	InputReplay inputReplay;
+	if (!options.replayPath.empty())
+	{
+		if (!inputReplay.Open(options.replayPath))
+		{
+			glfwTerminate();
+			return 1;
+		}
+		options.seed = inputReplay.seed;
+		options.hasSeed = true;
+
+		if (inputReplay.width != framebufferWidth || inputReplay.height != framebufferHeight)
+		{
+			std::cerr << "Recording was made at " << inputReplay.width << "x" << inputReplay.height
+				<< ", replaying at " << framebufferWidth << "x" << framebufferHeight << std::endl;
+		}
+	}
+	if (!options.hasSeed)
+	{
+		std::random_device rd;
+		options.seed = rd();
+	}
+	std::cout << "Seed: " << options.seed << std::endl;
+
+	// A replay ignores the keyboard and mouse
+	if (options.replayPath.empty())
+	{
+		inputSystem.Install(window);
+	}
+
+	if (!options.recordPath.empty() && !inputRecorder.Open(options.recordPath, options.seed, framebufferWidth, framebufferHeight))
+	{
+		glfwTerminate();
+		return 1;
+	}
+
+	// Printing from the render loop goes through the log thread. It starts after the last early return,
+	// since a log thread still running when the statics are destroyed would abort the program.
+	StartLog();
+
+	PlaceBodies(options.seed, options.asteroids, planets[0].texture);
+	std::cout << planets.size() << " bodies, " << jobs.ThreadCount() << " threads" << std::endl;
+
+	// With gravity the bodies leave their ellipses, so the integrator owns their positions
+	NBodySystem nbody;
+	if (options.gravity) {
+		InitGravity(nbody, jobs);
+		std::cout << "Gravity: " << nbody.count << " bodies, " << nbody.nodes.size() << " octree nodes" << std::endl;
+	}
+
+	// Planets cast analytic shadows on each other and on the asteroids, see Eclipse.h
+	EclipseOccluders eclipse;
+	eclipse.Init(planets, glm::vec3(0.f), SUN_RADIUS);
+
+	// The scattering tables are computed on the job threads, or loaded if an earlier run cached them
+	AtmosphereScattering atmospheres;
+	if (options.atmospheres) {
+		atmospheres.Init(jobs, planets, options.atmosphereCachePath, atmosphereShader);
+	}
+
+	// The state of every body goes to shared memory for dashboards and recorders, see SharedState.h
+	SharedStatePublisher statePublisher;
+	bool publishState = false;
+	if (!options.sharedStateName.empty()) {
+		std::vector<std::string> names(planets.size());
+		for (size_t i = 0; i < planets.size(); i++) {
+			names[i] = planets[i].name;
+		}
+		publishState = statePublisher.Open(options.sharedStateName, names);
+		if (publishState) {
+			std::cout << "Shared state: " << options.sharedStateName << ", " << statePublisher.mapping.size / 1024 << " KB" << std::endl;
+		}
+	}
+
+	// Size of the last frame rendered, which the cursor points into; its views keep their matrices until the next frame sets them
+	int shownRenderWidth = 1;
+	int shownRenderHeight = 1;
+
+	// The cursor position of the previous frame; mouse look only reacts when it changes
+	double lastCursorX = xMousePos;
+	double lastCursorY = yMousePos;
+	bool cursorWasCaptured = cursorCaptured;
+
+	// Bodies under the cursor are found through a bounding volume hierarchy over their bounding spheres
+	SphereBVH bodyIndex;
+	std::vector<glm::vec4> pickSpheres;
+	unsigned int pickMask = inputSystem.actions.MaskOf(ACTION_PICK_BODY);
+
+	FrameStats frameStats;
+
+	// Bodies are drawn instanced, one draw call per texture, so they are grouped by texture
+	std::vector<GLuint> textureGroups;
+	std::vector<int> bodyGroups(planets.size());
+	for (size_t i = 0; i < planets.size(); i++) {
+		std::vector<GLuint>::iterator group = std::find(textureGroups.begin(), textureGroups.end(), planets[i].texture);
+		bodyGroups[i] = (int)(group - textureGroups.begin());
+		if (group == textureGroups.end()) {
+			textureGroups.push_back(planets[i].texture);
+		}
+	}
+	int groupCount = (int)textureGroups.size();
+
+	int chunkCount = ((int)planets.size() + BODY_GRAIN_SIZE - 1) / BODY_GRAIN_SIZE;
+
+	// Every view culls and draws the same bodies; the free camera comes first and fills the render target,
+	// the insets are drawn over it
+	std::vector<ViewKind> viewKinds(1, VIEW_CAMERA);
+	if (options.focusView) {
+		viewKinds.push_back(VIEW_FOCUS);
+	}
+	if (options.systemMap) {
+		viewKinds.push_back(VIEW_SYSTEM_MAP);
+	}
+	std::vector<ViewRect> viewRects;
+	std::vector<RenderView> views(viewKinds.size());
+	for (size_t v = 0; v < views.size(); v++) {
+		RenderView& view = views[v];
+		view.kind = viewKinds[v];
+		view.bodyDraws.resize(planets.size());
+		view.meshChunkStarts.resize(chunkCount * groupCount);
+		view.impostorChunkStarts.resize(chunkCount * groupCount);
+		view.meshGroupStarts.resize(groupCount + 1);
+		view.impostorGroupStarts.resize(groupCount + 1);
+		view.chunkPixelRadii.resize(chunkCount * groupCount);
+	}
+
+	// The map is framed around the farthest orbit, so its camera never moves
+	float systemRadius = SUN_RADIUS;
+	for (size_t i = 0; i < planets.size(); i++) {
+		systemRadius = std::max(systemRadius, glm::length(glm::vec3(planets[i].cx, planets[i].cy, planets[i].cz)) + planets[i].majorAxis);
+	}
+	for (RenderView& view : views) {
+		if (view.kind == VIEW_SYSTEM_MAP) {
+			view.camera = SystemMapCamera(systemRadius);
+		}
+	}
+	if (views.size() > 1) {
+		std::cout << "Views: " << views.size() << ", system radius " << systemRadius << std::endl;
+	}
+
+	// The instance data is written straight into GPU-visible memory every frame
+	StreamBuffer instanceStream;
+	instanceStream.Init(64 * 1024);
+
+	// With GPU culling only the bodies' positions are streamed; the instances are written on the GPU
+	GpuCulling gpuCulling;
+	if (useGpuCulling) {
+		useGpuCulling = gpuCulling.Init(cullShader, bodyGroups, groupCount, meshLods, IMPOSTOR_FADE_START, IMPOSTOR_FADE_END, (int)views.size());
+		if (useGpuCulling) {
+			std::cout << "GPU culling: " << meshLods.size() << " levels of detail, " << gpuCulling.meshCommands.size() << " mesh draw commands" << std::endl;
+		}
+	}
+
+	// Otherwise the model matrix of every body and its inverse are built once per frame and copied into the instances of every view
+	std::vector<glm::mat4> bodyTransforms;
+	std::vector<glm::mat4> bodyInverseTransforms;
+	if (!useGpuCulling) {
+		bodyTransforms.resize(planets.size());
+		bodyInverseTransforms.resize(planets.size());
+	}
+
+	// Every body leaves a trail of its recent positions, next to the ellipse it should follow
+	OrbitTrails trails;
+	trails.Init((int)planets.size(), TRAIL_LENGTH, TRAIL_SAMPLE_INTERVAL, trailShader, orbitShader);
+	{
+		std::vector<glm::vec3> orbitCenters(planets.size());
+		std::vector<glm::vec2> orbitAxes(planets.size());
+		for (size_t i = 0; i < planets.size(); i++) {
+			orbitCenters[i] = glm::vec3(planets[i].cx, planets[i].cy, planets[i].cz);
+			orbitAxes[i] = glm::vec2(planets[i].majorAxis, planets[i].minorAxis);
+		}
+		trails.SetOrbits(orbitCenters, orbitAxes);
+	}
 
-	bool firstFrame = true;
+	// The background is a star catalog, or a made-up one that looks like the real sky
+	StarField starField;
+	{
+		std::vector<Star> stars;
+		if (options.starCatalogPath.empty() || !LoadStarCatalog(options.starCatalogPath, stars)) {
+			GenerateStarCatalog(options.starCount, stars);
+		}
+		starField.Init(stars, starShader);
+		std::cout << "Star field: " << starField.starCount << " stars in " << starField.tiles.size() << " tiles" << std::endl;
+	}
 
 	// Render loop
-	while (!glfwWindowShouldClose(window))
+	while (!glfwWindowShouldClose(window) && (options.maxFrames == 0 || frameCount < options.maxFrames))
 	{
+		// Wait for the GPU and the frame rate limit before anything else, so the input is as fresh as it can be
+		framePacer.BeginFrame();
+
+		// The frame's work starts here, after the waits for the GPU and the frame rate limit
+		double workStart = glfwGetTime();
+		float currentFrame = (float)workStart;
+		frameTime = currentFrame - lastFrame;
+		lastFrame = currentFrame;
+
+		// Tell GLFW to process window events (e.g., input events, window closed events, etc.)
+		glfwPollEvents();
+		InputFrame input;
+		if (!options.replayPath.empty())
+		{
+			if (!inputReplay.ReadFrame(input))
+			{
+				break;
+			}
+		}
+		else
+		{
+			// With a fixed time step every frame advances the simulation by the same amount, however long it took to render
+			input.deltaTime = options.fixedTimeStep > 0.f ? options.fixedTimeStep : frameTime;
+			inputSystem.Update(input);
+			inputRecorder.WriteFrame(input);
+		}
+		framePacer.InputSampled();
+		deltaTime = input.deltaTime;
+		simTime += deltaTime;
+
+		// The input acts before the view matrix is built, so the camera is never a frame behind it.
+		// Movement; nothing to do on frames without any keys involved
+		if (input.held != 0 || input.pressed != 0)
+		{
+			ProcessActions(input, inputSystem.actions, eye, target, up, deltaTime);
+		}
+
+		if (cursorCaptured != cursorWasCaptured)
+		{
+			glfwSetInputMode(window, GLFW_CURSOR, cursorCaptured ? GLFW_CURSOR_DISABLED : GLFW_CURSOR_NORMAL);
+			cursorWasCaptured = cursorCaptured;
+		}
+
+		// The click was on the last frame, so it is picked with that frame's views and body positions
+		if ((input.pressed & pickMask) && frameCount > 0)
+		{
+			PickBody(window, input, views, shownRenderWidth, shownRenderHeight, bodyIndex);
+		}
+
+		// Mouse look is driven by the sampled cursor (instead of a cursor callback) so it can be recorded and replayed
+		if (input.cursorX != lastCursorX || input.cursorY != lastCursorY)
+		{
+			if (cursorCaptured)
+			{
+				ProcessMouse(window, input.cursorX, input.cursorY);
+			}
+			lastCursorX = input.cursorX;
+			lastCursorY = input.cursorY;
+		}
+
+		// With gravity the bodies move before the camera, in case it follows one of them
+		if (options.gravity) {
+			double step = (double)deltaTime * revolutionSpeed;
+			int substeps = (int)ceil(step / NBODY_MAX_STEP);
+			if (substeps > NBODY_MAX_SUBSTEPS) {
+				substeps = NBODY_MAX_SUBSTEPS;
+				step = NBODY_MAX_SUBSTEPS * NBODY_MAX_STEP;
+			}
+			for (int substep = 0; substep < substeps; substep++) {
+				nbody.Step(jobs, step / substeps);
+			}
+		}
+
+		// A followed body is placed ahead of the simulate task, so the cameras that look at it sit where the body is drawn this frame
+		glm::vec3 focusedCenter(0.f);
+		if (isFollowingPlanet || options.focusView) {
+			const Planet& focused = planets[focusedPlanet];
+			if (options.gravity) {
+				focusedCenter = glm::vec3(nbody.Position(focusedPlanet + 1) - nbody.Position(0));
+			}
+			else {
+				float x1, z1;
+				ComputeOrbitPosition(focused, simTime, revolutionSpeed, x1, z1);
+				focusedCenter = glm::vec3(focused.cx + x1, focused.cy, focused.cz + z1);
+			}
+		}
+		if (isFollowingPlanet) {
+			eye = focusedCenter + glm::vec3(0.f, planets[focusedPlanet].radius + 1, 0.f);
+		}
+
+		if (framebufferResized)
+		{
+			dynamicResolution.Resize(framebufferWidth, framebufferHeight);
+			framebufferResized = false;
+		}
+		dynamicResolution.BeginFrame();
+		int renderWidth = dynamicResolution.renderWidth;
+		int renderHeight = dynamicResolution.renderHeight;
+
 		// Clear the colors and depth values (since we enabled depth testing) in our off-screen framebuffer
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+		glClearColor(0.f, 0.f, 0.f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glm::mat4 viewMatrix(1.0f);
-		viewMatrix = glm::translate(viewMatrix, -cameraPosition); // Note the negative translation
-		glm::mat4 lookAtMatrix = glm::lookAt(eye, eye + target, up);
-
-		// Construct our view frustrum (projection matrix) using the following parameters
-		float fieldOfViewY = glm::radians(60.0f); // Field of view
-		float aspectRatio = windowWidth * 1.0f / windowHeight; // Aspect ratio, which is the ratio between width and height
-		float nearPlane = 0.1f; // Near plane, minimum distance from the camera where things will be rendered
-		float farPlane = 500.0f; // Far plane, maximum distance from the camera where things will be rendered
-		glm::mat4 projectionMatrix = glm::perspective(fieldOfViewY, aspectRatio, nearPlane, farPlane);
-
-		// Skybox rendering
-		glDepthMask(GL_FALSE);
-		glUseProgram(skyboxShader);
-
-		glm::mat4 skyboxView = glm::mat4(glm::mat3(lookAtMatrix));
-
-		GLint skyboxViewMatrixUniform = glGetUniformLocation(skyboxShader, "viewMatrix");
-		glUniformMatrix4fv(skyboxViewMatrixUniform, 1, GL_FALSE, glm::value_ptr(skyboxView));
-
-		GLint skyboxProjectionMatrixUniform = glGetUniformLocation(skyboxShader, "projectionMatrix");
-		glUniformMatrix4fv(skyboxProjectionMatrixUniform, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-
-		glBindVertexArray(vao1);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-		// Cube renders from center of face then triangle-fans the render
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 6);
-		glDrawArrays(GL_TRIANGLE_FAN, 6, 6);
-		glDrawArrays(GL_TRIANGLE_FAN, 12, 6);
-		glDrawArrays(GL_TRIANGLE_FAN, 18, 6);
-		glDrawArrays(GL_TRIANGLE_FAN, 24, 6);
-		glDrawArrays(GL_TRIANGLE_FAN, 30, 6);
-		glDepthMask(GL_TRUE);
-		glBindVertexArray(0);
 
-		glUseProgram(program);
+		// Every view gets its viewport and matrices for this frame. The free camera uses a 60 degree
+		// field of view with near and far planes at 0.1 and 500, see ViewCamera.
+		LayoutViews(viewKinds, renderWidth, renderHeight, viewRects);
+		for (size_t v = 0; v < views.size(); v++) {
+			RenderView& view = views[v];
+			view.rect = viewRects[v];
+			if (view.kind == VIEW_CAMERA) {
+				view.camera.eye = eye;
+				view.camera.forward = target;
+				view.camera.up = up;
+			}
+			else if (view.kind == VIEW_FOCUS) {
+				view.camera = FocusCamera(focusedCenter, planets[focusedPlanet].radius, glm::vec3(0.f));
+			}
+			view.viewMatrix = view.camera.ViewMatrix() * modelMatrix;
+			view.projectionMatrix = view.camera.ProjectionMatrix(view.rect);
+		}
+		RenderView& mainView = views[0];
+
+		// Frame graph: simulate -> occluders -> cull and LOD for every view, then build the instances and submit them.
+		// The tasks run on the job system while this thread draws the stars; only the GL calls stay on the context thread.
+		int bodyCount = (int)planets.size();
+		frameStats.Reset();
+		frameStats.bodiesTotal = bodyCount + 1;
+
+		// The bodies are moved and transformed once, however many views draw them
+		Task* simulateTask = jobs.AddTask([&]() {
+			jobs.ParallelFor(bodyCount, BODY_GRAIN_SIZE, [&](int begin, int end) {
+				glm::dvec3 sunPosition = options.gravity ? nbody.Position(0) : glm::dvec3(0.0);
+				for (int i = begin; i < end; i++) {
+					Planet& currentPlanet = planets[i];
+					if (options.gravity) {
+						// Relative to the sun, which is drawn at the origin; cy follows the body out of its plane
+						glm::dvec3 position = nbody.Position(i + 1) - sunPosition;
+						currentPlanet.x1 = (float)position.x - currentPlanet.cx;
+						currentPlanet.cy = (float)position.y;
+						currentPlanet.z1 = (float)position.z - currentPlanet.cz;
+					}
+					else {
+						UpdateOrbitPosition(currentPlanet, simTime, revolutionSpeed);
+					}
+
+					glm::vec3 planetCenter = glm::vec3(currentPlanet.cx + currentPlanet.x1, currentPlanet.cy, currentPlanet.cz + currentPlanet.z1);
+					for (RenderView& view : views) {
+						view.bodyDraws[i].pixelRadius = ComputePixelRadius(planetCenter, currentPlanet.radius, view.camera.eye, view.projectionMatrix, view.rect.height);
+					}
+					if (!useGpuCulling) {
+						bodyTransforms[i] = ComputeBodyTransform(currentPlanet);
+						bodyInverseTransforms[i] = glm::inverse(bodyTransforms[i]);
+					}
+				}
+			});
+		});
+
+		// The bodies whose shadows fall on another body are found while the rest is culled
+		Task* eclipseTask = jobs.AddTask([&]() {
+			if (options.eclipses) {
+				eclipse.Select(jobs, planets, BODY_GRAIN_SIZE);
+			}
+		}, { simulateTask });
+
+		// Other programs read the new positions from shared memory, written while the bodies are culled
+		Task* publishTask = nullptr;
+		if (publishState) {
+			publishTask = jobs.AddTask([&]() {
+				PublishBodyState(statePublisher, jobs, simTime, options.gravity ? &nbody : nullptr);
+			}, { simulateTask });
+		}
 
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
+		// The picking index follows the bodies while they are culled, so a click on this frame only casts a ray
+		Task* pickIndexTask = jobs.AddTask([&]() {
+			UpdatePickIndex(pickSpheres, bodyIndex);
+		}, { simulateTask });
+
+		// With GPU culling the compute shader does the rest, so only the simulation runs here
+		for (size_t v = 0; v < views.size(); v++) {
+			views[v].cullTask = simulateTask;
+			if (useGpuCulling) {
+				continue;
+			}
+
+			// Occlusion culling: the sun and every planet that is big on screen go into the
+			// occlusion buffer, then everything is tested against it before being drawn.
+			// A view that draws the bodies bigger than they are would see them poke out from behind the occluders, so it has none.
+			Task* occluderTask = jobs.AddTask([&, v]() {
+				RenderView& view = views[v];
+				view.occlusionBuffer.Clear(view.viewMatrix, view.projectionMatrix, view.camera.nearPlane, view.rect.width, view.rect.height);
+				if (occlusionCullingEnabled && view.camera.minPixelRadius == 0.f) {
+					view.occlusionBuffer.AddOccluder(glm::vec3(0.f), SUN_RADIUS);
+					for (int i = 0; i < bodyCount; i++) {
+						if (view.bodyDraws[i].pixelRadius >= OCCLUDER_MIN_PIXELS) {
+							const Planet& currentPlanet = planets[i];
+							view.occlusionBuffer.AddOccluder(glm::vec3(currentPlanet.cx + currentPlanet.x1, currentPlanet.cy, currentPlanet.cz + currentPlanet.z1), currentPlanet.radius);
+						}
+					}
+					view.occlusionBuffer.BuildPyramid();
+				}
+			}, { simulateTask });
+
+			// Far planets only cover a few pixels, so they are drawn as impostors instead of full spheres.
+			// Every chunk counts its instances per texture so the instances can be written in parallel afterwards.
+			views[v].cullTask = jobs.AddTask([&, v]() {
+				RenderView& view = views[v];
+				jobs.ParallelFor(chunkCount, 1, [&](int beginChunk, int endChunk) {
+					for (int chunk = beginChunk; chunk < endChunk; chunk++) {
+						int* meshCounts = &view.meshChunkStarts[chunk * groupCount];
+						int* impostorCounts = &view.impostorChunkStarts[chunk * groupCount];
+						float* pixelRadii = &view.chunkPixelRadii[chunk * groupCount];
+						std::fill(meshCounts, meshCounts + groupCount, 0);
+						std::fill(impostorCounts, impostorCounts + groupCount, 0);
+						std::fill(pixelRadii, pixelRadii + groupCount, 0.f);
+
+						int end = std::min(bodyCount, (chunk + 1) * BODY_GRAIN_SIZE);
+						for (int i = chunk * BODY_GRAIN_SIZE; i < end; i++) {
+							const Planet& currentPlanet = planets[i];
+							BodyDraw& draw = view.bodyDraws[i];
+							glm::vec3 planetCenter = glm::vec3(currentPlanet.cx + currentPlanet.x1, currentPlanet.cy, currentPlanet.cz + currentPlanet.z1);
+
+							draw.occluded = view.occlusionBuffer.IsOccluded(planetCenter, currentPlanet.radius);
+							if (draw.occluded) {
+								continue;
+							}
+
+							// Bodies behind the camera do not need a sharp texture
+							if (glm::dot(planetCenter - view.camera.eye, view.camera.forward) > -currentPlanet.radius) {
+								pixelRadii[bodyGroups[i]] = std::max(pixelRadii[bodyGroups[i]], draw.pixelRadius);
+							}
+
+							draw.meshFade = ComputeMeshFade(draw.pixelRadius);
+							if (draw.meshFade > 0.f) {
+								meshCounts[bodyGroups[i]]++;
+							}
+							if (draw.meshFade < 1.f) {
+								impostorCounts[bodyGroups[i]]++;
+							}
+						}
+					}
+				});
+			}, { occluderTask });
+		}
+
+		// The stars are drawn first, behind everything
+		frameStats.starsDrawn = starField.Draw(mainView.projectionMatrix, mainView.viewMatrix, renderHeight);
 
-		float moveSpeed = moveConstant * deltaTime;
-		viewMatrix = lookAtMatrix * modelMatrix;
-		GLint viewMatrixUniform = glGetUniformLocation(program, "viewMatrix");
-		glUniformMatrix4fv(viewMatrixUniform, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+		glUseProgram(program);
 
 		glm::mat4 normalMatrix(1.0f);
 		GLint normalMatrixUniform = glGetUniformLocation(program, "normalMatrix");
 		glUniformMatrix4fv(normalMatrixUniform, 1, GL_FALSE, glm::value_ptr(normalMatrix));
 		
 		// START: Lighting
-		// Point light
-		// Ambient
-		glm::vec3 ambientColor = glm::vec3(1.0f, 1.0f, 1.0f);
-		GLint ambientColorUniform = glGetUniformLocation(program, "ptLight.ambient");
-		glUniform3fv(ambientColorUniform, 1, glm::value_ptr(ambientColor));
-
-		// Diffuse
-		glm::vec3 lightPos = glm::vec3(0.0f, 0.0f, 0.0f);
-		GLint lightPosUniform = glGetUniformLocation(program, "ptLight.position");
-		glUniform3fv(lightPosUniform, 1, glm::value_ptr(lightPos));
-
-		//glm::vec3 diffuseColor = glm::vec3(0.5294f, 0.8078f, 0.9216f);
-		glm::vec3 diffuseColor = glm::vec3(1.0f, 1.0f, 1.0f);
-		GLint diffuseColorUniform = glGetUniformLocation(program, "ptLight.diffuse");
-		glUniform3fv(diffuseColorUniform, 1, glm::value_ptr(diffuseColor));
-
-		glm::vec3 pointLightAttenuation = glm::vec3(0.0f, 0.f, 1.0f);
-		GLint plAttenuationUniform = glGetUniformLocation(program, "ptLight.attenuation");
-		glUniform3fv(plAttenuationUniform, 1, glm::value_ptr(pointLightAttenuation));
+		SetPointLightUniforms(program);
 		// END: Lighting
 
-		GLint projectionMatrixUniform = glGetUniformLocation(program, "projectionMatrix");
-		glUniformMatrix4fv(projectionMatrixUniform, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-
-		// We retrieve our 'modelMatrix' uniform variable from the vertex shader,
-		GLint modelMatrixUniform = glGetUniformLocation(program, "modelMatrix");
+		for (RenderView& view : views) {
+			jobs.Wait(view.cullTask);
+		}
+		if (publishTask != nullptr) {
+			jobs.Wait(publishTask);
+		}
+		jobs.Wait(eclipseTask);
+		jobs.Wait(pickIndexTask);
+
+		// Also waits for the tasks nothing above waits on, like the simulation and the occluders of every view
+		jobs.ResetTasks();
+		eclipse.SetUniforms(program);
+
+		// Every so often the positions of all bodies go into the trails as well
+		bool takeTrailSample = trails.SampleDue(simTime);
+		GLsizeiptr trailSampleSize = takeTrailSample ? trails.SampleSize() : 0;
+		GLintptr trailSampleOffset = 0;
+
+		bool spheresWritten = false;
+		GLintptr sphereOffset = 0;
+		if (useGpuCulling) {
+			// What was drawn comes back a few frames late, which is soon enough for the stats and the texture mips
+			gpuCulling.ReadBack();
+			for (int group = 0; group < groupCount; group++) {
+				textureStreamer.Request(textureGroups[group], gpuCulling.groupPixelRadii[group]);
+			}
+			textureStreamer.Update();
+			frameStats.meshesDrawn = gpuCulling.meshesDrawn;
+			frameStats.impostorsDrawn = gpuCulling.impostorsDrawn;
+
+			// Only the bounding spheres go up, once for every view; the compute shader builds the instances from them
+			instanceStream.BeginFrame(bodyCount * sizeof(glm::vec4) + trailSampleSize + gpuCulling.storageAlignment + INSTANCE_ALIGNMENT);
+			glm::vec4* spheres = (glm::vec4*)instanceStream.Allocate(bodyCount * sizeof(glm::vec4), gpuCulling.storageAlignment, sphereOffset);
+			glm::vec2* trailSample = (glm::vec2*)instanceStream.Allocate(trailSampleSize, INSTANCE_ALIGNMENT, trailSampleOffset);
+
+			spheresWritten = spheres != nullptr && trailSample != nullptr;
+			if (spheresWritten) {
+				jobs.ParallelFor(bodyCount, BODY_GRAIN_SIZE, [&](int begin, int end) {
+					for (int i = begin; i < end; i++) {
+						const Planet& currentPlanet = planets[i];
+						spheres[i] = glm::vec4(currentPlanet.cx + currentPlanet.x1, currentPlanet.cy, currentPlanet.cz + currentPlanet.z1, currentPlanet.radius);
+						if (takeTrailSample && i < trails.bodyCount) {
+							trailSample[i] = glm::vec2(spheres[i].x, spheres[i].z);
+						}
+					}
+				});
+			}
+			else {
+				takeTrailSample = false;
+			}
+			instanceStream.EndWrites();
+		}
+		else {
+			// Instances are laid out by view, then by texture, and by body within each texture. The counts of
+			// every chunk become the position where that chunk writes its first instance.
+			// A texture is loaded as sharp as the view that shows it the biggest needs it.
+			std::vector<float> groupPixelRadii(groupCount, 0.f);
+			GLsizeiptr instanceBytes = trailSampleSize + INSTANCE_ALIGNMENT;
+			for (RenderView& view : views) {
+				int meshTotal = 0;
+				int impostorTotal = 0;
+				for (int group = 0; group < groupCount; group++) {
+					view.meshGroupStarts[group] = meshTotal;
+					view.impostorGroupStarts[group] = impostorTotal;
+					for (int chunk = 0; chunk < chunkCount; chunk++) {
+						int index = chunk * groupCount + group;
+						int meshCount = view.meshChunkStarts[index];
+						int impostorCount = view.impostorChunkStarts[index];
+						view.meshChunkStarts[index] = meshTotal;
+						view.impostorChunkStarts[index] = impostorTotal;
+						meshTotal += meshCount;
+						impostorTotal += impostorCount;
+						groupPixelRadii[group] = std::max(groupPixelRadii[group], view.chunkPixelRadii[index]);
+					}
+				}
+				view.meshGroupStarts[groupCount] = meshTotal;
+				view.impostorGroupStarts[groupCount] = impostorTotal;
+				instanceBytes += meshTotal * sizeof(MeshInstance) + impostorTotal * sizeof(ImpostorInstance) + 2 * INSTANCE_ALIGNMENT;
+
+				frameStats.occluders += view.occlusionBuffer.occluderCount;
+				frameStats.occlusionCulled += bodyCount - (int)std::count_if(view.bodyDraws.begin(), view.bodyDraws.end(), [](const BodyDraw& draw) { return !draw.occluded; });
+				frameStats.meshesDrawn += meshTotal;
+				frameStats.impostorsDrawn += impostorTotal;
+			}
+			for (int group = 0; group < groupCount; group++) {
+				textureStreamer.Request(textureGroups[group], groupPixelRadii[group]);
+			}
+			textureStreamer.Update();
+
+			instanceStream.BeginFrame(instanceBytes);
+			bool instancesMapped = true;
+			for (RenderView& view : views) {
+				view.meshOffset = 0;
+				view.impostorOffset = 0;
+				view.meshInstances = (MeshInstance*)instanceStream.Allocate(view.meshGroupStarts[groupCount] * sizeof(MeshInstance), INSTANCE_ALIGNMENT, view.meshOffset);
+				view.impostorInstances = (ImpostorInstance*)instanceStream.Allocate(view.impostorGroupStarts[groupCount] * sizeof(ImpostorInstance), INSTANCE_ALIGNMENT, view.impostorOffset);
+				instancesMapped = instancesMapped && view.meshInstances != nullptr && view.impostorInstances != nullptr;
+			}
+			glm::vec2* trailSample = (glm::vec2*)instanceStream.Allocate(trailSampleSize, INSTANCE_ALIGNMENT, trailSampleOffset);
+
+			// Build the instances of every view on every core, straight into the mapped buffer. Only the
+			// level of detail differs between the views; the transforms are the ones the simulate task built.
+			if (instancesMapped && trailSample != nullptr) {
+				int viewChunkCount = (int)views.size() * chunkCount;
+				jobs.ParallelFor(viewChunkCount, 1, [&](int beginChunk, int endChunk) {
+					for (int viewChunk = beginChunk; viewChunk < endChunk; viewChunk++) {
+						RenderView& view = views[viewChunk / chunkCount];
+						int chunk = viewChunk % chunkCount;
+						int* meshNext = &view.meshChunkStarts[chunk * groupCount];
+						int* impostorNext = &view.impostorChunkStarts[chunk * groupCount];
+						bool writeTrailSample = takeTrailSample && viewChunk < chunkCount;
+
+						int end = std::min(bodyCount, (chunk + 1) * BODY_GRAIN_SIZE);
+						for (int i = chunk * BODY_GRAIN_SIZE; i < end; i++) {
+							const BodyDraw& draw = view.bodyDraws[i];
+							const Planet& currentPlanet = planets[i];
+							if (writeTrailSample && i < trails.bodyCount) {
+								trailSample[i] = glm::vec2(currentPlanet.cx + currentPlanet.x1, currentPlanet.cz + currentPlanet.z1);
+							}
+							if (draw.occluded) {
+								continue;
+							}
+
+							if (draw.meshFade > 0.f) {
+								MeshInstance& instance = view.meshInstances[meshNext[bodyGroups[i]]++];
+								instance.transform = bodyTransforms[i];
+								instance.lodFade = draw.meshFade;
+							}
+							if (draw.meshFade < 1.f) {
+								ImpostorInstance& instance = view.impostorInstances[impostorNext[bodyGroups[i]]++];
+								instance.sphere = glm::vec4(currentPlanet.cx + currentPlanet.x1, currentPlanet.cy, currentPlanet.cz + currentPlanet.z1, currentPlanet.radius);
+								instance.inverseTransform = bodyInverseTransforms[i];
+								instance.lodFade = 1.f - draw.meshFade;
+							}
+						}
+					}
+				});
+			}
+			else {
+				for (RenderView& view : views) {
+					std::fill(view.meshGroupStarts.begin(), view.meshGroupStarts.end(), 0);
+					std::fill(view.impostorGroupStarts.begin(), view.impostorGroupStarts.end(), 0);
+				}
+				takeTrailSample = false;
+			}
+			instanceStream.EndWrites();
+		}
 
-		glBindVertexArray(0);
-		glBindVertexArray(vao2);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-		// Adjustments on proper orientation of planets
-		glm::vec3 planeAngle = glm::vec3(-1.0f, 0.f, 0.f);
-		float angle = 90.0f;
-		
-		float x1, z1;
-		// Declaration of elliptical constants
+		if (takeTrailSample) {
+			trails.AddSample(instanceStream.buffer, trailSampleOffset);
+		}
 
-		for (auto& currentPlanet : planets) {
-			glm::mat4 sphereTransform2 = glm::mat4(1.0f);
+		// Everything above ran once for the frame; what is left is rasterizing every view
+		for (size_t v = 0; v < views.size(); v++) {
+			RenderView& view = views[v];
+			const glm::mat4& projectionMatrix = view.projectionMatrix;
+			const glm::mat4& viewMatrix = view.viewMatrix;
+			glm::vec3 viewEye = view.camera.eye;
+
+			// The insets are drawn over the free camera, each on its own background
+			if (v > 0) {
+				glViewport(view.rect.x, view.rect.y, view.rect.width, view.rect.height);
+				glScissor(view.rect.x, view.rect.y, view.rect.width, view.rect.height);
+				glEnable(GL_SCISSOR_TEST);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				glDisable(GL_SCISSOR_TEST);
+				frameStats.starsDrawn += starField.Draw(projectionMatrix, viewMatrix, view.rect.height);
+			}
 
-			if (firstFrame) {
-				currentPlanet.phaseShift = dist(gen);
+			glUseProgram(program);
+
+			GLint viewMatrixUniform = glGetUniformLocation(program, "viewMatrix");
+			glUniformMatrix4fv(viewMatrixUniform, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+
+			GLint projectionMatrixUniform = glGetUniformLocation(program, "projectionMatrix");
+			glUniformMatrix4fv(projectionMatrixUniform, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+
+			if (useGpuCulling) {
+				if (spheresWritten) {
+					gpuCulling.Cull((int)v, instanceStream.buffer, sphereOffset, projectionMatrix, viewMatrix, viewEye, view.rect.height);
+
+					// One multi-draw per texture covers every level of detail
+					glUseProgram(program);
+					glBindVertexArray(vao2);
+					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+					SetMeshInstanceAttributes(gpuCulling.meshInstanceBuffer, 0);
+					for (int group = 0; group < groupCount; group++) {
+						glActiveTexture(GL_TEXTURE0);
+						glBindTexture(GL_TEXTURE_2D, textureGroups[group]);
+						gpuCulling.DrawMeshes((int)v, group);
+						frameStats.drawCalls++;
+					}
+
+					UseImpostorShader(impostorShader, projectionMatrix, viewMatrix, viewEye, eclipse, view.camera.minPixelRadius, view.rect.height);
+					glBindVertexArray(impostorVAO);
+					SetImpostorInstanceAttributes(gpuCulling.impostorInstanceBuffer, 0);
+					for (int group = 0; group < groupCount; group++) {
+						glActiveTexture(GL_TEXTURE0);
+						glBindTexture(GL_TEXTURE_2D, textureGroups[group]);
+						gpuCulling.DrawImpostors((int)v, group);
+						frameStats.drawCalls++;
+					}
+
+					// The stats and texture mips follow the free camera; the insets cull into their own commands afterwards
+					if (v == 0) {
+						gpuCulling.EndFrame();
+					}
+				}
+			}
+			else {
+				// One instanced draw call per texture
+				glBindVertexArray(vao2);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+				for (int group = 0; group < groupCount; group++) {
+					int instanceCount = view.meshGroupStarts[group + 1] - view.meshGroupStarts[group];
+					if (instanceCount == 0) {
+						continue;
+					}
+
+					glActiveTexture(GL_TEXTURE0);
+					glBindTexture(GL_TEXTURE_2D, textureGroups[group]);
+
+					SetMeshInstanceAttributes(instanceStream.buffer, view.meshOffset + view.meshGroupStarts[group] * sizeof(MeshInstance));
+					glDrawElementsInstanced(GL_TRIANGLES, meshLods[0].indexCount, GL_UNSIGNED_INT, (void*)0, instanceCount);
+					frameStats.drawCalls++;
+				}
+
+				// Impostors: one camera-facing quad per far planet, ray-traced against the sphere in the fragment shader
+				if (view.impostorGroupStarts[groupCount] > 0) {
+					UseImpostorShader(impostorShader, projectionMatrix, viewMatrix, viewEye, eclipse, view.camera.minPixelRadius, view.rect.height);
+
+					glBindVertexArray(impostorVAO);
+					for (int group = 0; group < groupCount; group++) {
+						int instanceCount = view.impostorGroupStarts[group + 1] - view.impostorGroupStarts[group];
+						if (instanceCount == 0) {
+							continue;
+						}
+
+						glActiveTexture(GL_TEXTURE0);
+						glBindTexture(GL_TEXTURE_2D, textureGroups[group]);
+
+						SetImpostorInstanceAttributes(instanceStream.buffer, view.impostorOffset + view.impostorGroupStarts[group] * sizeof(ImpostorInstance));
+						glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+						frameStats.drawCalls++;
+					}
+				}
 			}
-			x1 = currentPlanet.majorAxis * glm::cos(glm::radians(((float)glfwGetTime() * currentPlanet.speed * revolutionSpeed) + currentPlanet.phaseShift));
-			z1 = currentPlanet.minorAxis * -glm::sin(glm::radians(((float)glfwGetTime() * currentPlanet.speed * revolutionSpeed) + currentPlanet.phaseShift));
-			currentPlanet.x1 = x1;
-			currentPlanet.z1 = z1;
-			
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, currentPlanet.texture);
-
-			sphereTransform2 = glm::translate(sphereTransform2, glm::vec3(currentPlanet.cx, currentPlanet.cy, currentPlanet.cz));
-			sphereTransform2 = glm::translate(sphereTransform2, glm::vec3(currentPlanet.x1, 0.f, currentPlanet.z1));
-			sphereTransform2 = glm::rotate(sphereTransform2, glm::radians(angle), planeAngle);
-			// Negatively scaling the objects flips the object in the correct orientation
-			sphereTransform2 = glm::scale(sphereTransform2, glm::vec3(-currentPlanet.radius));			
-			glUniformMatrix4fv(modelMatrixUniform, 1, GL_FALSE, glm::value_ptr(sphereTransform2));
-			glDrawElements(GL_TRIANGLES, sphereIndices.size(), GL_UNSIGNED_INT, (void*)0);
-		}
-		firstFrame = false;
 
-		if (isFollowingPlanet) {
-			eye = glm::vec3(planets[focusedPlanet].x1, planets[focusedPlanet].radius + 1, planets[focusedPlanet].z1);
-		}
+			glBindVertexArray(0);
 
-		glBindVertexArray(0);
+			glUseProgram(lightShader);
+			glBindVertexArray(sunVAO);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 
-		glUseProgram(lightShader);
-		glBindVertexArray(sunVAO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, tex0);
+			// Same orientation as the planets, see ComputeBodyTransform
+			glm::mat4 sphereTransforms(1.0f);
+			sphereTransforms = glm::rotate(sphereTransforms, glm::radians(90.0f), glm::vec3(-1.0f, 0.f, 0.f));
+
+			// Where the bodies are drawn bigger than they are, the sun is drawn bigger still so it marks the center
+			if (view.camera.minPixelRadius > 0.f) {
+				float sunPixelRadius = ComputePixelRadius(glm::vec3(0.f), SUN_RADIUS, viewEye, projectionMatrix, view.rect.height);
+				sphereTransforms = glm::scale(sphereTransforms, glm::vec3(std::max(1.f, VIEW_MAP_SUN_PIXELS / sunPixelRadius)));
+			}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, tex0);
-		glm::mat4 sphereTransforms(1.0f);
-		sphereTransforms = glm::rotate(sphereTransforms, glm::radians(angle), planeAngle);
+			GLint lightProjectionMatrixUniform = glGetUniformLocation(lightShader, "projectionMatrix");
+			glUniformMatrix4fv(lightProjectionMatrixUniform, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+			GLint lightViewMatrixUniform = glGetUniformLocation(lightShader, "viewMatrix");
+			glUniformMatrix4fv(lightViewMatrixUniform, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+			GLint lightModelMatrixUniform = glGetUniformLocation(lightShader, "modelMatrix");
+
+			glUniformMatrix4fv(lightModelMatrixUniform, 1, GL_FALSE, glm::value_ptr(sphereTransforms));
+			glDrawElements(GL_TRIANGLES, meshLods[0].indexCount, GL_UNSIGNED_INT, (void*)0);
+			frameStats.meshesDrawn++;
+			frameStats.drawCalls++;
 
-		GLint lightProjectionMatrixUniform = glGetUniformLocation(lightShader, "projectionMatrix");
-		glUniformMatrix4fv(lightProjectionMatrixUniform, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-		GLint lightViewMatrixUniform = glGetUniformLocation(lightShader, "viewMatrix");
-		glUniformMatrix4fv(lightViewMatrixUniform, 1, GL_FALSE, glm::value_ptr(viewMatrix));
-		GLint lightModelMatrixUniform = glGetUniformLocation(lightShader, "modelMatrix");
+			// The atmospheres blend over their bodies
+			if (options.atmospheres) {
+				frameStats.drawCalls += atmospheres.Draw(projectionMatrix, viewMatrix, viewEye, glm::vec3(0.f), planets, sunVAO, meshLods[0].indexCount, view.rect.height);
+			}
 
-		glUniformMatrix4fv(lightModelMatrixUniform, 1, GL_FALSE, glm::value_ptr(sphereTransforms));
-		glDrawElements(GL_TRIANGLES, sphereIndices.size(), GL_UNSIGNED_INT, (void*)0);
+			// Trails and orbits go last, since they are blended over everything else; the map always shows the orbits
+			frameStats.drawCalls += trails.Draw(projectionMatrix, viewMatrix, trailsVisible, orbitsVisible || view.kind == VIEW_SYSTEM_MAP);
+		}
+		instanceStream.EndFrame();
+		glViewport(0, 0, renderWidth, renderHeight);
+
+		// Only the work of the frame counts: waiting for the frame rate limit or a vblank is not time the
+		// resolution could save, and with vsync on it would pin every frame at the budget. The swap comes after this.
+		dynamicResolution.EndFrame((float)(glfwGetTime() - workStart) * 1000.f);
+		frameCapture.CaptureFrame(dynamicResolution.SceneFramebuffer());
+		if (frameCapture.failed) {
+			// The frames asked for can no longer be written, so there is no point in going on
+			glfwSetWindowShouldClose(window, GLFW_TRUE);
+		}
 
-		glBindVertexArray(0);
-		// Movement
-		glfwGetCursorPos(window, &xMousePos, &yMousePos);
-		ProcessMovement(window, eye, target, up, moveSpeed);
-		FollowPlanet(window);
-		ProcessRevolutionSpeed(window, revolutionSpeed);
-		//std::cout << "Revolution speed:" << revolutionSpeed << std::endl;
-		glfwSetCursorPosCallback(window, ProcessMouse);
+		frameStats.frameTimeMs = frameTime * 1000.f;
+		frameStats.gpuTimeMs = dynamicResolution.gpuTimeMs;
+		frameStats.latencyMs = framePacer.latencyMs;
+		frameStats.renderScale = dynamicResolution.scale;
+		GpuMemoryStats gpuMemory = GetGpuMemoryStats();
+		frameStats.gpuMemoryBytes = gpuMemory.totalBytes;
+		frameStats.gpuPeakMemoryBytes = gpuMemory.peakBytes;
+		UpdateStatsOverlay(window, frameStats, glfwGetTime());
 
 		// "Unuse" the vertex array object
 		glBindVertexArray(0);
 
 		// Tell GLFW to swap the screen buffer with the offscreen buffer
 		glfwSwapBuffers(window);
+		framePacer.EndFrame();
 
-		// Tell GLFW to process window events (e.g., input events, window closed events, etc.)
-		glfwPollEvents();
+		shownRenderWidth = renderWidth;
+		shownRenderHeight = renderHeight;
+		frameCount++;
 	}
 
+	// Write out the frames that are still being read back or encoded
+	frameCapture.Stop();
+	inputRecorder.Close();
+
 	// --- Cleanup ---
 
+	// The handles would free everything when main returns, but the context is gone by then,
+	// so everything is released here while it is still current
+
 	// Make sure to delete the shader program
-	glDeleteProgram(program);
-	glDeleteProgram(skyboxShader);
+	program.Reset();
+	starShader.Reset();
+	lightShader.Reset();
+	impostorShader.Reset();
+	trailShader.Reset();
+	orbitShader.Reset();
+	atmosphereShader.Reset();
+	cullShader.Reset();
 
 	// Delete the VBO that contains our vertices
-	glDeleteBuffers(1, &vbo2);
-	glDeleteBuffers(1, &vbo1);
-
-	// Delete the vertex array object
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glDeleteVertexArrays(1, &vbo1);
-	glDeleteVertexArrays(1, &vbo2);
+	vbo2.Reset();
+	ibo.Reset();
+	quadVBO.Reset();
+
+	// Delete the vertex array object
+	vao2.Reset();
+	sunVAO.Reset();
+	impostorVAO.Reset();
 
 	// Delete our textures
-	glDeleteTextures(1, &tex0);
+	tex0.Reset();
+	textureStreamer.Destroy();
+
+	dynamicResolution.Destroy();
+	framePacer.Destroy();
+	statePublisher.Close();
+	instanceStream.Destroy();
+	gpuCulling.Destroy();
+	trails.Destroy();
+	starField.Destroy();
+	atmospheres.Destroy();
+
+	std::cout << "Texture streaming: " << textureStreamer.loads << " levels loaded, " << textureStreamer.evictions << " evicted" << std::endl;
+
+	// Anything still listed here was never released
+	ReportGpuResources();
+	jobs.Stop();
+	StopLog();
 
 	// Remember to tell GLFW to clean itself up before exiting the application
 	glfwTerminate();
 
-	return 0;
+	return frameCapture.failed ? 1 : 0;
 }
 
 /**
@@ -1146,6 +2422,36 @@ GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::s
 	return program;
 }
 
+/**
+ * @brief Creates a compute shader program based on the provided file path.
+ * @param[in] computeShaderFilePath Compute shader file path
+ * @return OpenGL handle to the created shader program
+ */
+GLuint CreateComputeShaderProgram(const std::string& computeShaderFilePath)
+{
+	GLuint computeShader = CreateShaderFromFile(GL_COMPUTE_SHADER, computeShaderFilePath);
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, computeShader);
+
+	glLinkProgram(program);
+
+	glDetachShader(program, computeShader);
+	glDeleteShader(computeShader);
+
+	// Check shader program link status
+	GLint linkStatus;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus != GL_TRUE) {
+		char infoLog[512];
+		GLsizei infoLogLen = sizeof(infoLog);
+		glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
+		std::cerr << "program link error: " << infoLog << std::endl;
+	}
+
+	return program;
+}
+
 /**
  * @brief Creates a shader based on the provided shader type and the path to the file containing the shader source.
  * @param[in] shaderType Shader type
@@ -1154,20 +2460,11 @@ GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::s
  */
 GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath)
 {
-	std::ifstream shaderFile(shaderFilePath);
-	if (shaderFile.fail())
-	{
-		std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
-		return 0;
-	}
-
 	std::string shaderSource;
-	std::string temp;
-	while (std::getline(shaderFile, temp))
+	if (!LoadShaderSource(shaderFilePath, shaderSource))
 	{
-		shaderSource += temp + "\n";
+		return 0;
 	}
-	shaderFile.close();
 
 	return CreateShaderFromSource(shaderType, shaderSource);
 }
@@ -1212,4 +2509,9 @@ void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
 	// Whenever the size of the framebuffer changed (due to window resizing, etc.),
 	// update the dimensions of the region to the new size
 	glViewport(0, 0, width, height);
+
+	// The offscreen framebuffer is resized at the start of the next frame
+	framebufferWidth = width;
+	framebufferHeight = height;
+	framebufferResized = true;
 }
\ No newline at end of file
@@ -0,0 +1,603 @@
+/**
+ * Sphere mesh generation (UV sphere, icosphere, cube-sphere) and vertex cache optimization.
+ */
+
+#include "Mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+const float PI = 3.14159265358979f;
+
+// A vertex this close to a pole has no meaningful longitude
+const float POLE_EPSILON = 1e-5f;
+
+// Weights of the Forsyth vertex score
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+void GenerateSphereVertices(std::vector<Vertex>& vertices, std::vector<int>& indices, float radius, int sectorCount, int stackCount, float color[3])
+{
+	// xyz, rgb, uv
+	// Both sizes are known up front, so each vector grows at most once
+	vertices.reserve(vertices.size() + (stackCount + 1) * (sectorCount + 1));
+	indices.reserve(indices.size() + 6 * sectorCount * (stackCount - 1));
+	Vertex v;
+
+	float xy;
+	float lengthInv = 1.0f / radius;
+
+	float sectorStep = 2 * PI / sectorCount;
+	float stackStep = PI / stackCount;
+	float sectorAngle, stackAngle;
+
+	for (int i = 0; i <= stackCount; ++i)
+	{
+		stackAngle = PI / 2 - i * stackStep;        // starting from pi/2 to -pi/2
+		xy = radius * cosf(stackAngle);             // r * cos(u)
+		v.z = radius * sinf(stackAngle);              // r * sin(u)
+
+		// add (sectorCount+1) vertices per stack
+		// the first and last vertices have same position and normal, but different tex coords
+		for (int j = 0; j <= sectorCount; ++j)
+		{
+			sectorAngle = j * sectorStep;           // starting from 0 to 2pi
+
+			// vertex position (x, y, z)
+			v.x = xy * cosf(sectorAngle);             // r * cos(u) * cos(v)
+			v.y = xy * sinf(sectorAngle);             // r * cos(u) * sin(v)
+
+			v.nx = v.x * lengthInv;
+			v.ny = v.y * lengthInv;
+			v.nz = v.z * lengthInv;
+
+			// vertex color (r, g, b)
+
+			v.r = color[0];
+			v.g = color[1];
+			v.b = color[2];
+
+			// vertex tex coord (s, t) range between [0, 1]
+			v.u = (float)j / sectorCount;
+			v.v = (float)i / stackCount;
+
+			vertices.push_back(v);
+		}
+	}
+	;
+	int k1, k2;
+	for (int i = 0; i < stackCount; ++i)
+	{
+		k1 = i * (sectorCount + 1);     // beginning of current stack
+		k2 = k1 + sectorCount + 1;      // beginning of next stack
+
+		for (int j = 0; j < sectorCount; ++j, ++k1, ++k2)
+		{
+			// 2 triangles per sector excluding first and last stacks
+			// k1 => k2 => k1+1
+			if (i != 0)
+			{
+				indices.push_back(k1);
+				indices.push_back(k2);
+				indices.push_back(k1 + 1);
+			}
+
+			// k1+1 => k2 => k2+1
+			if (i != (stackCount - 1))
+			{
+				indices.push_back(k1 + 1);
+				indices.push_back(k2);
+				indices.push_back(k2 + 1);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Longitude of a point on the unit sphere as a texture coordinate, like GenerateSphereVertices.
+ */
+static float SphereU(const glm::vec3& p)
+{
+	float u = atan2f(p.y, p.x) / (2.f * PI);
+	return u < 0.f ? u + 1.f : u;
+}
+
+/**
+ * @brief Latitude of a point on the unit sphere as a texture coordinate, like GenerateSphereVertices.
+ */
+static float SphereV(const glm::vec3& p)
+{
+	return 0.5f - asinf(glm::clamp(p.z, -1.f, 1.f)) / PI;
+}
+
+/**
+ * @brief Turns positions on the unit sphere into vertices with UV-coordinates. Triangles that cross
+ * the u = 0 seam get copies of their vertices with u + 1, and every triangle that touches a pole gets
+ * its own copy of the pole vertex with the u of its other two vertices, so the texture does not smear.
+ * @param[in] positions Positions on the unit sphere
+ * @param[in,out] indices Triangles; indices of split vertices are replaced by their copies
+ * @param[out] vertices Vertices to replace
+ */
+static void BuildSphereVertices(const std::vector<glm::vec3>& positions, std::vector<int>& indices, std::vector<Vertex>& vertices)
+{
+	int positionCount = (int)positions.size();
+	int triangleCount = (int)indices.size() / 3;
+
+	std::vector<float> us(positionCount);
+	for (int i = 0; i < positionCount; i++)
+	{
+		us[i] = SphereU(positions[i]);
+	}
+
+	// First pass: decide which vertices need copies, so the vertices can be allocated exactly
+	std::vector<int> seamCopies(positionCount, -1);
+	int copyCount = 0;
+	int poleCount = 0;
+	for (int t = 0; t < triangleCount; t++)
+	{
+		float minU = 2.f, maxU = -1.f;
+		for (int k = 0; k < 3; k++)
+		{
+			int index = indices[t * 3 + k];
+			if (fabsf(positions[index].z) > 1.f - POLE_EPSILON)
+			{
+				poleCount++;
+				continue;
+			}
+			minU = std::min(minU, us[index]);
+			maxU = std::max(maxU, us[index]);
+		}
+		if (maxU - minU <= 0.5f)
+		{
+			continue;
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			int index = indices[t * 3 + k];
+			if (fabsf(positions[index].z) <= 1.f - POLE_EPSILON && us[index] < 0.5f && seamCopies[index] < 0)
+			{
+				seamCopies[index] = positionCount + copyCount++;
+			}
+		}
+	}
+
+	vertices.clear();
+	vertices.reserve(positionCount + copyCount + poleCount);
+	vertices.resize(positionCount + copyCount);
+	for (int i = 0; i < positionCount; i++)
+	{
+		const glm::vec3& p = positions[i];
+		Vertex vertex(p.x, p.y, p.z, p.x, p.y, p.z, 255, 255, 255, us[i], SphereV(p));
+		vertices[i] = vertex;
+		if (seamCopies[i] >= 0)
+		{
+			vertex.u += 1.f;
+			vertices[seamCopies[i]] = vertex;
+		}
+	}
+
+	// Second pass: point the triangles at the copies
+	for (int t = 0; t < triangleCount; t++)
+	{
+		int* triangle = &indices[t * 3];
+		float minU = 2.f, maxU = -1.f;
+		for (int k = 0; k < 3; k++)
+		{
+			if (fabsf(positions[triangle[k]].z) <= 1.f - POLE_EPSILON)
+			{
+				minU = std::min(minU, us[triangle[k]]);
+				maxU = std::max(maxU, us[triangle[k]]);
+			}
+		}
+		if (maxU - minU > 0.5f)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				if (seamCopies[triangle[k]] >= 0)
+				{
+					triangle[k] = seamCopies[triangle[k]];
+				}
+			}
+		}
+
+		// A pole takes the average longitude of the rest of the triangle
+		float uSum = 0.f;
+		int uCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			if (fabsf(vertices[triangle[k]].z) <= 1.f - POLE_EPSILON)
+			{
+				uSum += vertices[triangle[k]].u;
+				uCount++;
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			if (fabsf(vertices[triangle[k]].z) > 1.f - POLE_EPSILON)
+			{
+				Vertex pole = vertices[triangle[k]];
+				pole.u = uCount > 0 ? uSum / uCount : 0.5f;
+				triangle[k] = (int)vertices.size();
+				vertices.push_back(pole);
+			}
+		}
+	}
+}
+
+void GenerateIcosphere(Mesh& mesh, int subdivisions)
+{
+	int finalVertexCount = 10 * (1 << (2 * subdivisions)) + 2;
+	int finalTriangleCount = 20 * (1 << (2 * subdivisions));
+
+	std::vector<glm::vec3> positions;
+	std::vector<int> indices;
+	positions.reserve(finalVertexCount);
+	indices.reserve(finalTriangleCount * 3);
+
+	// Icosahedron: three golden rectangles
+	float t = (1.f + sqrtf(5.f)) / 2.f;
+	const float corners[12][3] = {
+		{ -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+		{ 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+		{ t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+	};
+	const int faces[20][3] = {
+		{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+		{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+		{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+		{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+	};
+
+	// Rotated so that a vertex sits on each pole (+z and -z), like the UV sphere
+	glm::vec3 poleAxis = glm::normalize(glm::vec3(0.f, 1.f, t));
+	glm::vec3 sideAxis = glm::normalize(glm::cross(glm::vec3(1.f, 0.f, 0.f), poleAxis));
+	glm::vec3 thirdAxis = glm::cross(poleAxis, sideAxis);
+	for (int i = 0; i < 12; i++)
+	{
+		glm::vec3 corner = glm::normalize(glm::vec3(corners[i][0], corners[i][1], corners[i][2]));
+		positions.push_back(glm::vec3(glm::dot(corner, sideAxis), glm::dot(corner, thirdAxis), glm::dot(corner, poleAxis)));
+	}
+	for (int i = 0; i < 20; i++)
+	{
+		indices.push_back(faces[i][0]);
+		indices.push_back(faces[i][1]);
+		indices.push_back(faces[i][2]);
+	}
+
+	// Every level adds one vertex per edge of the previous level; neighboring triangles share it
+	std::unordered_map<uint64_t, int> midpoints;
+	std::vector<int> subdivided;
+	for (int level = 0; level < subdivisions; level++)
+	{
+		int triangleCount = (int)indices.size() / 3;
+		midpoints.clear();
+		midpoints.reserve(triangleCount * 3 / 2);
+		subdivided.clear();
+		subdivided.reserve(triangleCount * 12);
+
+		for (int tri = 0; tri < triangleCount; tri++)
+		{
+			int corner[3] = { indices[tri * 3], indices[tri * 3 + 1], indices[tri * 3 + 2] };
+			int middle[3];
+			for (int k = 0; k < 3; k++)
+			{
+				int a = std::min(corner[k], corner[(k + 1) % 3]);
+				int b = std::max(corner[k], corner[(k + 1) % 3]);
+				uint64_t key = ((uint64_t)a << 32) | (uint64_t)b;
+
+				std::unordered_map<uint64_t, int>::iterator found = midpoints.find(key);
+				if (found != midpoints.end())
+				{
+					middle[k] = found->second;
+					continue;
+				}
+				middle[k] = (int)positions.size();
+				positions.push_back(glm::normalize(positions[a] + positions[b]));
+				midpoints[key] = middle[k];
+			}
+
+			const int children[4][3] = {
+				{ corner[0], middle[0], middle[2] },
+				{ corner[1], middle[1], middle[0] },
+				{ corner[2], middle[2], middle[1] },
+				{ middle[0], middle[1], middle[2] }
+			};
+			for (int c = 0; c < 4; c++)
+			{
+				subdivided.push_back(children[c][0]);
+				subdivided.push_back(children[c][1]);
+				subdivided.push_back(children[c][2]);
+			}
+		}
+		indices.swap(subdivided);
+	}
+
+	mesh.indices.swap(indices);
+	BuildSphereVertices(positions, mesh.indices, mesh.vertices);
+}
+
+void GenerateCubeSphere(Mesh& mesh, int gridSize)
+{
+	int faceVertexCount = (gridSize + 1) * (gridSize + 1);
+
+	std::vector<glm::vec3> positions;
+	std::vector<int> indices;
+	positions.reserve(6 * faceVertexCount);
+	indices.reserve(6 * gridSize * gridSize * 6);
+
+	// Normal, then the two axes that span the face
+	const glm::vec3 faceAxes[6][3] = {
+		{ glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1) },
+		{ glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0) },
+		{ glm::vec3(0, 1, 0), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0) },
+		{ glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1) },
+		{ glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0) },
+		{ glm::vec3(0, 0, -1), glm::vec3(0, 1, 0), glm::vec3(1, 0, 0) }
+	};
+
+	for (int face = 0; face < 6; face++)
+	{
+		int first = (int)positions.size();
+		for (int j = 0; j <= gridSize; j++)
+		{
+			for (int i = 0; i <= gridSize; i++)
+			{
+				glm::vec3 p = faceAxes[face][0]
+					+ faceAxes[face][1] * (2.f * i / gridSize - 1.f)
+					+ faceAxes[face][2] * (2.f * j / gridSize - 1.f);
+
+				// Maps the cube onto the sphere with far less stretching than normalizing
+				glm::vec3 squared = p * p;
+				positions.push_back(glm::vec3(
+					p.x * sqrtf(1.f - squared.y / 2.f - squared.z / 2.f + squared.y * squared.z / 3.f),
+					p.y * sqrtf(1.f - squared.z / 2.f - squared.x / 2.f + squared.z * squared.x / 3.f),
+					p.z * sqrtf(1.f - squared.x / 2.f - squared.y / 2.f + squared.x * squared.y / 3.f)));
+			}
+		}
+
+		for (int j = 0; j < gridSize; j++)
+		{
+			for (int i = 0; i < gridSize; i++)
+			{
+				int corner = first + j * (gridSize + 1) + i;
+				indices.push_back(corner);
+				indices.push_back(corner + 1);
+				indices.push_back(corner + gridSize + 1);
+
+				indices.push_back(corner + 1);
+				indices.push_back(corner + gridSize + 2);
+				indices.push_back(corner + gridSize + 1);
+			}
+		}
+	}
+
+	mesh.indices.swap(indices);
+	BuildSphereVertices(positions, mesh.indices, mesh.vertices);
+}
+
+/**
+ * @brief Forsyth score of a vertex: high for vertices that are recent in the cache and for
+ * vertices with few triangles left, so they get finished off instead of being left behind.
+ * @param[in] cachePosition Position in the simulated cache, or -1 if the vertex is not in it
+ * @param[in] remainingTriangles Number of triangles that still use the vertex
+ */
+static float ForsythVertexScore(int cachePosition, int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+	{
+		return -1.f;
+	}
+
+	float score = 0.f;
+	if (cachePosition >= 0)
+	{
+		// The vertices of the last triangle get a fixed score, so the next triangle does not
+		// simply reuse the same edge over and over
+		if (cachePosition < 3)
+		{
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			float scale = 1.f / (VERTEX_CACHE_SIZE - 3);
+			score = powf(1.f - (cachePosition - 3) * scale, FORSYTH_CACHE_DECAY_POWER);
+		}
+	}
+
+	score += FORSYTH_VALENCE_BOOST_SCALE * powf((float)remainingTriangles, -FORSYTH_VALENCE_BOOST_POWER);
+	return score;
+}
+
+void OptimizeVertexCache(std::vector<int>& indices, int vertexCount)
+{
+	int triangleCount = (int)indices.size() / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles of every vertex, as one flat array with an offset per vertex
+	std::vector<int> remaining(vertexCount, 0);
+	for (int index : indices)
+	{
+		remaining[index]++;
+	}
+	std::vector<int> triangleOffsets(vertexCount + 1, 0);
+	for (int v = 0; v < vertexCount; v++)
+	{
+		triangleOffsets[v + 1] = triangleOffsets[v] + remaining[v];
+	}
+	std::vector<int> vertexTriangles(indices.size());
+	std::vector<int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+	for (int t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int v = indices[t * 3 + k];
+			vertexTriangles[fill[v]++] = t;
+		}
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (int v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = ForsythVertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (int t = 0; t < triangleCount; t++)
+	{
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+	}
+
+	// The cache holds three more entries than it really has while a triangle is being added
+	int cache[VERTEX_CACHE_SIZE + 3];
+	int cacheCount = 0;
+
+	std::vector<int> result;
+	result.reserve(indices.size());
+
+	int bestTriangle = -1;
+	int scanCursor = 0;
+	for (int emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		// Nothing in the cache is useful any more: continue with the best remaining triangle
+		if (bestTriangle < 0)
+		{
+			float bestScore = -1.f;
+			while (scanCursor < triangleCount && emitted[scanCursor])
+			{
+				scanCursor++;
+			}
+			for (int t = scanCursor; t < triangleCount; t++)
+			{
+				if (!emitted[t] && triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		int triangle = bestTriangle;
+		emitted[triangle] = true;
+		const int* corners = &indices[triangle * 3];
+
+		// Put the triangle's vertices at the front of the cache, then the old entries without them
+		int newCache[VERTEX_CACHE_SIZE + 3];
+		int newCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			int v = corners[k];
+			result.push_back(v);
+			newCache[newCount++] = v;
+
+			// The triangle is done, so it no longer counts for its vertices
+			int* first = &vertexTriangles[triangleOffsets[v]];
+			int* last = first + remaining[v];
+			*std::find(first, last, triangle) = *(last - 1);
+			remaining[v]--;
+		}
+		for (int c = 0; c < cacheCount; c++)
+		{
+			int v = cache[c];
+			if (v != corners[0] && v != corners[1] && v != corners[2])
+			{
+				newCache[newCount++] = v;
+			}
+		}
+
+		// Rescore everything in the cache (and whatever just fell out of it), then pick the best
+		// triangle among the ones that touch it
+		for (int c = 0; c < newCount; c++)
+		{
+			int v = newCache[c];
+			cachePositions[v] = c < VERTEX_CACHE_SIZE ? c : -1;
+			vertexScores[v] = ForsythVertexScore(cachePositions[v], remaining[v]);
+		}
+
+		bestTriangle = -1;
+		float bestScore = -1.f;
+		for (int c = 0; c < newCount; c++)
+		{
+			int v = newCache[c];
+			for (int i = 0; i < remaining[v]; i++)
+			{
+				int t = vertexTriangles[triangleOffsets[v] + i];
+				const int* other = &indices[t * 3];
+				triangleScores[t] = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+				if (triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		cacheCount = std::min(newCount, VERTEX_CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+	}
+
+	// Meshes that are already grids narrow enough for the cache can lose a little to the greedy order
+	if (MeasureVertexCache(result, vertexCount, VERTEX_CACHE_SIZE).acmr < MeasureVertexCache(indices, vertexCount, VERTEX_CACHE_SIZE).acmr)
+	{
+		indices.swap(result);
+	}
+}
+
+void OptimizeVertexFetch(Mesh& mesh)
+{
+	int vertexCount = (int)mesh.vertices.size();
+	std::vector<int> remap(vertexCount, -1);
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertexCount);
+
+	for (int& index : mesh.indices)
+	{
+		if (remap[index] < 0)
+		{
+			remap[index] = (int)reordered.size();
+			reordered.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	// Vertices no triangle uses are dropped
+	mesh.vertices.swap(reordered);
+}
+
+VertexCacheStats MeasureVertexCache(const std::vector<int>& indices, int vertexCount, int cacheSize)
+{
+	// In a FIFO cache a vertex stays until cacheSize other vertices have been loaded after it
+	std::vector<int> loadedAt(vertexCount, -cacheSize - 1);
+	std::vector<bool> used(vertexCount, false);
+	int misses = 0;
+	int usedCount = 0;
+
+	for (int index : indices)
+	{
+		if (misses - loadedAt[index] > cacheSize)
+		{
+			loadedAt[index] = misses;
+			misses++;
+		}
+		if (!used[index])
+		{
+			used[index] = true;
+			usedCount++;
+		}
+	}
+
+	VertexCacheStats stats;
+	stats.acmr = indices.empty() ? 0.f : (float)misses / (indices.size() / 3);
+	stats.atvr = usedCount == 0 ? 0.f : (float)misses / usedCount;
+	return stats;
+}
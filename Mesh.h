@@ -0,0 +1,132 @@
+/**
+ * Sphere mesh generation (UV sphere, icosphere, cube-sphere) and vertex cache optimization.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+
+// Entries of the post-transform vertex cache that indices are optimized for and measured against
+const int VERTEX_CACHE_SIZE = 32;
+
+/**
+ * Struct containing data about a vertex
+ */
+struct Vertex
+{
+	GLfloat x, y, z;	// Position
+	GLfloat nx, ny, nz; // Normals
+	GLubyte r, g, b;	// Color
+	GLfloat u, v;		// UV-coordinates
+
+	Vertex()
+	{
+
+	}
+
+	Vertex(GLfloat cx, GLfloat cy, GLfloat cz, GLfloat cnx, GLfloat cny, GLfloat cnz, GLubyte cr, GLubyte cg, GLfloat cb, GLfloat cu, GLfloat cv)
+	{
+		x = cx;
+		y = cy;
+		z = cz;
+		nx = cnx;
+		ny = cny;
+		nz = cnz;
+		r = cr;
+		g = cg;
+		b = cb;
+		u = cu;
+		v = cv;
+	}
+
+	Vertex(GLfloat vertex[3], GLfloat normals[3], GLubyte cr, GLubyte cg, GLfloat cb, GLfloat cu, GLfloat cv)
+	{
+		x = vertex[0];
+		y = vertex[1];
+		z = vertex[2];
+		nx = normals[0];
+		ny = normals[1];
+		nz = normals[2];
+		r = cr;
+		g = cg;
+		b = cb;
+		u = cu;
+		v = cv;
+	}
+};
+
+/**
+ * Struct containing an indexed triangle mesh
+ */
+struct Mesh
+{
+	std::vector<Vertex> vertices;
+	std::vector<int> indices;	// Three per triangle
+};
+
+/**
+ * Struct containing how well a triangle order uses the post-transform vertex cache
+ */
+struct VertexCacheStats
+{
+	float acmr;		// Average cache miss ratio: vertex shader runs per triangle (0.5 is the ideal for large meshes)
+	float atvr;		// Average transformed vertex ratio: vertex shader runs per vertex (1 is the ideal)
+};
+
+/**
+ * @brief Generates a UV sphere: rings of vertices from the +z pole to the -z pole, with the first
+ * and last vertex of every ring duplicated for the texture seam.
+ * @param[out] vertices Vertices are appended here
+ * @param[out] indices Indices are appended here
+ * @param[in] radius Radius of the sphere
+ * @param[in] sectorCount Number of vertices around each ring (plus the seam vertex)
+ * @param[in] stackCount Number of rings from pole to pole
+ * @param[in] color Vertex color, 0 to 255 per channel
+ */
+void GenerateSphereVertices(std::vector<Vertex>& vertices, std::vector<int>& indices, float radius, int sectorCount, int stackCount, float color[3]);
+
+/**
+ * @brief Generates a unit icosphere: an icosahedron whose triangles are split in four and pushed
+ * out to the sphere, so all triangles are nearly the same size (no clustering at the poles).
+ * UV-coordinates follow the same layout as GenerateSphereVertices.
+ * @param[out] mesh Mesh to replace
+ * @param[in] subdivisions Number of times the icosahedron is subdivided; gives 20 * 4^subdivisions triangles
+ */
+void GenerateIcosphere(Mesh& mesh, int subdivisions);
+
+/**
+ * @brief Generates a unit cube-sphere: every face of a cube is a grid that is mapped onto the
+ * sphere with the usual cube-to-sphere mapping, x * sqrt(1 - y^2/2 - z^2/2 + y^2 z^2/3) and so on.
+ * It is not equal-area, but its cells vary far less in size than those of a normalized cube.
+ * UV-coordinates follow the same layout as GenerateSphereVertices.
+ * @param[out] mesh Mesh to replace
+ * @param[in] gridSize Cells along each edge of a face; gives 12 * gridSize^2 triangles
+ */
+void GenerateCubeSphere(Mesh& mesh, int gridSize);
+
+/**
+ * @brief Reorders the triangles so that vertices are reused while they are still in the
+ * post-transform cache (Tom Forsyth's linear-speed vertex cache optimization). The original order
+ * is kept if it already has fewer cache misses.
+ * @param[in,out] indices Triangle list to reorder
+ * @param[in] vertexCount Number of vertices the indices refer to
+ */
+void OptimizeVertexCache(std::vector<int>& indices, int vertexCount);
+
+/**
+ * @brief Reorders the vertices in the order the triangles first use them, so vertex fetches
+ * read memory front to back. Call after OptimizeVertexCache.
+ * @param[in,out] mesh Mesh to reorder
+ */
+void OptimizeVertexFetch(Mesh& mesh);
+
+/**
+ * @brief Simulates a FIFO post-transform vertex cache.
+ * @param[in] indices Triangle list
+ * @param[in] vertexCount Number of vertices the indices refer to
+ * @param[in] cacheSize Number of cache entries
+ * @return Cache miss ratios of the triangle order
+ */
+VertexCacheStats MeasureVertexCache(const std::vector<int>& indices, int vertexCount, int cacheSize);
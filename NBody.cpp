@@ -0,0 +1,519 @@
+/**
+ * Mutual gravity between bodies: a leapfrog integrator with Barnes-Hut force evaluation.
+ */
+
+#include "NBody.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+
+// Bodies per job of the parallel passes
+const int NBODY_GRAIN_SIZE = 256;
+
+// Bits sorted per pass of the radix sort; 6 passes cover the 63 bits of a key
+const int RADIX_BITS = 11;
+
+/**
+ * @brief Spreads the low 21 bits of a value out to every third bit.
+ */
+static uint64_t SpreadBits(uint64_t value)
+{
+	value &= 0x1fffff;
+	value = (value | value << 32) & 0x1f00000000ffffULL;
+	value = (value | value << 16) & 0x1f0000ff0000ffULL;
+	value = (value | value << 8) & 0x100f00f00f00f00fULL;
+	value = (value | value << 4) & 0x10c30c30c30c30c3ULL;
+	value = (value | value << 2) & 0x1249249249249249ULL;
+	return value;
+}
+
+/**
+ * @brief Milliseconds since a point in time.
+ */
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+NBodySystem::NBodySystem()
+{
+	count = 0;
+	gravitationalConstant = 1.0;
+	softening = 1e-3;
+	theta = 0.5;
+	buildMs = 0.0;
+	forceMs = 0.0;
+	interactions = 0;
+}
+
+void NBodySystem::Init(JobSystem& jobs, const std::vector<glm::dvec3>& positions, const std::vector<glm::dvec3>& velocities, const std::vector<double>& masses)
+{
+	count = (int)positions.size();
+	x.resize(count);
+	y.resize(count);
+	z.resize(count);
+	vx.resize(count);
+	vy.resize(count);
+	vz.resize(count);
+	ax.assign(count, 0.0);
+	ay.assign(count, 0.0);
+	az.assign(count, 0.0);
+	mass = masses;
+	for (int i = 0; i < count; i++)
+	{
+		x[i] = positions[i].x;
+		y[i] = positions[i].y;
+		z[i] = positions[i].z;
+		vx[i] = velocities[i].x;
+		vy[i] = velocities[i].y;
+		vz[i] = velocities[i].z;
+	}
+
+	ids.resize(count);
+	slots.resize(count);
+	std::iota(ids.begin(), ids.end(), 0);
+	std::iota(slots.begin(), slots.end(), 0);
+
+	BuildTree(jobs);
+	ComputeAccelerations(jobs);
+}
+
+void NBodySystem::Step(JobSystem& jobs, double dt)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	// Kick by half a step with the old accelerations, then drift a full step
+	double halfStep = 0.5 * dt;
+	jobs.ParallelFor(count, NBODY_GRAIN_SIZE, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			vx[i] += ax[i] * halfStep;
+			vy[i] += ay[i] * halfStep;
+			vz[i] += az[i] * halfStep;
+			x[i] += vx[i] * dt;
+			y[i] += vy[i] * dt;
+			z[i] += vz[i] * dt;
+		}
+	});
+
+	BuildTree(jobs);
+	ComputeAccelerations(jobs);
+
+	// Kick by the other half with the accelerations at the new positions
+	jobs.ParallelFor(count, NBODY_GRAIN_SIZE, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			vx[i] += ax[i] * halfStep;
+			vy[i] += ay[i] * halfStep;
+			vz[i] += az[i] * halfStep;
+		}
+	});
+}
+
+glm::dvec3 NBodySystem::Position(int body) const
+{
+	int slot = slots[body];
+	return glm::dvec3(x[slot], y[slot], z[slot]);
+}
+
+glm::dvec3 NBodySystem::Velocity(int body) const
+{
+	int slot = slots[body];
+	return glm::dvec3(vx[slot], vy[slot], vz[slot]);
+}
+
+void NBodySystem::BuildTree(JobSystem& jobs)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	nodes.clear();
+	if (count == 0)
+	{
+		return;
+	}
+
+	// Bounding cube of all bodies
+	glm::dvec3 low(x[0], y[0], z[0]);
+	glm::dvec3 high = low;
+	std::mutex boundsMutex;
+	jobs.ParallelFor(count, NBODY_GRAIN_SIZE, [&](int begin, int end) {
+		glm::dvec3 chunkLow(x[begin], y[begin], z[begin]);
+		glm::dvec3 chunkHigh = chunkLow;
+		for (int i = begin; i < end; i++)
+		{
+			glm::dvec3 position(x[i], y[i], z[i]);
+			chunkLow = glm::min(chunkLow, position);
+			chunkHigh = glm::max(chunkHigh, position);
+		}
+		std::lock_guard<std::mutex> lock(boundsMutex);
+		low = glm::min(low, chunkLow);
+		high = glm::max(high, chunkHigh);
+	});
+	glm::dvec3 extent = high - low;
+	double size = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-9)) * (1.0 + 1e-9);
+
+	// Morton keys of the cells at the deepest level
+	double cellsPerUnit = (double)(1 << NBODY_MORTON_BITS) / size;
+	int maxCell = (1 << NBODY_MORTON_BITS) - 1;
+	keys.resize(count);
+	order.resize(count);
+	jobs.ParallelFor(count, NBODY_GRAIN_SIZE, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			int cellX = std::min(maxCell, (int)((x[i] - low.x) * cellsPerUnit));
+			int cellY = std::min(maxCell, (int)((y[i] - low.y) * cellsPerUnit));
+			int cellZ = std::min(maxCell, (int)((z[i] - low.z) * cellsPerUnit));
+			keys[i] = SpreadBits(cellX) | SpreadBits(cellY) << 1 | SpreadBits(cellZ) << 2;
+			order[i] = i;
+		}
+	});
+
+	// LSD radix sort; after an even number of passes the result is back in keys and order
+	sortedKeys.resize(count);
+	sortedOrder.resize(count);
+	std::vector<int> buckets(1 << RADIX_BITS);
+	for (int shift = 0; shift < 3 * NBODY_MORTON_BITS; shift += RADIX_BITS)
+	{
+		std::fill(buckets.begin(), buckets.end(), 0);
+		uint64_t mask = (1 << RADIX_BITS) - 1;
+		for (int i = 0; i < count; i++)
+		{
+			buckets[(keys[i] >> shift) & mask]++;
+		}
+		int total = 0;
+		for (int& bucket : buckets)
+		{
+			int bucketCount = bucket;
+			bucket = total;
+			total += bucketCount;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			int destination = buckets[(keys[i] >> shift) & mask]++;
+			sortedKeys[destination] = keys[i];
+			sortedOrder[destination] = order[i];
+		}
+		keys.swap(sortedKeys);
+		order.swap(sortedOrder);
+	}
+
+	// Move the state into the sorted order. The accelerations are recomputed from the new positions, so they are not moved.
+	scratch.resize(count);
+	std::vector<double>* arrays[7] = { &x, &y, &z, &vx, &vy, &vz, &mass };
+	for (std::vector<double>* values : arrays)
+	{
+		jobs.ParallelFor(count, NBODY_GRAIN_SIZE, [&](int begin, int end) {
+			for (int i = begin; i < end; i++)
+			{
+				scratch[i] = (*values)[order[i]];
+			}
+		});
+		values->swap(scratch);
+	}
+	scratchIds.resize(count);
+	jobs.ParallelFor(count, NBODY_GRAIN_SIZE, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			scratchIds[i] = ids[order[i]];
+			slots[scratchIds[i]] = i;
+		}
+	});
+	ids.swap(scratchIds);
+
+	nodes.resize(1);
+	groups.clear();
+	BuildNode(0, 0, count, 0, size, false);
+	buildMs = MillisecondsSince(start);
+}
+
+void NBodySystem::BuildNode(int nodeIndex, int begin, int end, int level, double size, bool inGroup)
+{
+	OctreeNode node;
+	node.size = size;
+	node.begin = begin;
+	node.end = end;
+	node.firstChild = -1;
+	node.childCount = 0;
+	node.mass = 0.0;
+	node.centerOfMass = glm::dvec3(0.0);
+
+	bool leaf = end - begin <= NBODY_LEAF_SIZE || level == NBODY_MORTON_BITS;
+	if (!inGroup && (end - begin <= NBODY_GROUP_SIZE || leaf))
+	{
+		groups.push_back(nodeIndex);
+		inGroup = true;
+	}
+
+	if (!leaf)
+	{
+		// The keys of the cell share everything above this level, so each child is the run of
+		// keys with the same prefix down to the child's three bits
+		int shift = 3 * (NBODY_MORTON_BITS - 1 - level);
+		int childBegins[9];
+		int childCount = 0;
+		int childBegin = begin;
+		while (childBegin < end)
+		{
+			uint64_t prefix = keys[childBegin] >> shift;
+			int childEnd = (int)(std::upper_bound(keys.begin() + childBegin, keys.begin() + end, prefix,
+				[shift](uint64_t value, uint64_t key) { return value < (key >> shift); }) - keys.begin());
+			childBegins[childCount++] = childBegin;
+			childBegin = childEnd;
+		}
+		childBegins[childCount] = end;
+
+		// The children are allocated together so a node only needs the first one's index
+		node.firstChild = (int)nodes.size();
+		node.childCount = childCount;
+		nodes.resize(nodes.size() + childCount);
+		for (int child = 0; child < childCount; child++)
+		{
+			BuildNode(node.firstChild + child, childBegins[child], childBegins[child + 1], level + 1, size * 0.5, inGroup);
+			const OctreeNode& childNode = nodes[node.firstChild + child];
+			node.mass += childNode.mass;
+			node.centerOfMass += childNode.centerOfMass * childNode.mass;
+		}
+	}
+	else
+	{
+		for (int i = begin; i < end; i++)
+		{
+			node.mass += mass[i];
+			node.centerOfMass += glm::dvec3(x[i], y[i], z[i]) * mass[i];
+		}
+	}
+
+	if (node.mass > 0.0)
+	{
+		node.centerOfMass /= node.mass;
+	}
+	nodes[nodeIndex] = node;
+}
+
+void NBodySystem::ComputeAccelerations(JobSystem& jobs)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::atomic<long long> interactionTotal(0);
+	jobs.ParallelFor((int)groups.size(), 1, [&](int begin, int end) {
+		InteractionList list;
+		long long chunkInteractions = 0;
+		for (int group = begin; group < end; group++)
+		{
+			chunkInteractions += AccelerateGroup(groups[group], list);
+		}
+		interactionTotal += chunkInteractions;
+	});
+	interactions = interactionTotal;
+	forceMs = MillisecondsSince(start);
+}
+
+long long NBodySystem::AccelerateGroup(int groupIndex, InteractionList& list)
+{
+	const OctreeNode& group = nodes[groupIndex];
+
+	// Bounding box of the group's bodies
+	glm::dvec3 boxLow(x[group.begin], y[group.begin], z[group.begin]);
+	glm::dvec3 boxHigh = boxLow;
+	for (int i = group.begin + 1; i < group.end; i++)
+	{
+		glm::dvec3 position(x[i], y[i], z[i]);
+		boxLow = glm::min(boxLow, position);
+		boxHigh = glm::max(boxHigh, position);
+	}
+
+	list.x.clear();
+	list.y.clear();
+	list.z.clear();
+	list.mass.clear();
+	double theta2 = theta * theta;
+
+	// Depth-first; every level adds at most 7 entries to what is already on the stack
+	int stack[8 * (NBODY_MORTON_BITS + 2)];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const OctreeNode& node = nodes[stack[--stackSize]];
+		if (node.mass <= 0.0)
+		{
+			continue;
+		}
+
+		// A cell counts as a single mass if it is small as seen from the nearest point of the box, and so from every body in it.
+		// A cell whose center of mass is inside the box, like the group itself, is at distance 0 and is always opened.
+		glm::dvec3 gap = glm::max(glm::max(boxLow - node.centerOfMass, node.centerOfMass - boxHigh), glm::dvec3(0.0));
+		if (node.size * node.size < theta2 * glm::dot(gap, gap))
+		{
+			list.x.push_back(node.centerOfMass.x);
+			list.y.push_back(node.centerOfMass.y);
+			list.z.push_back(node.centerOfMass.z);
+			list.mass.push_back(node.mass);
+		}
+		else if (node.firstChild < 0)
+		{
+			for (int j = node.begin; j < node.end; j++)
+			{
+				if (mass[j] > 0.0)
+				{
+					list.x.push_back(x[j]);
+					list.y.push_back(y[j]);
+					list.z.push_back(z[j]);
+					list.mass.push_back(mass[j]);
+				}
+			}
+		}
+		else
+		{
+			for (int child = 0; child < node.childCount; child++)
+			{
+				stack[stackSize++] = node.firstChild + child;
+			}
+		}
+	}
+
+	// Every body of the group sums over the same list. A body meets itself at distance 0, which adds nothing.
+	double softening2 = softening * softening;
+	int listSize = (int)list.mass.size();
+	const double* listX = list.x.data();
+	const double* listY = list.y.data();
+	const double* listZ = list.z.data();
+	const double* listMass = list.mass.data();
+	for (int i = group.begin; i < group.end; i++)
+	{
+		double px = x[i], py = y[i], pz = z[i];
+		double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+		for (int j = 0; j < listSize; j++)
+		{
+			double dx = listX[j] - px, dy = listY[j] - py, dz = listZ[j] - pz;
+			double distance2 = dx * dx + dy * dy + dz * dz + softening2;
+			double inverse = distance2 > 0.0 ? 1.0 / std::sqrt(distance2) : 0.0;
+			double scale = listMass[j] * inverse * inverse * inverse;
+			sumX += dx * scale;
+			sumY += dy * scale;
+			sumZ += dz * scale;
+		}
+		ax[i] = sumX * gravitationalConstant;
+		ay[i] = sumY * gravitationalConstant;
+		az[i] = sumZ * gravitationalConstant;
+	}
+
+	return (long long)listSize * (group.end - group.begin);
+}
+
+glm::dvec3 NBodySystem::DirectAcceleration(int slot) const
+{
+	glm::dvec3 acceleration(0.0);
+	double softening2 = softening * softening;
+	for (int j = 0; j < count; j++)
+	{
+		if (j == slot || mass[j] <= 0.0)
+		{
+			continue;
+		}
+		double dx = x[j] - x[slot], dy = y[j] - y[slot], dz = z[j] - z[slot];
+		double inverse = 1.0 / std::sqrt(dx * dx + dy * dy + dz * dz + softening2);
+		acceleration += glm::dvec3(dx, dy, dz) * (mass[j] * inverse * inverse * inverse);
+	}
+	return acceleration * gravitationalConstant;
+}
+
+/**
+ * @brief Samples a Plummer sphere of unit mass and scale radius in equilibrium (Aarseth, Henon and Wielen 1974).
+ * @param[in] bodies Number of bodies
+ * @param[in,out] gen Random number generator
+ * @param[out] positions Position of every body
+ * @param[out] velocities Velocity of every body
+ */
+static void GeneratePlummerSphere(int bodies, std::mt19937& gen, std::vector<glm::dvec3>& positions, std::vector<glm::dvec3>& velocities)
+{
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::normal_distribution<double> normal(0.0, 1.0);
+
+	positions.resize(bodies);
+	velocities.resize(bodies);
+	for (int i = 0; i < bodies; i++)
+	{
+		// The few bodies past 10 scale radii would only stretch the tree
+		double radius;
+		do
+		{
+			radius = 1.0 / std::sqrt(std::pow(std::max(uniform(gen), 1e-12), -2.0 / 3.0) - 1.0);
+		} while (radius > 10.0);
+
+		// Speed as a fraction of the escape speed, by rejection from q^2 (1 - q^2)^3.5
+		double q, g;
+		do
+		{
+			q = uniform(gen);
+			g = uniform(gen) * 0.1;
+		} while (g > q * q * std::pow(1.0 - q * q, 3.5));
+		double speed = q * std::sqrt(2.0) * std::pow(1.0 + radius * radius, -0.25);
+
+		glm::dvec3 direction(normal(gen), normal(gen), normal(gen));
+		glm::dvec3 velocityDirection(normal(gen), normal(gen), normal(gen));
+		positions[i] = glm::normalize(direction) * radius;
+		velocities[i] = glm::normalize(velocityDirection) * speed;
+	}
+}
+
+void RunNBodyBenchmark(JobSystem& jobs)
+{
+	const int BODY_COUNTS[3] = { 10000, 100000, 1000000 };
+	const double TIME_STEP = 1e-3;
+	const double MIN_SECONDS = 1.0;
+	const int ERROR_SAMPLES = 64;
+
+	std::cout << "N-body benchmark: Plummer spheres, theta 0.5, " << jobs.ThreadCount() << " threads" << std::endl;
+	for (int bodies : BODY_COUNTS)
+	{
+		std::mt19937 gen(1234);
+		std::vector<glm::dvec3> positions, velocities;
+		GeneratePlummerSphere(bodies, gen, positions, velocities);
+		std::vector<double> masses(bodies, 1.0 / bodies);
+
+		NBodySystem system;
+		system.softening = 0.01;
+		system.Init(jobs, positions, velocities, masses);
+
+		// As many steps as fit in a second, but at least one
+		int steps = 0;
+		double buildMs = 0.0, forceMs = 0.0;
+		long long interactions = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		do
+		{
+			system.Step(jobs, TIME_STEP);
+			steps++;
+			buildMs += system.buildMs;
+			forceMs += system.forceMs;
+			interactions += system.interactions;
+		} while (MillisecondsSince(start) < MIN_SECONDS * 1000.0);
+		double seconds = MillisecondsSince(start) / 1000.0;
+
+		// RMS relative error of the tree against an exact sum, over bodies spread through the sorted order
+		double errorSum = 0.0;
+		for (int sample = 0; sample < ERROR_SAMPLES; sample++)
+		{
+			int slot = (int)((long long)sample * bodies / ERROR_SAMPLES);
+			glm::dvec3 exact = system.DirectAcceleration(slot);
+			glm::dvec3 tree(system.ax[slot], system.ay[slot], system.az[slot]);
+			double error = glm::length(tree - exact) / std::max(glm::length(exact), 1e-30);
+			errorSum += error * error;
+		}
+
+		std::cout << "  " << bodies << " bodies: " << steps / seconds << " steps/s, "
+			<< (double)bodies * steps / seconds / 1e6 << " M body-steps/s (tree " << buildMs / steps << " ms, forces "
+			<< forceMs / steps << " ms, " << interactions / steps / bodies << " interactions per body, force error "
+			<< std::sqrt(errorSum / ERROR_SAMPLES) * 100.0 << "%)" << std::endl;
+	}
+}
@@ -0,0 +1,158 @@
+/**
+ * Mutual gravity between bodies: a leapfrog integrator with Barnes-Hut force evaluation.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct JobSystem;
+
+// Bodies per octree leaf; smaller leaves mean more nodes, bigger ones more direct sums
+const int NBODY_LEAF_SIZE = 8;
+
+// Most bodies that share one walk of the octree in the force pass
+const int NBODY_GROUP_SIZE = 64;
+
+// Levels of the octree, i.e. bits per axis of the Morton keys
+const int NBODY_MORTON_BITS = 21;
+
+/**
+ * Struct containing one cell of the octree. The bodies of a cell are contiguous, since they are kept in Morton order.
+ */
+struct OctreeNode
+{
+	glm::dvec3 centerOfMass;
+	double mass;
+	double size;		// Edge length of the cell
+	int firstChild;		// Index of the first child in nodes, or -1 for a leaf; the children are contiguous
+	int childCount;
+	int begin, end;		// Slots of the bodies in the cell
+};
+
+/**
+ * Struct containing the point masses one group of bodies interacts with
+ */
+struct InteractionList
+{
+	std::vector<double> x, y, z, mass;
+};
+
+/**
+ * The state is kept as structure of arrays and re-sorted into Morton order every step, so the
+ * octree is built from ranges of the sorted keys and the bodies close in space are close in
+ * memory during the force pass. Slots therefore change from step to step; ids and slots map
+ * between them and the body indices that were passed to Init.
+ *
+ * Forces are evaluated per group rather than per body (Barnes 1990): the tree is walked once
+ * for the bounding box of the bodies of a small cell, and all of them sum over the resulting
+ * list of cells and bodies in a tight loop. The opening test uses the nearest point of the box, so every body
+ * gets at least the accuracy of its own walk.
+ *
+ * Every step is kick-drift-kick leapfrog, which is symplectic: the energy error stays bounded
+ * instead of drifting, however many steps are taken. Bodies with no mass feel the others but pull on nothing.
+ */
+struct NBodySystem
+{
+	int count;
+	std::vector<double> x, y, z;
+	std::vector<double> vx, vy, vz;
+	std::vector<double> ax, ay, az;
+	std::vector<double> mass;
+	std::vector<int> ids;		// Body in each slot
+	std::vector<int> slots;		// Slot of each body
+
+	std::vector<OctreeNode> nodes;
+	std::vector<int> groups;	// Highest nodes with at most NBODY_GROUP_SIZE bodies, or leaves
+
+	double gravitationalConstant;
+	double softening;		// Added to every distance, so close encounters do not blow up
+	double theta;			// Opening angle: a cell is one point mass if size / distance < theta
+
+	// Timings and counters of the last step
+	double buildMs;
+	double forceMs;
+	long long interactions;
+
+	// Scratch space of the sort, kept between steps
+	std::vector<uint64_t> keys, sortedKeys;
+	std::vector<int> order, sortedOrder;
+	std::vector<double> scratch;
+	std::vector<int> scratchIds;
+
+	NBodySystem();
+
+	/**
+	 * @brief Sets the bodies and computes their first accelerations.
+	 * @param[in] jobs Job system that runs the work
+	 * @param[in] positions Position of every body
+	 * @param[in] velocities Velocity of every body
+	 * @param[in] masses Mass of every body, 0 for test particles
+	 */
+	void Init(JobSystem& jobs, const std::vector<glm::dvec3>& positions, const std::vector<glm::dvec3>& velocities, const std::vector<double>& masses);
+
+	/**
+	 * @brief Advances every body by one time step. Can be called from inside a task.
+	 * @param[in] jobs Job system that runs the work
+	 * @param[in] dt Time step
+	 */
+	void Step(JobSystem& jobs, double dt);
+
+	/**
+	 * @brief Position of a body.
+	 * @param[in] body Index the body had in Init
+	 */
+	glm::dvec3 Position(int body) const;
+
+	/**
+	 * @brief Velocity of a body.
+	 * @param[in] body Index the body had in Init
+	 */
+	glm::dvec3 Velocity(int body) const;
+
+	/**
+	 * @brief Sorts the bodies into Morton order and rebuilds the octree over them.
+	 */
+	void BuildTree(JobSystem& jobs);
+
+	/**
+	 * @brief Fills in a node and, recursively, the nodes below it.
+	 * @param[in] nodeIndex Node to fill in, already allocated
+	 * @param[in] begin First slot of the cell
+	 * @param[in] end One past the last slot of the cell
+	 * @param[in] level Depth of the cell
+	 * @param[in] size Edge length of the cell
+	 * @param[in] inGroup Whether a node above is already a group
+	 */
+	void BuildNode(int nodeIndex, int begin, int end, int level, double size, bool inGroup);
+
+	/**
+	 * @brief Computes the acceleration of every body from the octree.
+	 */
+	void ComputeAccelerations(JobSystem& jobs);
+
+	/**
+	 * @brief Walks the octree for one group and sets the accelerations of its bodies.
+	 * @param[in] groupIndex Node of the group
+	 * @param[in,out] list Space for the interaction list, reused between groups
+	 * @return Number of interactions summed
+	 */
+	long long AccelerateGroup(int groupIndex, InteractionList& list);
+
+	/**
+	 * @brief Acceleration of one body by summing over every other body, to check the tree against.
+	 * @param[in] slot Slot of the body
+	 */
+	glm::dvec3 DirectAcceleration(int slot) const;
+};
+
+/**
+ * @brief Times the integrator on Plummer spheres of 10k, 100k and 1M equal-mass bodies and prints the
+ * steps per second, how long the tree build and the force pass took and how far the tree forces are
+ * from an exact sum over a sample of bodies.
+ * @param[in] jobs Job system that runs the work
+ */
+void RunNBodyBenchmark(JobSystem& jobs);
@@ -0,0 +1,195 @@
+/**
+ * Software hierarchical-Z occlusion culling against the largest spheres in the scene.
+ */
+
+#include "Occlusion.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Width of the occlusion buffer in texels; the height follows the aspect ratio of the viewport
+const int OCCLUSION_BUFFER_WIDTH = 128;
+
+OcclusionBuffer::OcclusionBuffer()
+{
+	width = 0;
+	height = 0;
+	nearPlane = 0.1f;
+	occluderCount = 0;
+}
+
+void OcclusionBuffer::Clear(const glm::mat4& view, const glm::mat4& projection, float zNear, int viewportWidth, int viewportHeight)
+{
+	viewMatrix = view;
+	projectionMatrix = projection;
+	nearPlane = zNear;
+	occluderCount = 0;
+
+	int newWidth = OCCLUSION_BUFFER_WIDTH;
+	int newHeight = std::max(1, (int)std::lround((float)OCCLUSION_BUFFER_WIDTH * viewportHeight / std::max(viewportWidth, 1)));
+
+	if (newWidth != width || newHeight != height)
+	{
+		width = newWidth;
+		height = newHeight;
+		levels.clear();
+		levelWidths.clear();
+		levelHeights.clear();
+
+		int levelWidth = width;
+		int levelHeight = height;
+		while (true)
+		{
+			levels.push_back(std::vector<float>(levelWidth * levelHeight));
+			levelWidths.push_back(levelWidth);
+			levelHeights.push_back(levelHeight);
+
+			if (levelWidth == 1 && levelHeight == 1)
+			{
+				break;
+			}
+			levelWidth = std::max(1, (levelWidth + 1) / 2);
+			levelHeight = std::max(1, (levelHeight + 1) / 2);
+		}
+	}
+
+	std::fill(levels[0].begin(), levels[0].end(), FLT_MAX);
+}
+
+void OcclusionBuffer::AddOccluder(glm::vec3 center, float radius)
+{
+	glm::vec4 viewPos = viewMatrix * glm::vec4(center, 1.f);
+	float depth = -viewPos.z;
+
+	// Skip spheres that are behind the camera or that the camera is inside of
+	if (depth <= nearPlane || depth <= radius)
+	{
+		return;
+	}
+
+	glm::vec4 clipPos = projectionMatrix * viewPos;
+	float centerX = (clipPos.x / clipPos.w * 0.5f + 0.5f) * width;
+	float centerY = (clipPos.y / clipPos.w * 0.5f + 0.5f) * height;
+	float radiusX = radius / depth * projectionMatrix[0][0] * 0.5f * width;
+	float radiusY = radius / depth * projectionMatrix[1][1] * 0.5f * height;
+
+	int minY = std::max(0, (int)std::ceil(centerY - radiusY - 0.5f));
+	int maxY = std::min(height - 1, (int)std::floor(centerY + radiusY - 0.5f));
+	if (minY > maxY)
+	{
+		return;
+	}
+
+	std::vector<float>& buffer = levels[0];
+	for (int y = minY; y <= maxY; y++)
+	{
+		float dy = (y + 0.5f - centerY) / radiusY;
+		float halfSpan = radiusX * std::sqrt(std::max(0.f, 1.f - dy * dy));
+
+		int minX = std::max(0, (int)std::ceil(centerX - halfSpan - 0.5f));
+		int maxX = std::min(width - 1, (int)std::floor(centerX + halfSpan - 0.5f));
+		for (int x = minX; x <= maxX; x++)
+		{
+			float& texel = buffer[y * width + x];
+			texel = std::min(texel, depth);
+		}
+	}
+
+	occluderCount++;
+}
+
+void OcclusionBuffer::BuildPyramid()
+{
+	for (size_t level = 1; level < levels.size(); level++)
+	{
+		const std::vector<float>& src = levels[level - 1];
+		std::vector<float>& dst = levels[level];
+		int srcWidth = levelWidths[level - 1];
+		int srcHeight = levelHeights[level - 1];
+		int dstWidth = levelWidths[level];
+		int dstHeight = levelHeights[level];
+
+		for (int y = 0; y < dstHeight; y++)
+		{
+			int y0 = std::min(y * 2, srcHeight - 1);
+			int y1 = std::min(y * 2 + 1, srcHeight - 1);
+			for (int x = 0; x < dstWidth; x++)
+			{
+				int x0 = std::min(x * 2, srcWidth - 1);
+				int x1 = std::min(x * 2 + 1, srcWidth - 1);
+				dst[y * dstWidth + x] = std::max(
+					std::max(src[y0 * srcWidth + x0], src[y0 * srcWidth + x1]),
+					std::max(src[y1 * srcWidth + x0], src[y1 * srcWidth + x1]));
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::IsOccluded(glm::vec3 center, float radius) const
+{
+	if (occluderCount == 0)
+	{
+		return false;
+	}
+
+	glm::vec4 viewPos = viewMatrix * glm::vec4(center, 1.f);
+	float depth = -viewPos.z;
+	float nearestDepth = depth - radius;
+
+	// Anything that reaches the near plane is never hidden
+	if (nearestDepth <= nearPlane)
+	{
+		return false;
+	}
+
+	// Project the view-space bounding box of the sphere; each side divides by
+	// whichever of the near or far depth makes it widest on screen
+	float extentX[2] = { viewPos.x - radius, viewPos.x + radius };
+	float extentY[2] = { viewPos.y - radius, viewPos.y + radius };
+	float ndcMinX = projectionMatrix[0][0] * extentX[0] / (extentX[0] < 0.f ? nearestDepth : depth + radius);
+	float ndcMaxX = projectionMatrix[0][0] * extentX[1] / (extentX[1] > 0.f ? nearestDepth : depth + radius);
+	float ndcMinY = projectionMatrix[1][1] * extentY[0] / (extentY[0] < 0.f ? nearestDepth : depth + radius);
+	float ndcMaxY = projectionMatrix[1][1] * extentY[1] / (extentY[1] > 0.f ? nearestDepth : depth + radius);
+
+	int minX = (int)std::floor((ndcMinX * 0.5f + 0.5f) * width);
+	int maxX = (int)std::floor((ndcMaxX * 0.5f + 0.5f) * width);
+	int minY = (int)std::floor((ndcMinY * 0.5f + 0.5f) * height);
+	int maxY = (int)std::floor((ndcMaxY * 0.5f + 0.5f) * height);
+
+	// Off-screen spheres are left to the frustum
+	if (maxX < 0 || maxY < 0 || minX >= width || minY >= height)
+	{
+		return false;
+	}
+	minX = std::max(minX, 0);
+	minY = std::max(minY, 0);
+	maxX = std::min(maxX, width - 1);
+	maxY = std::min(maxY, height - 1);
+
+	// Walk up the pyramid until the rectangle covers at most 2x2 texels
+	size_t level = 0;
+	while (level + 1 < levels.size() && (maxX - minX > 1 || maxY - minY > 1))
+	{
+		level++;
+		minX /= 2;
+		minY /= 2;
+		maxX /= 2;
+		maxY /= 2;
+	}
+
+	const std::vector<float>& buffer = levels[level];
+	int levelWidth = levelWidths[level];
+	for (int y = minY; y <= maxY; y++)
+	{
+		for (int x = minX; x <= maxX; x++)
+		{
+			if (buffer[y * levelWidth + x] >= nearestDepth)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
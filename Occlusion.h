@@ -0,0 +1,61 @@
+/**
+ * Software hierarchical-Z occlusion culling against the largest spheres in the scene.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/**
+ * Low-resolution depth buffer that the biggest bodies (the sun and planets that cover a
+ * lot of the screen) are rasterized into on the CPU, followed by a max-depth mip pyramid.
+ * Other bodies test their bounding spheres against the pyramid before they are submitted.
+ * Depths are stored as linear view-space distances, so farther is larger.
+ */
+struct OcclusionBuffer
+{
+	int width, height;
+
+	// levels[0] is the full-resolution buffer, every level after it keeps the farthest depth of a 2x2 block
+	std::vector<std::vector<float>> levels;
+	std::vector<int> levelWidths, levelHeights;
+
+	glm::mat4 viewMatrix, projectionMatrix;
+	float nearPlane;
+	int occluderCount;
+
+	OcclusionBuffer();
+
+	/**
+	 * @brief Clears the buffer for a new frame and resizes it to match the aspect ratio of the viewport.
+	 * @param[in] view View matrix used for rendering
+	 * @param[in] projection Projection matrix used for rendering
+	 * @param[in] zNear Near plane of the projection
+	 * @param[in] viewportWidth Width of the viewport in pixels
+	 * @param[in] viewportHeight Height of the viewport in pixels
+	 */
+	void Clear(const glm::mat4& view, const glm::mat4& projection, float zNear, int viewportWidth, int viewportHeight);
+
+	/**
+	 * @brief Rasterizes a sphere as an occluder. The disc written is the one subtended by r / z,
+	 * which is always inside the true silhouette, at the depth of the sphere's center.
+	 * @param[in] center World-space center of the sphere
+	 * @param[in] radius Radius of the sphere
+	 */
+	void AddOccluder(glm::vec3 center, float radius);
+
+	/**
+	 * @brief Builds the max-depth mip pyramid. Call this after all occluders have been added.
+	 */
+	void BuildPyramid();
+
+	/**
+	 * @brief Tests whether a sphere is completely hidden behind the occluders.
+	 * @param[in] center World-space center of the sphere
+	 * @param[in] radius Radius of the sphere
+	 * @return True if the sphere does not need to be drawn
+	 */
+	bool IsOccluded(glm::vec3 center, float radius) const;
+};
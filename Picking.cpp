@@ -0,0 +1,283 @@
+/**
+ * Ray casting against the bounding spheres of the bodies, used to pick a body with the mouse.
+ */
+
+#include "Picking.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Deepest the traversal stack can get; a median split keeps the tree depth near log2(n / BVH_LEAF_SIZE)
+const int BVH_STACK_SIZE = 64;
+
+/**
+ * Struct containing a node that still has to be split while building
+ */
+struct BuildTask
+{
+	int node;
+	int first, count;
+};
+
+/**
+ * Struct containing a sphere together with its original index, so the two move together while building
+ */
+struct BuildSphere
+{
+	glm::vec4 sphere;
+	int index;
+};
+
+/**
+ * @brief Computes the surface area of a node's box, which is proportional to how likely a ray is to visit it.
+ */
+static float SurfaceArea(const BVHNode& node)
+{
+	glm::vec3 size = glm::max(node.boundsMax - node.boundsMin, glm::vec3(0.f));
+	return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+SphereBVH::SphereBVH()
+{
+	builtArea = 0.f;
+}
+
+void SphereBVH::Build(const std::vector<glm::vec4>& bodySpheres)
+{
+	int sphereCount = (int)bodySpheres.size();
+
+	// The spheres themselves are partitioned (instead of a list of indices into them), so every
+	// pass over a node reads memory in order; with millions of bodies this is what the build time depends on
+	std::vector<BuildSphere> items(sphereCount);
+	for (int i = 0; i < sphereCount; i++)
+	{
+		items[i].sphere = bodySpheres[i];
+		items[i].index = i;
+	}
+
+	nodes.clear();
+	spheres.clear();
+	indices.clear();
+	builtArea = 0.f;
+	if (sphereCount == 0)
+	{
+		return;
+	}
+	// Every split leaves at least two spheres on each side, so there are fewer nodes than spheres
+	nodes.reserve(std::max(sphereCount, 1));
+	nodes.push_back(BVHNode());
+
+	std::vector<BuildTask> tasks;
+	tasks.push_back({ 0, 0, sphereCount });
+	while (!tasks.empty())
+	{
+		BuildTask task = tasks.back();
+		tasks.pop_back();
+
+		// Bounds of the spheres, and of their centers for picking the split
+		glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+		glm::vec3 centerMin(FLT_MAX), centerMax(-FLT_MAX);
+		for (int i = task.first; i < task.first + task.count; i++)
+		{
+			const glm::vec4& sphere = items[i].sphere;
+			glm::vec3 center(sphere);
+			boundsMin = glm::min(boundsMin, center - glm::vec3(sphere.w));
+			boundsMax = glm::max(boundsMax, center + glm::vec3(sphere.w));
+			centerMin = glm::min(centerMin, center);
+			centerMax = glm::max(centerMax, center);
+		}
+
+		BVHNode& node = nodes[task.node];
+		node.boundsMin = boundsMin;
+		node.boundsMax = boundsMax;
+
+		glm::vec3 extent = centerMax - centerMin;
+		int axis = 0;
+		if (extent.y > extent[axis])
+		{
+			axis = 1;
+		}
+		if (extent.z > extent[axis])
+		{
+			axis = 2;
+		}
+
+		// Small groups, and groups that all share one center, become leaves
+		if (task.count <= BVH_LEAF_SIZE || extent[axis] <= 0.f)
+		{
+			node.first = task.first;
+			node.count = task.count;
+			continue;
+		}
+
+		// Split at the median center along the longest axis, so both halves get the same number of spheres
+		int half = task.count / 2;
+		std::vector<BuildSphere>::iterator begin = items.begin() + task.first;
+		std::nth_element(begin, begin + half, begin + task.count, [axis](const BuildSphere& a, const BuildSphere& b) {
+			return a.sphere[axis] < b.sphere[axis];
+		});
+
+		int firstChild = (int)nodes.size();
+		node.first = firstChild;
+		node.count = 0;
+		nodes.push_back(BVHNode());
+		nodes.push_back(BVHNode());
+
+		tasks.push_back({ firstChild, task.first, half });
+		tasks.push_back({ firstChild + 1, task.first + half, task.count - half });
+	}
+
+	spheres.resize(sphereCount);
+	indices.resize(sphereCount);
+	for (int i = 0; i < sphereCount; i++)
+	{
+		spheres[i] = items[i].sphere;
+		indices[i] = items[i].index;
+	}
+	for (const BVHNode& node : nodes)
+	{
+		builtArea += SurfaceArea(node);
+	}
+}
+
+bool SphereBVH::Refit(const std::vector<glm::vec4>& bodySpheres)
+{
+	if (nodes.empty() || bodySpheres.size() != spheres.size())
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		spheres[i] = bodySpheres[indices[i]];
+	}
+
+	// Children always come after their parent, so going backwards every child is done before its parent
+	float area = 0.f;
+	for (int i = (int)nodes.size() - 1; i >= 0; i--)
+	{
+		BVHNode& node = nodes[i];
+		if (node.count > 0)
+		{
+			node.boundsMin = glm::vec3(FLT_MAX);
+			node.boundsMax = glm::vec3(-FLT_MAX);
+			for (int s = node.first; s < node.first + node.count; s++)
+			{
+				glm::vec3 center(spheres[s]);
+				node.boundsMin = glm::min(node.boundsMin, center - glm::vec3(spheres[s].w));
+				node.boundsMax = glm::max(node.boundsMax, center + glm::vec3(spheres[s].w));
+			}
+		}
+		else
+		{
+			node.boundsMin = glm::min(nodes[node.first].boundsMin, nodes[node.first + 1].boundsMin);
+			node.boundsMax = glm::max(nodes[node.first].boundsMax, nodes[node.first + 1].boundsMax);
+		}
+		area += SurfaceArea(node);
+	}
+	return area <= builtArea * BVH_REFIT_MAX_GROWTH;
+}
+
+/**
+ * @brief Intersects a ray with an axis-aligned box.
+ * @return Distance where the ray enters the box, or FLT_MAX if it misses
+ */
+static float IntersectBox(const BVHNode& node, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance)
+{
+	glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+	glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+int SphereBVH::Raycast(glm::vec3 origin, glm::vec3 direction, float& hitDistance) const
+{
+	int hit = -1;
+	hitDistance = FLT_MAX;
+	if (nodes.empty())
+	{
+		return hit;
+	}
+
+	// Division by a zero component gives infinity, which the slab test handles
+	glm::vec3 inverseDirection = 1.f / direction;
+
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	if (IntersectBox(nodes[0], origin, inverseDirection, hitDistance) != FLT_MAX)
+	{
+		stack[stackSize++] = 0;
+	}
+
+	while (stackSize > 0)
+	{
+		const BVHNode& node = nodes[stack[--stackSize]];
+
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				const glm::vec4& sphere = spheres[i];
+				glm::vec3 offset = origin - glm::vec3(sphere);
+				float b = glm::dot(offset, direction);
+				float c = glm::dot(offset, offset) - sphere.w * sphere.w;
+				float discriminant = b * b - c;
+				if (discriminant < 0.f)
+				{
+					continue;
+				}
+
+				// Nearest intersection in front of the origin (the far one if the origin is inside)
+				float root = std::sqrt(discriminant);
+				float t = -b - root;
+				if (t < 0.f)
+				{
+					t = -b + root;
+				}
+				if (t >= 0.f && t < hitDistance)
+				{
+					hitDistance = t;
+					hit = indices[i];
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first, so the farther one can often be skipped
+		int nearChild = node.first;
+		int farChild = node.first + 1;
+		float nearDistance = IntersectBox(nodes[nearChild], origin, inverseDirection, hitDistance);
+		float farDistance = IntersectBox(nodes[farChild], origin, inverseDirection, hitDistance);
+		if (farDistance < nearDistance)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(nearDistance, farDistance);
+		}
+
+		if (farDistance != FLT_MAX && stackSize < BVH_STACK_SIZE)
+		{
+			stack[stackSize++] = farChild;
+		}
+		if (nearDistance != FLT_MAX && stackSize < BVH_STACK_SIZE)
+		{
+			stack[stackSize++] = nearChild;
+		}
+	}
+
+	return hit;
+}
+
+void ScreenPointToRay(float ndcX, float ndcY, const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, glm::vec3& origin, glm::vec3& direction)
+{
+	glm::mat4 inverseViewProjection = glm::inverse(projectionMatrix * viewMatrix);
+	glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.f, 1.f);
+	glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.f, 1.f);
+
+	origin = glm::vec3(nearPoint) / nearPoint.w;
+	direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
@@ -0,0 +1,78 @@
+/**
+ * Ray casting against the bounding spheres of the bodies, used to pick a body with the mouse.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Most bodies a leaf of the bounding volume hierarchy holds
+const int BVH_LEAF_SIZE = 4;
+
+// A refitted hierarchy is rebuilt once the surface area of its nodes has grown by this factor since the last
+// build, since the bodies have moved far enough that its boxes overlap a lot and the rays visit many of them
+const float BVH_REFIT_MAX_GROWTH = 2.f;
+
+/**
+ * Struct containing one node of the bounding volume hierarchy. An inner node's children are stored
+ * next to each other starting at first; a leaf's spheres are spheres[first, first + count).
+ */
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+	int first;		// First child for inner nodes, first entry in spheres for leaves
+	glm::vec3 boundsMax;
+	int count;		// Number of spheres in a leaf, 0 for inner nodes
+};
+
+/**
+ * Bounding volume hierarchy over spheres, stored as a flat array of nodes.
+ * Building takes O(n log n) and a ray query visits O(log n) nodes, so picking stays cheap for
+ * catalogs with millions of bodies.
+ */
+struct SphereBVH
+{
+	std::vector<BVHNode> nodes;
+	std::vector<glm::vec4> spheres;		// Center in xyz, radius in w, grouped by leaf
+	std::vector<int> indices;			// Index that each entry of spheres had when it was passed to Build
+	float builtArea;					// Summed surface area of the nodes right after the last build
+
+	SphereBVH();
+
+	/**
+	 * @brief Builds the hierarchy over a set of spheres, replacing the previous one.
+	 * @param[in] bodySpheres Spheres to index (center in xyz, radius in w)
+	 */
+	void Build(const std::vector<glm::vec4>& bodySpheres);
+
+	/**
+	 * @brief Moves the spheres to new positions and recomputes the bounds of every node, keeping the tree
+	 * as it is. Takes O(n), against O(n log n) for a build.
+	 * @param[in] bodySpheres The spheres passed to Build, in the same order, at their new positions
+	 * @return False if the tree has to be built again instead: the number of spheres changed, or the
+	 * nodes grew by more than BVH_REFIT_MAX_GROWTH
+	 */
+	bool Refit(const std::vector<glm::vec4>& bodySpheres);
+
+	/**
+	 * @brief Finds the first sphere hit by a ray.
+	 * @param[in] origin Origin of the ray
+	 * @param[in] direction Normalized direction of the ray
+	 * @param[out] hitDistance Distance along the ray to the hit
+	 * @return Index of the sphere that was hit, or -1 if the ray hits nothing
+	 */
+	int Raycast(glm::vec3 origin, glm::vec3 direction, float& hitDistance) const;
+};
+
+/**
+ * @brief Turns a point on the screen into a world-space ray from the camera.
+ * @param[in] ndcX Horizontal position in normalized device coordinates (-1 is the left edge)
+ * @param[in] ndcY Vertical position in normalized device coordinates (-1 is the bottom edge)
+ * @param[in] projectionMatrix Projection matrix used for rendering
+ * @param[in] viewMatrix View matrix used for rendering
+ * @param[out] origin Origin of the ray, on the near plane
+ * @param[out] direction Normalized direction of the ray
+ */
+void ScreenPointToRay(float ndcX, float ndcY, const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, glm::vec3& origin, glm::vec3& direction);
@@ -0,0 +1,45 @@
+/**
+ * The bodies of the solar system and the Keplerian ellipses they follow. Needs no GL context, so the benchmarks can use it.
+ */
+
+#include "Planet.h"
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+void CrossProduct (float cross[3], float origin[3], float start[3], float end[3])
+{
+	float a[3] = { start[0] - origin[0], start[1] - origin[1], start[2] - origin[2] };
+	float b[3] = { end[0] - origin[0], end[1] - origin[1], end[2] - origin[2] };
+
+	cross[0] = (a[1] * b[2]) - (a[2] * b[1]);
+	cross[1] = (a[0] * b[2]) - (a[2] * b[0]);
+	cross[2] = (a[0] * b[1]) - (a[1] * b[0]);
+}
+
+void Planet::ComputeMinorAxis() {
+	minorAxis = majorAxis * sqrt(1 - (pow(eccentricity, 2)));
+}
+
+void ComputeOrbitPosition(const Planet& planet, double simTime, float revolutionSpeed, float& x1, float& z1)
+{
+	double degrees = fmod(simTime * planet.speed * revolutionSpeed + planet.phaseShift, 360.0);
+	float orbitAngle = glm::radians((float)degrees);
+	x1 = planet.majorAxis * glm::cos(orbitAngle);
+	z1 = planet.minorAxis * -glm::sin(orbitAngle);
+}
+
+void ComputeOrbitVelocity(const Planet& planet, double simTime, float revolutionSpeed, float& vx, float& vz)
+{
+	double degrees = fmod(simTime * planet.speed * revolutionSpeed + planet.phaseShift, 360.0);
+	float orbitAngle = glm::radians((float)degrees);
+	float angularSpeed = glm::radians(planet.speed * revolutionSpeed);
+	vx = -planet.majorAxis * glm::sin(orbitAngle) * angularSpeed;
+	vz = -planet.minorAxis * glm::cos(orbitAngle) * angularSpeed;
+}
+
+void UpdateOrbitPosition(Planet& planet, double simTime, float revolutionSpeed)
+{
+	ComputeOrbitPosition(planet, simTime, revolutionSpeed, planet.x1, planet.z1);
+}
@@ -0,0 +1,78 @@
+/**
+ * The bodies of the solar system and the Keplerian ellipses they follow. Needs no GL context, so the benchmarks can use it.
+ */
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+
+void CrossProduct (float cross[3], float origin[3], float start[3], float end[3]);
+
+struct Planet {
+	GLfloat radius, majorAxis, minorAxis, angle, speed, eccentricity;
+	GLfloat cx, cy, cz, x1, y1, z1;
+	GLfloat phaseShift;
+	double mass;	// Relative to the sun; 0 for bodies that feel gravity but pull on nothing
+	std::string textureMap, name;
+	GLuint texture;
+	
+	Planet(){
+		texture = 0;
+		mass = 0.0;
+		radius = 1.0f;
+		majorAxis = 1.0f;
+		minorAxis = 1.0f;
+		angle = 0.f;
+		cx = 0.f;
+		cy = 0.f;
+		cz = 0.f;
+		speed = 90.0f;
+	}
+
+	Planet(std::string n, float r, float m1, float m2, float a, float s, float x, float y, float z) {
+		texture = 0;
+		mass = 0.0;
+		name = n;
+		radius = r;
+		majorAxis = m1;
+		minorAxis = m2;
+		angle = a;
+		speed = s;
+		cx = x;
+		cy = y;
+		cz = z;
+	}
+
+	void ComputeMinorAxis();
+};
+
+/**
+ * @brief Computes where a body is on its ellipse at the given time, without moving it. The angle is
+ * reduced in double precision, so it stays exact over spans of centuries.
+ * @param[in] planet Body on its ellipse
+ * @param[in] simTime Simulated time since the start
+ * @param[in] revolutionSpeed Speed-up of the simulation
+ * @param[out] x1 Offset from the center of the ellipse along the major axis
+ * @param[out] z1 Offset from the center of the ellipse along the minor axis
+ */
+void ComputeOrbitPosition(const Planet& planet, double simTime, float revolutionSpeed, float& x1, float& z1);
+
+/**
+ * @brief Computes how fast a body moves along its ellipse at the given time.
+ * @param[in] planet Body on its ellipse
+ * @param[in] simTime Simulated time since the start
+ * @param[in] revolutionSpeed Speed-up of the simulation
+ * @param[out] vx Velocity along the major axis, per simulated second
+ * @param[out] vz Velocity along the minor axis, per simulated second
+ */
+void ComputeOrbitVelocity(const Planet& planet, double simTime, float revolutionSpeed, float& vx, float& vz);
+
+/**
+ * @brief Moves a body to where it is on its ellipse at the given time.
+ * @param[in,out] planet Body to move; sets x1 and z1
+ * @param[in] simTime Simulated time since the start
+ * @param[in] revolutionSpeed Speed-up of the simulation
+ */
+void UpdateOrbitPosition(Planet& planet, double simTime, float revolutionSpeed);
@@ -0,0 +1,28 @@
+/**
+ * Reading shader sources from files, kept apart from compiling them so it needs no GL context.
+ */
+
+#include "ShaderSource.h"
+
+#include <fstream>
+#include <iostream>
+
+bool LoadShaderSource(const std::string& shaderFilePath, std::string& shaderSource)
+{
+	std::ifstream shaderFile(shaderFilePath);
+	if (shaderFile.fail())
+	{
+		std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
+		return false;
+	}
+
+	shaderSource.clear();
+	std::string temp;
+	while (std::getline(shaderFile, temp))
+	{
+		shaderSource += temp + "\n";
+	}
+	shaderFile.close();
+
+	return true;
+}
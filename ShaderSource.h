@@ -0,0 +1,15 @@
+/**
+ * Reading shader sources from files, kept apart from compiling them so it needs no GL context.
+ */
+
+#pragma once
+
+#include <string>
+
+/**
+ * @brief Reads a shader source file line by line, ending every line with a newline.
+ * @param[in] shaderFilePath Path to the file containing the shader source
+ * @param[out] shaderSource Contents of the file
+ * @return False if the file could not be opened
+ */
+bool LoadShaderSource(const std::string& shaderFilePath, std::string& shaderSource);
@@ -0,0 +1,335 @@
+/**
+ * Live body state in shared memory, for other programs on the same machine (dashboards, recorders).
+ */
+
+#include "SharedState.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Rounds a size up to SHARED_STATE_ALIGNMENT.
+ */
+static uint64_t AlignShared(uint64_t size)
+{
+	return (size + SHARED_STATE_ALIGNMENT - 1) / SHARED_STATE_ALIGNMENT * SHARED_STATE_ALIGNMENT;
+}
+
+#ifdef _WIN32
+/**
+ * @brief Name of the file mapping for a shared memory name. POSIX names start with a slash,
+ * which Windows does not want, and the mapping is only visible within the session.
+ */
+static std::string MappingName(const std::string& name)
+{
+	return "Local\\" + (name.empty() || name[0] != '/' ? name : name.substr(1));
+}
+#else
+/**
+ * @brief POSIX shared memory names have to start with a slash.
+ */
+static std::string MappingName(const std::string& name)
+{
+	return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+#endif
+
+/**
+ * @brief Creates shared memory of the given size, or empties the existing one.
+ * @param[in,out] mapping Mapping whose name is set; memory, size and handle are filled in
+ * @param[in] size Bytes to map
+ * @return False if the shared memory could not be created
+ */
+static bool CreateSharedMemory(SharedStateMapping& mapping, size_t size)
+{
+	std::string name = MappingName(mapping.name);
+#ifdef _WIN32
+	HANDLE handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, name.c_str());
+	if (handle == nullptr)
+	{
+		return false;
+	}
+	void* memory = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (memory == nullptr)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	mapping.handle = handle;
+#else
+	// A run that crashed leaves its shared memory behind, possibly with another body count
+	shm_unlink(name.c_str());
+	int file = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (file < 0)
+	{
+		return false;
+	}
+	void* memory = MAP_FAILED;
+	if (ftruncate(file, (off_t)size) == 0)
+	{
+		memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	}
+	close(file);
+	if (memory == MAP_FAILED)
+	{
+		shm_unlink(name.c_str());
+		return false;
+	}
+#endif
+	mapping.memory = memory;
+	mapping.size = size;
+	memset(memory, 0, size);
+	return true;
+}
+
+/**
+ * @brief Maps existing shared memory for reading.
+ * @param[in,out] mapping Mapping whose name is set; memory, size and handle are filled in
+ * @return False if there is no such shared memory
+ */
+static bool OpenSharedMemory(SharedStateMapping& mapping)
+{
+	std::string name = MappingName(mapping.name);
+#ifdef _WIN32
+	HANDLE handle = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+	if (handle == nullptr)
+	{
+		return false;
+	}
+	void* memory = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if (memory == nullptr || VirtualQuery(memory, &info, sizeof(info)) == 0)
+	{
+		if (memory != nullptr)
+		{
+			UnmapViewOfFile(memory);
+		}
+		CloseHandle(handle);
+		return false;
+	}
+	mapping.handle = handle;
+	mapping.size = info.RegionSize;
+#else
+	int file = shm_open(name.c_str(), O_RDONLY, 0);
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat status;
+	void* memory = MAP_FAILED;
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		memory = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, file, 0);
+	}
+	close(file);
+	if (memory == MAP_FAILED)
+	{
+		return false;
+	}
+	mapping.size = (size_t)status.st_size;
+#endif
+	mapping.memory = memory;
+	return true;
+}
+
+SharedStateMapping::SharedStateMapping()
+{
+	memory = nullptr;
+	size = 0;
+	handle = nullptr;
+}
+
+SharedStateHeader* SharedStateMapping::Header() const
+{
+	return static_cast<SharedStateHeader*>(memory);
+}
+
+void SharedStateMapping::ViewSlot(int index, SharedStateView& view) const
+{
+	const SharedStateHeader* header = Header();
+	unsigned char* slotStart = static_cast<unsigned char*>(memory) + header->slotsOffset + index * header->slotBytes;
+	unsigned char* columns = slotStart + AlignShared(sizeof(SharedStateSlot));
+
+	view.bodyCount = (int)header->bodyCount;
+	view.slot = reinterpret_cast<SharedStateSlot*>(slotStart);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		view.positions[axis] = reinterpret_cast<float*>(columns + axis * header->columnBytes);
+		view.velocities[axis] = reinterpret_cast<float*>(columns + (3 + axis) * header->columnBytes);
+	}
+}
+
+void SharedStateMapping::Unmap()
+{
+	if (memory == nullptr)
+	{
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(memory);
+	CloseHandle(static_cast<HANDLE>(handle));
+#else
+	munmap(memory, size);
+#endif
+	memory = nullptr;
+	size = 0;
+	handle = nullptr;
+}
+
+SharedStatePublisher::SharedStatePublisher()
+{
+	snapshot = 0;
+	current = SharedStateView();
+}
+
+bool SharedStatePublisher::Open(const std::string& name, const std::vector<std::string>& names)
+{
+	uint64_t bodyCount = names.size();
+	uint64_t namesOffset = AlignShared(sizeof(SharedStateHeader));
+	uint64_t slotsOffset = namesOffset + AlignShared(bodyCount * SHARED_STATE_NAME_LENGTH);
+	uint64_t columnBytes = AlignShared(bodyCount * sizeof(float));
+	uint64_t slotBytes = AlignShared(sizeof(SharedStateSlot)) + 6 * columnBytes;
+
+	mapping.name = name;
+	if (!CreateSharedMemory(mapping, (size_t)(slotsOffset + SHARED_STATE_SLOT_COUNT * slotBytes)))
+	{
+		std::cerr << "Unable to create shared memory: " << name << std::endl;
+		return false;
+	}
+
+	char* nameTable = static_cast<char*>(mapping.memory) + namesOffset;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		strncpy(nameTable + i * SHARED_STATE_NAME_LENGTH, names[i].c_str(), SHARED_STATE_NAME_LENGTH - 1);
+	}
+
+	// The memory was zeroed, so every slot starts at sequence 0 and nothing is published
+	SharedStateHeader* header = mapping.Header();
+	header->version = SHARED_STATE_VERSION;
+	header->bodyCount = (uint32_t)bodyCount;
+	header->slotCount = SHARED_STATE_SLOT_COUNT;
+	header->namesOffset = namesOffset;
+	header->slotsOffset = slotsOffset;
+	header->slotBytes = slotBytes;
+	header->columnBytes = columnBytes;
+
+	// Readers check the magic last, so they never see a half-written header
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(header->magic, SHARED_STATE_MAGIC, sizeof(SHARED_STATE_MAGIC));
+
+	snapshot = 0;
+	return true;
+}
+
+SharedStateView& SharedStatePublisher::BeginSnapshot(double simTime)
+{
+	mapping.ViewSlot((int)(snapshot % SHARED_STATE_SLOT_COUNT), current);
+
+	// Odd while the slot is written; the fence keeps the writes below from moving above it
+	SharedStateSlot* slot = current.slot;
+	uint32_t sequence = slot->sequence.load(std::memory_order_relaxed) + 1;
+	slot->sequence.store(sequence, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->snapshot = snapshot;
+	slot->simTime = simTime;
+	current.snapshot = snapshot;
+	current.simTime = simTime;
+	current.sequence = sequence;
+	return current;
+}
+
+void SharedStatePublisher::EndSnapshot()
+{
+	current.slot->sequence.store(current.sequence + 1, std::memory_order_release);
+	mapping.Header()->published.store(++snapshot, std::memory_order_release);
+}
+
+void SharedStatePublisher::Close()
+{
+	if (mapping.memory == nullptr)
+	{
+		return;
+	}
+	mapping.Unmap();
+#ifndef _WIN32
+	shm_unlink(MappingName(mapping.name).c_str());
+#endif
+}
+
+bool SharedStateReader::Open(const std::string& name)
+{
+	mapping.name = name;
+	if (!OpenSharedMemory(mapping))
+	{
+		return false;
+	}
+
+	const SharedStateHeader* header = mapping.Header();
+	bool valid = mapping.size >= sizeof(SharedStateHeader) && memcmp(header->magic, SHARED_STATE_MAGIC, sizeof(SHARED_STATE_MAGIC)) == 0;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	valid = valid && header->version == SHARED_STATE_VERSION
+		&& header->slotsOffset + (uint64_t)header->slotCount * header->slotBytes <= mapping.size;
+	if (!valid)
+	{
+		std::cerr << "Shared memory " << name << " was not written by this version of the simulation" << std::endl;
+		mapping.Unmap();
+		return false;
+	}
+	return true;
+}
+
+bool SharedStateReader::Latest(SharedStateView& view) const
+{
+	const SharedStateHeader* header = mapping.Header();
+	uint64_t published = header->published.load(std::memory_order_acquire);
+	if (published == 0)
+	{
+		return false;
+	}
+
+	mapping.ViewSlot((int)((published - 1) % header->slotCount), view);
+	view.sequence = view.slot->sequence.load(std::memory_order_acquire);
+	if (view.sequence & 1u)
+	{
+		return false;
+	}
+	view.snapshot = view.slot->snapshot;
+	view.simTime = view.slot->simTime;
+	return Validate(view);
+}
+
+bool SharedStateReader::Validate(const SharedStateView& view) const
+{
+	// Keeps the reads of the snapshot from moving below the second look at the sequence
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return view.slot->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
+
+std::string SharedStateReader::BodyName(int body) const
+{
+	const SharedStateHeader* header = mapping.Header();
+	if (body < 0 || body >= (int)header->bodyCount)
+	{
+		return std::string();
+	}
+	const char* name = static_cast<const char*>(mapping.memory) + header->namesOffset + body * SHARED_STATE_NAME_LENGTH;
+	return std::string(name, strnlen(name, SHARED_STATE_NAME_LENGTH));
+}
+
+void SharedStateReader::Close()
+{
+	mapping.Unmap();
+}
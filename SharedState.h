@@ -0,0 +1,185 @@
+/**
+ * Live body state in shared memory, for other programs on the same machine (dashboards, recorders).
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const char SHARED_STATE_MAGIC[4] = { 'S', 'S', 'S', 'M' };
+const uint32_t SHARED_STATE_VERSION = 1;
+
+// Snapshots kept in the ring; a reader has this many snapshots' time to read one before it is overwritten
+const int SHARED_STATE_SLOT_COUNT = 4;
+
+// Characters stored per body name, including the terminating zero
+const int SHARED_STATE_NAME_LENGTH = 32;
+
+// Alignment of the header, the slots and every column, so no two of them share a cache line
+const size_t SHARED_STATE_ALIGNMENT = 64;
+
+/**
+ * Struct at the start of the shared memory. The body names follow it, then the slots.
+ */
+struct SharedStateHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t bodyCount;
+	uint32_t slotCount;
+	uint64_t namesOffset;		// From the start of the shared memory
+	uint64_t slotsOffset;
+	uint64_t slotBytes;			// Distance between two slots
+	uint64_t columnBytes;		// Distance between two columns of a slot
+	std::atomic<uint64_t> published;	// Snapshots published so far; the newest one is in slot (published - 1) % slotCount
+};
+
+/**
+ * Struct at the start of every slot. Six columns of bodyCount floats follow it: the x, y and z of
+ * every position, then of every velocity, in scene units (per simulated second).
+ *
+ * The slot is guarded by a sequence lock: the sequence is odd while the publisher writes the slot
+ * and goes up by two with every snapshot, so a reader knows a slot it read was not written to in
+ * the meantime if the sequence did not change.
+ */
+struct SharedStateSlot
+{
+	std::atomic<uint32_t> sequence;
+	uint32_t padding;
+	uint64_t snapshot;			// Number of the snapshot, counting from 0
+	double simTime;				// Simulated time of the snapshot
+};
+
+/**
+ * Struct pointing into a slot of the shared memory, either to be written by the publisher or read by a reader
+ */
+struct SharedStateView
+{
+	uint64_t snapshot;
+	double simTime;
+	int bodyCount;
+	float* positions[3];		// x, y and z columns
+	float* velocities[3];
+	SharedStateSlot* slot;
+	uint32_t sequence;			// Sequence the slot had when the view was taken
+};
+
+/**
+ * A mapping of the shared memory, the part the publisher and the readers have in common
+ */
+struct SharedStateMapping
+{
+	void* memory;
+	size_t size;
+	void* handle;				// File mapping on Windows, unused elsewhere
+	std::string name;
+
+	SharedStateMapping();
+
+	SharedStateHeader* Header() const;
+
+	/**
+	 * @brief Points a view at the columns of a slot.
+	 * @param[in] index Slot
+	 * @param[out] view View to fill in, apart from the snapshot, time and sequence
+	 */
+	void ViewSlot(int index, SharedStateView& view) const;
+
+	/**
+	 * @brief Unmaps the shared memory.
+	 */
+	void Unmap();
+};
+
+/**
+ * Writes snapshots of the body state into a ring of slots in shared memory (POSIX shared memory, which
+ * Linux keeps in /dev/shm, or a named file mapping on Windows). Publishing never waits on a reader.
+ * The publisher writes straight into the slot it hands out, so there is no extra copy.
+ */
+struct SharedStatePublisher
+{
+	SharedStateMapping mapping;
+	uint64_t snapshot;			// Number of the next snapshot
+	SharedStateView current;	// Slot being written, between BeginSnapshot and EndSnapshot
+
+	SharedStatePublisher();
+
+	/**
+	 * @brief Creates the shared memory, replacing any left over from an earlier run.
+	 * @param[in] name Name of the shared memory, e.g. "/solar-system"
+	 * @param[in] names Name of every body
+	 * @return False if the shared memory could not be created
+	 */
+	bool Open(const std::string& name, const std::vector<std::string>& names);
+
+	/**
+	 * @brief Marks the next slot as being written and returns where to write it.
+	 * @param[in] simTime Simulated time of the snapshot
+	 * @return Columns to fill in; valid until EndSnapshot
+	 */
+	SharedStateView& BeginSnapshot(double simTime);
+
+	/**
+	 * @brief Makes the snapshot visible to the readers.
+	 */
+	void EndSnapshot();
+
+	/**
+	 * @brief Unmaps and removes the shared memory. Readers that have it mapped keep their mapping.
+	 */
+	void Close();
+};
+
+/**
+ * Reads the snapshots without locks or copies. Typical use:
+ *
+ *   SharedStateReader reader;
+ *   reader.Open("/solar-system");
+ *   SharedStateView view;
+ *   if (reader.Latest(view)) {
+ *       ... use view.positions and view.velocities ...
+ *       if (!reader.Validate(view)) { ... the snapshot was overwritten while being used, discard what was read ... }
+ *   }
+ *
+ * A reader that takes longer than SHARED_STATE_SLOT_COUNT snapshots to use one can copy the columns
+ * out first, then validate.
+ */
+struct SharedStateReader
+{
+	SharedStateMapping mapping;
+
+	/**
+	 * @brief Maps the shared memory of a running publisher.
+	 * @param[in] name Name the publisher opened it with
+	 * @return False if there is no such shared memory or it has another layout
+	 */
+	bool Open(const std::string& name);
+
+	/**
+	 * @brief Takes a view of the newest snapshot.
+	 * @param[out] view View of the snapshot
+	 * @return False if nothing was published yet or the publisher is writing the slot right now
+	 */
+	bool Latest(SharedStateView& view) const;
+
+	/**
+	 * @brief Checks that a snapshot was not overwritten since its view was taken.
+	 * @param[in] view View taken by Latest
+	 * @return True if everything read through the view is consistent
+	 */
+	bool Validate(const SharedStateView& view) const;
+
+	/**
+	 * @brief Name of a body.
+	 */
+	std::string BodyName(int body) const;
+
+	/**
+	 * @brief Unmaps the shared memory.
+	 */
+	void Close();
+};
@@ -0,0 +1,417 @@
+/**
+ * Background stars from a star catalog, drawn as point sprites from a single vertex buffer.
+ */
+
+#include "StarField.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+
+// Seed of the generated catalog, so the sky does not change between runs
+const unsigned int STAR_CATALOG_SEED = 184116;
+
+// Magnitude of the faintest stars a real catalog of 9000 stars holds (about what the eye can see)
+const float NAKED_EYE_MAGNITUDE = 6.5f;
+
+// Render height the sprite sizes were chosen for
+const float STAR_REFERENCE_HEIGHT = 600.f;
+
+/**
+ * Struct containing one star as it is stored in a catalog file
+ */
+struct StarRecord
+{
+	float x, y, z;
+	float magnitude;
+	unsigned char r, g, b, pad;
+};
+
+/**
+ * @brief Finds the tile a direction falls into.
+ * @param[in] direction Unit vector
+ * @return Index of the tile: face * N * N + row * N + column
+ */
+static int StarTileIndex(const glm::vec3& direction)
+{
+	glm::vec3 a = glm::abs(direction);
+	int face;
+	float u, v;
+	if (a.x >= a.y && a.x >= a.z)
+	{
+		face = direction.x > 0.f ? 0 : 1;
+		u = direction.y / a.x;
+		v = direction.z / a.x;
+	}
+	else if (a.y >= a.z)
+	{
+		face = direction.y > 0.f ? 2 : 3;
+		u = direction.x / a.y;
+		v = direction.z / a.y;
+	}
+	else
+	{
+		face = direction.z > 0.f ? 4 : 5;
+		u = direction.x / a.z;
+		v = direction.y / a.z;
+	}
+
+	int n = STAR_TILES_PER_FACE_SIDE;
+	int column = std::min(n - 1, std::max(0, (int)((u + 1.f) * 0.5f * n)));
+	int row = std::min(n - 1, std::max(0, (int)((v + 1.f) * 0.5f * n)));
+	return face * n * n + row * n + column;
+}
+
+/**
+ * @brief Converts a B-V color index to the color of a black body of the same temperature.
+ * @param[in] colorIndex B-V color index, from about -0.4 (blue) to 2 (red)
+ * @return RGB color, brightest channel at 1
+ */
+static glm::vec3 StarColor(float colorIndex)
+{
+	// Ballesteros' formula for the temperature, then a fit of the black body curve in sRGB
+	float temperature = 4600.f * (1.f / (0.92f * colorIndex + 1.7f) + 1.f / (0.92f * colorIndex + 0.62f));
+	float t = temperature / 100.f;
+
+	glm::vec3 color;
+	if (t <= 66.f)
+	{
+		color.r = 255.f;
+		color.g = 99.47f * std::log(t) - 161.12f;
+		color.b = t <= 19.f ? 0.f : 138.52f * std::log(t - 10.f) - 305.04f;
+	}
+	else
+	{
+		color.r = 329.70f * std::pow(t - 60.f, -0.1332f);
+		color.g = 288.12f * std::pow(t - 60.f, -0.0755f);
+		color.b = 255.f;
+	}
+
+	color = glm::clamp(color / 255.f, 0.f, 1.f);
+	return color / std::max(color.r, std::max(color.g, color.b));
+}
+
+StarField::StarField()
+{
+	program = 0;
+	starCount = 0;
+}
+
+void StarField::Init(const std::vector<Star>& stars, GLuint starShader)
+{
+	program = starShader;
+	starCount = (int)stars.size();
+
+	// Counting sort into tiles, then bright to faint within every tile
+	int tileCount = 6 * STAR_TILES_PER_FACE_SIDE * STAR_TILES_PER_FACE_SIDE;
+	std::vector<int> starTiles(starCount);
+	std::vector<int> tileStarts(tileCount + 1, 0);
+	for (int i = 0; i < starCount; i++)
+	{
+		starTiles[i] = StarTileIndex(stars[i].direction);
+		tileStarts[starTiles[i] + 1]++;
+	}
+	for (int tile = 0; tile < tileCount; tile++)
+	{
+		tileStarts[tile + 1] += tileStarts[tile];
+	}
+
+	std::vector<int> order(starCount);
+	std::vector<int> nextSlot(tileStarts.begin(), tileStarts.end() - 1);
+	for (int i = 0; i < starCount; i++)
+	{
+		order[nextSlot[starTiles[i]]++] = i;
+	}
+
+	tiles.resize(tileCount);
+	for (int tile = 0; tile < tileCount; tile++)
+	{
+		std::vector<int>::iterator begin = order.begin() + tileStarts[tile];
+		std::vector<int>::iterator end = order.begin() + tileStarts[tile + 1];
+		std::sort(begin, end, [&stars](int a, int b) { return stars[a].magnitude < stars[b].magnitude; });
+
+		// The cone around the mean direction that reaches the farthest star of the tile
+		glm::vec3 sum(0.f);
+		for (std::vector<int>::iterator it = begin; it != end; ++it)
+		{
+			sum += stars[*it].direction;
+		}
+		StarTile& starTile = tiles[tile];
+		starTile.first = tileStarts[tile];
+		starTile.count = tileStarts[tile + 1] - tileStarts[tile];
+		starTile.center = glm::length(sum) > 0.f ? glm::normalize(sum) : glm::vec3(1.f, 0.f, 0.f);
+
+		float minCos = 1.f;
+		for (std::vector<int>::iterator it = begin; it != end; ++it)
+		{
+			minCos = std::min(minCos, glm::dot(starTile.center, stars[*it].direction));
+		}
+		starTile.sinRadius = minCos > 0.f ? std::sqrt(1.f - minCos * minCos) : 1.f;
+	}
+
+	std::vector<StarVertex> vertices(starCount);
+	tileMagnitudes.resize(starCount);
+	for (int slot = 0; slot < starCount; slot++)
+	{
+		const Star& star = stars[order[slot]];
+		StarVertex& vertex = vertices[slot];
+		vertex.x = (GLshort)std::lround(glm::clamp(star.direction.x, -1.f, 1.f) * 32767.f);
+		vertex.y = (GLshort)std::lround(glm::clamp(star.direction.y, -1.f, 1.f) * 32767.f);
+		vertex.z = (GLshort)std::lround(glm::clamp(star.direction.z, -1.f, 1.f) * 32767.f);
+		vertex.magnitude = (GLshort)std::lround(glm::clamp(star.magnitude, -300.f, 300.f) * 100.f);
+		vertex.r = star.r;
+		vertex.g = star.g;
+		vertex.b = star.b;
+		vertex.a = 255;
+		tileMagnitudes[slot] = star.magnitude;
+	}
+
+	sortedMagnitudes = tileMagnitudes;
+	std::sort(sortedMagnitudes.begin(), sortedMagnitudes.end());
+
+	vbo.Create("star catalog");
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(StarVertex), vertices.data(), GL_STATIC_DRAW);
+	vbo.SetSize(vertices.size() * sizeof(StarVertex));
+
+	vao.Create("stars");
+	glBindVertexArray(vao);
+
+	// Vertex attribute 0 - Direction
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(StarVertex), (void*)0);
+
+	// Vertex attribute 1 - Magnitude in hundredths
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 1, GL_SHORT, GL_FALSE, sizeof(StarVertex), (void*)(offsetof(StarVertex, magnitude)));
+
+	// Vertex attribute 2 - Color
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(StarVertex), (void*)(offsetof(StarVertex, r)));
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	drawFirsts.reserve(tileCount);
+	drawCounts.reserve(tileCount);
+}
+
+int StarField::Draw(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, int renderHeight)
+{
+	if (starCount == 0)
+	{
+		return 0;
+	}
+
+	// Stars are infinitely far away, so moving the camera does not move them
+	glm::mat4 rotation = glm::mat4(glm::mat3(viewMatrix));
+
+	// Side planes of the view frustum (Gribb and Hartmann). They pass through the eye, so for a
+	// direction only the normal matters; the near and far planes do not cut directions at all.
+	glm::mat4 clip = projectionMatrix * rotation;
+	glm::vec3 planes[4];
+	for (int i = 0; i < 4; i++)
+	{
+		int row = i / 2;
+		float sign = (i % 2 == 0) ? 1.f : -1.f;
+		glm::vec3 normal;
+		for (int column = 0; column < 3; column++)
+		{
+			normal[column] = clip[column][3] + sign * clip[column][row];
+		}
+		planes[i] = glm::normalize(normal);
+	}
+
+	// A tile is visible unless its whole cone is behind one of the planes
+	drawFirsts.clear();
+	drawCounts.clear();
+	int visibleStars = 0;
+	for (const StarTile& tile : tiles)
+	{
+		bool visible = tile.count > 0;
+		for (int i = 0; i < 4 && visible; i++)
+		{
+			visible = glm::dot(planes[i], tile.center) >= -tile.sinRadius;
+		}
+		if (visible)
+		{
+			drawFirsts.push_back(tile.first);
+			drawCounts.push_back(tile.count);
+			visibleStars += tile.count;
+		}
+	}
+
+	// Over the budget, only the brightest stars are drawn. The catalog is about equally dense in every
+	// direction at this scale, so the limit is where the whole catalog would hold budget / visible fraction stars.
+	float limitingMagnitude = std::numeric_limits<float>::max();
+	if (visibleStars > STAR_DRAW_BUDGET)
+	{
+		long long index = (long long)STAR_DRAW_BUDGET * starCount / visibleStars;
+		limitingMagnitude = sortedMagnitudes[(size_t)std::min<long long>(index, starCount - 1)];
+	}
+
+	// Every tile runs from bright to faint, so the stars over the limit are a suffix that is simply not drawn.
+	// Tiles that stay whole and follow each other in the buffer are merged into one range.
+	int starsDrawn = 0;
+	int rangeCount = 0;
+	for (size_t i = 0; i < drawFirsts.size(); i++)
+	{
+		GLint first = drawFirsts[i];
+		GLsizei count = drawCounts[i];
+		if (limitingMagnitude < std::numeric_limits<float>::max())
+		{
+			count = (GLsizei)(std::upper_bound(tileMagnitudes.begin() + first, tileMagnitudes.begin() + first + count, limitingMagnitude)
+				- (tileMagnitudes.begin() + first));
+		}
+		if (count == 0)
+		{
+			continue;
+		}
+
+		starsDrawn += count;
+		if (rangeCount > 0 && drawFirsts[rangeCount - 1] + drawCounts[rangeCount - 1] == first)
+		{
+			drawCounts[rangeCount - 1] += count;
+		}
+		else
+		{
+			drawFirsts[rangeCount] = first;
+			drawCounts[rangeCount] = count;
+			rangeCount++;
+		}
+	}
+
+	if (rangeCount == 0)
+	{
+		return 0;
+	}
+
+	// Stars add up where they overlap and never hide anything
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glDepthMask(GL_FALSE);
+	// On the far plane the stars have the depth of a cleared pixel
+	glDepthFunc(GL_LEQUAL);
+
+	glUseProgram(program);
+	glUniformMatrix4fv(glGetUniformLocation(program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+	glUniformMatrix4fv(glGetUniformLocation(program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(rotation));
+	glUniform1f(glGetUniformLocation(program, "pointScale"), renderHeight / STAR_REFERENCE_HEIGHT);
+	glUniform1f(glGetUniformLocation(program, "limitingMagnitude"), std::min(limitingMagnitude, 100.f));
+
+	glBindVertexArray(vao);
+	glMultiDrawArrays(GL_POINTS, drawFirsts.data(), drawCounts.data(), rangeCount);
+	glBindVertexArray(0);
+
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_PROGRAM_POINT_SIZE);
+	glDisable(GL_BLEND);
+
+	return starsDrawn;
+}
+
+void StarField::Destroy()
+{
+	vbo.Reset();
+	vao.Reset();
+}
+
+bool LoadStarCatalog(const std::string& path, std::vector<Star>& stars)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Failed to open star catalog " << path << std::endl;
+		return false;
+	}
+
+	char magic[4];
+	uint32_t count = 0;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&count), sizeof(count));
+	if (!file || std::memcmp(magic, "STR1", sizeof(magic)) != 0)
+	{
+		std::cerr << path << " is not a star catalog" << std::endl;
+		return false;
+	}
+
+	std::vector<StarRecord> records(count);
+	file.read(reinterpret_cast<char*>(records.data()), (std::streamsize)count * sizeof(StarRecord));
+	if (!file)
+	{
+		std::cerr << "Star catalog " << path << " is cut short" << std::endl;
+		return false;
+	}
+
+	stars.clear();
+	stars.reserve(count);
+	for (const StarRecord& record : records)
+	{
+		glm::vec3 direction(record.x, record.y, record.z);
+		if (!(glm::length(direction) > 0.f))
+		{
+			continue;
+		}
+
+		Star star;
+		star.direction = glm::normalize(direction);
+		star.magnitude = record.magnitude;
+		star.r = record.r;
+		star.g = record.g;
+		star.b = record.b;
+		stars.push_back(star);
+	}
+	return true;
+}
+
+void GenerateStarCatalog(int count, std::vector<Star>& stars)
+{
+	std::mt19937 gen(STAR_CATALOG_SEED);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	std::normal_distribution<float> diskLatitude(0.f, glm::radians(12.f));
+	std::normal_distribution<float> colorIndex(0.65f, 0.35f);
+
+	// The galactic plane is tilted against the orbital plane, as it is in the real sky
+	glm::mat3 galacticToScene = glm::mat3(glm::rotate(glm::mat4(1.f), glm::radians(60.f), glm::vec3(1.f, 0.f, 0.2f)));
+
+	// N(brighter than m) = count * 10^(0.5 * (m - faintest)); a catalog of 9000 stars ends at the naked-eye limit
+	float faintest = NAKED_EYE_MAGNITUDE + 2.f * std::log10(std::max(count, 1) / 9000.f);
+
+	stars.resize(count);
+	for (Star& star : stars)
+	{
+		star.magnitude = std::max(-1.5f, faintest + 2.f * std::log10(std::max(uniform(gen), 1e-9f)));
+
+		// Faint stars are mostly far away in the disk; bright ones are close and all around
+		float diskChance = glm::clamp((star.magnitude - 2.f) / 10.f, 0.f, 0.6f);
+		float longitude = uniform(gen) * glm::radians(360.f);
+		float sinLatitude;
+		if (uniform(gen) < diskChance)
+		{
+			sinLatitude = std::sin(glm::clamp(diskLatitude(gen), -glm::radians(90.f), glm::radians(90.f)));
+		}
+		else
+		{
+			sinLatitude = uniform(gen) * 2.f - 1.f;
+		}
+		float cosLatitude = std::sqrt(std::max(0.f, 1.f - sinLatitude * sinLatitude));
+		glm::vec3 galactic(cosLatitude * std::cos(longitude), sinLatitude, cosLatitude * std::sin(longitude));
+		star.direction = glm::normalize(galacticToScene * galactic);
+
+		glm::vec3 color = StarColor(glm::clamp(colorIndex(gen), -0.4f, 2.f));
+		star.r = (unsigned char)std::lround(color.r * 255.f);
+		star.g = (unsigned char)std::lround(color.g * 255.f);
+		star.b = (unsigned char)std::lround(color.b * 255.f);
+	}
+}
@@ -0,0 +1,117 @@
+/**
+ * Background stars from a star catalog, drawn as point sprites from a single vertex buffer.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// Tiles along each side of a cube face; the sky is split into 6 * N * N tiles
+const int STAR_TILES_PER_FACE_SIDE = 8;
+
+// Stars in the generated catalog when no catalog file is given
+const int STAR_DEFAULT_COUNT = 100000;
+
+// Most stars drawn per frame; past this the faintest visible stars are left out
+const int STAR_DRAW_BUDGET = 150000;
+
+/**
+ * Struct containing one star of a catalog
+ */
+struct Star
+{
+	glm::vec3 direction;	// Unit vector from the solar system towards the star
+	float magnitude;		// Apparent visual magnitude; smaller is brighter
+	unsigned char r, g, b;
+};
+
+/**
+ * Struct containing one star as it is stored in the vertex buffer (12 bytes)
+ */
+struct StarVertex
+{
+	GLshort x, y, z;		// Direction, normalized to [-32767, 32767]
+	GLshort magnitude;		// Magnitude in hundredths
+	GLubyte r, g, b, a;
+};
+
+/**
+ * Struct containing the stars of one tile of the sky, which are contiguous in the vertex buffer
+ */
+struct StarTile
+{
+	int first;				// First vertex of the tile
+	int count;
+	glm::vec3 center;		// Axis of a cone that holds every star of the tile
+	float sinRadius;		// Sine of the cone's half angle
+};
+
+/**
+ * The stars are sorted into cube-face tiles and, within every tile, from bright to faint. Each
+ * frame the tiles whose bounding cone is outside the view are skipped, and of the others only
+ * the stars brighter than a limiting magnitude are drawn; that is a prefix of every tile, so
+ * the whole sky is one glMultiDrawArrays. The limit is lowered when more than STAR_DRAW_BUDGET
+ * stars are in view, which keeps the cost flat however large the catalog is.
+ */
+struct StarField
+{
+	BufferHandle vbo;
+	VertexArrayHandle vao;
+	GLuint program;
+
+	std::vector<StarTile> tiles;
+	std::vector<float> tileMagnitudes;		// Magnitudes of the stars in vertex buffer order, for the per-tile search
+	std::vector<float> sortedMagnitudes;	// Magnitudes of the whole catalog from bright to faint
+	int starCount;
+
+	// Ranges of the visible tiles, rebuilt every frame
+	std::vector<GLint> drawFirsts;
+	std::vector<GLsizei> drawCounts;
+
+	StarField();
+
+	/**
+	 * @brief Sorts the stars into tiles and uploads them.
+	 * @param[in] stars Catalog to draw
+	 * @param[in] starShader Program that draws the stars (star.vsh)
+	 */
+	void Init(const std::vector<Star>& stars, GLuint starShader);
+
+	/**
+	 * @brief Draws the stars behind everything else. Depth writes are off, so call it first.
+	 * @param[in] projectionMatrix Projection matrix used for rendering
+	 * @param[in] viewMatrix View matrix used for rendering; only its rotation is used
+	 * @param[in] renderHeight Height of the render target in pixels, which the sprite sizes follow
+	 * @return Number of stars drawn
+	 */
+	int Draw(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, int renderHeight);
+
+	/**
+	 * @brief Deletes the GPU buffers.
+	 */
+	void Destroy();
+};
+
+/**
+ * @brief Reads a binary star catalog: the magic "STR1", a 32-bit star count, then per star the direction
+ * (3 floats), the magnitude (float) and the color (3 bytes, 1 byte of padding), all little-endian.
+ * @param[in] path Catalog file
+ * @param[out] stars Stars of the catalog
+ * @return False if the file could not be read
+ */
+bool LoadStarCatalog(const std::string& path, std::vector<Star>& stars);
+
+/**
+ * @brief Makes up a catalog that looks like the real sky: star counts rise about 3.2 times per
+ * magnitude, faint stars crowd into a galactic band, and the colors follow the usual spread of temperatures.
+ * The same count always gives the same stars.
+ * @param[in] count Number of stars
+ * @param[out] stars Generated stars
+ */
+void GenerateStarCatalog(int count, std::vector<Star>& stars);
@@ -0,0 +1,39 @@
+/**
+ * Per-frame counters and the stats overlay shown in the window title.
+ */
+
+#include "Stats.h"
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include <cstdio>
+
+// How often the window title is refreshed, in seconds
+const double OVERLAY_REFRESH_INTERVAL = 0.5;
+
+void UpdateStatsOverlay(GLFWwindow* window, const FrameStats& stats, double currentTime)
+{
+	static double lastRefresh = 0.0;
+	static double frameTimeSum = 0.0;
+	static int frameCount = 0;
+
+	frameTimeSum += stats.frameTimeMs;
+	frameCount++;
+
+	if (currentTime - lastRefresh < OVERLAY_REFRESH_INTERVAL)
+	{
+		return;
+	}
+
+	char title[256];
+	snprintf(title, sizeof(title),
+		"Solar System simulation | %.2f ms (GPU %.2f ms, latency %.1f ms) | scale %.0f%% | bodies %d | meshes %d | impostors %d | occluded %d (%d occluders) | draws %d | stars %d | VRAM %.1f MB (peak %.1f)",
+		frameTimeSum / frameCount, stats.gpuTimeMs, stats.latencyMs, stats.renderScale * 100.f, stats.bodiesTotal, stats.meshesDrawn, stats.impostorsDrawn,
+		stats.occlusionCulled, stats.occluders, stats.drawCalls, stats.starsDrawn, stats.gpuMemoryBytes / (1024.0 * 1024.0), stats.gpuPeakMemoryBytes / (1024.0 * 1024.0));
+	glfwSetWindowTitle(window, title);
+
+	lastRefresh = currentTime;
+	frameTimeSum = 0.0;
+	frameCount = 0;
+}
@@ -0,0 +1,61 @@
+/**
+ * Per-frame counters and the stats overlay shown in the window title.
+ */
+
+#pragma once
+
+struct GLFWwindow;
+
+/**
+ * Struct containing the counters collected while rendering one frame
+ */
+struct FrameStats
+{
+	float frameTimeMs;		// CPU time between the last two frames
+	float gpuTimeMs;		// GPU time of the last frame that finished
+	float renderScale;		// Resolution scale picked by dynamic resolution scaling
+	float latencyMs;		// Time from sampling the input to the GPU finishing the swap, averaged
+	long long gpuMemoryBytes;		// GPU memory held by the tracked buffers and textures
+	long long gpuPeakMemoryBytes;	// Highest gpuMemoryBytes since the start
+	int bodiesTotal;		// Bodies in the scene, including the sun
+	int meshesDrawn;		// Bodies drawn as full sphere meshes
+	int impostorsDrawn;		// Bodies drawn as impostor quads
+	int occluders;			// Bodies rasterized into the occlusion buffer
+	int occlusionCulled;	// Bodies skipped because they were hidden behind an occluder
+	int drawCalls;			// Draw calls for the bodies, with every instanced draw counting once
+	int starsDrawn;			// Background stars that passed the tile culling and the magnitude limit
+
+	FrameStats()
+	{
+		frameTimeMs = 0.f;
+		gpuTimeMs = 0.f;
+		renderScale = 1.f;
+		latencyMs = 0.f;
+		gpuMemoryBytes = 0;
+		gpuPeakMemoryBytes = 0;
+		Reset();
+	}
+
+	/**
+	 * @brief Clears the per-frame counters. The frame time is kept.
+	 */
+	void Reset()
+	{
+		bodiesTotal = 0;
+		meshesDrawn = 0;
+		impostorsDrawn = 0;
+		occluders = 0;
+		occlusionCulled = 0;
+		drawCalls = 0;
+		starsDrawn = 0;
+	}
+};
+
+/**
+ * @brief Shows the stats of the current frame in the window title.
+ * The title is only rewritten a few times per second so the overlay itself stays cheap.
+ * @param[in] window Reference to the window
+ * @param[in] stats Counters of the current frame
+ * @param[in] currentTime Current time in seconds
+ */
+void UpdateStatsOverlay(GLFWwindow* window, const FrameStats& stats, double currentTime);
@@ -0,0 +1,219 @@
+/**
+ * Ring buffer that streams per-frame data (instances, uniforms, lines) to the GPU without stalls.
+ */
+
+#include "StreamBuffer.h"
+
+#include <GLFW/glfw3.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// Buffer storage is GL 4.4 (or ARB_buffer_storage), so it is not part of the GL 3.3 loader
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Longest single wait on a fence before checking again, in nanoseconds
+const GLuint64 STREAM_FENCE_TIMEOUT = 1000000;
+
+/**
+ * @brief Loads glBufferStorage if the context has it.
+ * @return The function, or null if buffer storage is not supported
+ */
+static BufferStorageProc LoadBufferStorage()
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	bool supported = major > 4 || (major == 4 && minor >= 4);
+
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount && !supported; i++)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		supported = extension != nullptr && strcmp(extension, "GL_ARB_buffer_storage") == 0;
+	}
+
+	if (!supported)
+	{
+		return nullptr;
+	}
+	return (BufferStorageProc)glfwGetProcAddress("glBufferStorage");
+}
+
+StreamBuffer::StreamBuffer()
+{
+	segmentSize = 0;
+	segment = 0;
+	used = 0;
+	for (int i = 0; i < STREAM_SEGMENT_COUNT; i++)
+	{
+		fences[i] = nullptr;
+	}
+	persistent = false;
+	mapped = nullptr;
+	persistentMemory = nullptr;
+	waitMs = 0.f;
+}
+
+void StreamBuffer::Init(GLsizeiptr initialSegmentSize)
+{
+	Create(initialSegmentSize);
+	std::cout << "Streaming buffer: " << (persistent ? "persistent mapping" : "unsynchronized mapping") << std::endl;
+}
+
+void StreamBuffer::Create(GLsizeiptr newSegmentSize)
+{
+	segmentSize = newSegmentSize;
+	GLsizeiptr totalSize = segmentSize * STREAM_SEGMENT_COUNT;
+
+	buffer.Create("streaming buffer");
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	// Coherent, so writes are visible to the GPU without flushing; the fences keep the CPU and GPU apart
+	static BufferStorageProc bufferStorage = LoadBufferStorage();
+	persistent = bufferStorage != nullptr;
+	if (persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		bufferStorage(GL_ARRAY_BUFFER, totalSize, nullptr, flags);
+		persistentMemory = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, totalSize, flags);
+		if (persistentMemory == nullptr)
+		{
+			std::cerr << "Failed to map the streaming buffer persistently" << std::endl;
+			buffer.Create("streaming buffer");
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			persistent = false;
+		}
+	}
+	if (!persistent)
+	{
+		glBufferData(GL_ARRAY_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+	}
+	buffer.SetSize(totalSize);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void StreamBuffer::WaitForSegment(int index)
+{
+	if (fences[index] == nullptr)
+	{
+		return;
+	}
+
+	// The first wait flushes the commands, so the fence is guaranteed to signal eventually
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (glClientWaitSync(fences[index], flags, STREAM_FENCE_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+	{
+		flags = 0;
+	}
+	glDeleteSync(fences[index]);
+	fences[index] = nullptr;
+}
+
+void StreamBuffer::BeginFrame(GLsizeiptr frameBytes)
+{
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+
+	// A frame that needs more than a segment gets a bigger buffer, once every segment is free again
+	if (frameBytes > segmentSize)
+	{
+		for (int i = 0; i < STREAM_SEGMENT_COUNT; i++)
+		{
+			WaitForSegment(i);
+		}
+		GLsizeiptr newSegmentSize = segmentSize;
+		while (newSegmentSize < frameBytes)
+		{
+			newSegmentSize *= 2;
+		}
+		Destroy();
+		Create(newSegmentSize);
+	}
+
+	segment = (segment + 1) % STREAM_SEGMENT_COUNT;
+	used = 0;
+	WaitForSegment(segment);
+
+	waitMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+
+	if (persistent)
+	{
+		mapped = persistentMemory + segmentSize * segment;
+	}
+	else
+	{
+		// The fence already says the GPU is done with the segment, so the driver does not need to check
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, segmentSize * segment, segmentSize,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		if (mapped == nullptr)
+		{
+			std::cerr << "Failed to map the streaming buffer" << std::endl;
+		}
+	}
+}
+
+unsigned char* StreamBuffer::Allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr& bufferOffset)
+{
+	GLsizeiptr start = (used + alignment - 1) / alignment * alignment;
+	if (mapped == nullptr || start + size > segmentSize)
+	{
+		return nullptr;
+	}
+
+	used = start + size;
+	bufferOffset = segmentSize * segment + start;
+	return mapped + start;
+}
+
+void StreamBuffer::EndWrites()
+{
+	if (!persistent && mapped != nullptr)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	mapped = nullptr;
+}
+
+void StreamBuffer::EndFrame()
+{
+	fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamBuffer::Destroy()
+{
+	for (int i = 0; i < STREAM_SEGMENT_COUNT; i++)
+	{
+		if (fences[i] != nullptr)
+		{
+			glDeleteSync(fences[i]);
+			fences[i] = nullptr;
+		}
+	}
+
+	if (buffer != 0)
+	{
+		if (persistent || mapped != nullptr)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		buffer.Reset();
+	}
+	mapped = nullptr;
+	persistentMemory = nullptr;
+}
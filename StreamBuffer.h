@@ -0,0 +1,77 @@
+/**
+ * Ring buffer that streams per-frame data (instances, uniforms, lines) to the GPU without stalls.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+
+#include <glad/glad.h>
+
+// Number of frames whose data can be in flight at once; each one writes to its own segment
+const int STREAM_SEGMENT_COUNT = 3;
+
+/**
+ * One buffer split into STREAM_SEGMENT_COUNT segments, used round-robin one frame at a time. The CPU
+ * writes straight into mapped GPU-visible memory and a fence per segment tells when the GPU is done
+ * reading it, so the buffer is never reallocated (orphaned) and the driver never has to sync implicitly.
+ * With ARB_buffer_storage (or GL 4.4) the whole buffer stays mapped persistently; otherwise each
+ * segment is mapped unsynchronized while it is being written.
+ */
+struct StreamBuffer
+{
+	BufferHandle buffer;
+	GLsizeiptr segmentSize;
+	int segment;				// Segment of the current frame
+	GLsizeiptr used;			// Bytes allocated from the current segment
+	GLsync fences[STREAM_SEGMENT_COUNT];
+	bool persistent;			// Whether the buffer is mapped once for its whole lifetime
+	unsigned char* mapped;		// Start of the current segment in mapped memory, or null when unmapped
+	unsigned char* persistentMemory;	// Whole buffer, only for persistent mapping
+
+	float waitMs;				// Time spent waiting for the GPU in the last BeginFrame
+
+	StreamBuffer();
+
+	/**
+	 * @brief Creates the buffer, using persistent mapping if the context supports it.
+	 * @param[in] initialSegmentSize Bytes per frame to start with; the segments grow when a frame needs more
+	 */
+	void Init(GLsizeiptr initialSegmentSize);
+
+	/**
+	 * @brief Moves on to the next segment, waiting until the GPU is done with it, and maps it for writing.
+	 * Has to be called on the thread with the GL context.
+	 * @param[in] frameBytes Bytes the frame will allocate, including alignment padding
+	 */
+	void BeginFrame(GLsizeiptr frameBytes);
+
+	/**
+	 * @brief Takes memory from the current segment. Only does pointer arithmetic, so the memory can be
+	 * handed to (and written by) any thread until EndWrites.
+	 * @param[in] size Bytes to allocate
+	 * @param[in] alignment Alignment of the offset in the buffer
+	 * @param[out] bufferOffset Offset of the memory in the buffer, to use with the GL calls
+	 * @return Memory to write to, or null if the segment is full
+	 */
+	unsigned char* Allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr& bufferOffset);
+
+	/**
+	 * @brief Finishes writing the frame's data; the buffer can be used for drawing afterwards.
+	 */
+	void EndWrites();
+
+	/**
+	 * @brief Puts a fence after the draw calls that read the current segment.
+	 */
+	void EndFrame();
+
+	/**
+	 * @brief Unmaps and deletes the buffer.
+	 */
+	void Destroy();
+
+private:
+	void Create(GLsizeiptr newSegmentSize);
+	void WaitForSegment(int index);
+};
@@ -0,0 +1,531 @@
+/**
+ * Streams the mip levels of body textures in and out of GPU memory by how big the bodies are on screen.
+ */
+
+#include "TextureStreaming.h"
+
+#include "JobSystem.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Start of every mip cache file; bump the version when the layout changes
+const char CACHE_MAGIC[4] = { 'M', 'I', 'P', '1' };
+
+/**
+ * Struct containing the header of a mip cache file, followed by the RGB texels of level 0, 1, ...
+ */
+struct MipCacheHeader
+{
+	char magic[4];
+	int32_t width, height;
+	int32_t levelCount;
+	int64_t sourceSize;		// Size of the source image, so a changed image rebuilds its cache
+};
+
+/**
+ * @brief Returns the size of a file in bytes, or -1 if it cannot be opened.
+ */
+static long long FileSize(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	return file ? (long long)file.tellg() : -1;
+}
+
+/**
+ * @brief Halves an RGB image with a box filter. Odd sizes repeat the last row or column.
+ */
+static void Downsample(const std::vector<unsigned char>& source, int sourceWidth, int sourceHeight,
+	std::vector<unsigned char>& target, int targetWidth, int targetHeight)
+{
+	target.resize((size_t)targetWidth * targetHeight * 3);
+	for (int y = 0; y < targetHeight; y++)
+	{
+		int y0 = std::min(y * 2, sourceHeight - 1);
+		int y1 = std::min(y * 2 + 1, sourceHeight - 1);
+		for (int x = 0; x < targetWidth; x++)
+		{
+			int x0 = std::min(x * 2, sourceWidth - 1);
+			int x1 = std::min(x * 2 + 1, sourceWidth - 1);
+			for (int c = 0; c < 3; c++)
+			{
+				int sum = source[((size_t)y0 * sourceWidth + x0) * 3 + c] + source[((size_t)y0 * sourceWidth + x1) * 3 + c]
+					+ source[((size_t)y1 * sourceWidth + x0) * 3 + c] + source[((size_t)y1 * sourceWidth + x1) * 3 + c];
+				target[((size_t)y * targetWidth + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+TextureStreamer::TextureStreamer()
+{
+	budgetBytes = 0;
+	residentBytes = 0;
+	pendingBytes = 0;
+	frame = 0;
+	synchronous = false;
+	loads = 0;
+	evictions = 0;
+	stopping = false;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	if (loader.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueChanged.notify_all();
+		loader.join();
+	}
+}
+
+int TextureStreamer::Add(const std::string& path)
+{
+	for (size_t i = 0; i < textures.size(); i++)
+	{
+		if (textures[i].path == path)
+		{
+			return (int)i;
+		}
+	}
+
+	StreamedTexture texture;
+	texture.path = path;
+	texture.cachePath = path + ".mips";
+	texture.width = 0;
+	texture.height = 0;
+	texture.levelCount = 0;
+	texture.floorLevel = 0;
+	texture.residentLevel = 0;
+	texture.wantedLevel = 0;
+	texture.pendingLevel = -1;
+	texture.lastUsedFrame = 0;
+	texture.residentBytes = 0;
+	texture.streamed = false;
+	textures.push_back(std::move(texture));
+	return (int)textures.size() - 1;
+}
+
+void TextureStreamer::Init(JobSystem& jobs, long long budget, bool loadSynchronously)
+{
+	budgetBytes = budget;
+	synchronous = loadSynchronously;
+
+	// Decoding a large image is by far the slowest part, so the caches are built on every core
+	std::vector<std::vector<std::vector<unsigned char>>> memoryLevels(textures.size());
+	std::vector<char> loaded(textures.size());
+	jobs.ParallelFor((int)textures.size(), 1, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			loaded[i] = BuildCache(textures[i], memoryLevels[i]);
+		}
+	});
+
+	long long floorBytes = 0;
+	for (int i = 0; i < (int)textures.size(); i++)
+	{
+		StreamedTexture& texture = textures[i];
+		if (!loaded[i])
+		{
+			std::cerr << "Failed to load " << texture.path << std::endl;
+			continue;
+		}
+
+		texture.texture.Create(texture.path);
+		textureIndices[texture.texture] = i;
+
+		glBindTexture(GL_TEXTURE_2D, texture.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+
+		// Without a cache there is nothing to stream from, so the whole chain is uploaded now
+		int firstLevel = texture.streamed ? texture.floorLevel : 0;
+		texture.residentLevel = texture.levelCount;
+		texture.wantedLevel = texture.levelCount;
+		for (int level = texture.levelCount - 1; level >= firstLevel; level--)
+		{
+			if (texture.streamed)
+			{
+				std::vector<unsigned char> pixels = ReadLevel(texture, level);
+				if (pixels.empty())
+				{
+					texture.streamed = false;
+					break;
+				}
+				UploadLevel(i, level, pixels);
+			}
+			else
+			{
+				UploadLevel(i, level, memoryLevels[i][level]);
+			}
+		}
+		floorBytes += texture.residentBytes;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	loads = 0;
+
+	if (!synchronous)
+	{
+		loader = std::thread(&TextureStreamer::LoaderLoop, this);
+	}
+
+	std::cout << "Texture streaming: " << textures.size() << " textures, " << floorBytes / 1024 << " KB always resident, budget "
+		<< budgetBytes / (1024 * 1024) << " MB" << (synchronous ? " (synchronous)" : "") << std::endl;
+}
+
+bool TextureStreamer::BuildCache(StreamedTexture& texture, std::vector<std::vector<unsigned char>>& levels)
+{
+	long long sourceSize = FileSize(texture.path);
+	if (sourceSize < 0)
+	{
+		return false;
+	}
+
+	// A cache that matches the image is used as is, as long as it holds every level
+	std::ifstream cacheFile(texture.cachePath, std::ios::binary);
+	MipCacheHeader header;
+	bool cacheValid = cacheFile.read((char*)&header, sizeof(header)) && memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+		&& header.sourceSize == sourceSize && header.width > 0 && header.height > 0 && header.levelCount > 0 && header.levelCount <= 32;
+	cacheFile.close();
+	if (cacheValid)
+	{
+		texture.width = header.width;
+		texture.height = header.height;
+		texture.levelCount = header.levelCount;
+
+		long long cacheBytes = sizeof(MipCacheHeader);
+		for (int level = 0; level < texture.levelCount; level++)
+		{
+			cacheBytes += LevelBytes(texture, level);
+		}
+		if (FileSize(texture.cachePath) != cacheBytes)
+		{
+			std::cerr << "Mip cache " << texture.cachePath << " is truncated, rebuilding it" << std::endl;
+			cacheValid = false;
+		}
+	}
+
+	if (!cacheValid)
+	{
+
+		int width, height, numChannels;
+		unsigned char* imageData = stbi_load(texture.path.c_str(), &width, &height, &numChannels, 3);
+		if (imageData == nullptr)
+		{
+			return false;
+		}
+
+		texture.width = width;
+		texture.height = height;
+		texture.levelCount = (int)std::floor(std::log2((double)std::max(width, height))) + 1;
+
+		levels.resize(texture.levelCount);
+		levels[0].assign(imageData, imageData + (size_t)width * height * 3);
+		stbi_image_free(imageData);
+		for (int level = 1; level < texture.levelCount; level++)
+		{
+			Downsample(levels[level - 1], std::max(1, width >> (level - 1)), std::max(1, height >> (level - 1)),
+				levels[level], std::max(1, width >> level), std::max(1, height >> level));
+		}
+
+		memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.width = width;
+		header.height = height;
+		header.levelCount = texture.levelCount;
+		header.sourceSize = sourceSize;
+
+		// Written next to the cache and renamed over it, so a run that is killed halfway never leaves a partial cache behind
+		std::string temporaryPath = texture.cachePath + ".tmp";
+		std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+		output.write((const char*)&header, sizeof(header));
+		for (const std::vector<unsigned char>& level : levels)
+		{
+			output.write((const char*)level.data(), level.size());
+		}
+		output.close();
+
+		// Windows does not rename over an existing file
+		bool written = !output.fail();
+		if (written)
+		{
+			std::remove(texture.cachePath.c_str());
+			written = std::rename(temporaryPath.c_str(), texture.cachePath.c_str()) == 0;
+		}
+		if (!written)
+		{
+			std::remove(temporaryPath.c_str());
+			std::cerr << "Unable to write the mip cache " << texture.cachePath << ", keeping " << texture.path << " fully resident" << std::endl;
+			texture.floorLevel = 0;
+			texture.streamed = false;
+			return true;
+		}
+		levels.clear();
+	}
+
+	texture.floorLevel = 0;
+	while (texture.floorLevel < texture.levelCount - 1
+		&& std::max(texture.width >> texture.floorLevel, texture.height >> texture.floorLevel) > STREAM_FLOOR_SIZE)
+	{
+		texture.floorLevel++;
+	}
+	texture.streamed = true;
+	return true;
+}
+
+std::vector<unsigned char> TextureStreamer::ReadLevel(const StreamedTexture& texture, int level) const
+{
+	long long offset = sizeof(MipCacheHeader);
+	for (int i = 0; i < level; i++)
+	{
+		offset += LevelBytes(texture, i);
+	}
+
+	std::vector<unsigned char> pixels((size_t)LevelBytes(texture, level));
+	std::ifstream cacheFile(texture.cachePath, std::ios::binary);
+	if (!cacheFile.seekg(offset) || !cacheFile.read((char*)pixels.data(), pixels.size()))
+	{
+		std::cerr << "Unable to read level " << level << " of " << texture.cachePath << std::endl;
+		pixels.clear();
+	}
+	return pixels;
+}
+
+long long TextureStreamer::LevelBytes(const StreamedTexture& texture, int level) const
+{
+	return (long long)std::max(1, texture.width >> level) * std::max(1, texture.height >> level) * 3;
+}
+
+GLuint TextureStreamer::Texture(int index) const
+{
+	return textures[index].texture;
+}
+
+void TextureStreamer::Request(GLuint texture, float pixelRadius)
+{
+	std::unordered_map<GLuint, int>::iterator found = textureIndices.find(texture);
+	if (found == textureIndices.end() || pixelRadius <= 0.f)
+	{
+		return;
+	}
+
+	// The visible half of the sphere spans half the texture width over the body's diameter on screen
+	StreamedTexture& streamed = textures[found->second];
+	float texelsPerPixel = streamed.width / (4.f * pixelRadius);
+	int level = texelsPerPixel > 1.f ? (int)std::floor(std::log2(texelsPerPixel)) : 0;
+	streamed.wantedLevel = std::min(streamed.wantedLevel, std::min(level, streamed.levelCount - 1));
+	streamed.lastUsedFrame = frame;
+}
+
+void TextureStreamer::UploadLevel(int textureIndex, int level, const std::vector<unsigned char>& pixels)
+{
+	StreamedTexture& texture = textures[textureIndex];
+	if (pixels.empty() || level != texture.residentLevel - 1)
+	{
+		return;
+	}
+
+	// Rows of the small levels are not 4-byte aligned
+	glBindTexture(GL_TEXTURE_2D, texture.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, std::max(1, texture.width >> level), std::max(1, texture.height >> level), 0,
+		GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+	texture.residentLevel = level;
+	texture.residentBytes += LevelBytes(texture, level);
+	texture.texture.SetSize(texture.residentBytes);
+	residentBytes += LevelBytes(texture, level);
+	loads++;
+}
+
+bool TextureStreamer::MakeRoom(long long bytes, int loadingIndex)
+{
+	while (residentBytes + pendingBytes + bytes > budgetBytes)
+	{
+		// Levels finer than what this frame needs can go, oldest texture first, finest level first
+		int victim = -1;
+		for (int i = 0; i < (int)textures.size(); i++)
+		{
+			const StreamedTexture& texture = textures[i];
+			if (i == loadingIndex || !texture.streamed || texture.pendingLevel >= 0
+				|| texture.residentLevel >= texture.floorLevel || texture.residentLevel >= texture.wantedLevel)
+			{
+				continue;
+			}
+			if (victim < 0 || texture.lastUsedFrame < textures[victim].lastUsedFrame
+				|| (texture.lastUsedFrame == textures[victim].lastUsedFrame && texture.residentLevel < textures[victim].residentLevel))
+			{
+				victim = i;
+			}
+		}
+		if (victim < 0)
+		{
+			return false;
+		}
+
+		// A zero-sized level releases its storage; the base level keeps the texture complete
+		StreamedTexture& texture = textures[victim];
+		int level = texture.residentLevel;
+		glBindTexture(GL_TEXTURE_2D, texture.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, 0, 0, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+
+		texture.residentLevel = level + 1;
+		texture.residentBytes -= LevelBytes(texture, level);
+		texture.texture.SetSize(texture.residentBytes);
+		residentBytes -= LevelBytes(texture, level);
+		evictions++;
+	}
+	return true;
+}
+
+void TextureStreamer::Update()
+{
+	// Upload what the loader finished, a limited amount per frame
+	std::deque<TextureLoad> ready;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		long long uploadBytes = 0;
+		while (!finished.empty() && (uploadBytes == 0 || uploadBytes + (long long)finished.front().pixels.size() <= STREAM_UPLOAD_BYTES_PER_FRAME))
+		{
+			uploadBytes += finished.front().pixels.size();
+			ready.push_back(std::move(finished.front()));
+			finished.pop_front();
+		}
+	}
+	for (TextureLoad& load : ready)
+	{
+		StreamedTexture& texture = textures[load.textureIndex];
+		texture.pendingLevel = -1;
+		pendingBytes -= LevelBytes(texture, load.level);
+
+		// A cache that cannot be read would be asked for the same level every frame, so the texture keeps what it has
+		if (load.pixels.empty())
+		{
+			texture.streamed = false;
+			continue;
+		}
+		UploadLevel(load.textureIndex, load.level, load.pixels);
+	}
+
+	// Textures that fall furthest short of what their bodies need load first
+	std::vector<int> order;
+	for (int i = 0; i < (int)textures.size(); i++)
+	{
+		const StreamedTexture& texture = textures[i];
+		if (texture.streamed && texture.pendingLevel < 0 && texture.wantedLevel < texture.residentLevel)
+		{
+			order.push_back(i);
+		}
+	}
+	std::sort(order.begin(), order.end(), [this](int a, int b) {
+		return textures[a].residentLevel - textures[a].wantedLevel > textures[b].residentLevel - textures[b].wantedLevel;
+	});
+
+	for (int index : order)
+	{
+		StreamedTexture& texture = textures[index];
+
+		// In synchronous mode the texture goes all the way down to the wanted level before the frame is drawn
+		while (texture.wantedLevel < texture.residentLevel && texture.pendingLevel < 0)
+		{
+			int level = texture.residentLevel - 1;
+			long long bytes = LevelBytes(texture, level);
+			if (!MakeRoom(bytes, index))
+			{
+				break;
+			}
+
+			if (synchronous)
+			{
+				// Without the level the resident level never gets lower, so this would loop forever
+				std::vector<unsigned char> pixels = ReadLevel(texture, level);
+				if (pixels.empty())
+				{
+					texture.streamed = false;
+					break;
+				}
+				UploadLevel(index, level, pixels);
+				continue;
+			}
+
+			texture.pendingLevel = level;
+			pendingBytes += bytes;
+			TextureLoad load;
+			load.textureIndex = index;
+			load.level = level;
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				requests.push_back(std::move(load));
+			}
+			queueChanged.notify_one();
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	for (StreamedTexture& texture : textures)
+	{
+		texture.wantedLevel = texture.levelCount;
+	}
+	frame++;
+}
+
+void TextureStreamer::LoaderLoop()
+{
+	while (true)
+	{
+		TextureLoad load;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueChanged.wait(lock, [this]() { return !requests.empty() || stopping; });
+			if (stopping)
+			{
+				return;
+			}
+			load = std::move(requests.front());
+			requests.pop_front();
+		}
+
+		load.pixels = ReadLevel(textures[load.textureIndex], load.level);
+
+		std::lock_guard<std::mutex> lock(queueMutex);
+		finished.push_back(std::move(load));
+	}
+}
+
+void TextureStreamer::Destroy()
+{
+	if (loader.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueChanged.notify_all();
+		loader.join();
+	}
+	requests.clear();
+	finished.clear();
+
+	for (StreamedTexture& texture : textures)
+	{
+		texture.texture.Reset();
+	}
+	textureIndices.clear();
+	residentBytes = 0;
+	pendingBytes = 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * Streams the mip levels of body textures in and out of GPU memory by how big the bodies are on screen.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct JobSystem;
+
+// Levels whose longer side is at most this many texels are loaded at startup and never evicted
+const int STREAM_FLOOR_SIZE = 128;
+
+// Most bytes uploaded per frame, so a burst of finished loads does not cause a hitch
+const long long STREAM_UPLOAD_BYTES_PER_FRAME = 8 * 1024 * 1024;
+
+/**
+ * Struct containing one streamed texture
+ */
+struct StreamedTexture
+{
+	std::string path;		// Source image
+	std::string cachePath;	// Mip chain of the image, written next to it
+	TextureHandle texture;
+	int width, height;		// Size of level 0
+	int levelCount;
+	int floorLevel;			// Finest level that is always resident
+	int residentLevel;		// Finest level in GPU memory; every coarser level is resident too
+	int wantedLevel;		// Finest level a body needed this frame, or levelCount if none
+	int pendingLevel;		// Level the loader is reading, or -1
+	long long lastUsedFrame;
+	long long residentBytes;
+	bool streamed;			// False if the cache could not be written or read; then the levels it has stay resident
+};
+
+/**
+ * Struct containing one level read by the loader thread
+ */
+struct TextureLoad
+{
+	int textureIndex;
+	int level;
+	std::vector<unsigned char> pixels;	// RGB, empty if the read failed
+};
+
+/**
+ * The mip chain of every texture is built once and cached on disk (`<image>.mips`), so a single level
+ * can be read without decoding the whole image. At startup only the small levels up to STREAM_FLOOR_SIZE
+ * are uploaded; every frame the bodies request the level that matches their size on screen, and the
+ * next finer level of the textures that fall short is read by a loader thread and uploaded a frame or
+ * more later. GL_TEXTURE_BASE_LEVEL hides the levels that are not resident, so the texture names never
+ * change. When a load would go over the memory budget, levels that no body needs this frame are
+ * evicted from the least recently used textures first.
+ */
+struct TextureStreamer
+{
+	std::vector<StreamedTexture> textures;
+	std::unordered_map<GLuint, int> textureIndices;	// Texture name to index in textures
+
+	long long budgetBytes;
+	long long residentBytes;	// All resident levels, including the floor levels
+	long long pendingBytes;		// Levels being read, which already count against the budget
+	long long frame;
+	bool synchronous;			// Whether loads finish within the frame that requested them
+	int loads;
+	int evictions;
+
+	std::thread loader;
+	std::mutex queueMutex;
+	std::condition_variable queueChanged;
+	std::deque<TextureLoad> requests;
+	std::deque<TextureLoad> finished;
+	bool stopping;
+
+	TextureStreamer();
+	~TextureStreamer();
+
+	/**
+	 * @brief Adds a texture; a path that was added before is shared.
+	 * @param[in] path Image file
+	 * @return Index of the texture
+	 */
+	int Add(const std::string& path);
+
+	/**
+	 * @brief Builds the missing mip caches on every core, uploads the floor levels and starts the loader thread.
+	 * @param[in] jobs Job system that builds the caches
+	 * @param[in] budget Most bytes of texture memory to keep resident
+	 * @param[in] loadSynchronously Whether to finish loads in the frame that needs them, for reproducible frames
+	 */
+	void Init(JobSystem& jobs, long long budget, bool loadSynchronously);
+
+	/**
+	 * @brief Returns the GL name of a texture, or 0 if its image could not be loaded.
+	 * @param[in] index Index returned by Add
+	 */
+	GLuint Texture(int index) const;
+
+	/**
+	 * @brief Asks for the mip level that a body of the given size on screen needs.
+	 * @param[in] texture GL name of the texture; unknown names are ignored
+	 * @param[in] pixelRadius Projected radius of the body in pixels
+	 */
+	void Request(GLuint texture, float pixelRadius);
+
+	/**
+	 * @brief Uploads the levels that finished loading, evicts levels to make room and starts new loads.
+	 * Called once per frame, after the requests.
+	 */
+	void Update();
+
+	/**
+	 * @brief Stops the loader thread and deletes the textures.
+	 */
+	void Destroy();
+
+	/**
+	 * @brief Builds the mip cache of a texture if it is missing or stale. Touches no GL state.
+	 * @param[in] texture Texture to build the cache for
+	 * @param[out] levels If the cache could not be written, every level is kept here instead
+	 * @return False if the image could not be loaded
+	 */
+	bool BuildCache(StreamedTexture& texture, std::vector<std::vector<unsigned char>>& levels);
+
+	/**
+	 * @brief Reads one level from the mip cache. Touches no GL state.
+	 * @return RGB texels, empty if the read failed
+	 */
+	std::vector<unsigned char> ReadLevel(const StreamedTexture& texture, int level) const;
+
+	/**
+	 * @brief Uploads a level and makes it the finest resident one.
+	 */
+	void UploadLevel(int textureIndex, int level, const std::vector<unsigned char>& pixels);
+
+	/**
+	 * @brief Evicts levels until the given number of bytes fits in the budget.
+	 * @param[in] bytes Bytes that are about to be loaded
+	 * @param[in] loadingIndex Texture the bytes are for, which is never evicted from
+	 * @return False if not enough levels could be evicted
+	 */
+	bool MakeRoom(long long bytes, int loadingIndex);
+
+	/**
+	 * @brief Size in bytes of one level of a texture.
+	 */
+	long long LevelBytes(const StreamedTexture& texture, int level) const;
+
+	/**
+	 * @brief Reads the requested levels until Destroy is called.
+	 */
+	void LoaderLoop();
+};
@@ -0,0 +1,205 @@
+/**
+ * Orbit ellipses and fading motion trails for every body, each drawn with a single draw call.
+ */
+
+#include "Trails.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+// Colors of the lines; the trails additionally fade out with age
+const glm::vec4 TRAIL_COLOR = glm::vec4(0.55f, 0.8f, 1.f, 0.9f);
+const glm::vec4 ORBIT_COLOR = glm::vec4(1.f, 1.f, 1.f, 0.18f);
+
+OrbitTrails::OrbitTrails()
+{
+	trailProgram = 0;
+	orbitProgram = 0;
+	bodyCount = 0;
+	length = 0;
+	head = 0;
+	filled = 0;
+	sampleInterval = 0.0;
+	nextSampleTime = 0.0;
+}
+
+void OrbitTrails::Init(int bodies, int samplesPerBody, double interval, GLuint trailShader, GLuint orbitShader)
+{
+	bodyCount = bodies;
+	sampleInterval = interval;
+	trailProgram = trailShader;
+	orbitProgram = orbitShader;
+
+	// GL only guarantees 65536 texels in a buffer texture, so a large catalog gets shorter trails. Every body
+	// takes at least two texels in both buffers, so past half the limit the last bodies get no trail or orbit at all.
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	bodyCount = std::min(bodies, std::max(maxTexels, 2) / 2);
+	if (bodyCount < bodies)
+	{
+		std::cerr << "Trails and orbits only drawn for the first " << bodyCount << " of " << bodies << " bodies" << std::endl;
+	}
+	length = std::max(2, std::min(samplesPerBody, maxTexels / std::max(bodyCount, 1)));
+	if (length < samplesPerBody)
+	{
+		std::cerr << "Trails shortened to " << length << " samples to fit " << bodyCount << " bodies" << std::endl;
+	}
+
+	historyBuffer.Create("trail history");
+	glBindBuffer(GL_TEXTURE_BUFFER, historyBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)bodyCount * length * sizeof(glm::vec2), nullptr, GL_DYNAMIC_DRAW);
+	historyBuffer.SetSize((long long)bodyCount * length * sizeof(glm::vec2));
+
+	elementBuffer.Create("orbit elements");
+	glBindBuffer(GL_TEXTURE_BUFFER, elementBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)bodyCount * 2 * sizeof(glm::vec4), nullptr, GL_STATIC_DRAW);
+	elementBuffer.SetSize((long long)bodyCount * 2 * sizeof(glm::vec4));
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// The buffer textures only view the buffers, so their memory is counted with the buffers
+	historyTexture.Create("trail history view");
+	glBindTexture(GL_TEXTURE_BUFFER, historyTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, historyBuffer);
+
+	elementTexture.Create("orbit elements view");
+	glBindTexture(GL_TEXTURE_BUFFER, elementTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, elementBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	vao.Create("trails");
+
+	// Every body is one strip; gl_VertexID starts at its first vertex, which the shaders turn back into the body
+	trailFirsts.resize(bodyCount);
+	trailCounts.assign(bodyCount, 0);
+	orbitFirsts.resize(bodyCount);
+	orbitCounts.assign(bodyCount, ORBIT_SEGMENTS + 1);
+	for (int i = 0; i < bodyCount; i++)
+	{
+		trailFirsts[i] = i * length;
+		orbitFirsts[i] = i * (ORBIT_SEGMENTS + 1);
+	}
+
+	head = length - 1;
+	filled = 0;
+	nextSampleTime = 0.0;
+}
+
+void OrbitTrails::SetOrbits(const std::vector<glm::vec3>& centers, const std::vector<glm::vec2>& axes)
+{
+	std::vector<glm::vec4> elements(bodyCount * 2);
+	for (int i = 0; i < bodyCount; i++)
+	{
+		elements[i * 2] = glm::vec4(centers[i], 0.f);
+		elements[i * 2 + 1] = glm::vec4(axes[i].x, axes[i].y, 0.f, 0.f);
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, elementBuffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, elements.size() * sizeof(glm::vec4), elements.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+bool OrbitTrails::SampleDue(double simTime)
+{
+	if (bodyCount == 0 || simTime < nextSampleTime)
+	{
+		return false;
+	}
+
+	// A long frame takes one sample rather than several of the same position
+	nextSampleTime = std::max(nextSampleTime + sampleInterval, simTime);
+	return true;
+}
+
+GLsizeiptr OrbitTrails::SampleSize() const
+{
+	return (GLsizeiptr)bodyCount * sizeof(glm::vec2);
+}
+
+void OrbitTrails::AddSample(GLuint sourceBuffer, GLintptr sourceOffset)
+{
+	head = (head + 1) % length;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, sourceBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, historyBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sourceOffset, head * SampleSize(), SampleSize());
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// The strips grow until the ring is full
+	if (filled < length)
+	{
+		filled++;
+		std::fill(trailCounts.begin(), trailCounts.end(), filled);
+	}
+}
+
+int OrbitTrails::Draw(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, bool drawTrails, bool drawOrbits)
+{
+	drawTrails = drawTrails && filled >= 2;
+	if (bodyCount == 0 || (!drawTrails && !drawOrbits))
+	{
+		return 0;
+	}
+
+	// Lines are blended over the scene and do not hide each other
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(GL_FALSE);
+	glBindVertexArray(vao);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, elementTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, historyTexture);
+
+	int drawCalls = 0;
+	if (drawOrbits)
+	{
+		glUseProgram(orbitProgram);
+		glUniformMatrix4fv(glGetUniformLocation(orbitProgram, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+		glUniformMatrix4fv(glGetUniformLocation(orbitProgram, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
+		glUniform1i(glGetUniformLocation(orbitProgram, "elements"), 0);
+		glUniform1i(glGetUniformLocation(orbitProgram, "orbitSegments"), ORBIT_SEGMENTS);
+		glUniform4fv(glGetUniformLocation(orbitProgram, "color"), 1, glm::value_ptr(ORBIT_COLOR));
+
+		glMultiDrawArrays(GL_LINE_STRIP, orbitFirsts.data(), orbitCounts.data(), bodyCount);
+		drawCalls++;
+	}
+
+	if (drawTrails)
+	{
+		glUseProgram(trailProgram);
+		glUniformMatrix4fv(glGetUniformLocation(trailProgram, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+		glUniformMatrix4fv(glGetUniformLocation(trailProgram, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
+		glUniform1i(glGetUniformLocation(trailProgram, "elements"), 0);
+		glUniform1i(glGetUniformLocation(trailProgram, "history"), 1);
+		glUniform1i(glGetUniformLocation(trailProgram, "bodyCount"), bodyCount);
+		glUniform1i(glGetUniformLocation(trailProgram, "trailLength"), length);
+		glUniform1i(glGetUniformLocation(trailProgram, "head"), head);
+		glUniform1i(glGetUniformLocation(trailProgram, "filled"), filled);
+		glUniform4fv(glGetUniformLocation(trailProgram, "color"), 1, glm::value_ptr(TRAIL_COLOR));
+
+		glMultiDrawArrays(GL_LINE_STRIP, trailFirsts.data(), trailCounts.data(), bodyCount);
+		drawCalls++;
+	}
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindVertexArray(0);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+
+	return drawCalls;
+}
+
+void OrbitTrails::Destroy()
+{
+	historyTexture.Reset();
+	elementTexture.Reset();
+	historyBuffer.Reset();
+	elementBuffer.Reset();
+	vao.Reset();
+}
@@ -0,0 +1,98 @@
+/**
+ * Orbit ellipses and fading motion trails for every body, each drawn with a single draw call.
+ */
+
+#pragma once
+
+#include "GpuResources.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Line segments per orbit ellipse
+const int ORBIT_SEGMENTS = 128;
+
+/**
+ * Trails are kept on the GPU as a ring of position samples: slot s holds the positions of all
+ * bodies at one point in time, at texels [s * bodyCount, (s + 1) * bodyCount). A new sample only
+ * overwrites the oldest slot, so memory stays at `length` samples per body however long the program runs.
+ * Both the trails and the ellipses are generated in the vertex shader from gl_VertexID and buffer
+ * textures, with no vertex data; every body is one line strip of a single glMultiDrawArrays.
+ */
+struct OrbitTrails
+{
+	BufferHandle historyBuffer;			// Ring of samples, one RG32F (x, z) texel per body and slot
+	TextureHandle historyTexture;
+	BufferHandle elementBuffer;			// Orbital elements, two RGBA32F texels per body
+	TextureHandle elementTexture;
+	VertexArrayHandle vao;				// Empty; the core profile needs one bound to draw
+	GLuint trailProgram, orbitProgram;
+
+	int bodyCount;		// Bodies with a trail and an orbit: the first ones, as many as the buffer textures hold
+	int length;			// Samples kept per body
+	int head;			// Slot of the newest sample
+	int filled;			// Number of slots that hold a sample
+	double sampleInterval;	// Simulated seconds between two samples
+	double nextSampleTime;
+
+	// Per-body line strips for glMultiDrawArrays
+	std::vector<GLint> trailFirsts, orbitFirsts;
+	std::vector<GLsizei> trailCounts, orbitCounts;
+
+	OrbitTrails();
+
+	/**
+	 * @brief Creates the GPU buffers. The trail length is shortened if the buffer texture would be too big,
+	 * and if even the shortest trails do not fit, only the first bodies get one.
+	 * @param[in] bodies Number of bodies
+	 * @param[in] samplesPerBody Length of the trails in samples
+	 * @param[in] interval Simulated seconds between two samples
+	 * @param[in] trailShader Program that draws the trails (trail.vsh)
+	 * @param[in] orbitShader Program that draws the ellipses (orbit.vsh)
+	 */
+	void Init(int bodies, int samplesPerBody, double interval, GLuint trailShader, GLuint orbitShader);
+
+	/**
+	 * @brief Uploads the orbital elements the ellipses are generated from.
+	 * @param[in] centers Center of every orbit
+	 * @param[in] axes Major (x) and minor (y) axis of every orbit
+	 */
+	void SetOrbits(const std::vector<glm::vec3>& centers, const std::vector<glm::vec2>& axes);
+
+	/**
+	 * @brief Checks whether the trails take a sample this frame and advances the sampling clock if so.
+	 * @param[in] simTime Simulated time of the frame
+	 * @return True if the frame has to call AddSample
+	 */
+	bool SampleDue(double simTime);
+
+	/**
+	 * @brief Bytes of one sample, i.e. the (x, z) positions of every body as floats.
+	 */
+	GLsizeiptr SampleSize() const;
+
+	/**
+	 * @brief Copies a sample into the oldest slot of the ring. The copy happens on the GPU, so the
+	 * sample can be written into mapped streaming memory beforehand.
+	 * @param[in] sourceBuffer Buffer that holds the sample
+	 * @param[in] sourceOffset Offset of the sample in the buffer
+	 */
+	void AddSample(GLuint sourceBuffer, GLintptr sourceOffset);
+
+	/**
+	 * @brief Draws the trails and orbits.
+	 * @param[in] projectionMatrix Projection matrix used for rendering
+	 * @param[in] viewMatrix View matrix used for rendering
+	 * @param[in] drawTrails Whether the trails are drawn
+	 * @param[in] drawOrbits Whether the orbit ellipses are drawn
+	 * @return Number of draw calls
+	 */
+	int Draw(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix, bool drawTrails, bool drawOrbits);
+
+	/**
+	 * @brief Deletes the GPU buffers.
+	 */
+	void Destroy();
+};
@@ -0,0 +1,97 @@
+/**
+ * Views of the scene that are drawn in the same frame: the free camera, a picture-in-picture of the followed body and a map of the system.
+ */
+
+#include "Views.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+ViewCamera::ViewCamera()
+{
+	eye = glm::vec3(0.f);
+	forward = glm::vec3(0.f, 0.f, -1.f);
+	up = glm::vec3(0.f, 1.f, 0.f);
+	fieldOfViewY = glm::radians(60.f);
+	nearPlane = 0.1f;
+	farPlane = 500.f;
+	minPixelRadius = 0.f;
+}
+
+glm::mat4 ViewCamera::ViewMatrix() const
+{
+	return glm::lookAt(eye, eye + forward, up);
+}
+
+glm::mat4 ViewCamera::ProjectionMatrix(const ViewRect& rect) const
+{
+	return glm::perspective(fieldOfViewY, rect.width * 1.f / std::max(rect.height, 1), nearPlane, farPlane);
+}
+
+void LayoutViews(const std::vector<ViewKind>& kinds, int renderWidth, int renderHeight, std::vector<ViewRect>& rects)
+{
+	int insetSize = std::max(1, (int)std::lround(renderHeight * VIEW_INSET_SIZE));
+	int margin = (int)std::lround(renderHeight * VIEW_INSET_MARGIN);
+
+	rects.resize(kinds.size());
+	for (size_t i = 0; i < kinds.size(); i++)
+	{
+		ViewRect& rect = rects[i];
+		if (kinds[i] == VIEW_CAMERA)
+		{
+			rect.x = 0;
+			rect.y = 0;
+			rect.width = renderWidth;
+			rect.height = renderHeight;
+			continue;
+		}
+
+		rect.x = kinds[i] == VIEW_FOCUS ? renderWidth - margin - insetSize : margin;
+		rect.y = margin;
+		rect.width = insetSize;
+		rect.height = insetSize;
+	}
+}
+
+ViewCamera FocusCamera(glm::vec3 center, float radius, glm::vec3 sunPosition)
+{
+	glm::vec3 worldUp(0.f, 1.f, 0.f);
+	glm::vec3 toSun = sunPosition - center;
+	toSun = glm::dot(toSun, toSun) > 0.f ? glm::normalize(toSun) : glm::vec3(0.f, 0.f, 1.f);
+
+	// Halfway between the sun and the side of the body, a little above it, so the terminator shows
+	glm::vec3 side = glm::cross(toSun, worldUp);
+	side = glm::dot(side, side) > 1e-6f ? glm::normalize(side) : glm::vec3(1.f, 0.f, 0.f);
+	glm::vec3 direction = glm::normalize(toSun + side + worldUp * 0.4f);
+
+	ViewCamera camera;
+	camera.eye = center + direction * radius * VIEW_FOCUS_DISTANCE;
+	camera.forward = -direction;
+	camera.up = worldUp;
+	camera.fieldOfViewY = glm::radians(40.f);
+
+	// Nothing in front of the body matters, so the near plane can be far out for a better depth precision
+	camera.nearPlane = radius * 0.5f;
+	camera.farPlane = 1000.f;
+	return camera;
+}
+
+ViewCamera SystemMapCamera(float systemRadius)
+{
+	ViewCamera camera;
+	camera.fieldOfViewY = glm::radians(60.f);
+	float height = systemRadius * 1.1f / std::tan(camera.fieldOfViewY * 0.5f);
+
+	// Looking straight down, with the -z axis at the top of the map
+	camera.eye = glm::vec3(0.f, height, 0.f);
+	camera.forward = glm::vec3(0.f, -1.f, 0.f);
+	camera.up = glm::vec3(0.f, 0.f, -1.f);
+
+	// The bodies stay close to the orbital plane
+	camera.nearPlane = height * 0.5f;
+	camera.farPlane = height * 1.5f;
+	camera.minPixelRadius = VIEW_MAP_MIN_PIXELS;
+	return camera;
+}
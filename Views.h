@@ -0,0 +1,95 @@
+/**
+ * Views of the scene that are drawn in the same frame: the free camera, a picture-in-picture of the followed body and a map of the system.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Side of an inset, as a fraction of the height of the render target
+const float VIEW_INSET_SIZE = 0.3f;
+
+// Gap between an inset and the edges of the render target, as a fraction of its height
+const float VIEW_INSET_MARGIN = 0.02f;
+
+// Distance of the focus camera from the center of the followed body, in body radii
+const float VIEW_FOCUS_DISTANCE = 4.f;
+
+// At true scale most bodies are smaller than a pixel in the system map, so they are drawn at least this big
+const float VIEW_MAP_MIN_PIXELS = 2.5f;
+
+// Same for the sun, which marks the center of the map
+const float VIEW_MAP_SUN_PIXELS = 5.f;
+
+/**
+ * What a view looks at
+ */
+enum ViewKind
+{
+	VIEW_CAMERA,		// The free camera, filling the render target
+	VIEW_FOCUS,			// The followed body, from a lit side
+	VIEW_SYSTEM_MAP		// The whole system from above
+};
+
+/**
+ * Struct containing the part of the render target a view is drawn into, in pixels from the bottom left
+ */
+struct ViewRect
+{
+	int x, y;
+	int width, height;
+};
+
+/**
+ * Struct containing where a view looks from and what its projection keeps
+ */
+struct ViewCamera
+{
+	glm::vec3 eye;
+	glm::vec3 forward;			// Normalized
+	glm::vec3 up;
+	float fieldOfViewY;			// In radians
+	float nearPlane, farPlane;
+	float minPixelRadius;		// Bodies are drawn at least this big on screen, 0 to draw them at their true size
+
+	ViewCamera();
+
+	/**
+	 * @brief Builds the view matrix of the camera.
+	 */
+	glm::mat4 ViewMatrix() const;
+
+	/**
+	 * @brief Builds the projection matrix of the camera for a viewport.
+	 * @param[in] rect Viewport the camera is drawn into
+	 */
+	glm::mat4 ProjectionMatrix(const ViewRect& rect) const;
+};
+
+/**
+ * @brief Places the views in the render target. The free camera fills it; the followed body goes
+ * into the bottom right corner and the system map into the bottom left one.
+ * @param[in] kinds What every view looks at
+ * @param[in] renderWidth Width of the render target in pixels
+ * @param[in] renderHeight Height of the render target in pixels
+ * @param[out] rects Viewport of every view
+ */
+void LayoutViews(const std::vector<ViewKind>& kinds, int renderWidth, int renderHeight, std::vector<ViewRect>& rects);
+
+/**
+ * @brief Places a camera that looks at a body from the side the sun lights.
+ * @param[in] center Center of the body
+ * @param[in] radius Radius of the body
+ * @param[in] sunPosition Center of the sun
+ * @return The camera
+ */
+ViewCamera FocusCamera(glm::vec3 center, float radius, glm::vec3 sunPosition);
+
+/**
+ * @brief Places a camera that looks down on the orbital plane from high enough to see the whole system.
+ * @param[in] systemRadius Distance from the sun to the farthest point of any orbit
+ * @return The camera
+ */
+ViewCamera SystemMapCamera(float systemRadius);